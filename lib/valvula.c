@@ -46,6 +46,10 @@
 /* private include */
 #include <valvula_private.h>
 
+/* number of contexts initialized: pools are shared by all of them
+ * so they are only cleaned up when the last one finishes */
+static int __valvula_contexts_running = 0;
+
 #define LOG_DOMAIN "valvula"
 
 /* Ugly hack to have access to vsnprintf function (secure form of
@@ -523,6 +527,7 @@ axl_bool    valvula_init_ctx (ValvulaCtx * ctx)
 
 	/* flag this context as initialized */
 	ctx->valvula_initialized = axl_true;
+	__sync_fetch_and_add (&__valvula_contexts_running, 1);
 
 	/* register the valvula exit function */
 	return axl_true;
@@ -632,6 +637,11 @@ void valvula_exit_ctx (ValvulaCtx * ctx, axl_bool  free_ctx)
 	 * deal. */
 	valvula_thread_pool_exit (ctx); 
 
+	/* release objects cached by pools (only when this is the last
+	 * context running, pools are shared) */
+	if (__sync_sub_and_fetch (&__valvula_contexts_running, 1) == 0)
+		valvula_pool_cleanup ();
+
 	/* lock/unlock to avoid race condition */
 	valvula_mutex_lock  (&ctx->exit_mutex);
 	valvula_mutex_unlock  (&ctx->exit_mutex);
@@ -65,10 +65,18 @@
 #define FD_SETSIZE 1024
 #endif
 
+/* the library is built with -ansi but uses GNU/POSIX interfaces
+ * (lstat, S_ISSOCK, accept4, thread affinity...): enable them before
+ * any system header is included */
+#if defined(__COMPILING_VALVULA__) && ! defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+
 /* External header includes */
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h>
 
 /* Axl library headers */
 #include <axl.h>
@@ -135,6 +143,9 @@
 #include <fcntl.h>
 #include <netdb.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <sys/stat.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <sys/select.h>
@@ -154,6 +165,16 @@
 #include <sys/epoll.h>
 #endif
 
+/* additional headers for linux io_uring support */
+#if defined(VALVULA_HAVE_URING)
+#include <liburing.h>
+#endif
+
+/* additional headers for thread affinity support */
+#if defined(VALVULA_HAVE_AFFINITY)
+#include <sched.h>
+#endif
+
 /* Check gnu extensions, providing an alias to disable its precence
  * when no available. */
 #if     __GNUC__ > 2 || (__GNUC__ == 2 && __GNUC_MINOR__ >= 8)
@@ -327,6 +348,8 @@ BEGIN_C_DECLS
 #include <valvula_support.h>
 #include <valvula_io.h>
 #include <valvula_hash.h>
+#include <valvula_pool.h>
+#include <valvula_cache.h>
 #include <valvula_ctx.h>
 #include <valvula_thread.h>
 #include <valvula_thread_pool.h>
@@ -405,6 +428,12 @@ const char * valvula_get_queue_id (ValvulaRequest * request);
 
 const char * valvula_get_request_instance (ValvulaRequest * request);
 
+const char * valvula_request_get_attr (ValvulaRequest * request, const char * name);
+
+long         valvula_request_get_remaining (ValvulaRequest * request);
+
+void         valvula_request_complete (ValvulaRequest * request, ValvulaState state, const char * message);
+
 axl_bool     valvula_address_rule_match (ValvulaCtx * ctx, const char * rule, const char * address);
 
 const char * valvula_get_domain (const char * address);
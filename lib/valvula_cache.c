@@ -0,0 +1,427 @@
+/* 
+ *  Valvula: a high performance policy daemon
+ *  Copyright (C) 2025 Advanced Software Production Line, S.L.
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2.1 of
+ *  the License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+ *  02111-1307 USA
+ *  
+ *  You may find a copy of the license under this software is released
+ *  at COPYING file. 
+ *
+ *  For comercial support about integrating valvula or any other ASPL
+ *  software production please contact as at:
+ *          
+ *      Postal address:
+ *         Advanced Software Production Line, S.L.
+ *         C/ Antonio Suarez Nº 10, 
+ *         Edificio Alius A, Despacho 102
+ *         Alcalá de Henares 28802 (Madrid)
+ *         Spain
+ *
+ *      Email address:
+ *         info@aspl.es - http://www.aspl.es/valvula
+ */
+#include <valvula.h>
+#include <valvula_private.h>
+#define LOG_DOMAIN "valvula-cache"
+
+/** 
+ * \defgroup valvula_cache ValvulaCache: verdict cache placed in front of the handler chain.
+ */
+
+/** 
+ * \addtogroup valvula_cache
+ * @{
+ */
+
+/** 
+ * @internal Separator placed between values of the key (values are
+ * received one per line so they never include it).
+ */
+#define VALVULA_CACHE_SEPARATOR '\n'
+
+/** 
+ * @internal Returns the value of the provided key field for the
+ * request. Besides request attributes, sender_domain and
+ * recipient_domain are supported.
+ */
+const char * __valvula_cache_field (ValvulaRequest * request, const char * field)
+{
+	if (axl_cmp (field, "sender_domain"))
+		return valvula_get_sender_domain (request);
+	if (axl_cmp (field, "recipient_domain"))
+		return valvula_get_recipient_domain (request);
+	return valvula_request_get_attr (request, field);
+}
+
+/** 
+ * @internal Request fields added to the key when handlers filter
+ * requests: the handlers called (and so the verdict) depend on them.
+ */
+static const char * __valvula_cache_stage_fields[] = { "protocol_state", "request", NULL };
+
+/** 
+ * @internal Appends the value of the provided key field.
+ */
+int __valvula_cache_key_append (char * key, int written, ValvulaRequest * request, const char * field)
+{
+	const char * value = __valvula_cache_field (request, field);
+
+	key[written++] = VALVULA_CACHE_SEPARATOR;
+	if (value) {
+		memcpy (key + written, value, strlen (value));
+		written += strlen (value);
+	} /* end if */
+
+	return written;
+}
+
+/** 
+ * @internal Builds the key used to cache the verdict of the provided
+ * request: listener port followed by the values of all key fields
+ * (and protocol_state and request values when handlers filter
+ * requests, see \ref valvula_ctx_set_request_handler_filter).
+ */
+char * __valvula_cache_key (ValvulaCtx * ctx, ValvulaCache * cache, ValvulaRequest * request, int port)
+{
+	char       * key;
+	const char * value;
+	int          length = 16;
+	int          written;
+	int          iterator;
+	axl_bool     stage  = ctx->handler_filtered;
+
+	/* get key size */
+	for (iterator = 0; cache->fields[iterator]; iterator++) {
+		value   = __valvula_cache_field (request, cache->fields[iterator]);
+		length += (value ? strlen (value) : 0) + 1;
+	} /* end for */
+	for (iterator = 0; stage && __valvula_cache_stage_fields[iterator]; iterator++) {
+		value   = __valvula_cache_field (request, __valvula_cache_stage_fields[iterator]);
+		length += (value ? strlen (value) : 0) + 1;
+	} /* end for */
+
+	key = axl_new (char, length + 1);
+	if (key == NULL)
+		return NULL;
+
+	written = sprintf (key, "%d", port);
+	for (iterator = 0; stage && __valvula_cache_stage_fields[iterator]; iterator++)
+		written = __valvula_cache_key_append (key, written, request, __valvula_cache_stage_fields[iterator]);
+	for (iterator = 0; cache->fields[iterator]; iterator++)
+		written = __valvula_cache_key_append (key, written, request, cache->fields[iterator]);
+
+	return key;
+}
+
+/** 
+ * @internal Gets a free entry to store a new verdict. Once the cache
+ * is full, entries are evicted with the CLOCK algorithm: the hand
+ * gives a second chance to entries used since it last passed over
+ * them (expired entries are evicted directly). Called with the cache
+ * mutex held.
+ */
+ValvulaCacheEntry * __valvula_cache_slot (ValvulaCache * cache, long now)
+{
+	ValvulaCacheEntry * entry;
+
+	if (cache->used < cache->size)
+		return &cache->entries[cache->used++];
+
+	while (axl_true) {
+		entry       = &cache->entries[cache->hand];
+		cache->hand = (cache->hand + 1) % cache->size;
+
+		if (entry->referenced && entry->expires > now) {
+			/* second chance */
+			entry->referenced = axl_false;
+			continue;
+		} /* end if */
+		break;
+	} /* end while */
+
+	/* release previous verdict */
+	axl_hash_remove (cache->index, entry->key);
+	axl_free (entry->key);
+	axl_free (entry->message);
+	entry->key     = NULL;
+	entry->message = NULL;
+
+	return entry;
+}
+
+/** 
+ * @internal Releases all entries stored. Called with the cache mutex
+ * held.
+ */
+void __valvula_cache_clear (ValvulaCache * cache)
+{
+	int iterator;
+
+	for (iterator = 0; iterator < cache->used; iterator++) {
+		axl_free (cache->entries[iterator].key);
+		axl_free (cache->entries[iterator].message);
+	} /* end for */
+	memset (cache->entries, 0, sizeof (ValvulaCacheEntry) * cache->size);
+
+	axl_hash_free (cache->index);
+	cache->index = axl_hash_new (axl_hash_string, axl_hash_equal_string);
+	cache->used  = 0;
+	cache->hand  = 0;
+
+	return;
+}
+
+/** 
+ * @internal Releases the provided cache.
+ */
+void __valvula_cache_free (ValvulaCache * cache)
+{
+	if (cache == NULL)
+		return;
+
+	__valvula_cache_clear (cache);
+	axl_hash_free (cache->index);
+	axl_free (cache->entries);
+	axl_freev (cache->fields);
+	valvula_mutex_destroy (&cache->mutex);
+	axl_free (cache);
+
+	return;
+}
+
+/** 
+ * @brief Enables the verdict cache placed in front of the handler
+ * chain.
+ *
+ * Verdicts resolved by the handler chain are stored under a key built
+ * with the listener port and the values of the provided request
+ * fields. Requests with the same key are replied directly from the
+ * reader thread, without calling handlers, until the verdict
+ * expires.
+ *
+ * Only verdicts resolved by handlers declared cacheable are stored
+ * (see \ref valvula_ctx_set_request_handler_cacheable): the verdict
+ * lives the lowest time declared by the handlers called to resolve
+ * it. Verdicts replied because the request deadline was reached are
+ * never stored.
+ *
+ * The key must include every field the cacheable handlers use to
+ * resolve requests. When handlers filter requests (see \ref
+ * valvula_ctx_set_request_handler_filter), protocol_state and request
+ * values are added to the key too, so verdicts resolved at one SMTP
+ * stage are not replied at other stages. The function must be called
+ * before starting listeners.
+ *
+ * @param ctx The context to configure.
+ *
+ * @param size Max number of verdicts stored (when reached, least
+ * recently used verdicts are evicted). Use 0 to disable the cache.
+ *
+ * @param fields Comma separated list of request attributes used as
+ * key (for example "sasl_username,sender,recipient_domain,client_address"). 
+ * Besides request attributes, sender_domain and recipient_domain can be used.
+ *
+ * @return axl_true if the cache was configured, otherwise axl_false.
+ */
+axl_bool     valvula_cache_setup   (ValvulaCtx    * ctx,
+				    int             size,
+				    const char    * fields)
+{
+	ValvulaCache * cache;
+	int            iterator;
+
+	if (ctx == NULL)
+		return axl_false;
+
+	/* release previous cache */
+	__valvula_cache_free (ctx->verdict_cache);
+	ctx->verdict_cache = NULL;
+
+	if (size <= 0 || fields == NULL)
+		return axl_true;
+
+	cache = axl_new (ValvulaCache, 1);
+	if (cache == NULL)
+		return axl_false;
+
+	cache->size    = size;
+	cache->entries = axl_new (ValvulaCacheEntry, size);
+	cache->index   = axl_hash_new (axl_hash_string, axl_hash_equal_string);
+	cache->fields  = axl_split (fields, 1, ",");
+	valvula_mutex_create (&cache->mutex);
+	if (cache->entries == NULL || cache->index == NULL || cache->fields == NULL) {
+		__valvula_cache_free (cache);
+		return axl_false;
+	} /* end if */
+
+	for (iterator = 0; cache->fields[iterator]; iterator++)
+		axl_stream_trim (cache->fields[iterator]);
+
+	ctx->verdict_cache = cache;
+
+	return axl_true;
+}
+
+/** 
+ * @brief Removes all verdicts stored by the verdict cache (for
+ * example, after changing the configuration used by handlers).
+ *
+ * @param ctx The context where the cache is configured.
+ */
+void         valvula_cache_flush   (ValvulaCtx    * ctx)
+{
+	ValvulaCache * cache;
+
+	if (ctx == NULL || ctx->verdict_cache == NULL)
+		return;
+	cache = ctx->verdict_cache;
+
+	valvula_mutex_lock (&cache->mutex);
+	__valvula_cache_clear (cache);
+	valvula_mutex_unlock (&cache->mutex);
+
+	return;
+}
+
+/** 
+ * @brief Allows to get verdict cache stats.
+ *
+ * @param ctx The context where the cache is configured.
+ *
+ * @param hits Optional reference to report requests replied from the cache.
+ *
+ * @param misses Optional reference to report requests not found in the cache.
+ *
+ * @param entries Optional reference to report verdicts currently stored.
+ *
+ * @return axl_true if the cache is enabled and stats were reported, otherwise axl_false.
+ */
+axl_bool     valvula_cache_stats   (ValvulaCtx    * ctx,
+				    long          * hits,
+				    long          * misses,
+				    int           * entries)
+{
+	ValvulaCache * cache;
+
+	if (ctx == NULL || ctx->verdict_cache == NULL)
+		return axl_false;
+	cache = ctx->verdict_cache;
+
+	valvula_mutex_lock (&cache->mutex);
+	if (hits)
+		(*hits)    = cache->hits;
+	if (misses)
+		(*misses)  = cache->misses;
+	if (entries)
+		(*entries) = axl_hash_items (cache->index);
+	valvula_mutex_unlock (&cache->mutex);
+
+	return axl_true;
+}
+
+/** 
+ * @internal Looks up a verdict not expired for the provided request.
+ *
+ * @param message Reference where the message stored with the verdict
+ * is reported (newly allocated, or NULL).
+ *
+ * @return axl_true if a verdict was found.
+ */
+axl_bool     __valvula_cache_lookup (ValvulaCtx     * ctx,
+				     ValvulaRequest * request,
+				     int              port,
+				     ValvulaState   * state,
+				     char          ** message)
+{
+	ValvulaCache      * cache = ctx->verdict_cache;
+	ValvulaCacheEntry * entry;
+	char              * key;
+	axl_bool            found = axl_false;
+
+	if (cache == NULL)
+		return axl_false;
+
+	key = __valvula_cache_key (ctx, cache, request, port);
+	if (key == NULL)
+		return axl_false;
+
+	valvula_mutex_lock (&cache->mutex);
+
+	entry = axl_hash_get (cache->index, key);
+	if (entry && entry->expires > valvula_now ()) {
+		entry->referenced = axl_true;
+		(*state)          = entry->state;
+		(*message)        = entry->message ? axl_strdup (entry->message) : NULL;
+		found             = axl_true;
+		cache->hits++;
+	} else 
+		cache->misses++;
+
+	valvula_mutex_unlock (&cache->mutex);
+
+	axl_free (key);
+	return found;
+}
+
+/** 
+ * @internal Stores the verdict resolved for the provided request
+ * during ttl seconds.
+ */
+void         __valvula_cache_store  (ValvulaCtx     * ctx,
+				     ValvulaRequest * request,
+				     int              port,
+				     ValvulaState     state,
+				     const char     * message,
+				     long             ttl)
+{
+	ValvulaCache      * cache = ctx->verdict_cache;
+	ValvulaCacheEntry * entry;
+	char              * key;
+	long                now;
+
+	if (cache == NULL || ttl <= 0)
+		return;
+
+	key = __valvula_cache_key (ctx, cache, request, port);
+	if (key == NULL)
+		return;
+	now = valvula_now ();
+
+	valvula_mutex_lock (&cache->mutex);
+
+	entry = axl_hash_get (cache->index, key);
+	if (entry == NULL) {
+		entry      = __valvula_cache_slot (cache, now);
+		entry->key = key;
+		key        = NULL;
+		axl_hash_insert_full (cache->index, entry->key, NULL, entry, NULL);
+	} /* end if */
+
+	axl_free (entry->message);
+	entry->state      = state;
+	entry->message    = message ? axl_strdup (message) : NULL;
+	entry->expires    = now + ttl;
+	entry->referenced = axl_false;
+
+	valvula_mutex_unlock (&cache->mutex);
+
+	axl_free (key);
+	return;
+}
+
+/** 
+ * @}
+ */
@@ -0,0 +1,73 @@
+/* 
+ *  Valvula: a high performance policy daemon
+ *  Copyright (C) 2025 Advanced Software Production Line, S.L.
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2.1 of
+ *  the License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+ *  02111-1307 USA
+ *  
+ *  You may find a copy of the license under this software is released
+ *  at COPYING file. 
+ *
+ *  For comercial support about integrating valvula or any other ASPL
+ *  software production please contact as at:
+ *          
+ *      Postal address:
+ *         Advanced Software Production Line, S.L.
+ *         C/ Antonio Suarez Nº 10, 
+ *         Edificio Alius A, Despacho 102
+ *         Alcalá de Henares 28802 (Madrid)
+ *         Spain
+ *
+ *      Email address:
+ *         info@aspl.es - http://www.aspl.es/valvula
+ */
+#ifndef __VALVULA_CACHE_H__
+#define __VALVULA_CACHE_H__
+
+#include <valvula.h>
+
+axl_bool     valvula_cache_setup   (ValvulaCtx    * ctx,
+				    int             size,
+				    const char    * fields);
+
+void         valvula_cache_flush   (ValvulaCtx    * ctx);
+
+axl_bool     valvula_cache_stats   (ValvulaCtx    * ctx,
+				    long          * hits,
+				    long          * misses,
+				    int           * entries);
+
+/* internal API */
+struct _ValvulaCache;
+
+char       * __valvula_cache_key    (ValvulaCtx     * ctx,
+				     struct _ValvulaCache * cache,
+				     ValvulaRequest * request,
+				     int              port);
+
+axl_bool     __valvula_cache_lookup (ValvulaCtx     * ctx,
+				     ValvulaRequest * request,
+				     int              port,
+				     ValvulaState   * state,
+				     char          ** message);
+
+void         __valvula_cache_store  (ValvulaCtx     * ctx,
+				     ValvulaRequest * request,
+				     int              port,
+				     ValvulaState     state,
+				     const char     * message,
+				     long             ttl);
+
+#endif
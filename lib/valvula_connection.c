@@ -411,11 +411,12 @@ ValvulaConnection  * valvula_connection_new_empty              (ValvulaCtx
 	if (ctx == NULL || _socket < 0)
 		return NULL;
 
-	conn = axl_new (ValvulaConnection, 1);
+	conn = valvula_pool_alloc (VALVULA_POOL_CONNECTION, sizeof (ValvulaConnection));
 	if (conn == NULL)
 		return NULL;
 
 	valvula_mutex_create (&conn->ref_mutex);
+	valvula_mutex_create (&conn->op_mutex);
 	conn->ref_count = 1;
 	conn->ctx       = ctx;
 	conn->session   = _socket;
@@ -611,12 +612,40 @@ axl_bool                valvula_connection_is_ok (ValvulaConnection * connection
  */
 void                valvula_connection_close                  (ValvulaConnection * connection)
 {
+	int                 iterator;
+	ValvulaConnection * shard;
+
 	if (connection == NULL)
 		return;
 
+	/* remove it from the reader watching set (persistent
+	 * registration mode) */
+	if (connection->watched) {
+		valvula_io_waiting_invoke_remove_from_fd_group (connection->ctx, connection->session, connection, 
+								connection->reader ? connection->reader->on_reading : NULL);
+		connection->watched = axl_false;
+	} /* end if */
+
+	/* close listener shards (if any) */
+	iterator = 0;
+	while (connection->shards && iterator < axl_list_length (connection->shards)) {
+		shard = axl_list_get_nth (connection->shards, iterator);
+		valvula_connection_close (shard);
+
+		/* next shard */
+		iterator++;
+	} /* end while */
+
 	valvula_close_socket (connection->session);
 	connection->session = -1;
 
+	/* remove unix socket file created by this listener */
+	if (connection->unix_path) {
+		unlink (connection->unix_path);
+		axl_free (connection->unix_path);
+		connection->unix_path = NULL;
+	} /* end if */
+
 	return;
 }
 
@@ -627,41 +656,15 @@ void                valvula_connection_close                  (ValvulaConnection
 void                valvula_connection_request_free (ValvulaRequest * request) {
 	
 	if (request) {
-		/* release */
-		axl_free (request->request);
-		axl_free (request->protocol_state);
-		axl_free (request->protocol_name);
-		axl_free (request->queue_id);
-		
-		axl_free (request->sender);
-		axl_free (request->recipient);
-		axl_free (request->helo_name);
-		
-		axl_free (request->client_address);
-		axl_free (request->client_name);
-		axl_free (request->reverse_client);
-		axl_free (request->instance);
-		
-		
-		axl_free (request->sasl_method);
-		axl_free (request->sasl_username);
-		axl_free (request->sasl_sender);
-		
-		axl_free (request->ccert_subject);
-		axl_free (request->ccert_issuer);
-		axl_free (request->ccert_fingerprint);
-		axl_free (request->ccert_pubkey_fingerprint);
-		
-		axl_free (request->encryption_protocol);
-		axl_free (request->encryption_cipher);
-		axl_free (request->encryption_keysize);
-		
-		axl_free (request->etrn_domain);
-		axl_free (request->stress);
+		/* all attributes point into raw, only release the
+		 * block if it was moved out of the request */
+		if (request->raw != request->raw_inline)
+			axl_free (request->raw);
 
 		axl_free (request->message_reply);
 		
-		axl_free (request);
+		/* return the request to the pool to be reused */
+		valvula_pool_release (VALVULA_POOL_REQUEST, request);
 	} /* end if */
 	return;
 }
@@ -680,12 +683,23 @@ void                valvula_connection_free (ValvulaConnection * conn)
 	axl_free (conn->port);
 	axl_free (conn->local_addr);
 	axl_free (conn->local_port);
+	axl_free (conn->unix_path);
+
+	/* release input and output buffers */
+	axl_free (conn->buffer);
+	axl_free (conn->out_buffer);
+
+	/* release listener shards */
+	axl_list_free (conn->shards);
 
 	/* clear internal reference if any */
 	valvula_connection_request_free (conn->request);
 	conn->request = NULL;
 
-	axl_free (conn);
+	/* release requests not processed */
+	axl_list_free (conn->pending_requests);
+
+	valvula_pool_release (VALVULA_POOL_CONNECTION, conn);
 	return;
 }
 
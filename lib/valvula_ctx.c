@@ -78,6 +78,10 @@ ValvulaCtx * valvula_ctx_new (void)
 	/* init stats mutex */
 	valvula_mutex_create (&ctx->stats_mutex);
 
+	/* init deadline mutex */
+	valvula_mutex_create (&ctx->deadline_mutex);
+	valvula_cond_create  (&ctx->deadline_cond);
+
 	/* init op mutex */
 	valvula_mutex_create (&ctx->op_mutex);
 	ctx->request_in_process = axl_list_new (axl_list_always_return_1, axl_free);
@@ -112,11 +116,253 @@ void __valvula_ctx_free_registry (axlPointer _ptr) {
 
 	valvula_mutex_destroy (&reg->stats_mutex);
 	axl_free (reg->identifier);
+	axl_free (reg->request_filter);
 	axl_free (reg);
 	
 	return;
 }
 
+/** 
+ * @internal Min number of calls a handler must receive between two
+ * reorderings to update its cost (see
+ * valvula_ctx_reorder_request_handlers).
+ */
+#define VALVULA_CTX_REORDER_SAMPLES 50
+
+/** 
+ * @internal Sorts handlers by port, priority, measured cost (adaptive
+ * handlers sharing priority, the rest have no cost so they are
+ * called first) and registration order.
+ */
+int __valvula_ctx_compare_handlers (const void * _a, const void * _b)
+{
+	const ValvulaRequestRegistry * a = *(ValvulaRequestRegistry * const *) _a;
+	const ValvulaRequestRegistry * b = *(ValvulaRequestRegistry * const *) _b;
+
+	if (a->port != b->port)
+		return a->port < b->port ? -1 : 1;
+	if (a->priority != b->priority)
+		return a->priority < b->priority ? -1 : 1;
+	if (a->rank != b->rank)
+		return a->rank < b->rank ? -1 : 1;
+	return a->sequence - b->sequence;
+}
+
+/** 
+ * @internal Releases the provided handler chains table.
+ */
+void __valvula_ctx_free_handler_chains (ValvulaHandlerChains * chains)
+{
+	int iterator;
+
+	for (iterator = 0; chains->request_filters && chains->handlers && chains->handlers[iterator]; iterator++)
+		axl_free (chains->request_filters[iterator]);
+	axl_free (chains->chains);
+	axl_free (chains->handlers);
+	axl_free (chains->groups);
+	axl_free (chains->protocol_states);
+	axl_free (chains->request_filters);
+	axl_free (chains);
+
+	return;
+}
+
+/** 
+ * @internal Releases replaced handler chains tables no thread uses
+ * anymore. Called with ref_mutex held.
+ *
+ * Quiescent state check: threads reference a table between
+ * announcing themselves on handler_chains_loaders and loading the
+ * pointer (see __valvula_ctx_acquire_handler_chains). Once the
+ * counter is seen at 0 after a table was replaced, no thread can
+ * still be about to reference it, so it is released as soon as its
+ * references drop to 0 (tables still referenced or replaced while
+ * threads were loading are checked again on next call).
+ */
+void __valvula_ctx_reclaim_handler_chains (ValvulaCtx * ctx)
+{
+	ValvulaHandlerChains * previous = ctx->handler_chains;
+	ValvulaHandlerChains * chains;
+	axl_bool               quiescent;
+
+	if (previous == NULL)
+		return;
+
+	/* all tables retired before this point are quiescent if
+	 * no thread is loading */
+	quiescent = (__sync_fetch_and_add (&ctx->handler_chains_loaders, 0) == 0);
+	for (chains = previous->retired; quiescent && chains; chains = chains->retired)
+		chains->quiescent = axl_true;
+
+	while (previous->retired) {
+		chains = previous->retired;
+		if (! chains->quiescent || __sync_fetch_and_add (&chains->refs, 0) != 0) {
+			previous = chains;
+			continue;
+		} /* end if */
+
+		/* unlink and release */
+		previous->retired = chains->retired;
+		__valvula_ctx_free_handler_chains (chains);
+	} /* end while */
+
+	return;
+}
+
+/** 
+ * @internal Compiles the registered handlers into a sorted chain for
+ * each port and publishes the new table with an atomic pointer swap
+ * so requests walk the chain without locks. Called with ref_mutex
+ * held every time the registry changes.
+ */
+void __valvula_ctx_compile_handler_chains (ValvulaCtx * ctx)
+{
+	ValvulaHandlerChains    * chains;
+	ValvulaHandlerChain     * chain = NULL;
+	ValvulaRequestRegistry  * registry;
+	axlHashCursor           * cursor;
+	int                       count;
+	int                       iterator;
+
+	count  = valvula_hash_size (ctx->process_handler_registry);
+	chains = axl_new (ValvulaHandlerChains, 1);
+	if (chains == NULL)
+		return;
+	chains->handlers        = axl_new (ValvulaRequestRegistry *, count + 1);
+	chains->groups          = axl_new (int, count + 1);
+	chains->protocol_states = axl_new (int, count + 1);
+	chains->request_filters = axl_new (char *, count + 1);
+	chains->chains          = axl_new (ValvulaHandlerChain, count + 1);
+	if (chains->handlers == NULL || chains->groups == NULL || chains->protocol_states == NULL ||
+	    chains->request_filters == NULL || chains->chains == NULL) {
+		__valvula_ctx_free_handler_chains (chains);
+		return;
+	} /* end if */
+
+	/* collect all handlers */
+	iterator = 0;
+	cursor   = valvula_hash_get_cursor (ctx->process_handler_registry);
+	axl_hash_cursor_first (cursor);
+	while (axl_hash_cursor_has_item (cursor) && iterator < count) {
+		chains->handlers[iterator] = axl_hash_cursor_get_value (cursor);
+		iterator++;
+		axl_hash_cursor_next (cursor);
+	} /* end while */
+	axl_hash_cursor_free (cursor);
+	count = iterator;
+
+	qsort (chains->handlers, count, sizeof (ValvulaRequestRegistry *), __valvula_ctx_compare_handlers);
+
+	/* split into one chain for each port, copying filters so
+	 * they can be changed later publishing a new table */
+	for (iterator = 0; iterator < count; iterator++) {
+		registry                          = chains->handlers[iterator];
+		chains->protocol_states[iterator] = registry->protocol_states;
+		chains->request_filters[iterator] = registry->request_filter ? axl_strdup (registry->request_filter) : NULL;
+		if (chain == NULL || chain->port != registry->port) {
+			chain                  = &chains->chains[chains->length];
+			chain->port            = registry->port;
+			chain->handlers        = &chains->handlers[iterator];
+			chain->groups          = &chains->groups[iterator];
+			chain->protocol_states = &chains->protocol_states[iterator];
+			chain->request_filters = &chains->request_filters[iterator];
+			chain->non_blocking    = axl_true;
+			chain->table           = chains;
+			chains->length++;
+		} /* end if */
+
+		chain->length++;
+		if (! registry->non_blocking)
+			chain->non_blocking = axl_false;
+	} /* end for */
+
+	/* parallel handlers with the same priority are evaluated
+	 * together: count handlers of the group left from each
+	 * position (the chain may start the group at any of them
+	 * when some are filtered out) */
+	for (iterator = count - 1; iterator >= 0; iterator--) {
+		registry                 = chains->handlers[iterator];
+		chains->groups[iterator] = 1;
+		if (iterator + 1 < count && registry->parallel && chains->handlers[iterator + 1]->parallel &&
+		    chains->handlers[iterator + 1]->port == registry->port && 
+		    chains->handlers[iterator + 1]->priority == registry->priority)
+			chains->groups[iterator] = chains->groups[iterator + 1] + 1;
+	} /* end for */
+
+	/* publish, keeping previous table until no request walks
+	 * it */
+	chains->retired = __atomic_exchange_n (&ctx->handler_chains, chains, __ATOMIC_SEQ_CST);
+
+	__valvula_ctx_reclaim_handler_chains (ctx);
+
+	return;
+}
+
+/** 
+ * @internal Returns the handler chains table currently published,
+ * referenced until \ref __valvula_ctx_release_handler_chains is
+ * called (NULL if no handler is registered). Lock free.
+ */
+ValvulaHandlerChains * __valvula_ctx_acquire_handler_chains (ValvulaCtx * ctx)
+{
+	ValvulaHandlerChains * chains;
+
+	/* announce the load so the table isn't released before it
+	 * is referenced (see __valvula_ctx_reclaim_handler_chains) */
+	__sync_fetch_and_add (&ctx->handler_chains_loaders, 1);
+	chains = __atomic_load_n (&ctx->handler_chains, __ATOMIC_SEQ_CST);
+	if (chains)
+		__sync_fetch_and_add (&chains->refs, 1);
+	__sync_fetch_and_sub (&ctx->handler_chains_loaders, 1);
+
+	return chains;
+}
+
+/** 
+ * @internal Releases a table acquired with \ref
+ * __valvula_ctx_acquire_handler_chains.
+ */
+void                   __valvula_ctx_release_handler_chains (ValvulaHandlerChains * chains)
+{
+	if (chains)
+		__sync_fetch_and_sub (&chains->refs, 1);
+	return;
+}
+
+/** 
+ * @internal Returns the handler chain compiled for the provided
+ * port, referenced until \ref __valvula_ctx_release_handler_chain
+ * is called (NULL if no handler is registered for the port).
+ */
+ValvulaHandlerChain * __valvula_ctx_acquire_handler_chain (ValvulaCtx * ctx, int port)
+{
+	ValvulaHandlerChains * chains = __valvula_ctx_acquire_handler_chains (ctx);
+	int                    iterator;
+
+	if (chains == NULL)
+		return NULL;
+
+	for (iterator = 0; iterator < chains->length; iterator++) {
+		if (chains->chains[iterator].port == port)
+			return &chains->chains[iterator];
+	} /* end for */
+
+	/* no handler for this port */
+	__valvula_ctx_release_handler_chains (chains);
+	return NULL;
+}
+
+/** 
+ * @internal Releases a chain acquired with \ref
+ * __valvula_ctx_acquire_handler_chain.
+ */
+void                  __valvula_ctx_release_handler_chain (ValvulaHandlerChain * chain)
+{
+	if (chain)
+		__valvula_ctx_release_handler_chains (chain->table);
+	return;
+}
+
 /** 
  * @brief Allows to register a new process handler with the provided priority under the given port.
  *
@@ -199,13 +445,361 @@ ValvulaRequestRegistry *   valvula_ctx_register_request_handler (ValvulaCtx
 		ctx->process_handler_registry = valvula_hash_new (axl_hash_int, axl_hash_equal_int);
 	
 	/* register */
+	registry->sequence = ctx->handler_sequence++;
 	valvula_hash_replace_full (ctx->process_handler_registry, registry, __valvula_ctx_free_registry, registry, NULL);
 
+	/* update handler chains */
+	__valvula_ctx_compile_handler_chains (ctx);
+
 	valvula_mutex_unlock (&ctx->ref_mutex);
 
 	return registry;
 }
 
+/** 
+ * @brief Allows to flag a registered request handler as non-blocking.
+ *
+ * A non-blocking handler promises to resolve every request using
+ * only in-memory state (no database queries, no network and no long
+ * held locks). When all handlers selected for a port are
+ * non-blocking, the request is evaluated and replied directly from
+ * the reader thread instead of being handed to the thread pool.
+ *
+ * @param registry The registry returned by \ref valvula_ctx_register_request_handler.
+ *
+ * @param non_blocking axl_true to flag the handler as non-blocking, otherwise axl_false (default).
+ */
+void        valvula_ctx_set_request_handler_non_blocking (ValvulaRequestRegistry * registry,
+							  axl_bool                 non_blocking)
+{
+	if (registry == NULL)
+		return;
+
+	valvula_mutex_lock (&registry->ctx->ref_mutex);
+	registry->non_blocking = non_blocking;
+
+	/* update chains (non-blocking state of the port) */
+	__valvula_ctx_compile_handler_chains (registry->ctx);
+	valvula_mutex_unlock (&registry->ctx->ref_mutex);
+
+	return;
+}
+
+/** 
+ * @brief Allows to flag a registered request handler to be evaluated
+ * in parallel.
+ *
+ * Handlers registered on the same port with the same priority and
+ * flagged as parallel are launched concurrently on the thread pool
+ * instead of one after the other. Their results are considered in
+ * registration order: the first state distinct from \ref
+ * VALVULA_STATE_DUNNO is replied as soon as it is known (handlers of
+ * the group not started yet are skipped and the states reported by
+ * the rest are discarded). If all of them report \ref
+ * VALVULA_STATE_DUNNO, the chain continues with the next priority,
+ * so the group costs the slowest handler instead of the sum of all
+ * of them.
+ *
+ * Use it only for independent handlers: all of them may be called
+ * even when an earlier one rejects the request, and they must reply
+ * synchronously (\ref VALVULA_STATE_PENDING is not supported inside
+ * a parallel group and is handled as \ref VALVULA_STATE_DUNNO).
+ *
+ * @param registry The registry returned by \ref valvula_ctx_register_request_handler.
+ *
+ * @param parallel axl_true to allow evaluating the handler in parallel, otherwise axl_false (default).
+ */
+void        valvula_ctx_set_request_handler_parallel (ValvulaRequestRegistry * registry,
+						      axl_bool                 parallel)
+{
+	if (registry == NULL)
+		return;
+
+	valvula_mutex_lock (&registry->ctx->ref_mutex);
+	registry->parallel = parallel;
+
+	/* parallel groups are never reordered */
+	if (parallel)
+		registry->rank = 0;
+
+	/* update chains (parallel groups) */
+	__valvula_ctx_compile_handler_chains (registry->ctx);
+	valvula_mutex_unlock (&registry->ctx->ref_mutex);
+
+	return;
+}
+
+/** 
+ * @brief Allows to flag a registered request handler as adaptive: it
+ * can be reordered among handlers sharing its priority according to
+ * its measured cost (see \ref valvula_ctx_reorder_request_handlers).
+ *
+ * Handlers flagged as parallel (see \ref
+ * valvula_ctx_set_request_handler_parallel) are never reordered.
+ *
+ * @param registry The registry returned by \ref valvula_ctx_register_request_handler.
+ *
+ * @param adaptive axl_true to allow reordering the handler, otherwise axl_false (default).
+ */
+void        valvula_ctx_set_request_handler_adaptive (ValvulaRequestRegistry * registry,
+						      axl_bool                 adaptive)
+{
+	if (registry == NULL)
+		return;
+
+	valvula_mutex_lock (&registry->ctx->ref_mutex);
+	registry->adaptive = adaptive;
+
+	/* back to registration order */
+	if (! adaptive) {
+		registry->rank = 0;
+		__valvula_ctx_compile_handler_chains (registry->ctx);
+	} /* end if */
+	valvula_mutex_unlock (&registry->ctx->ref_mutex);
+
+	return;
+}
+
+/** 
+ * @brief Allows to declare verdicts resolved by a registered request
+ * handler as cacheable by the verdict cache (see \ref
+ * valvula_cache_setup).
+ *
+ * Only declare handlers whose verdict depends on the request fields
+ * used as cache key and on state that rarely changes (for example
+ * black and white lists). Handlers that count requests (quotas) must
+ * not be cacheable.
+ *
+ * @param registry The registry returned by \ref valvula_ctx_register_request_handler.
+ *
+ * @param ttl Seconds verdicts can be reused (0, the default, to make them not cacheable).
+ */
+void        valvula_ctx_set_request_handler_cacheable (ValvulaRequestRegistry * registry,
+						       long                     ttl)
+{
+	if (registry == NULL || ttl < 0)
+		return;
+	registry->cache_ttl = ttl;
+	return;
+}
+
+/** 
+ * @brief Allows to restrict the requests a registered request
+ * handler is called for.
+ *
+ * Postfix queries the policy service at different SMTP stages
+ * (protocol_state attribute: RCPT, DATA, END-OF-MESSAGE...). A
+ * handler that only acts on some of them can declare it so the
+ * handler chain skips it, without calling it, for the rest of
+ * requests. The filter can be changed at any time: chains are
+ * compiled again with it, requests being processed finish with the
+ * previous one.
+ *
+ * @param registry The registry returned by \ref valvula_ctx_register_request_handler.
+ *
+ * @param protocol_states Comma separated list of protocol_state
+ * values the handler is called for (for example "RCPT" or
+ * "MAIL,RCPT") or NULL to call it for all of them. Requests with an
+ * unknown protocol_state are passed to all handlers.
+ *
+ * @param request request attribute value the handler is called for
+ * (for example "smtpd_access_policy") or NULL to call it for all
+ * requests.
+ *
+ * @return axl_true if the filter was configured, otherwise axl_false
+ * (for example, if an unknown protocol state is provided).
+ */
+axl_bool    valvula_ctx_set_request_handler_filter (ValvulaRequestRegistry * registry,
+						    const char             * protocol_states,
+						    const char             * request)
+{
+	ValvulaCtx  * ctx;
+	char       ** states;
+	int           mask = 0;
+	int           state;
+	int           iterator;
+
+	if (registry == NULL)
+		return axl_false;
+	ctx = registry->ctx;
+
+	if (protocol_states) {
+		states = axl_split (protocol_states, 1, ",");
+		if (states == NULL)
+			return axl_false;
+
+		for (iterator = 0; states[iterator]; iterator++) {
+			axl_stream_trim (states[iterator]);
+			if (strlen (states[iterator]) == 0)
+				continue;
+
+			state = __valvula_reader_protocol_state (states[iterator]);
+			if (state == 0) {
+				valvula_log (VALVULA_LEVEL_CRITICAL, "Unknown protocol state '%s' found in filter for handler %s", 
+					     states[iterator], registry->identifier);
+				axl_freev (states);
+				return axl_false;
+			} /* end if */
+			mask |= state;
+		} /* end for */
+		axl_freev (states);
+	} /* end if */
+
+	valvula_mutex_lock (&ctx->ref_mutex);
+	registry->protocol_states = mask;
+	axl_free (registry->request_filter);
+	registry->request_filter  = request ? axl_strdup (request) : NULL;
+
+	/* verdicts cached now depend on the request stage */
+	if (mask || request)
+		ctx->handler_filtered = axl_true;
+
+	/* publish chains with the new filter (chains walking the
+	 * previous table keep using its copy) */
+	__valvula_ctx_compile_handler_chains (ctx);
+	valvula_mutex_unlock (&ctx->ref_mutex);
+
+	return axl_true;
+}
+
+/** 
+ * @brief Reorders adaptive handlers (see \ref
+ * valvula_ctx_set_request_handler_adaptive) registered with the same
+ * priority on a port according to their measured cost, so cheap
+ * handlers that resolve requests often are called first.
+ *
+ * For each adaptive handler that was called enough times since the
+ * last call to this function, its cost is updated with the average
+ * time it took divided by the probability of replying a state
+ * distinct from \ref VALVULA_STATE_DUNNO (the expected time spent for
+ * each decisive verdict). Adaptive handlers with the same priority
+ * are then ordered by ascending cost (registration order is used
+ * until a cost is measured) and, if the order changed, the handler
+ * chains are compiled again. Handlers with different priority keep their order, as do
+ * handlers not flagged adaptive (called before adaptive handlers
+ * sharing their priority) and parallel groups.
+ *
+ * The function is meant to be called periodically. Only use equal
+ * priorities for handlers that can be called in any order (for
+ * example, a handler counting requests may stop being called when
+ * another one rejects them first).
+ *
+ * @param ctx The context where handlers are registered.
+ */
+void        valvula_ctx_reorder_request_handlers  (ValvulaCtx       * ctx)
+{
+	ValvulaRequestRegistry * registry;
+	ValvulaHandlerChains   * chains;
+	axlHashCursor          * cursor;
+	axl_bool                 changed = axl_false;
+	int                      iterator;
+	int                      position;
+
+	v_return_if_fail (ctx);
+
+	valvula_mutex_lock (&ctx->ref_mutex);
+	if (ctx->process_handler_registry == NULL) {
+		valvula_mutex_unlock (&ctx->ref_mutex);
+		return;
+	} /* end if */
+
+	cursor = valvula_hash_get_cursor (ctx->process_handler_registry);
+	axl_hash_cursor_first (cursor);
+	while (axl_hash_cursor_has_item (cursor)) {
+		registry = axl_hash_cursor_get_value (cursor);
+
+		/* only adaptive handlers are ranked */
+		if (! registry->adaptive || registry->parallel) {
+			axl_hash_cursor_next (cursor);
+			continue;
+		} /* end if */
+
+		valvula_mutex_lock (&registry->stats_mutex);
+		if (registry->window_handled >= VALVULA_CTX_REORDER_SAMPLES) {
+			/* average time / probability of a decisive
+			 * verdict (smoothed so handlers that never
+			 * decide get a finite, high cost) */
+			registry->rank = ((double) registry->window_total / registry->window_handled) * 
+				(registry->window_handled + 2) / (registry->window_decided + 1);
+
+			valvula_log (VALVULA_LEVEL_DEBUG, "Handler %s (port %d, priority %d): %d calls, %d decisive, cost %.0f",
+				     registry->identifier, registry->port, registry->priority, 
+				     registry->window_handled, registry->window_decided, registry->rank);
+
+			registry->window_handled = 0;
+			registry->window_decided = 0;
+			registry->window_total   = 0;
+		} /* end if */
+		valvula_mutex_unlock (&registry->stats_mutex);
+
+		axl_hash_cursor_next (cursor);
+	} /* end while */
+	axl_hash_cursor_free (cursor);
+
+	/* check if the order published is still sorted with the
+	 * costs updated (tables are only released holding
+	 * ref_mutex) */
+	chains = ctx->handler_chains;
+	for (iterator = 0; chains && ! changed && iterator < chains->length; iterator++) {
+		for (position = 1; position < chains->chains[iterator].length; position++) {
+			if (__valvula_ctx_compare_handlers (&chains->chains[iterator].handlers[position - 1],
+							    &chains->chains[iterator].handlers[position]) > 0) {
+				changed = axl_true;
+				break;
+			} /* end if */
+		} /* end for */
+	} /* end for */
+
+	/* publish chains with the new order (only if it changed),
+	 * otherwise just release tables no longer used */
+	if (changed)
+		__valvula_ctx_compile_handler_chains (ctx);
+	else
+		__valvula_ctx_reclaim_handler_chains (ctx);
+
+	valvula_mutex_unlock (&ctx->ref_mutex);
+
+	return;
+}
+
+/** 
+ * @brief Allows to get the order in which handlers are currently
+ * called for requests received on the provided port.
+ *
+ * @param ctx The context where handlers are registered.
+ *
+ * @param port The port to report.
+ *
+ * @return A newly allocated string with handler identifiers in
+ * calling order, separated by commas, or NULL if no handler is
+ * registered for the port. Call axl_free to release it.
+ */
+char      * valvula_ctx_get_request_handler_order (ValvulaCtx       * ctx,
+						   int                port)
+{
+	ValvulaHandlerChain * chain;
+	char                * order = NULL;
+	char                * aux;
+	int                   iterator;
+
+	if (ctx == NULL)
+		return NULL;
+
+	chain = __valvula_ctx_acquire_handler_chain (ctx, port);
+	if (chain == NULL)
+		return NULL;
+
+	for (iterator = 0; iterator < chain->length; iterator++) {
+		aux   = order;
+		order = axl_strdup_printf ("%s%s%s", aux ? aux : "", aux ? ", " : "", 
+					   chain->handlers[iterator]->identifier ? chain->handlers[iterator]->identifier : "(unnamed)");
+		axl_free (aux);
+	} /* end for */
+	__valvula_ctx_release_handler_chain (chain);
+
+	return order;
+}
+
 /** 
  * @brief Allows to register a handler that will be called with the final.
  *
@@ -246,6 +840,61 @@ void        valvula_ctx_set_default_reply_state   (ValvulaCtx       * ctx,
 	return;
 }
 
+/** 
+ * @brief Allows to configure the time budget requests received on a
+ * given port have to be replied.
+ *
+ * Requests are stamped when they are received. Before calling each
+ * handler, the engine checks the budget: once it is spent, the
+ * handler chain is stopped and the provided state is replied (for
+ * example \ref VALVULA_STATE_DUNNO to fail open or \ref
+ * VALVULA_STATE_DEFER), so the reply reaches Postfix before its
+ * smtpd_policy_service_timeout. Requests still inside a handler
+ * (slow or left pending) when their budget is spent are replied
+ * with that state by a watchdog that runs on the thread pool; the
+ * result reported later by the handler is discarded. Handlers can
+ * use \ref valvula_request_get_remaining to limit their own
+ * operations.
+ *
+ * @param ctx The context to configure.
+ *
+ * @param port The port to configure or -1 to configure the budget
+ * for all ports without a particular configuration.
+ *
+ * @param budget Milliseconds requests have to be replied. Use 0 to
+ * remove the budget for the provided port.
+ *
+ * @param state The state to reply when the budget is spent.
+ */
+void        valvula_ctx_set_request_deadline      (ValvulaCtx       * ctx,
+						   int                port,
+						   long               budget,
+						   ValvulaState       state)
+{
+	ValvulaRequestBudget * deadline;
+
+	v_return_if_fail (ctx);
+
+	valvula_mutex_lock (&ctx->ref_mutex);
+	if (ctx->deadlines == NULL)
+		ctx->deadlines = valvula_hash_new (axl_hash_int, axl_hash_equal_int);
+	valvula_mutex_unlock (&ctx->ref_mutex);
+
+	if (budget <= 0) {
+		valvula_hash_remove (ctx->deadlines, INT_TO_PTR (port));
+		return;
+	} /* end if */
+
+	deadline = axl_new (ValvulaRequestBudget, 1);
+	if (deadline == NULL)
+		return;
+	deadline->budget = budget;
+	deadline->state  = state;
+
+	valvula_hash_replace_full (ctx->deadlines, INT_TO_PTR (port), NULL, deadline, axl_free);
+	return;
+}
+
 /** 
  * @brief Allows to store arbitrary data associated to the provided
  * context, which can later retrieved using a particular key. 
@@ -469,6 +1118,8 @@ void        valvula_ctx_free (ValvulaCtx * ctx)
  */
 void        valvula_ctx_free2 (ValvulaCtx * ctx, const char * who)
 {
+	ValvulaHandlerChains * chains;
+
 	/* do nothing */
 	if (ctx == NULL)
 		return;
@@ -489,9 +1140,21 @@ void        valvula_ctx_free2 (ValvulaCtx * ctx, const char * who)
 	valvula_hash_destroy (ctx->data);
 	ctx->data = NULL;
 
+	/* free handler chains (including retired tables) */
+	while (ctx->handler_chains) {
+		chains              = ctx->handler_chains;
+		ctx->handler_chains = chains->retired;
+		__valvula_ctx_free_handler_chains (chains);
+	} /* end while */
+
 	/* free hash */
 	valvula_hash_destroy (ctx->process_handler_registry);
 	ctx->process_handler_registry = NULL;
+	valvula_hash_destroy (ctx->deadlines);
+	ctx->deadlines = NULL;
+
+	/* release verdict cache */
+	valvula_cache_setup (ctx, 0, NULL);
 
 	valvula_log (VALVULA_LEVEL_DEBUG, "finishing ValvulaCtx %p", ctx);
 
@@ -500,8 +1163,11 @@ void        valvula_ctx_free2 (ValvulaCtx * ctx, const char * who)
 	valvula_mutex_destroy (&ctx->ref_mutex);
 
 	valvula_mutex_destroy (&ctx->stats_mutex);
+	valvula_mutex_destroy (&ctx->deadline_mutex);
+	valvula_cond_destroy  (&ctx->deadline_cond);
 	valvula_mutex_destroy (&ctx->op_mutex);
 	axl_list_free (ctx->request_in_process);
+	axl_free (ctx->readers_cpus);
 
 	valvula_log (VALVULA_LEVEL_DEBUG, "about.to.free ValvulaCtx %p", ctx);
 
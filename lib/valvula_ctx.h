@@ -49,6 +49,27 @@ ValvulaRequestRegistry *   valvula_ctx_register_request_handler (ValvulaCtx
 								 int                      port,
 								 axlPointer               user_data);
 
+void        valvula_ctx_set_request_handler_non_blocking (ValvulaRequestRegistry * registry,
+							  axl_bool                 non_blocking);
+
+void        valvula_ctx_set_request_handler_parallel (ValvulaRequestRegistry * registry,
+						      axl_bool                 parallel);
+
+void        valvula_ctx_set_request_handler_adaptive (ValvulaRequestRegistry * registry,
+						      axl_bool                 adaptive);
+
+void        valvula_ctx_set_request_handler_cacheable (ValvulaRequestRegistry * registry,
+						       long                     ttl);
+
+axl_bool    valvula_ctx_set_request_handler_filter (ValvulaRequestRegistry * registry,
+						    const char             * protocol_states,
+						    const char             * request);
+
+void        valvula_ctx_reorder_request_handlers  (ValvulaCtx       * ctx);
+
+char      * valvula_ctx_get_request_handler_order (ValvulaCtx       * ctx,
+						   int                port);
+
 void        valvula_ctx_set_final_state_handler   (ValvulaCtx              * ctx,
 						   ValvulaReportFinalState   handler,
 						   axlPointer                user_data);
@@ -56,6 +77,11 @@ void        valvula_ctx_set_final_state_handler   (ValvulaCtx              * ctx
 void        valvula_ctx_set_request_line_limit    (ValvulaCtx       * ctx,
 						   int                line_limit);
 
+void        valvula_ctx_set_request_deadline      (ValvulaCtx       * ctx,
+						   int                port,
+						   long               budget,
+						   ValvulaState       state);
+
 void        valvula_ctx_set_default_reply_state   (ValvulaCtx       * ctx,
 						   ValvulaState       state);
 
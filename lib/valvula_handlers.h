@@ -121,6 +121,27 @@ typedef axl_bool      (* ValvulaIoAddToFdGroup)        (int                    f
 							ValvulaConnection     * connection,
 							axlPointer             fd_group);
 
+/** 
+ * @brief IO handler definition to perform the "remove from" the fd
+ * set operation. This handler is only provided by I/O mechanisms
+ * that keep sockets registered across wait operations (persistent
+ * registration), like epoll(2).
+ * 
+ * @param fds The socket descriptor to be removed (it may be -1 if the
+ * socket was already closed).
+ *
+ * @param connection The connection associated to the socket.
+ *
+ * @param fd_group The socket descriptor group where the socket was
+ * added.
+ * 
+ * @return returns axl_true if the socket descriptor was removed,
+ * otherwise, axl_false is returned.
+ */
+typedef axl_bool      (* ValvulaIoRemoveFromFdGroup)   (int                    fds,
+							ValvulaConnection     * connection,
+							axlPointer             fd_group);
+
 /** 
  * @brief IO handler definition to perform the "is set" the fd set
  * operation.
@@ -317,7 +338,10 @@ typedef axl_bool (* ValvulaThreadAsyncEvent)        (ValvulaCtx  * ctx,
  * message you can report. In any case, the handler, if wants to report something, must allocate the string using axl_strdup, axl_strdup_printf or axl_new (char, <num of chars). Once the engine is done with the message, memory is released using axl_free.
  *
  * @return An allowed \ref ValvulaState value reporting what to do
- * with the request received.
+ * with the request received. Handlers can also return \ref
+ * VALVULA_STATE_PENDING to release the calling thread and resolve the
+ * request later, from any thread, with \ref valvula_request_complete
+ * (message is ignored in that case).
  */
 typedef ValvulaState (* ValvulaProcessRequest) (ValvulaCtx        * ctx, 
 						ValvulaConnection * connection, 
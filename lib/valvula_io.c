@@ -480,6 +480,7 @@ void     __valvula_io_waiting_poll_dispatch (axlPointer           fd_group,
 #if defined(VALVULA_HAVE_EPOLL)
 typedef struct _ValvulaEPoll {
 	ValvulaCtx           * ctx;
+	axl_bool              edge_triggered;
 	int                   max;
 	int                   length;
 	int                   set;
@@ -515,6 +516,9 @@ axlPointer __valvula_io_waiting_epoll_create (ValvulaCtx * ctx, ValvulaIoWaiting
 	epoll->max         = max;
 	epoll->wait_to     = wait_to;
 	epoll->set         = set;
+	/* mode is fixed for the life of the fd group (changing it
+	 * makes the reader to create a new one) */
+	epoll->edge_triggered = ctx->waiting_edge_triggered;
 	epoll->events      = axl_new (struct epoll_event, max);
 
 	return epoll;
@@ -581,7 +585,7 @@ axl_bool  __valvula_io_waiting_epoll_add_to (int                fds,
 	struct epoll_event   ev;
 
 	/* check if max size reached */
-	if (epoll->length == epoll->max) {
+	if (__sync_fetch_and_add (&epoll->length, 0) >= epoll->max) {
 	
 		if (epoll->max >= max) {
 			valvula_log (VALVULA_LEVEL_DEBUG, "unable to accept more sockets, max poll set reached (%d).", epoll->max);
@@ -601,6 +605,14 @@ axl_bool  __valvula_io_waiting_epoll_add_to (int                fds,
 	/* configure the kind of polling */
 	if (VALVULA_IO_IS(epoll->wait_to, READ_OPERATIONS)) {
 		ev.events = EPOLLIN | EPOLLPRI;
+
+		/* only notify changes: reader drains until EAGAIN.
+		 * Listeners are kept level-triggered: an accept ()
+		 * failing with EMFILE/ENFILE would otherwise leave
+		 * pending connections without further notifications,
+		 * stalling the listener forever */
+		if (epoll->edge_triggered && connection->role != ValvulaRoleMasterListener)
+			ev.events |= EPOLLET | EPOLLRDHUP;
 	} /* end if */
 
 	if (VALVULA_IO_IS(epoll->wait_to, WRITE_OPERATIONS)) {
@@ -617,8 +629,51 @@ axl_bool  __valvula_io_waiting_epoll_add_to (int                fds,
 		return axl_false;
 	} /* end if */
 
-	/* update length */
-	epoll->length++;
+	/* update length (atomically, it is also updated from
+	 * remove_from, which may run on worker threads) */
+	__sync_fetch_and_add (&epoll->length, 1);
+
+	return axl_true;
+}
+
+/** 
+ * @internal
+ *
+ * Remove from file set implementation for epoll(2) interface. Once
+ * added, sockets are kept registered on the epoll set until they are
+ * removed with this function (or until they are closed, which makes
+ * the kernel to remove them).
+ * 
+ * @param fds The socket descriptor to be removed (or -1 if already closed).
+ *
+ * @param fd_set The fd set where the socket descriptor will be removed.
+ */
+axl_bool  __valvula_io_waiting_epoll_remove_from (int                fds, 
+						  ValvulaConnection * connection,
+						  axlPointer         __fd_set)
+{
+	ValvulaEPoll *        epoll  = (ValvulaEPoll *) __fd_set;
+	ValvulaCtx   *        ctx    = epoll->ctx;
+	struct epoll_event   ev;
+
+	/* update length: this may be called from worker threads
+	 * (connection close) so update it atomically, never going
+	 * below 0 */
+	if (__sync_sub_and_fetch (&epoll->length, 1) < 0)
+		__sync_fetch_and_add (&epoll->length, 1);
+
+	/* socket already closed, kernel removed it */
+	if (fds < 0)
+		return axl_true;
+
+	/* clear data (required by kernels before 2.6.9) */
+	memset (&ev, 0, sizeof (struct epoll_event));
+	if (epoll_ctl (epoll->set, EPOLL_CTL_DEL, fds, &ev) != 0 && errno != ENOENT && errno != EBADF) {
+		valvula_log (VALVULA_LEVEL_CRITICAL, 
+			     "failed to remove from the epoll fd=%d, epoll_ctl system call have failed: %s",
+			     fds, strerror (errno));
+		return axl_false;
+	} /* end if */
 
 	return axl_true;
 }
@@ -640,9 +695,9 @@ int __valvula_io_waiting_epoll_wait_on (axlPointer __fd_group, int max_fds, Valv
 	/* perform the select operation according to the
 	 * <b>wait_to</b> value. */
 	if (VALVULA_IO_IS (wait_to, READ_OPERATIONS)) {
-		result = epoll_wait (epoll->set, epoll->events, epoll->length, 500);
+		result = epoll_wait (epoll->set, epoll->events, epoll->max, 500);
 	} else 	if (VALVULA_IO_IS (wait_to, WRITE_OPERATIONS)) {
-		result = epoll_wait (epoll->set, epoll->events, epoll->length, 1000);
+		result = epoll_wait (epoll->set, epoll->events, epoll->max, 1000);
 	} /* end if */
 
 	/* check result */
@@ -680,13 +735,19 @@ void     __valvula_io_waiting_epoll_dispatch (axlPointer           fd_group,
 	int                iterator = 0;
 
 	/* for all sockets polled */
-	while ((iterator < changed) && (iterator < epoll->length)) {
+	while ((iterator < changed) && (iterator < epoll->max)) {
 		
 		/* item found now check the event */
 		if (VALVULA_IO_IS (epoll->wait_to, READ_OPERATIONS)) {
 			
+			/* also report hang up and errors so the
+			 * connection gets closed (otherwise it is
+			 * reported forever) */
 			if ((epoll->events[iterator].events & EPOLLIN) == EPOLLIN ||
-			    (epoll->events[iterator].events & EPOLLPRI) == EPOLLPRI) {
+			    (epoll->events[iterator].events & EPOLLPRI) == EPOLLPRI ||
+			    (epoll->events[iterator].events & EPOLLHUP) == EPOLLHUP ||
+			    (epoll->events[iterator].events & EPOLLRDHUP) == EPOLLRDHUP ||
+			    (epoll->events[iterator].events & EPOLLERR) == EPOLLERR) {
 
 				/* get the connection */
 				connection = (ValvulaConnection *) epoll->events[iterator].data.ptr;
@@ -734,6 +795,419 @@ void     __valvula_io_waiting_epoll_dispatch (axlPointer           fd_group,
 }
 #endif /* VALVULA_HAVE_EPOLL */
 
+/**
+ * linux io_uring(7) implementation (through liburing).
+ *
+ * Sockets are watched with multishot poll requests (falling back to
+ * single shot requests on kernels without multishot support) which
+ * are kept armed between waits, so under steady load the reader
+ * submits and reaps in batches with a single io_uring_enter(2) per
+ * loop. Completions carry the socket and a generation number (not the
+ * connection pointer) so completions arriving after a connection is
+ * removed are safely discarded.
+ */
+#if defined(VALVULA_HAVE_URING)
+typedef struct _ValvulaURingEntry {
+	ValvulaConnection   * connection;
+	unsigned int          generation;
+} ValvulaURingEntry;
+
+typedef struct _ValvulaURing {
+	ValvulaCtx           * ctx;
+	struct io_uring        ring;
+	int                    length;
+	ValvulaIoWaitingFor    wait_to;
+	axl_bool               multishot;
+
+	/* completions reaped on last wait */
+	struct io_uring_cqe  * cqes[VALVULA_URING_BATCH];
+
+	/* table of watched sockets (indexed by socket) and requests
+	 * to be cancelled: both can be updated from other threads
+	 * (valvula_connection_close) so they are protected by mutex */
+	ValvulaMutex           mutex;
+	ValvulaURingEntry    * entries;
+	int                    entries_size;
+	unsigned int           generation;
+	axlList              * cancel;
+}ValvulaURing;
+
+#define VALVULA_URING_DATA(fds,gen) ((((__u64) (gen)) << 32) | ((__u64) (unsigned int) (fds)))
+#define VALVULA_URING_FDS(data)     ((int) ((data) & 0xffffffff))
+#define VALVULA_URING_GEN(data)     ((unsigned int) ((data) >> 32))
+
+/** 
+ * @internal Gets a submission entry, flushing pending submissions if
+ * the submission queue is full.
+ */
+struct io_uring_sqe * __valvula_io_waiting_uring_get_sqe (ValvulaURing * uring)
+{
+	struct io_uring_sqe * sqe = io_uring_get_sqe (&uring->ring);
+
+	if (sqe == NULL) {
+		io_uring_submit (&uring->ring);
+		sqe = io_uring_get_sqe (&uring->ring);
+	} /* end if */
+
+	return sqe;
+}
+
+/** 
+ * @internal Arms a poll request for the provided socket.
+ */
+axl_bool __valvula_io_waiting_uring_arm (ValvulaURing * uring, int fds, unsigned int generation)
+{
+	struct io_uring_sqe * sqe = __valvula_io_waiting_uring_get_sqe (uring);
+	unsigned int          mask = POLLIN | POLLPRI;
+
+	if (sqe == NULL)
+		return axl_false;
+
+	if (VALVULA_IO_IS (uring->wait_to, WRITE_OPERATIONS))
+		mask = POLLOUT;
+
+	if (uring->multishot)
+		io_uring_prep_poll_multishot (sqe, fds, mask);
+	else
+		io_uring_prep_poll_add (sqe, fds, mask);
+	io_uring_sqe_set_data64 (sqe, VALVULA_URING_DATA (fds, generation));
+
+	return axl_true;
+}
+
+/** 
+ * @internal
+ *
+ * @brief Internal valvula implementation to support io_uring to the
+ * file set creation interface.
+ *
+ * @return A newly allocated file set reference, supporting io_uring.
+ */
+axlPointer __valvula_io_waiting_uring_create (ValvulaCtx * ctx, ValvulaIoWaitingFor wait_to) 
+{
+	ValvulaURing * uring;
+	int            rc;
+
+	uring = axl_new (ValvulaURing, 1);
+	rc    = io_uring_queue_init (VALVULA_URING_ENTRIES, &uring->ring, 0);
+	if (rc < 0) {
+		valvula_log (VALVULA_LEVEL_CRITICAL, "failed to create io_uring interface (io_uring_queue_init have failed): %s",
+			     strerror (-rc));
+		axl_free (uring);
+		return NULL;
+	} /* end if */
+
+	uring->ctx          = ctx;
+	uring->wait_to      = wait_to;
+	uring->multishot    = axl_true;
+	uring->entries_size = 1024;
+	uring->entries      = axl_new (ValvulaURingEntry, uring->entries_size);
+	uring->cancel       = axl_list_new (axl_list_always_return_1, NULL);
+	valvula_mutex_create (&uring->mutex);
+
+	return uring;
+}
+
+/** 
+ * @internal
+ *
+ * Internal implementation to destroy a file set supporting io_uring.
+ * 
+ * @param fd_group The file set to be deallocated.
+ */
+void    __valvula_io_waiting_uring_destroy (axlPointer fd_group)
+{
+	ValvulaURing * uring = (ValvulaURing *) fd_group;
+
+	io_uring_queue_exit (&uring->ring);
+	valvula_mutex_destroy (&uring->mutex);
+	axl_list_free (uring->cancel);
+	axl_free (uring->entries);
+	axl_free (uring);
+	
+	return;
+}
+
+/** 
+ * @internal
+ *
+ * Clears the file set supporting io_uring: all poll requests are
+ * cancelled.
+ */
+void    __valvula_io_waiting_uring_clear (axlPointer __fd_group)
+{
+	ValvulaURing        * uring = (ValvulaURing *) __fd_group;
+	int                   iterator;
+
+	valvula_mutex_lock (&uring->mutex);
+	for (iterator = 0; iterator < uring->entries_size; iterator++) {
+		if (uring->entries[iterator].connection == NULL)
+			continue;
+		axl_list_append (uring->cancel, INT_TO_PTR (iterator));
+		axl_list_append (uring->cancel, INT_TO_PTR (uring->entries[iterator].generation));
+		uring->entries[iterator].connection = NULL;
+	} /* end for */
+	uring->length = 0;
+	valvula_mutex_unlock (&uring->mutex);
+
+	return;
+}
+
+/** 
+ * @internal
+ *
+ * Add to file set implementation for io_uring. The poll request is
+ * queued and submitted with the next wait.
+ * 
+ * @param fds The socket descriptor to be added.
+ *
+ * @param fd_set The fd set where the socket descriptor will be added.
+ */
+axl_bool  __valvula_io_waiting_uring_add_to (int                fds, 
+					    ValvulaConnection * connection,
+					    axlPointer         __fd_set)
+{
+	ValvulaURing        * uring  = (ValvulaURing *) __fd_set;
+	ValvulaCtx          * ctx    = uring->ctx;
+	ValvulaURingEntry   * temp;
+	unsigned int          generation;
+	int                   size;
+
+	if (fds < 0)
+		return axl_false;
+
+	valvula_mutex_lock (&uring->mutex);
+
+	/* expand table if required */
+	if (fds >= uring->entries_size) {
+		size = uring->entries_size;
+		while (size <= fds)
+			size *= 2;
+		temp = axl_realloc (uring->entries, sizeof (ValvulaURingEntry) * size);
+		if (temp == NULL) {
+			valvula_mutex_unlock (&uring->mutex);
+			valvula_log (VALVULA_LEVEL_CRITICAL, "unable to expand io_uring socket table to %d entries", size);
+			return axl_false;
+		} /* end if */
+		memset (temp + uring->entries_size, 0, sizeof (ValvulaURingEntry) * (size - uring->entries_size));
+		uring->entries      = temp;
+		uring->entries_size = size;
+	} /* end if */
+
+	/* already watched */
+	if (uring->entries[fds].connection == connection) {
+		valvula_mutex_unlock (&uring->mutex);
+		return axl_true;
+	} /* end if */
+
+	/* register a new generation for this socket */
+	uring->generation++;
+	generation                          = uring->generation;
+	uring->entries[fds].connection      = connection;
+	uring->entries[fds].generation      = generation;
+	uring->length++;
+	valvula_mutex_unlock (&uring->mutex);
+
+	if (! __valvula_io_waiting_uring_arm (uring, fds, generation)) {
+		valvula_log (VALVULA_LEVEL_CRITICAL, "failed to add fd=%d to io_uring, no submission entry available", fds);
+		valvula_mutex_lock (&uring->mutex);
+		uring->entries[fds].connection = NULL;
+		uring->length--;
+		valvula_mutex_unlock (&uring->mutex);
+		return axl_false;
+	} /* end if */
+
+	return axl_true;
+}
+
+/** 
+ * @internal
+ *
+ * Remove from file set implementation for io_uring. It can be called
+ * from any thread: the cancel request is submitted by the reader on
+ * next wait.
+ * 
+ * @param fds The socket descriptor to be removed.
+ *
+ * @param fd_set The fd set where the socket descriptor will be removed.
+ */
+axl_bool  __valvula_io_waiting_uring_remove_from (int                fds, 
+						  ValvulaConnection * connection,
+						  axlPointer         __fd_set)
+{
+	ValvulaURing        * uring  = (ValvulaURing *) __fd_set;
+
+	if (fds < 0 || uring == NULL)
+		return axl_true;
+
+	valvula_mutex_lock (&uring->mutex);
+	if (fds < uring->entries_size && uring->entries[fds].connection == connection) {
+		/* queue cancel request */
+		axl_list_append (uring->cancel, INT_TO_PTR (fds));
+		axl_list_append (uring->cancel, INT_TO_PTR (uring->entries[fds].generation));
+
+		uring->entries[fds].connection = NULL;
+		uring->length--;
+	} /* end if */
+	valvula_mutex_unlock (&uring->mutex);
+
+	return axl_true;
+}
+
+/** 
+ * @internal
+ *
+ * Perform a wait operation over the object supporting io_uring:
+ * submits pending requests and reaps a batch of completions.
+ */
+int __valvula_io_waiting_uring_wait_on (axlPointer __fd_group, int max_fds, ValvulaIoWaitingFor wait_to)
+{
+	ValvulaURing            * uring   = (ValvulaURing *) __fd_group;
+	struct io_uring_sqe     * sqe;
+	struct io_uring_cqe     * cqe     = NULL;
+	struct __kernel_timespec  ts;
+	int                       fds;
+	unsigned int              generation;
+	int                       rc;
+
+	/* queue cancel requests for removed sockets */
+	valvula_mutex_lock (&uring->mutex);
+	while (axl_list_length (uring->cancel) >= 2) {
+		fds        = PTR_TO_INT (axl_list_get_nth (uring->cancel, 0));
+		generation = PTR_TO_INT (axl_list_get_nth (uring->cancel, 1));
+
+		sqe = __valvula_io_waiting_uring_get_sqe (uring);
+		if (sqe == NULL)
+			break;
+		io_uring_prep_poll_remove (sqe, VALVULA_URING_DATA (fds, generation));
+		io_uring_sqe_set_data64 (sqe, 0);
+
+		axl_list_unlink_first (uring->cancel);
+		axl_list_unlink_first (uring->cancel);
+	} /* end while */
+	valvula_mutex_unlock (&uring->mutex);
+
+	/* submit pending requests and wait for completions */
+	ts.tv_sec  = VALVULA_IO_IS (wait_to, READ_OPERATIONS) ? 0 : 1;
+	ts.tv_nsec = VALVULA_IO_IS (wait_to, READ_OPERATIONS) ? 500000000 : 0;
+	rc = io_uring_submit_and_wait_timeout (&uring->ring, &cqe, 1, &ts, NULL);
+	if (rc == -ETIME)
+		return 0;
+	if (rc < 0 && rc != -EINTR && cqe == NULL) {
+		errno = -rc;
+		return -1;
+	} /* end if */
+
+	/* reap completions in batch */
+	return io_uring_peek_batch_cqe (&uring->ring, uring->cqes, VALVULA_URING_BATCH);
+}
+
+/** 
+ * @internal Notify that we have dispatch support.
+ */
+axl_bool      __valvula_io_waiting_uring_have_dispatch (axlPointer fd_group)
+{
+	return axl_true;
+}
+
+/** 
+ * @internal
+ *
+ * io_uring implementation for the automatic dispatch.
+ */
+void     __valvula_io_waiting_uring_dispatch (axlPointer           fd_group, 
+					     ValvulaIoDispatchFunc dispatch_func,
+					     int                  changed,
+					     axlPointer           user_data)
+{
+	ValvulaURing        * uring    = (ValvulaURing *) fd_group;
+	ValvulaCtx          * ctx      = uring->ctx;
+	ValvulaConnection   * connection;
+	struct io_uring_cqe * cqe;
+	int                   iterator = 0;
+	int                   fds;
+	unsigned int          generation;
+	axl_bool              rearm;
+
+	while (iterator < changed && iterator < VALVULA_URING_BATCH) {
+		cqe = uring->cqes[iterator];
+		iterator++;
+
+		/* completion of a cancel request */
+		if (io_uring_cqe_get_data64 (cqe) == 0)
+			continue;
+
+		fds        = VALVULA_URING_FDS (io_uring_cqe_get_data64 (cqe));
+		generation = VALVULA_URING_GEN (io_uring_cqe_get_data64 (cqe));
+
+		/* kernel without multishot poll support: switch to
+		 * single shot requests */
+		if (cqe->res == -EINVAL && uring->multishot) {
+			valvula_log (VALVULA_LEVEL_WARNING, "io_uring multishot poll not supported by the kernel, using single shot requests");
+			uring->multishot = axl_false;
+		} /* end if */
+
+		/* find connection (if still watched) */
+		connection = NULL;
+		valvula_mutex_lock (&uring->mutex);
+		if (fds < uring->entries_size && uring->entries[fds].generation == generation)
+			connection = uring->entries[fds].connection;
+		valvula_mutex_unlock (&uring->mutex);
+
+		if (connection == NULL || cqe->res == -ECANCELED)
+			continue;
+
+		/* request finished (single shot or multishot
+		 * terminated): it must be armed again */
+		rearm = ! (cqe->flags & IORING_CQE_F_MORE);
+
+		if (cqe->res > 0 || (cqe->res < 0 && cqe->res != -EINVAL)) {
+			/* found event, dispatch */
+			dispatch_func (
+				/* socket found */
+				fds,
+				/* purpose for the waiting set */
+				uring->wait_to, 
+				/* connection associated */
+				connection,
+				/* dispatch user data */
+				user_data);
+		} /* end if */
+
+		if (! rearm)
+			continue;
+
+		/* check connection is still watched after dispatch */
+		valvula_mutex_lock (&uring->mutex);
+		rearm = fds < uring->entries_size && uring->entries[fds].generation == generation && uring->entries[fds].connection != NULL;
+		valvula_mutex_unlock (&uring->mutex);
+
+		if (rearm && ! __valvula_io_waiting_uring_arm (uring, fds, generation)) 
+			valvula_log (VALVULA_LEVEL_CRITICAL, "failed to arm again io_uring poll for fd=%d", fds);
+	} /* end while */
+
+	/* release completions reaped */
+	io_uring_cq_advance (&uring->ring, changed);
+	
+	return;
+}
+
+/** 
+ * @internal Checks if io_uring can be used with the running kernel
+ * (it could be not supported or disabled).
+ */
+axl_bool __valvula_io_waiting_uring_supported (void)
+{
+	struct io_uring ring;
+
+	if (io_uring_queue_init (2, &ring, 0) < 0)
+		return axl_false;
+	io_uring_queue_exit (&ring);
+	return axl_true;
+}
+#endif /* VALVULA_HAVE_URING */
+
+
 
 /** 
  * @brief Allows to configure the default io waiting mechanism to be
@@ -805,6 +1279,7 @@ axl_bool                  valvula_io_waiting_use (ValvulaCtx * ctx, ValvulaIoWai
 		ctx->waiting_clear         = __valvula_io_waiting_default_clear;
 		ctx->waiting_wait_on       = __valvula_io_waiting_default_wait_on;
 		ctx->waiting_add_to        = __valvula_io_waiting_default_add_to;
+		ctx->waiting_remove_from   = NULL;
 		ctx->waiting_is_set        = __valvula_io_waiting_default_is_set;
 		ctx->waiting_have_dispatch = NULL;
 		ctx->waiting_dispatch      = NULL;
@@ -825,6 +1300,7 @@ axl_bool                  valvula_io_waiting_use (ValvulaCtx * ctx, ValvulaIoWai
 		ctx->waiting_clear         = __valvula_io_waiting_poll_clear;
 		ctx->waiting_wait_on       = __valvula_io_waiting_poll_wait_on;
 		ctx->waiting_add_to        = __valvula_io_waiting_poll_add_to;
+		ctx->waiting_remove_from   = NULL;
 		/* no is_set support but automatic dispatch */
 		ctx->waiting_is_set        = NULL;
 		ctx->waiting_have_dispatch = __valvula_io_waiting_poll_have_dispatch;
@@ -851,6 +1327,8 @@ axl_bool                  valvula_io_waiting_use (ValvulaCtx * ctx, ValvulaIoWai
 		ctx->waiting_clear         = __valvula_io_waiting_epoll_clear;
 		ctx->waiting_wait_on       = __valvula_io_waiting_epoll_wait_on;
 		ctx->waiting_add_to        = __valvula_io_waiting_epoll_add_to;
+		/* sockets are kept registered between waits */
+		ctx->waiting_remove_from   = __valvula_io_waiting_epoll_remove_from;
 		/* no is_set support but automatic dispatch */
 		ctx->waiting_is_set        = NULL;
 		ctx->waiting_have_dispatch = __valvula_io_waiting_epoll_have_dispatch;
@@ -860,6 +1338,32 @@ axl_bool                  valvula_io_waiting_use (ValvulaCtx * ctx, ValvulaIoWai
 		mech                       = "linux epoll(2) system call";
 #endif
 	       
+		/* ok */
+		result = axl_true;
+#else 
+		result = axl_false;
+#endif
+		/* important, leave the break outside the mech
+		 * definition */
+		break;
+	case VALVULA_IO_WAIT_URING:
+#if defined (VALVULA_HAVE_URING)
+		ctx->waiting_create        = __valvula_io_waiting_uring_create;
+		ctx->waiting_destroy       = __valvula_io_waiting_uring_destroy;
+		ctx->waiting_clear         = __valvula_io_waiting_uring_clear;
+		ctx->waiting_wait_on       = __valvula_io_waiting_uring_wait_on;
+		ctx->waiting_add_to        = __valvula_io_waiting_uring_add_to;
+		/* sockets are kept registered between waits */
+		ctx->waiting_remove_from   = __valvula_io_waiting_uring_remove_from;
+		/* no is_set support but automatic dispatch */
+		ctx->waiting_is_set        = NULL;
+		ctx->waiting_have_dispatch = __valvula_io_waiting_uring_have_dispatch;
+		ctx->waiting_dispatch      = __valvula_io_waiting_uring_dispatch;
+		ctx->waiting_type          = VALVULA_IO_WAIT_URING;
+#if defined(ENABLE_VALVULA_LOG)
+		mech                       = "linux io_uring";
+#endif
+	       
 		/* ok */
 		result = axl_true;
 #else 
@@ -917,6 +1421,14 @@ axl_bool                  valvula_io_waiting_is_available (ValvulaIoWaitingType
 #else
 		/* not available */
 		return axl_false;
+#endif
+	case VALVULA_IO_WAIT_URING:
+		/* compiled in and supported by the running kernel */
+#if defined (VALVULA_HAVE_URING)
+		return __valvula_io_waiting_uring_supported ();
+#else
+		/* not available */
+		return axl_false;
 #endif
 	} /* end switch */
 
@@ -1152,6 +1664,139 @@ axl_bool               valvula_io_waiting_invoke_add_to_fd_group  (ValvulaCtx
 	return axl_false;
 }
 
+/** 
+ * @brief Allows to configure the remove socket from fd set
+ * operation. Configuring this handler makes the valvula reader to
+ * work in persistent registration mode: sockets are added to the fd
+ * set once (when they are accepted or registered) and removed when
+ * they are closed, instead of clearing and building the fd set again
+ * on every wait operation.
+ *
+ * @param ctx The context where the operation will be performed.
+ *
+ * @param remove_from The handler to be invoked when it is required
+ * to remove a socket descriptor from the fd set. Passing NULL
+ * disables persistent registration mode.
+ */
+void                 valvula_io_waiting_set_remove_from_fd_group (ValvulaCtx                 * ctx, 
+								  ValvulaIoRemoveFromFdGroup   remove_from)
+{
+	/* check for NULL reference */
+	if (ctx == NULL)
+		return;
+
+	/* set the new handler */
+	ctx->waiting_remove_from = remove_from;
+
+	return;
+}
+
+/** 
+ * @brief Allows to check if the current I/O mechanism keeps sockets
+ * registered across wait operations (persistent registration mode).
+ *
+ * @param ctx The context where the operation will be performed.
+ *
+ * @return axl_true if sockets are registered once, otherwise
+ * axl_false is returned (the fd set is built on every wait).
+ */
+axl_bool             valvula_io_waiting_is_persistent           (ValvulaCtx * ctx)
+{
+	if (ctx == NULL)
+		return axl_false;
+
+	return ctx->waiting_remove_from != NULL;
+}
+
+/** 
+ * @brief Allows to enable edge-triggered notifications for the epoll(2)
+ * mechanism. In this mode a socket is only reported when new data
+ * arrives, so the reader reads until EAGAIN and parses every complete
+ * line on each notification (instead of being woken up again for
+ * content already available). Listener sockets are always
+ * registered level-triggered.
+ *
+ * Changing the mode makes reader loops to rebuild their watching
+ * sets (as happens with \ref valvula_io_waiting_use).
+ *
+ * @param ctx The context where the operation will be performed.
+ *
+ * @param enable axl_true to enable edge-triggered mode, axl_false
+ * to use level-triggered mode (default).
+ */
+void                 valvula_io_waiting_set_edge_triggered       (ValvulaCtx * ctx,
+								  axl_bool     enable)
+{
+	axl_bool do_notify;
+
+	if (ctx == NULL || ctx->waiting_edge_triggered == enable)
+		return;
+
+	/* stop readers so watching sets are created with the new
+	 * mode */
+	do_notify = valvula_reader_notify_change_io_api (ctx);
+
+	ctx->waiting_edge_triggered = enable;
+
+	if (do_notify)
+		valvula_reader_notify_change_done_io_api (ctx);
+
+	return;
+}
+
+/** 
+ * @brief Allows to check if the current I/O mechanism only notifies
+ * sockets when new data arrives (edge-triggered), so readers must
+ * drain sockets until EAGAIN. This is the case of epoll(2) with \ref
+ * valvula_io_waiting_set_edge_triggered enabled and io_uring
+ * (multishot poll).
+ *
+ * @param ctx The context where the operation will be performed.
+ *
+ * @return axl_true if the mechanism is edge-triggered.
+ */
+axl_bool             valvula_io_waiting_is_edge_triggered        (ValvulaCtx * ctx)
+{
+	if (ctx == NULL)
+		return axl_false;
+
+	if (ctx->waiting_type == VALVULA_IO_WAIT_URING)
+		return axl_true;
+
+	return ctx->waiting_type == VALVULA_IO_WAIT_EPOLL && ctx->waiting_edge_triggered;
+}
+
+/** 
+ * @internal
+ *
+ * @brief Invokes current remove from operation for the given socket
+ * descriptor from the given fd set.
+ *
+ * @param ctx The context where the operation will be performed.
+ * 
+ * @param fds The socket descriptor to be removed (-1 if it was
+ * already closed).
+ *
+ * @param connection The connection associated to the socket.
+ *
+ * @param fd_group The fd set where the socket descriptor will be
+ * removed.
+ */
+axl_bool               valvula_io_waiting_invoke_remove_from_fd_group  (ValvulaCtx        * ctx,
+									VALVULA_SOCKET      fds, 
+									ValvulaConnection * connection, 
+									axlPointer          fd_group)
+{
+	if (ctx != NULL && ctx->waiting_remove_from != NULL && fd_group != NULL) {
+		
+		/* invoke remove from operation */
+		return ctx->waiting_remove_from (fds, connection, fd_group);
+	} /* end if */
+
+	/* return axl_false if it fails */
+	return axl_false;
+}
+
 /** 
  * @brief Allows to configure the is set operation for the socket on the fd set.
  *
@@ -1446,6 +2091,7 @@ void                 valvula_io_init (ValvulaCtx * ctx)
 	ctx->waiting_clear         = __valvula_io_waiting_epoll_clear;
 	ctx->waiting_wait_on       = __valvula_io_waiting_epoll_wait_on;
 	ctx->waiting_add_to        = __valvula_io_waiting_epoll_add_to;
+	ctx->waiting_remove_from   = __valvula_io_waiting_epoll_remove_from;
 	ctx->waiting_is_set        = NULL;
 	ctx->waiting_have_dispatch = __valvula_io_waiting_epoll_have_dispatch;
 	ctx->waiting_dispatch      = __valvula_io_waiting_epoll_dispatch;
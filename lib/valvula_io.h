@@ -59,6 +59,16 @@ void                 valvula_io_waiting_set_clear_fd_group      (ValvulaCtx
 void                 valvula_io_waiting_set_add_to_fd_group     (ValvulaCtx           * ctx,
 								 ValvulaIoAddToFdGroup add_to);
 
+void                 valvula_io_waiting_set_remove_from_fd_group (ValvulaCtx           * ctx,
+								  ValvulaIoRemoveFromFdGroup remove_from);
+
+axl_bool             valvula_io_waiting_is_persistent           (ValvulaCtx           * ctx);
+
+void                 valvula_io_waiting_set_edge_triggered      (ValvulaCtx           * ctx,
+								 axl_bool               enable);
+
+axl_bool             valvula_io_waiting_is_edge_triggered       (ValvulaCtx           * ctx);
+
 void                 valvula_io_waiting_set_is_set_fd_group     (ValvulaCtx           * ctx,
 								 ValvulaIoIsSetFdGroup is_set);
 
@@ -86,6 +96,11 @@ axl_bool             valvula_io_waiting_invoke_add_to_fd_group  (ValvulaCtx
 								 ValvulaConnection    * connection, 
 								 axlPointer            fd_group);
 
+axl_bool             valvula_io_waiting_invoke_remove_from_fd_group (ValvulaCtx           * ctx,
+								     VALVULA_SOCKET         fds, 
+								     ValvulaConnection    * connection, 
+								     axlPointer            fd_group);
+
 axl_bool             valvula_io_waiting_invoke_is_set_fd_group  (ValvulaCtx           * ctx,
 								 VALVULA_SOCKET         fds, 
 								 axlPointer fd_group,
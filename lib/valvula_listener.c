@@ -38,6 +38,10 @@
 /* local include */
 #include <valvula_private.h>
 
+#if defined(AXL_OS_UNIX)
+# include <netinet/tcp.h>
+#endif
+
 #define LOG_DOMAIN "valvula-listener"
 
 /** 
@@ -85,32 +89,16 @@ VALVULA_SOCKET valvula_listener_accept (VALVULA_SOCKET server_socket)
 }
 
 /** 
- * @brief Starts a generic TCP listener on the provided address and
- * port. This function is used internally by the valvula listener
- * module to startup the valvula listener TCP session associated,
- * however the function can be used directly to start TCP listeners.
- *
- * @param ctx The context where the listener is started.
- *
- * @param host Host address to allocate. It can be "127.0.0.1" to only
- * listen for localhost connections or "0.0.0.0" to listen on any
- * address that the server has installed. It cannot be NULL.
- *
- * @param port The port to listen on. It cannot be NULL and it must be
- * a non-zero string.
- *
- * @param error Optional axlError reference where a textual diagnostic
- * will be reported in case of error.
- *
- * @return The function returns the listener socket or -1 if it
- * fails. Optionally the axlError reports the textual especific error
- * found. If the function returns -2 then some parameter provided was
- * found to be NULL.
+ * @internal Implementation used by valvula_listener_sock_listen
+ * which also allows to bind the socket with SO_REUSEPORT so several
+ * sockets (one per reader loop) can listen on the same address and
+ * port.
  */
-VALVULA_SOCKET     valvula_listener_sock_listen      (ValvulaCtx   * ctx,
-						    const char  * host,
-						    const char  * port,
-						    axlError   ** error)
+VALVULA_SOCKET     __valvula_listener_sock_listen_common (ValvulaCtx   * ctx,
+							  const char  * host,
+							  const char  * port,
+							  axl_bool      reuse_port,
+							  axlError   ** error)
 {
 	struct hostent     * he;
        struct in_addr     * haddr;
@@ -125,7 +113,7 @@ VALVULA_SOCKET     valvula_listener_sock_listen      (ValvulaCtx   * ctx,
 	socklen_t            sin_size  = sizeof (sin);
 #endif	
 	uint16_t             int_port;
-	int                  backlog   = 0;
+	int                  backlog   = VALVULA_LISTENER_DEFAULT_BACKLOG;
 	int                  bind_res;
 
 	v_return_val_if_fail (ctx,  -2);
@@ -156,6 +144,15 @@ VALVULA_SOCKET     valvula_listener_sock_listen      (ValvulaCtx   * ctx,
 	/* setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, (char  *)&unit, sizeof(BOOL)); */
 #else
 	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &unit, sizeof (unit));
+#if defined(SO_REUSEPORT)
+	/* allow several listener sockets (shards) on the same
+	 * address:port so the kernel balances incoming connections */
+	if (reuse_port && setsockopt (fd, SOL_SOCKET, SO_REUSEPORT, &unit, sizeof (unit)) != 0) {
+		valvula_log (VALVULA_LEVEL_CRITICAL, "unable to enable SO_REUSEPORT on listener socket %d (errno=%d:%s)", fd, errno, strerror (errno));
+		valvula_close_socket (fd);
+		return -1;
+	} /* end if */
+#endif
 #endif 
 
 	/* get integer port */
@@ -191,6 +188,227 @@ VALVULA_SOCKET     valvula_listener_sock_listen      (ValvulaCtx   * ctx,
 	return fd;
 }
 
+/** 
+ * @brief Accepts a connection from the provided listener socket,
+ * returning it already configured as non-blocking and close-on-exec
+ * (using accept4(2) when available).
+ *
+ * @param server_socket The listener socket where the accept()
+ * operation will be called.
+ *
+ * @return Returns a connected socket descriptor or -1 if it fails
+ * (errno is set, i.e. EAGAIN when there are no more connections
+ * pending for a non-blocking listener).
+ */
+VALVULA_SOCKET valvula_listener_accept_nonblocking (VALVULA_SOCKET server_socket)
+{
+#if defined(VALVULA_HAVE_ACCEPT4)
+	struct sockaddr_storage addr;
+	socklen_t               addrlen = sizeof (addr);
+
+	return accept4 (server_socket, (struct sockaddr *) &addr, &addrlen, SOCK_NONBLOCK | SOCK_CLOEXEC);
+#else
+	VALVULA_SOCKET          fd = valvula_listener_accept (server_socket);
+
+	if (fd >= 0) {
+		valvula_connection_set_sock_block (fd, axl_false);
+#if defined(AXL_OS_UNIX)
+		fcntl (fd, F_SETFD, FD_CLOEXEC);
+#endif
+	} /* end if */
+	return fd;
+#endif
+}
+
+/** 
+ * @brief Starts a generic TCP listener on the provided address and
+ * port. This function is used internally by the valvula listener
+ * module to startup the valvula listener TCP session associated,
+ * however the function can be used directly to start TCP listeners.
+ *
+ * @param ctx The context where the listener is started.
+ *
+ * @param host Host address to allocate. It can be "127.0.0.1" to only
+ * listen for localhost connections or "0.0.0.0" to listen on any
+ * address that the server has installed. It cannot be NULL.
+ *
+ * @param port The port to listen on. It cannot be NULL and it must be
+ * a non-zero string.
+ *
+ * @param error Optional axlError reference where a textual diagnostic
+ * will be reported in case of error.
+ *
+ * @return The function returns the listener socket or -1 if it
+ * fails. Optionally the axlError reports the textual especific error
+ * found. If the function returns -2 then some parameter provided was
+ * found to be NULL.
+ */
+VALVULA_SOCKET     valvula_listener_sock_listen      (ValvulaCtx   * ctx,
+						    const char  * host,
+						    const char  * port,
+						    axlError   ** error)
+{
+	return __valvula_listener_sock_listen_common (ctx, host, port, axl_false, error);
+}
+
+/** 
+ * @brief Starts a UNIX domain (AF_UNIX) stream listener on the
+ * provided file system path. This is the local socket counterpart of
+ * \ref valvula_listener_sock_listen, useful when the MTA runs on the
+ * same host (i.e. postfix check_policy_service unix:private/valvula).
+ *
+ * Any stale socket file found at the provided path is removed before
+ * binding.
+ *
+ * @param ctx The context where the listener is started.
+ *
+ * @param path The file system path where the socket will be
+ * created. It cannot be NULL.
+ *
+ * @param mode Permissions to be configured on the socket file
+ * (i.e. 0660) or -1 to leave them as configured by the umask.
+ *
+ * @param error Optional axlError reference where a textual diagnostic
+ * will be reported in case of error.
+ *
+ * @return The function returns the listener socket or -1 if it
+ * fails. If the function returns -2 then some parameter provided was
+ * found to be NULL.
+ */
+VALVULA_SOCKET     valvula_listener_sock_listen_unix (ValvulaCtx   * ctx,
+						      const char   * path,
+						      int            mode,
+						      axlError    ** error)
+{
+#if defined(AXL_OS_UNIX)
+	struct sockaddr_un   saddr;
+	struct stat          st;
+	VALVULA_SOCKET       fd;
+
+	v_return_val_if_fail (ctx,  -2);
+	v_return_val_if_fail (path, -2);
+
+	if (strlen (path) >= sizeof (saddr.sun_path)) {
+		valvula_log (VALVULA_LEVEL_CRITICAL, "unix socket path is too long (max %d): %s", (int) sizeof (saddr.sun_path) - 1, path);
+		axl_error_report (error, -1, "unix socket path is too long: %s", path);
+		return -1;
+	} /* end if */
+
+	if ((fd = socket (AF_UNIX, SOCK_STREAM, 0)) <= 2) {
+		/* do not allow creating sockets reusing stdin (0),
+		   stdout (1), stderr (2) */
+		valvula_log (VALVULA_LEVEL_DEBUG, "failed to create unix listener socket: %d (errno=%d:%s)", fd, errno, strerror (errno));
+		axl_error_report (error, errno, "failed to create unix listener socket (errno=%d)", errno);
+		return -1;
+        } /* end if */
+
+	/* remove stale socket left by a previous run (but never
+	 * remove anything that is not a socket) */
+	if (lstat (path, &st) == 0 && S_ISSOCK (st.st_mode))
+		unlink (path);
+
+	memset (&saddr, 0, sizeof (struct sockaddr_un));
+	saddr.sun_family = AF_UNIX;
+	memcpy (saddr.sun_path, path, strlen (path));
+
+	/* call to bind */
+	if (bind (fd, (struct sockaddr *) &saddr, sizeof (struct sockaddr_un)) == VALVULA_SOCKET_ERROR) {
+		valvula_log (VALVULA_LEVEL_CRITICAL, "unable to bind unix socket %s (errno=%d:%s). Closing socket: %d", path, errno, strerror (errno), fd);
+		axl_error_report (error, errno, "unable to bind unix socket %s (errno=%d)", path, errno);
+		valvula_close_socket (fd);
+		return -1;
+	} /* end if */
+
+	/* configure permissions */
+	if (mode >= 0 && chmod (path, (mode_t) mode) != 0) 
+		valvula_log (VALVULA_LEVEL_WARNING, "unable to change permissions of unix socket %s to %o (errno=%d:%s)", path, mode, errno, strerror (errno));
+
+	if (listen (fd, VALVULA_LISTENER_DEFAULT_BACKLOG) == VALVULA_SOCKET_ERROR) {
+		valvula_log (VALVULA_LEVEL_CRITICAL, "an error have occur while executing listen on unix socket %s", path);
+		axl_error_report (error, errno, "listen failed on unix socket %s (errno=%d)", path, errno);
+		valvula_close_socket (fd);
+		unlink (path);
+		return -1;
+        } /* end if */
+
+	/* report and return fd */
+	valvula_log  (VALVULA_LEVEL_DEBUG, "running listener at unix:%s (socket: %d)", path, fd);
+	return fd;
+#else
+	valvula_log (VALVULA_LEVEL_CRITICAL, "unix socket listeners are not supported on this platform");
+	return -1;
+#endif
+}
+
+/** 
+ * @internal Destroy function used by the shards list.
+ */
+void __valvula_listener_shard_unref (axlPointer shard)
+{
+	valvula_connection_unref (shard, "listener shard");
+	return;
+}
+
+/** 
+ * @internal Creates additional listener sockets (shards) bound to the
+ * same address and port than the provided master listener so every
+ * reader loop accepts its own connections (SO_REUSEPORT). Shards are
+ * owned by the master listener.
+ */
+void __valvula_listener_create_shards (ValvulaCtx * ctx, ValvulaConnection * listener)
+{
+#if defined(SO_REUSEPORT)
+	struct sockaddr_in   sin;
+	socklen_t            sin_size = sizeof (sin);
+	char               * str_port;
+	ValvulaConnection  * shard;
+	VALVULA_SOCKET       fd;
+	int                  iterator;
+
+	/* get port really allocated (port could be 0) */
+	if (getsockname (listener->session, (struct sockaddr *) &sin, &sin_size) < 0) {
+		valvula_log (VALVULA_LEVEL_CRITICAL, "unable to get listener port to create shards (errno=%d:%s)", errno, strerror (errno));
+		return;
+	} /* end if */
+	str_port = axl_strdup_printf ("%d", ntohs (sin.sin_port));
+
+	listener->shards = axl_list_new (axl_list_always_return_1, __valvula_listener_shard_unref);
+
+	iterator = 1;
+	while (iterator < valvula_reader_get_num (ctx)) {
+		fd = __valvula_listener_sock_listen_common (ctx, listener->host, str_port, axl_true, NULL);
+		if (fd < 0) {
+			valvula_log (VALVULA_LEVEL_WARNING, "unable to create listener shard %d for %s:%s, connections will be accepted by remaining listeners", 
+				     iterator, listener->host, str_port);
+			break;
+		} /* end if */
+
+		shard = valvula_connection_new_empty (ctx, fd, ValvulaRoleMasterListener);
+		if (shard == NULL) {
+			valvula_close_socket (fd);
+			break;
+		} /* end if */
+
+		/* configure shard */
+		shard->host        = axl_strdup (listener->host);
+		shard->port        = axl_strdup (str_port);
+		shard->port_number = listener->port_number;
+		shard->listener    = listener;
+
+		/* shard reference is owned by the master listener */
+		axl_list_append (listener->shards, shard);
+
+		/* next shard */
+		iterator++;
+	} /* end while */
+
+	valvula_log (VALVULA_LEVEL_DEBUG, "listener %s:%s running with %d shards", 
+		     listener->host, str_port, axl_list_length (listener->shards) + 1);
+	axl_free (str_port);
+#endif
+	return;
+}
+
 axlPointer __valvula_listener_new (ValvulaListenerData * data)
 {
 	char               * host          = data->host;
@@ -207,7 +425,7 @@ axlPointer __valvula_listener_new (ValvulaListenerData * data)
 	axl_free (data);
 
 	/* allocate listener */
-	fd = valvula_listener_sock_listen (ctx, host, str_port, &error);
+	fd = __valvula_listener_sock_listen_common (ctx, host, str_port, valvula_reader_get_num (ctx) > 1, &error);
 	
 	/* listener ok */
 	/* seems listener to be created, now create the BEEP
@@ -219,8 +437,9 @@ axlPointer __valvula_listener_new (ValvulaListenerData * data)
 	} /* end if */
 
 	/* configure listener */
-	listener->port = str_port;
-	listener->host = host;
+	listener->port        = str_port;
+	listener->port_number = valvula_support_strtod (str_port, NULL);
+	listener->host        = host;
 
 	/* handle returned socket or error */
 	switch (fd) {
@@ -232,6 +451,11 @@ axlPointer __valvula_listener_new (ValvulaListenerData * data)
 			     axl_error_get_code (error), axl_error_get (error));
 		break;
 	default:
+		/* create one listener shard for each additional reader
+		 * loop */
+		if (valvula_reader_get_num (ctx) > 1)
+			__valvula_listener_create_shards (ctx, listener);
+
 		/* register the listener socket at the Valvula Reader process.  */
 		if (register_conn)
 			valvula_reader_watch_listener (ctx, listener);
@@ -632,6 +856,186 @@ ValvulaConnection * valvula_listener_new2    (ValvulaCtx   * ctx,
 
 
 
+/** 
+ * @brief Creates a new Valvula Listener accepting incoming
+ * connections on a UNIX domain socket created at the provided path.
+ *
+ * Because handlers are selected by the port where the request was
+ * received (see \ref valvula_ctx_register_request_handler), unix
+ * listeners have a virtual port that is reported by \ref
+ * valvula_connection_get_port so the same handler configuration
+ * works for TCP and unix listeners.
+ *
+ * @param ctx The context where the operation will be performed.
+ *
+ * @param path The file system path where the socket will be created.
+ *
+ * @param mode Permissions to be configured on the socket file
+ * (i.e. 0660) or -1 to leave them as configured by the umask.
+ *
+ * @param port Virtual port associated to this listener (used to
+ * select handlers). It can be NULL (port "0" is used).
+ *
+ * @return The listener connection created (check it with \ref
+ * valvula_connection_is_ok). The reference returned is owned by the
+ * valvula engine.
+ */
+ValvulaConnection * valvula_listener_new_unix        (ValvulaCtx   * ctx,
+						      const char   * path,
+						      int            mode,
+						      const char   * port)
+{
+	ValvulaConnection * listener;
+	axlError          * error = NULL;
+	VALVULA_SOCKET      fd;
+
+	/* check context is initialized */
+	if (! valvula_init_check (ctx) || path == NULL)
+		return NULL;
+	
+	/* init listener module */
+	valvula_listener_init (ctx);
+
+	/* allocate listener */
+	fd = valvula_listener_sock_listen_unix (ctx, path, mode, &error);
+
+	listener = valvula_connection_new_empty (ctx, fd, ValvulaRoleMasterListener);
+	if (listener == NULL) {
+		valvula_log (VALVULA_LEVEL_CRITICAL, "Unable to start listener at the provided location unix:%s", path);
+		axl_error_free (error);
+		return NULL;
+	} /* end if */
+
+	/* configure listener */
+	listener->host        = axl_strdup (path);
+	listener->port        = axl_strdup (port ? port : "0");
+	listener->port_number = valvula_support_strtod (listener->port, NULL);
+	if (fd < 0) {
+		valvula_log (VALVULA_LEVEL_CRITICAL, "Failed to start unix listener at %s: %s", path, axl_error_get (error));
+		axl_error_free (error);
+		return listener;
+	} /* end if */
+
+	/* record path so it is removed when the listener is closed */
+	listener->unix_path = axl_strdup (path);
+
+	/* register the listener socket at the Valvula Reader
+	 * process. Unix sockets are not sharded: they are watched by
+	 * the first reader loop. */
+	valvula_reader_watch_listener (ctx, listener);
+
+	valvula_log (VALVULA_LEVEL_DEBUG, "returning listener running at unix:%s (virtual port %s)", 
+		     path, valvula_connection_get_port (listener));
+	return listener;
+}
+
+/** 
+ * @brief Allows to configure the listen(2) backlog (queue of
+ * connections pending to be accepted) for the provided listener and
+ * its shards. Use larger values to absorb reconnect storms (i.e. all
+ * smtpd processes connecting at the same time after a restart).
+ *
+ * @param listener The master listener to configure.
+ *
+ * @param backlog The backlog to configure (capped by the kernel,
+ * see somaxconn).
+ *
+ * @return axl_true if the backlog was configured, otherwise axl_false.
+ */
+axl_bool            valvula_listener_set_backlog     (ValvulaConnection * listener,
+						      int                 backlog)
+{
+	ValvulaCtx        * ctx;
+	ValvulaConnection * shard;
+	int                 iterator;
+
+	if (listener == NULL || listener->role != ValvulaRoleMasterListener || backlog <= 0)
+		return axl_false;
+	ctx = listener->ctx;
+
+	/* calling listen(2) again on a listening socket updates its
+	 * backlog */
+	if (listen (listener->session, backlog) == VALVULA_SOCKET_ERROR) {
+		valvula_log (VALVULA_LEVEL_CRITICAL, "unable to configure backlog %d on listener socket %d (errno=%d)", backlog, listener->session, errno);
+		return axl_false;
+	} /* end if */
+
+	iterator = 0;
+	while (listener->shards && iterator < axl_list_length (listener->shards)) {
+		shard = axl_list_get_nth (listener->shards, iterator);
+		listen (shard->session, backlog);
+
+		/* next shard */
+		iterator++;
+	} /* end while */
+
+	return axl_true;
+}
+
+/** 
+ * @brief Allows to configure TCP_DEFER_ACCEPT on the provided
+ * listener (and its shards) so connections are only notified once
+ * data is available (the request). Only available on platforms
+ * supporting it.
+ *
+ * @param listener The master listener to configure.
+ *
+ * @param seconds Max time to wait for data. Use 0 to disable it.
+ *
+ * @return axl_true if the option was configured, otherwise axl_false.
+ */
+axl_bool            valvula_listener_set_defer_accept (ValvulaConnection * listener,
+						       int                 seconds)
+{
+	ValvulaCtx        * ctx;
+	ValvulaConnection * shard;
+	int                 iterator;
+
+	if (listener == NULL || listener->role != ValvulaRoleMasterListener || seconds < 0)
+		return axl_false;
+	ctx = listener->ctx;
+
+#if defined(TCP_DEFER_ACCEPT)
+	if (setsockopt (listener->session, IPPROTO_TCP, TCP_DEFER_ACCEPT, &seconds, sizeof (seconds)) != 0) {
+		valvula_log (VALVULA_LEVEL_CRITICAL, "unable to configure TCP_DEFER_ACCEPT on listener socket %d (errno=%d)", listener->session, errno);
+		return axl_false;
+	} /* end if */
+
+	iterator = 0;
+	while (listener->shards && iterator < axl_list_length (listener->shards)) {
+		shard = axl_list_get_nth (listener->shards, iterator);
+		setsockopt (shard->session, IPPROTO_TCP, TCP_DEFER_ACCEPT, &seconds, sizeof (seconds));
+
+		/* next shard */
+		iterator++;
+	} /* end while */
+
+	return axl_true;
+#else
+	valvula_log (VALVULA_LEVEL_WARNING, "TCP_DEFER_ACCEPT is not supported on this platform");
+	return axl_false;
+#endif
+}
+
+/** 
+ * @brief Allows to configure if connections accepted by the provided
+ * listener will have TCP_NODELAY enabled (Nagle algorithm disabled).
+ *
+ * @param listener The master listener to configure.
+ *
+ * @param enable axl_true to enable TCP_NODELAY on accepted connections.
+ */
+void                valvula_listener_set_tcp_nodelay (ValvulaConnection * listener,
+						      axl_bool            enable)
+{
+	if (listener == NULL || listener->role != ValvulaRoleMasterListener)
+		return;
+
+	/* not applicable to unix sockets */
+	listener->tcp_nodelay = enable && listener->unix_path == NULL;
+	return;
+}
+
 /** 
  * @internal Blocks a listener (or listeners) launched until valvula finish.
  * 
@@ -65,8 +65,29 @@ VALVULA_SOCKET     valvula_listener_sock_listen      (ValvulaCtx   * ctx,
 						      const char  * port,
 						      axlError   ** error);
 
+ValvulaConnection * valvula_listener_new_unix        (ValvulaCtx           * ctx,
+						      const char           * path,
+						      int                    mode,
+						      const char           * port);
+
+VALVULA_SOCKET     valvula_listener_sock_listen_unix (ValvulaCtx   * ctx,
+						      const char   * path,
+						      int            mode,
+						      axlError    ** error);
+
 VALVULA_SOCKET valvula_listener_accept               (VALVULA_SOCKET server_socket);
 
+VALVULA_SOCKET valvula_listener_accept_nonblocking   (VALVULA_SOCKET server_socket);
+
+axl_bool            valvula_listener_set_backlog     (ValvulaConnection * listener,
+						      int                 backlog);
+
+axl_bool            valvula_listener_set_defer_accept (ValvulaConnection * listener,
+						       int                 seconds);
+
+void                valvula_listener_set_tcp_nodelay (ValvulaConnection * listener,
+						      axl_bool            enable);
+
 void          valvula_listener_wait                 (ValvulaCtx * ctx);
 
 void          valvula_listener_unlock               (ValvulaCtx * ctx);
@@ -0,0 +1,434 @@
+/* 
+ *  Valvula: a high performance policy daemon
+ *  Copyright (C) 2025 Advanced Software Production Line, S.L.
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2.1 of
+ *  the License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+ *  02111-1307 USA
+ *  
+ *  You may find a copy of the license under this software is released
+ *  at COPYING file. 
+ *
+ *  For comercial support about integrating valvula or any other ASPL
+ *  software production please contact as at:
+ *          
+ *      Postal address:
+ *         Advanced Software Production Line, S.L.
+ *         C/ Antonio Suarez Nº 10, 
+ *         Edificio Alius A, Despacho 102
+ *         Alcalá de Henares 28802 (Madrid)
+ *         Spain
+ *
+ *      Email address:
+ *         info@aspl.es - http://www.aspl.es/valvula
+ */
+#include <valvula.h>
+#include <valvula_private.h>
+#define LOG_DOMAIN "valvula-pool"
+
+/** 
+ * \defgroup valvula_pool ValvulaPool: per-thread free lists used to recycle connection, request and task objects.
+ */
+
+/** 
+ * \addtogroup valvula_pool
+ * @{
+ */
+
+/** 
+ * @internal Max number of objects each thread keeps cached for a
+ * given pool. When reached, half of them are moved into the shared
+ * depot.
+ */
+#define VALVULA_POOL_CACHE_MAX 64
+
+/** 
+ * @internal Max number of objects kept into the shared depot of a
+ * given pool (for each NUMA node). Objects released over this limit
+ * are returned to the system allocator.
+ */
+#define VALVULA_POOL_DEPOT_MAX 4096
+
+/** 
+ * @internal Number of depots kept for each pool: one per NUMA node so
+ * objects released by a thread are only reused by threads running on
+ * the same node (higher nodes share depots).
+ */
+#define VALVULA_POOL_NODES_MAX 8
+
+typedef struct _ValvulaPoolItem {
+	struct _ValvulaPoolItem * next;
+} ValvulaPoolItem;
+
+#if defined(AXL_OS_UNIX)
+typedef struct _ValvulaPoolCache {
+	ValvulaPoolItem * head;
+	int               count;
+} ValvulaPoolCache;
+
+typedef struct _ValvulaPoolDepot {
+	pthread_mutex_t   mutex;
+	ValvulaPoolItem * head;
+	int               count;
+} ValvulaPoolDepot;
+
+static ValvulaPoolDepot __valvula_pool_depot[VALVULA_POOL_MAX][VALVULA_POOL_NODES_MAX];
+
+/* stats */
+static long             __valvula_pool_allocs[VALVULA_POOL_MAX];
+static long             __valvula_pool_hits[VALVULA_POOL_MAX];
+
+/* per thread caches, one for each pool */
+static __thread ValvulaPoolCache __valvula_pool_cache[VALVULA_POOL_MAX];
+static __thread axl_bool         __valvula_pool_thread_registered = axl_false;
+
+/* key used to flush thread caches when the thread finishes */
+static pthread_key_t             __valvula_pool_key;
+static pthread_once_t            __valvula_pool_once = PTHREAD_ONCE_INIT;
+
+/** 
+ * @internal Returns the depot to be used by the calling thread for
+ * the provided pool (the one of the NUMA node where it is running).
+ */
+ValvulaPoolDepot * __valvula_pool_get_depot (ValvulaPoolType type)
+{
+	return &__valvula_pool_depot[type][valvula_thread_get_numa_node (valvula_thread_get_cpu ()) % VALVULA_POOL_NODES_MAX];
+}
+
+/** 
+ * @internal Moves up to max items from the provided list into the
+ * depot, releasing them if the depot is full. Returns the remaining
+ * list (items not moved).
+ */
+ValvulaPoolItem * __valvula_pool_to_depot (ValvulaPoolType type, ValvulaPoolItem * list, int max, int * moved)
+{
+	ValvulaPoolDepot * depot = __valvula_pool_get_depot (type);
+	ValvulaPoolItem  * item;
+
+	(*moved) = 0;
+	pthread_mutex_lock (&depot->mutex);
+	while (list && (*moved) < max) {
+		item = list;
+		list = list->next;
+		(*moved)++;
+
+		if (depot->count >= VALVULA_POOL_DEPOT_MAX) {
+			/* depot full, return to the system */
+			axl_free (item);
+			continue;
+		} /* end if */
+
+		item->next  = depot->head;
+		depot->head = item;
+		depot->count++;
+	} /* end while */
+	pthread_mutex_unlock (&depot->mutex);
+
+	return list;
+}
+
+/** 
+ * @internal Called when a thread that used the pool finishes to move
+ * its cached objects into the depot.
+ */
+void __valvula_pool_thread_exit (axlPointer data)
+{
+	int iterator;
+	int moved;
+
+	for (iterator = 0; iterator < VALVULA_POOL_MAX; iterator++) {
+		__valvula_pool_to_depot (iterator, __valvula_pool_cache[iterator].head, 
+					 __valvula_pool_cache[iterator].count, &moved);
+		__valvula_pool_cache[iterator].head  = NULL;
+		__valvula_pool_cache[iterator].count = 0;
+	} /* end for */
+	return;
+}
+
+void __valvula_pool_init (void)
+{
+	int type;
+	int node;
+
+	for (type = 0; type < VALVULA_POOL_MAX; type++) {
+		for (node = 0; node < VALVULA_POOL_NODES_MAX; node++) 
+			pthread_mutex_init (&__valvula_pool_depot[type][node].mutex, NULL);
+	} /* end for */
+
+	pthread_key_create (&__valvula_pool_key, __valvula_pool_thread_exit);
+	return;
+}
+
+/** 
+ * @internal Flags the calling thread as a pool user so its caches
+ * are flushed into the depot when it finishes.
+ */
+void __valvula_pool_register_thread (void)
+{
+	if (__valvula_pool_thread_registered)
+		return;
+
+	pthread_once (&__valvula_pool_once, __valvula_pool_init);
+	pthread_setspecific (__valvula_pool_key, INT_TO_PTR (1));
+	__valvula_pool_thread_registered = axl_true;
+	return;
+}
+#endif
+
+/** 
+ * @brief Allocates a zeroed object of the provided size from the
+ * provided pool.
+ *
+ * Objects are first taken from the calling thread cache, then from
+ * the shared depot of the NUMA node where the thread runs (in
+ * batches to reduce locking) and, if no object is available, from the
+ * system allocator. 
+ *
+ * Objects returned by this function are allocated individually so
+ * they can be released either with \ref valvula_pool_release or
+ * axl_free.
+ *
+ * @param type The pool where the object is taken from.
+ *
+ * @param size The object size. All objects requested from the same
+ * pool must have the same size.
+ *
+ * @return A newly allocated (or recycled) zeroed object or NULL if it
+ * fails.
+ */
+axlPointer   valvula_pool_alloc    (ValvulaPoolType   type,
+				    int               size)
+{
+	return valvula_pool_alloc_header (type, size, size);
+}
+
+/** 
+ * @brief Same as \ref valvula_pool_alloc but, for recycled objects,
+ * only the first header bytes are cleared. This allows objects
+ * holding big inline buffers (that are always written before being
+ * read) to be reused without clearing the whole object.
+ *
+ * @param type The pool where the object is taken from.
+ *
+ * @param size The object size. All objects requested from the same
+ * pool must have the same size.
+ *
+ * @param header Number of bytes, from the start of the object, that
+ * are cleared (values bigger than size are limited to size).
+ *
+ * @return A newly allocated (or recycled) object or NULL if it fails.
+ */
+axlPointer   valvula_pool_alloc_header (ValvulaPoolType   type,
+					int               size,
+					int               header)
+{
+#if defined(AXL_OS_UNIX)
+	ValvulaPoolCache * cache;
+	ValvulaPoolDepot * depot;
+	ValvulaPoolItem  * item;
+
+	if (type < 0 || type >= VALVULA_POOL_MAX || size < (int) sizeof (ValvulaPoolItem))
+		return axl_new (char, size);
+
+	/* register thread exit handler to flush caches */
+	__valvula_pool_register_thread ();
+
+	cache = &__valvula_pool_cache[type];
+	__sync_fetch_and_add (&__valvula_pool_allocs[type], 1);
+
+	if (cache->head == NULL) {
+		/* refill thread cache from the depot of the node where
+		 * this thread runs */
+		depot = __valvula_pool_get_depot (type);
+		if (depot->head) {
+			pthread_mutex_lock (&depot->mutex);
+			while (depot->head && cache->count < (VALVULA_POOL_CACHE_MAX / 2)) {
+				item        = depot->head;
+				depot->head = item->next;
+				depot->count--;
+
+				item->next  = cache->head;
+				cache->head = item;
+				cache->count++;
+			} /* end while */
+			pthread_mutex_unlock (&depot->mutex);
+		} /* end if */
+	} /* end if */
+
+	if (cache->head) {
+		/* reuse cached object */
+		item        = cache->head;
+		cache->head = item->next;
+		cache->count--;
+		__sync_fetch_and_add (&__valvula_pool_hits[type], 1);
+
+		memset (item, 0, (header < size) ? header : size);
+		return item;
+	} /* end if */
+#endif
+
+	return axl_new (char, size);
+}
+
+/** 
+ * @brief Releases an object allocated by \ref valvula_pool_alloc (or
+ * axl_new) into the provided pool so it can be reused by next
+ * allocations.
+ *
+ * @param type The pool where the object is released.
+ *
+ * @param ptr The object to release. Function does nothing if NULL is
+ * received.
+ */
+void         valvula_pool_release  (ValvulaPoolType   type,
+				    axlPointer        ptr)
+{
+#if defined(AXL_OS_UNIX)
+	ValvulaPoolCache * cache;
+	ValvulaPoolItem  * item;
+	int                moved;
+#endif
+
+	if (ptr == NULL)
+		return;
+
+#if defined(AXL_OS_UNIX)
+	if (type < 0 || type >= VALVULA_POOL_MAX) {
+		axl_free (ptr);
+		return;
+	} /* end if */
+
+	/* objects are usually released by a thread different to
+	 * the one that allocated them, register it too */
+	__valvula_pool_register_thread ();
+
+	cache = &__valvula_pool_cache[type];
+	if (cache->count >= VALVULA_POOL_CACHE_MAX) {
+		/* move half of the cache into the depot */
+		cache->head   = __valvula_pool_to_depot (type, cache->head, VALVULA_POOL_CACHE_MAX / 2, &moved);
+		cache->count -= moved;
+	} /* end if */
+
+	item        = ptr;
+	item->next  = cache->head;
+	cache->head = item;
+	cache->count++;
+#else
+	axl_free (ptr);
+#endif
+	return;
+}
+
+/** 
+ * @brief Allows to get current stats for the provided pool.
+ *
+ * @param type The pool to report.
+ *
+ * @param allocs Optional reference to report the number of
+ * allocations done.
+ *
+ * @param hits Optional reference to report how many of those
+ * allocations were served with a recycled object.
+ *
+ * @param cached Optional reference to report the number of objects
+ * currently kept in the shared depots (thread caches not included).
+ *
+ * @return axl_true if stats were reported, otherwise axl_false is
+ * returned (pools not supported or wrong type).
+ */
+axl_bool     valvula_pool_stats    (ValvulaPoolType   type,
+				    long            * allocs,
+				    long            * hits,
+				    int             * cached)
+{
+#if defined(AXL_OS_UNIX)
+	int node;
+#endif
+
+	if (allocs)
+		(*allocs) = 0;
+	if (hits)
+		(*hits) = 0;
+	if (cached)
+		(*cached) = 0;
+
+#if defined(AXL_OS_UNIX)
+	if (type < 0 || type >= VALVULA_POOL_MAX)
+		return axl_false;
+
+	pthread_once (&__valvula_pool_once, __valvula_pool_init);
+	if (allocs)
+		(*allocs) = __sync_fetch_and_add (&__valvula_pool_allocs[type], 0);
+	if (hits)
+		(*hits)   = __sync_fetch_and_add (&__valvula_pool_hits[type], 0);
+	if (cached) {
+		for (node = 0; node < VALVULA_POOL_NODES_MAX; node++) {
+			pthread_mutex_lock (&__valvula_pool_depot[type][node].mutex);
+			(*cached) += __valvula_pool_depot[type][node].count;
+			pthread_mutex_unlock (&__valvula_pool_depot[type][node].mutex);
+		} /* end for */
+	} /* end if */
+	return axl_true;
+#else
+	return axl_false;
+#endif
+}
+
+/** 
+ * @brief Releases all objects cached by the calling thread and by
+ * the shared depots. Pools can still be used after this call.
+ *
+ * Pools are shared by all contexts in the process, so this must only
+ * be called once no other context is using them (\ref
+ * valvula_exit_ctx does it when the last initialized context
+ * finishes).
+ */
+void         valvula_pool_cleanup  (void)
+{
+#if defined(AXL_OS_UNIX)
+	ValvulaPoolDepot * depot;
+	ValvulaPoolItem  * item;
+	int                iterator;
+	int                node;
+
+	pthread_once (&__valvula_pool_once, __valvula_pool_init);
+	for (iterator = 0; iterator < VALVULA_POOL_MAX; iterator++) {
+		/* thread cache */
+		while (__valvula_pool_cache[iterator].head) {
+			item = __valvula_pool_cache[iterator].head;
+			__valvula_pool_cache[iterator].head = item->next;
+			axl_free (item);
+		} /* end while */
+		__valvula_pool_cache[iterator].count = 0;
+
+		/* depots */
+		for (node = 0; node < VALVULA_POOL_NODES_MAX; node++) {
+			depot = &__valvula_pool_depot[iterator][node];
+			pthread_mutex_lock (&depot->mutex);
+			while (depot->head) {
+				item        = depot->head;
+				depot->head = item->next;
+				axl_free (item);
+			} /* end while */
+			depot->count = 0;
+			pthread_mutex_unlock (&depot->mutex);
+		} /* end for */
+	} /* end for */
+#endif
+	return;
+}
+
+/** 
+ * @}
+ */
@@ -36,6 +36,88 @@
 #ifndef __VALVULA_PRIVATE_H__
 #define __VALVULA_PRIVATE_H__
 
+/** 
+ * @internal Amount of memory added to a connection input buffer
+ * every time it has to grow.
+ */
+#define VALVULA_READER_BUFFER_SIZE     4096
+
+/** 
+ * @internal Max amount of memory a connection input buffer can hold
+ * with content not processed yet.
+ */
+#define VALVULA_READER_BUFFER_MAX_SIZE 65536
+
+/** 
+ * @internal Max size allowed for a single request line.
+ */
+#define VALVULA_READER_LINE_SIZE       2048
+
+/** 
+ * @internal Max number of requests that can be queued (pipelined)
+ * on a single connection waiting to be processed.
+ */
+#define VALVULA_READER_MAX_PIPELINED   64
+
+/** 
+ * @internal Max time (milliseconds) a reply can wait for the socket
+ * to become writable before closing the connection.
+ */
+#define VALVULA_READER_WRITE_TIMEOUT   5000
+
+/** 
+ * @internal Max number of connections accepted from a listener on a
+ * single readiness notification.
+ */
+#define VALVULA_READER_ACCEPT_BATCH    256
+
+/** 
+ * @internal Default listen(2) backlog used by listeners (it can be
+ * changed with valvula_listener_set_backlog).
+ */
+#define VALVULA_LISTENER_DEFAULT_BACKLOG SOMAXCONN
+
+/** 
+ * @internal Number of submission entries used by io_uring fd groups.
+ */
+#define VALVULA_URING_ENTRIES          1024
+
+/** 
+ * @internal Max number of io_uring completions reaped per wait.
+ */
+#define VALVULA_URING_BATCH            256
+
+/** 
+ * @internal Max number of reader loops that can be started.
+ */
+#define VALVULA_READER_MAX_NUM         128
+
+/** 
+ * @internal Definition of a reader loop: each reader has its own
+ * thread, I/O waiting set and connections (listeners and accepted
+ * connections) it watches.
+ */
+typedef struct _ValvulaReader {
+	ValvulaCtx          * ctx;
+
+	/* reader index inside ctx->readers */
+	int                   id;
+
+	ValvulaThread         thread;
+
+	/*** queues ***/
+	ValvulaAsyncQueue   * reader_stopped;	
+	ValvulaAsyncQueue   * reader_queue;	
+
+	/*** lists ***/
+	axlList             * srv_list;
+	axlList             * conn_list;
+	axlListCursor       * srv_cursor;
+	axlListCursor       * conn_cursor;
+
+	axlPointer            on_reading;
+} ValvulaReader;
+
 /** 
  * @internal Definition of Valvula context. 
  */
@@ -66,27 +148,33 @@ struct _ValvulaCtx {
 	axlList      * request_in_process;
 
 	ValvulaHash  * process_handler_registry;
+	/* handler chains compiled for each port (see
+	 * __valvula_ctx_compile_handler_chains) and registration
+	 * counter used to order handlers with the same priority */
+	struct _ValvulaHandlerChains * handler_chains;
+	int                            handler_sequence;
+	/* threads between loading handler_chains and referencing
+	 * the table loaded */
+	int                            handler_chains_loaders;
+	/* some handler filters requests (see
+	 * valvula_ctx_set_request_handler_filter): handlers called
+	 * depend on protocol_state and request values */
+	axl_bool                       handler_filtered;
 
 	ValvulaMutex         listener_unlock;
 	ValvulaAsyncQueue  * listener_wait_lock;
 	ValvulaMutex         listener_mutex;
 
-	/*** queues ***/
-	ValvulaAsyncQueue * reader_stopped;	
-	ValvulaAsyncQueue * reader_queue;	
-
 	ValvulaMutex        connection_hostname_mutex;
 	axlHash           * connection_hostname;
 
-	/*** lists ***/
-	axlList           * srv_list;
-	axlList           * conn_list;
-	axlListCursor     * srv_cursor;
-	axlListCursor     * conn_cursor;
-
-	axlPointer          on_reading;
-
-	ValvulaThread       reader_thread;
+	/*** reader loops ***/
+	ValvulaReader     * readers[VALVULA_READER_MAX_NUM];
+	int                 readers_num;
+	int                 readers_next;
+	ValvulaMutex        readers_mutex;
+	/* CPUs where reader loops are pinned (one per loop) */
+	char              * readers_cpus;
 	axl_bool            skip_reader_stop;
 
 	/**** valvula io waiting module state ****/
@@ -96,9 +184,12 @@ struct _ValvulaCtx {
 	ValvulaIoClearFdGroup   waiting_clear;
 	ValvulaIoWaitOnFdGroup  waiting_wait_on;
 	ValvulaIoAddToFdGroup   waiting_add_to;
+	ValvulaIoRemoveFromFdGroup waiting_remove_from;
 	ValvulaIoIsSetFdGroup   waiting_is_set;
 	ValvulaIoHaveDispatch   waiting_have_dispatch;
 	ValvulaIoDispatch       waiting_dispatch;
+	/* register sockets in edge-triggered mode (epoll) */
+	axl_bool                waiting_edge_triggered;
 
 	/*** thread pool ***/
 	ValvulaThreadPool       * thread_pool;
@@ -112,11 +203,33 @@ struct _ValvulaCtx {
 
 	int                       request_line_limit;
 
+	/*** request deadlines: budget configured for each port ***/
+	ValvulaHash             * deadlines;
+	/* chains being processed with a deadline, checked by the
+	 * deadline watchdog: a one shot event armed for the earliest
+	 * deadline (generation of the event armed and when it fires,
+	 * tv_sec == 0 if none is armed) */
+	struct _ValvulaReaderChain * deadline_chains;
+	int                       deadline_timer;
+	struct timeval            deadline_armed;
+	ValvulaMutex              deadline_mutex;
+	/* signaled once the watchdog sent an expired reply */
+	ValvulaCond               deadline_cond;
+
+	/*** verdict cache (see valvula_cache_setup) ***/
+	struct _ValvulaCache    * verdict_cache;
+
 	/*** processing stats ***/
 	long                      avg_processing;
 	long                      max_processing;
 	long                      min_processing;
 	int                       requests_handled;
+	/* requests replied because their deadline was reached */
+	long                      requests_expired;
+	/* requests resolved by the handler chain and microseconds
+	 * spent (avg_processing = total / count) */
+	long                      processing_count;
+	long long                 processing_total;
 	ValvulaMutex              stats_mutex;
 
 	/*** log handling ****/
@@ -140,6 +253,9 @@ struct _ValvulaConnection {
 
 	char          * host;
 	char          * port;
+	/* numeric port (master listeners), converted once so it is
+	 * not parsed for every request */
+	int             port_number;
 	char          * host_ip;
 	char          * local_addr;
 	char          * local_port;
@@ -148,11 +264,47 @@ struct _ValvulaConnection {
 	
 	ValvulaConnection * listener;
 
-	char              * pending_line;
+	/* file system path for AF_UNIX master listeners (NULL for
+	 * TCP listeners) */
+	char              * unix_path;
+
+	/* master listeners: enable TCP_NODELAY on accepted sockets */
+	axl_bool            tcp_nodelay;
+
+	/* reader loop watching this connection */
+	ValvulaReader     * reader;
 
+	/* listener sockets bound to the same address on other reader
+	 * loops (SO_REUSEPORT), only for master listeners */
+	axlList           * shards;
+
+	/* input buffer: content between buffer_start and
+	 * buffer_length is pending to be processed */
+	char              * buffer;
+	int                 buffer_size;
+	int                 buffer_length;
+	int                 buffer_start;
+
+	/* output buffer: reply content not written yet (partial
+	 * writes) */
+	char              * out_buffer;
+	int                 out_size;
+	int                 out_length;
+
+	/* request being built by the reader (only accessed by the
+	 * reader loop) */
 	ValvulaRequest    * request;
+
+	/* fully parsed requests waiting to be processed, in the order
+	 * received (protected by op_mutex). process_launched signals
+	 * a worker is already draining this queue */
+	axlList           * pending_requests;
 	axl_bool            process_launched;
 
+	/* flag to signal this connection is registered into the
+	 * reader fd group (persistent registration mode) */
+	axl_bool            watched;
+
 	int                 lines_found;
 };
 
@@ -180,15 +332,217 @@ struct _ValvulaRequestRegistry {
 	int                       priority;
 	int                       port;
 	axlPointer                user_data;
+	/* registration order (tie break for equal priorities) */
+	int                       sequence;
+
+	/* handler never blocks (no I/O, no locks held for long), it
+	 * can be called directly from the reader thread */
+	axl_bool                  non_blocking;
+
+	/* handler can be evaluated concurrently with other parallel
+	 * handlers registered with the same priority */
+	axl_bool                  parallel;
+
+	/* handler can be reordered among handlers sharing priority
+	 * according to its measured cost (never when parallel) */
+	axl_bool                  adaptive;
+
+	/* seconds verdicts resolved by the handler can be cached (0:
+	 * not cacheable) */
+	long                      cache_ttl;
+
+	/* protocol_state values the handler is called for (mask of
+	 * __valvula_reader_protocol_state values, 0: all) and request
+	 * value (NULL: all) */
+	int                       protocol_states;
+	char                    * request_filter;
 
 	/*** processing stats ***/
 	long                      avg_processing;
 	long                      max_processing;
 	long                      min_processing;
 	int                       requests_handled;
+	/* calls with a state distinct from DUNNO and microseconds
+	 * spent (avg_processing = total / requests_handled) */
+	int                       requests_decided;
+	long long                 processing_total;
+
+	/* stats since handlers were last reordered and cost used to
+	 * order handlers sharing priority (see
+	 * valvula_ctx_reorder_request_handlers) */
+	int                       window_handled;
+	int                       window_decided;
+	long long                 window_total;
+	double                    rank;
 	ValvulaMutex              stats_mutex;
 };
 
+/** 
+ * @internal Handlers selected for a port, sorted by priority.
+ */
+typedef struct _ValvulaHandlerChain {
+	int                        port;
+	int                        length;
+	ValvulaRequestRegistry  ** handlers;
+	/* number of handlers evaluated concurrently starting at
+	 * each position (1: called alone) */
+	int                      * groups;
+	/* filters of each handler (copied from the registry when
+	 * the table was compiled) */
+	int                      * protocol_states;
+	char                    ** request_filters;
+	/* all handlers can be called from the reader thread */
+	axl_bool                   non_blocking;
+	/* table holding this chain */
+	struct _ValvulaHandlerChains * table;
+} ValvulaHandlerChain;
+
+/** 
+ * @internal Handler chains compiled for all ports. Once published
+ * (ValvulaCtx.handler_chains) a table is never modified, so it is
+ * walked without locks. Replaced tables are linked into retired and
+ * released once no thread can be loading them (quiescent) and no
+ * thread references them (refs).
+ */
+typedef struct _ValvulaHandlerChains {
+	int                             length;
+	ValvulaHandlerChain           * chains;
+	/* all handlers, sorted by port and priority (chains point
+	 * into these arrays) */
+	ValvulaRequestRegistry       ** handlers;
+	int                           * groups;
+	int                           * protocol_states;
+	char                         ** request_filters;
+	/* threads walking the table and whether it was seen
+	 * quiescent after being replaced */
+	int                             refs;
+	axl_bool                        quiescent;
+	struct _ValvulaHandlerChains  * retired;
+} ValvulaHandlerChains;
+
+ValvulaHandlerChains * __valvula_ctx_acquire_handler_chains (ValvulaCtx * ctx);
+
+void                   __valvula_ctx_release_handler_chains (ValvulaHandlerChains * chains);
+
+ValvulaHandlerChain * __valvula_ctx_acquire_handler_chain (ValvulaCtx * ctx, int port);
+
+void                  __valvula_ctx_release_handler_chain (ValvulaHandlerChain * chain);
+
+int                   __valvula_reader_protocol_state (const char * value);
+
+/** 
+ * @internal Progress of the handler chain processing a request. It
+ * is kept while a handler completes the request asynchronously (see
+ * valvula_request_complete).
+ */
+typedef struct _ValvulaReaderChain {
+	ValvulaConnection       * connection;
+	ValvulaRequest          * request;
+	int                       listener_port;
+
+	/* handlers for the port and position of the next one */
+	ValvulaHandlerChain     * handlers;
+	int                       next;
+
+	/* request protocol_state and request values used to skip
+	 * handlers filtering them */
+	int                       protocol_state;
+	const char              * request_name;
+
+	/* handler being executed */
+	ValvulaRequestRegistry  * registry;
+	axlPointer                record_id;
+
+	/* chain and handler start */
+	struct timeval            start;
+	struct timeval            start_m;
+
+	/* request budget */
+	axl_bool                  has_deadline;
+	ValvulaState              expired_state;
+
+	/* who replied the request (VALVULA_READER_REPLY_*) and links
+	 * on ctx->deadline_chains */
+	int                       replied;
+	struct _ValvulaReaderChain * deadline_prev;
+	struct _ValvulaReaderChain * deadline_next;
+
+	/* lowest cache ttl of handlers called (-1 if none yet) */
+	long                      cache_ttl;
+
+	/* handler call phase and result reported by
+	 * valvula_request_complete */
+	int                       phase;
+	int                       completed;
+	ValvulaState              state;
+	char                    * message;
+} ValvulaReaderChain;
+
+/** 
+ * @internal Verdict stored by the verdict cache.
+ */
+typedef struct _ValvulaCacheEntry {
+	char                    * key;
+	ValvulaState              state;
+	char                    * message;
+	long                      expires;
+	/* used since the CLOCK hand passed over it */
+	axl_bool                  referenced;
+} ValvulaCacheEntry;
+
+typedef struct _ValvulaCache {
+	ValvulaMutex              mutex;
+	/* key -> entry */
+	axlHash                 * index;
+	/* CLOCK ring: size entries, used ones and hand position */
+	ValvulaCacheEntry       * entries;
+	int                       size;
+	int                       used;
+	int                       hand;
+	/* request fields used as key */
+	char                   ** fields;
+	long                      hits;
+	long                      misses;
+} ValvulaCache;
+
+typedef struct _ValvulaReaderFanOut ValvulaReaderFanOut;
+
+/** 
+ * @internal Handler of a parallel group and the state it reported.
+ */
+typedef struct _ValvulaReaderBranch {
+	ValvulaReaderFanOut     * fan_out;
+	ValvulaRequestRegistry  * registry;
+	axl_bool                  done;
+	ValvulaState              state;
+	char                    * message;
+} ValvulaReaderBranch;
+
+/** 
+ * @internal Parallel group of handlers being evaluated concurrently
+ * for a request. Released by the last branch finished.
+ */
+struct _ValvulaReaderFanOut {
+	ValvulaRequest          * request;
+	ValvulaConnection       * connection;
+	ValvulaMutex              mutex;
+	int                       length;
+	int                       finished;
+	/* group outcome known: branches not started are skipped */
+	axl_bool                  decided;
+	/* request has a budget (copied from the chain: branches
+	 * never touch the chain, the decisive one releases it) */
+	axl_bool                  has_deadline;
+	ValvulaReaderBranch     * branches;
+};
+
+typedef struct _ValvulaRequestBudget {
+	/* milliseconds */
+	long                      budget;
+	/* state replied once the budget is spent */
+	ValvulaState              state;
+} ValvulaRequestBudget;
+
 typedef struct _ValvulaReaderProcess  {
 	const char     * handler_name;
 	ValvulaRequest * request;
@@ -38,6 +38,13 @@
 /* local/private includes */
 #include <valvula_private.h>
 
+/* vector byte scan used to validate request values */
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 #define LOG_DOMAIN "valvula-reader"
 
 /**
@@ -65,16 +72,22 @@ typedef struct _ValvulaReaderData {
 	ValvulaAsyncQueue   * notify;
 }ValvulaReaderData;
 
+VALVULA_SOCKET   __valvula_reader_build_set_to_watch (ValvulaCtx     * ctx,
+						    axlPointer      on_reading, 
+						    axlListCursor * conn_cursor, 
+						    axlListCursor * srv_cursor);
+
+void __valvula_reader_watch_listener_on (ValvulaCtx        * ctx,
+					 ValvulaConnection * listener,
+					 int                 reader_id);
+
 /**
- * @brief Read the next line, byte by byte until it gets a \n or
- * maxlen is reached. Some code errors are used to manage exceptions
- * (see return values)
+ * @internal Reads into the connection input buffer as much content
+ * as is available, with a single recv () call, growing the buffer
+ * when required. Content already consumed by the parser is discarded
+ * (moving pending content to the start of the buffer) before reading.
  * 
  * @param connection The connection where the read operation will be done.
- *
- * @param buffer A buffer to store content read from the network.
- *
- * @param maxlen max content to read from the network.
  * 
  * @return  values returned by this function follows:
  *  0 - remote peer have closed the connection
@@ -83,11 +96,11 @@ typedef struct _ValvulaReaderData {
  *  n - some data was read.
  * 
  **/
-int          valvula_readline (ValvulaConnection * connection, char  * buffer, int  maxlen)
+int          valvula_reader_fill_buffer (ValvulaConnection * connection)
 {
-	int         n, rc;
-	int         desp;
-	char        c, *ptr;
+	int         rc;
+	int         pending;
+	char      * temp;
 #if defined(ENABLE_VALVULA_LOG)
 	char      * error_msg;
 #endif
@@ -99,126 +112,399 @@ int          valvula_readline (ValvulaConnection * connection, char  * buffer, i
 	if (connection->session == -1)
 		return -1;
 
-	/* clear the buffer received */
-	/* memset (buffer, 0, maxlen * sizeof (char ));  */
+	/* discard content already consumed */
+	pending = connection->buffer_length - connection->buffer_start;
+	if (connection->buffer_start > 0) {
+		if (pending > 0)
+			memmove (connection->buffer, connection->buffer + connection->buffer_start, pending);
+		connection->buffer_start  = 0;
+		connection->buffer_length = pending;
+	} /* end if */
 
-	/* check for pending line read */
-	desp         = 0;
-	if (connection->pending_line) {
-		/* get size and check exceeded values */
-		desp = strlen (connection->pending_line);
-		if (desp >= maxlen) {
+	/* check if we have to grow the buffer (always leaving space
+	 * for a trailing \0) */
+	if (connection->buffer == NULL || (connection->buffer_size - connection->buffer_length) < (VALVULA_READER_BUFFER_SIZE / 4)) {
+		if ((connection->buffer_size + VALVULA_READER_BUFFER_SIZE) > VALVULA_READER_BUFFER_MAX_SIZE) {
+			valvula_log (VALVULA_LEVEL_CRITICAL, "found too much content pending to be processed (%d bytes) on socket=%d, closing connection",
+				     connection->buffer_length, connection->session);
 			valvula_connection_close (connection);
-			valvula_log (VALVULA_LEVEL_CRITICAL, "found fragmented frame line header but allowed size was exceeded (desp:%d >= maxlen:%d)",
-				     desp, maxlen);
 			return -1;
 		} /* end if */
 
-		/* now store content into the buffer */
-		memcpy (buffer, connection->pending_line, desp);
+		temp = axl_realloc (connection->buffer, connection->buffer_size + VALVULA_READER_BUFFER_SIZE);
+		if (temp == NULL) {
+			valvula_log (VALVULA_LEVEL_CRITICAL, "unable to allocate memory to hold connection content, closing connection");
+			valvula_connection_close (connection);
+			return -1;
+		} /* end if */
+		connection->buffer       = temp;
+		connection->buffer_size += VALVULA_READER_BUFFER_SIZE;
+	} /* end if */
 
-		/* clear from the connection the line */
-		axl_free (connection->pending_line);
-		connection->pending_line = NULL;
-	}
+ __valvula_reader_fill_buffer_again:
+	rc = recv (connection->session, connection->buffer + connection->buffer_length, 
+		   connection->buffer_size - connection->buffer_length - 1, 0);
+	if (rc > 0) {
+		connection->buffer_length += rc;
+		connection->buffer[connection->buffer_length] = 0;
+		return rc;
+	} /* end if */
 
+	if (rc == 0)
+		return 0;
 
-	/* read current next line */
-	ptr = (buffer + desp);
-	for (n = 1; n < (maxlen - desp); n++) {
-	__valvula_frame_readline_again:
-		if (( rc = recv (connection->session, &c, 1, 0)) == 1) {
-			*ptr++ = c;
-			if (c == '\x0A')
-				break;
-		}else if (rc == 0) {
-			if (n == 1)
-				return 0;
-			else
-				break;
-		} else {
-			if (errno == VALVULA_EINTR) 
-				goto __valvula_frame_readline_again;
-			if ((errno == VALVULA_EWOULDBLOCK) || (errno == VALVULA_EAGAIN) || (rc == -2)) {
-				if (n > 0) {
-					/* store content read until now */
-					if ((n + desp - 1) > 0) {
-						buffer[n+desp - 1] = 0;
-						/* valvula_log (VALVULA_LEVEL_WARNING, "storing partially line read: '%s' n:%d, desp:%d", buffer, n, desp);*/
-						connection->pending_line = axl_strdup (buffer);
-					} /* end if */
-				} /* end if */
-				return (-2);
-			}
+	if (errno == VALVULA_EINTR) 
+		goto __valvula_reader_fill_buffer_again;
+	if ((errno == VALVULA_EWOULDBLOCK) || (errno == VALVULA_EAGAIN))
+		return (-2);
 			
 #if defined(ENABLE_VALVULA_LOG)
-			/* if the connection is closed, just return
-			 * without logging a message */
-			if (valvula_connection_is_ok (connection) && ! connection->process_launched) {
-				error_msg = strerror (errno);
-				valvula_log (VALVULA_LEVEL_CRITICAL, "unable to read a line from conn-id (socket %d, rc %d), error was: %s",
-					     valvula_connection_get_socket (connection), rc,
-					     error_msg ? error_msg : "");
-			} /* end if */
+	/* if the connection is closed, just return without logging a
+	 * message */
+	if (valvula_connection_is_ok (connection) && ! connection->process_launched) {
+		error_msg = strerror (errno);
+		valvula_log (VALVULA_LEVEL_CRITICAL, "unable to read from conn-id (socket %d, rc %d), error was: %s",
+			     valvula_connection_get_socket (connection), rc,
+			     error_msg ? error_msg : "");
+	} /* end if */
+#endif
+	return (-1);
+}
+
+/**
+ * @internal Gets the next complete line found inside the connection
+ * input buffer. The line returned is a reference inside the buffer
+ * (ending \n replaced by \0) that is only valid until the next call
+ * to \ref valvula_reader_fill_buffer.
+ *
+ * @param connection The connection where the line is read.
+ *
+ * @param maxlen Max line size allowed. 
+ *
+ * @return A reference to the next line or NULL if no complete line is
+ * available yet. In the case the line found is bigger than maxlen,
+ * the connection is closed and NULL is returned.
+ */
+char       * valvula_reader_next_line (ValvulaConnection * connection, int maxlen)
+{
+	char       * line;
+	char       * end;
+	int          pending;
+#if defined(ENABLE_VALVULA_LOG) && ! defined(SHOW_FORMAT_BUGS)
+	ValvulaCtx * ctx = valvula_connection_get_ctx (connection);
 #endif
-			return (-1);
+
+	pending = connection->buffer_length - connection->buffer_start;
+	if (pending <= 0)
+		return NULL;
+
+	line = connection->buffer + connection->buffer_start;
+	end  = memchr (line, '\n', pending);
+	if (end == NULL) {
+		/* line not complete yet, check limits */
+		if (pending >= maxlen) {
+			valvula_connection_close (connection);
+			valvula_log (VALVULA_LEVEL_CRITICAL, "found fragmented line but allowed size was exceeded (pending:%d >= maxlen:%d)",
+				     pending, maxlen);
 		} /* end if */
-	} /* end for */
+		return NULL;
+	} /* end if */
+
+	if ((end - line) >= maxlen) {
+		valvula_connection_close (connection);
+		valvula_log (VALVULA_LEVEL_CRITICAL, "found line but allowed size was exceeded (size:%d >= maxlen:%d)",
+			     (int) (end - line), maxlen);
+		return NULL;
+	} /* end if */
 
-	*ptr = 0;
-	return (n + desp);
+	/* terminate line and flag it as consumed */
+	(*end) = 0;
+	connection->buffer_start += (end - line) + 1;
 
+	return line;
 }
 
-axl_bool __valvula_reader_find_next_registry (axlPointer key, axlPointer data, axlPointer user_data, axlPointer user_data2, axlPointer user_data3)
+/**
+ * @brief Read the next line available on the provided connection
+ * until it gets a \n or maxlen is reached.
+ *
+ * This function is kept for API compatibility: it is now
+ * implemented on top of the connection input buffer (see \ref
+ * valvula_reader_fill_buffer and \ref valvula_reader_next_line) so
+ * it can be mixed with content already buffered by the reader. As
+ * before, the line stored into the buffer includes the trailing \n.
+ * 
+ * @param connection The connection where the read operation will be done.
+ *
+ * @param buffer A buffer to store content read from the network.
+ *
+ * @param maxlen max content to read from the network.
+ * 
+ * @return  values returned by this function follows:
+ *  0 - remote peer have closed the connection
+ * -1 - an error have happened while reading
+ * -2 - could read because this connection is on non-blocking mode and there is no data.
+ *  n - some data was read.
+ * 
+ **/
+int          valvula_readline (ValvulaConnection * connection, char  * buffer, int  maxlen)
 {
-	ValvulaRequestRegistry  * current  = user_data;
-	ValvulaRequestRegistry ** next     = user_data2;
-	int                       port     = PTR_TO_INT (user_data3);
+	char * line;
+	int    length;
+	int    rc;
+
+	if (connection == NULL || buffer == NULL || maxlen < 2)
+		return -1;
+
+	while (axl_true) {
+		/* check for a line already buffered (leaving space for
+		 * the trailing \n and \0) */
+		line = valvula_reader_next_line (connection, maxlen - 1);
+		if (line) {
+			length = strlen (line);
+			memcpy (buffer, line, length);
+			buffer[length]     = '\n';
+			buffer[length + 1] = 0;
+			return length + 1;
+		} /* end if */
+
+		/* next_line closes the connection when the limit is
+		 * exceeded */
+		if (! valvula_connection_is_ok (connection))
+			return -1;
 
-	if (port > 0 && current->port != port)
-		return axl_false; /* port doesn't match so we cannot use this for this policy */
+		rc = valvula_reader_fill_buffer (connection);
+		if (rc == 0 && (connection->buffer_length - connection->buffer_start) > 0) {
+			/* remote peer closed: report content read so far */
+			length = connection->buffer_length - connection->buffer_start;
+			if (length >= maxlen)
+				length = maxlen - 1;
+			memcpy (buffer, connection->buffer + connection->buffer_start, length);
+			buffer[length]           = 0;
+			connection->buffer_start = connection->buffer_length;
+			return length;
+		} /* end if */
+		if (rc <= 0)
+			return rc;
+	} /* end while */
+
+	return -1;
+}
 
-	if (current == (*next)) 
-		return axl_false; /* skip same value */
+/** 
+ * @internal Preformatted reply for a given state: action name (to be
+ * used when a message must be appended) and the complete bare reply
+ * (used when there is no message) with their lengths.
+ */
+typedef struct _ValvulaReaderReply {
+	const char * action;
+	int          action_len;
+	const char * bare;
+	int          bare_len;
+} ValvulaReaderReply;
+
+#define VALVULA_READER_REPLY(a) { a, sizeof (a) - 1, "action=" a "\n\n", sizeof ("action=" a "\n\n") - 1 }
+#define VALVULA_READER_NO_REPLY { NULL, 0, NULL, 0 }
+
+/* replies indexed by ValvulaState */
+static const ValvulaReaderReply __valvula_reader_replies[] = {
+	VALVULA_READER_REPLY ("ok"),              /* VALVULA_STATE_OK */
+	VALVULA_READER_REPLY ("dunno"),           /* VALVULA_STATE_DUNNO */
+	VALVULA_READER_REPLY ("reject"),          /* VALVULA_STATE_REJECT */
+	VALVULA_READER_REPLY ("defer_if_permit"), /* VALVULA_STATE_DEFER_IF_PERMIT */
+	VALVULA_READER_REPLY ("defer_if_reject"), /* VALVULA_STATE_DEFER_IF_REJECT */
+	VALVULA_READER_REPLY ("defer"),           /* VALVULA_STATE_DEFER */
+	VALVULA_READER_NO_REPLY,                  /* VALVULA_STATE_BCC */
+	VALVULA_READER_REPLY ("discard"),         /* VALVULA_STATE_DISCARD */
+	VALVULA_READER_NO_REPLY,                  /* VALVULA_STATE_HOLD */
+	VALVULA_READER_NO_REPLY,                  /* VALVULA_STATE_PREPEND */
+	VALVULA_READER_NO_REPLY,                  /* VALVULA_STATE_REDIRECT */
+	VALVULA_READER_NO_REPLY,                  /* VALVULA_STATE_LOG */
+	VALVULA_READER_NO_REPLY,                  /* VALVULA_STATE_GENERIC_ERROR */
+	VALVULA_READER_REPLY ("filter")           /* VALVULA_STATE_FILTER */
+};
+
+/** 
+ * @internal Waits until the connection socket is writable or the
+ * provided timeout (milliseconds) expires.
+ *
+ * @return axl_true if the socket is writable.
+ */
+axl_bool __valvula_reader_wait_writable (ValvulaConnection * connection, int timeout)
+{
+#if defined(VALVULA_HAVE_POLL)
+	struct pollfd     pfd;
+	int               rc;
 
-	/* check if the current handler has a lower priority than
-	   current selected (next). NOTE: (*next) always must point to the latest policy selected */
-	if (current->priority < (*next)->priority)
-		(*next) = current;
+	pfd.fd      = connection->session;
+	pfd.events  = POLLOUT;
+	pfd.revents = 0;
+	do {
+		rc = poll (&pfd, 1, timeout);
+	} while (rc < 0 && errno == VALVULA_EINTR);
+
+	return rc > 0 && (pfd.revents & POLLOUT);
+#else
+	fd_set            wset;
+	struct timeval    tv;
+	int               rc;
+
+	FD_ZERO (&wset);
+	FD_SET (connection->session, &wset);
+	tv.tv_sec  = timeout / 1000;
+	tv.tv_usec = (timeout % 1000) * 1000;
+	do {
+		rc = select (connection->session + 1, NULL, &wset, NULL, &tv);
+	} while (rc < 0 && errno == VALVULA_EINTR);
 
-	return axl_false; /* dont stop iterating */
+	return rc > 0;
+#endif
 }
 
-void __valvula_reader_send (ValvulaConnection * connection, ValvulaRequest * request, const char * _status, const char * _message)
+/** 
+ * @internal Writes all content pending in the connection output
+ * buffer, waiting for the socket to be writable if required.
+ *
+ * @return axl_true if all pending content was written, otherwise
+ * axl_false is returned and the connection is closed.
+ */
+axl_bool __valvula_reader_flush_output (ValvulaConnection * connection)
 {
 	ValvulaCtx * ctx = connection->ctx;
-	int          bytes_written;
-	char       * message;
-
-	/* build message */
-	if (_message)
-		message = axl_strdup_printf ("action=%s %s\n\n", _status, _message);
-	else if (request->message_reply)
-		message = axl_strdup_printf ("action=%s %s\n\n", _status, request->message_reply);
-	else
-		message = axl_strdup_printf ("action=%s\n\n", _status);
-
-	/* send content and catch bytes written */
-	bytes_written = send (connection->session, message, strlen (message), 0);
-
-	/* check result */
-	if (bytes_written != strlen (message)) {
-		valvula_log (VALVULA_LEVEL_CRITICAL, "Failed to send message %s, reported bytes written %d but expected %d",
-			     message, bytes_written, strlen (message));
-	} else {
-		valvula_log (VALVULA_LEVEL_DEBUG, "Sending reply '%s' over session=%d (%p)",
-			     message, connection->session, connection);
+	int          written;
+
+	while (connection->out_length > 0) {
+		written = send (connection->session, connection->out_buffer, connection->out_length, 0);
+		if (written > 0) {
+			/* move pending content to the beginning */
+			connection->out_length -= written;
+			if (connection->out_length > 0)
+				memmove (connection->out_buffer, connection->out_buffer + written, connection->out_length);
+			continue;
+		} /* end if */
+
+		if (written < 0 && errno == VALVULA_EINTR)
+			continue;
+
+		if (written < 0 && (errno == VALVULA_EWOULDBLOCK || errno == VALVULA_EAGAIN)) {
+			if (__valvula_reader_wait_writable (connection, VALVULA_READER_WRITE_TIMEOUT))
+				continue;
+			valvula_log (VALVULA_LEVEL_CRITICAL, "Timeout while sending reply (%d bytes pending) over session=%d (%p), closing connection",
+				     connection->out_length, connection->session, connection);
+		} else {
+			valvula_log (VALVULA_LEVEL_CRITICAL, "Failed to send reply (%d bytes pending) over session=%d (%p), errno=%d, closing connection",
+				     connection->out_length, connection->session, connection, errno);
+		} /* end if */
+
+		connection->out_length = 0;
+		valvula_connection_close (connection);
+		return axl_false;
+	} /* end while */
+
+	return axl_true;
+}
+
+/** 
+ * @internal Writes the provided vector of buffers into the
+ * connection. Content not written (partial write) is kept on the
+ * connection output buffer until it can be flushed.
+ */
+axl_bool __valvula_reader_writev (ValvulaConnection * connection, struct iovec * iov, int iovcnt)
+{
+	ValvulaCtx * ctx     = connection->ctx;
+	int          written = 0;
+	int          total   = 0;
+	int          pending;
+	int          iterator;
+	int          skip;
+	char       * temp;
+
+	/* write previous content first to keep replies order */
+	if (connection->out_length > 0 && ! __valvula_reader_flush_output (connection))
+		return axl_false;
+
+	for (iterator = 0; iterator < iovcnt; iterator++)
+		total += iov[iterator].iov_len;
+
+	do {
+		written = writev (connection->session, iov, iovcnt);
+	} while (written < 0 && errno == VALVULA_EINTR);
+
+	if (written == total)
+		return axl_true;
+
+	if (written < 0) {
+		if (errno != VALVULA_EWOULDBLOCK && errno != VALVULA_EAGAIN) {
+			valvula_log (VALVULA_LEVEL_CRITICAL, "Failed to send reply over session=%d (%p), errno=%d, closing connection",
+				     connection->session, connection, errno);
+			valvula_connection_close (connection);
+			return axl_false;
+		} /* end if */
+		written = 0;
 	} /* end if */
 
-	/* release message */
-	axl_free (message);
+	/* partial write: keep content not written */
+	pending = total - written;
+	if (connection->out_size < pending) {
+		temp = axl_realloc (connection->out_buffer, pending);
+		if (temp == NULL) {
+			valvula_log (VALVULA_LEVEL_CRITICAL, "unable to allocate memory to hold reply, closing connection");
+			valvula_connection_close (connection);
+			return axl_false;
+		} /* end if */
+		connection->out_buffer = temp;
+		connection->out_size   = pending;
+	} /* end if */
+
+	skip = written;
+	for (iterator = 0; iterator < iovcnt; iterator++) {
+		if (skip >= (int) iov[iterator].iov_len) {
+			skip -= iov[iterator].iov_len;
+			continue;
+		} /* end if */
+		memcpy (connection->out_buffer + connection->out_length, 
+			((char *) iov[iterator].iov_base) + skip, iov[iterator].iov_len - skip);
+		connection->out_length += iov[iterator].iov_len - skip;
+		skip = 0;
+	} /* end for */
+
+	valvula_log (VALVULA_LEVEL_DEBUG, "Partial write (%d of %d bytes) over session=%d (%p), flushing pending content",
+		     written, total, connection->session, connection);
+
+	return __valvula_reader_flush_output (connection);
+}
+
+void __valvula_reader_send (ValvulaConnection * connection, ValvulaRequest * request, const ValvulaReaderReply * reply, const char * _message)
+{
+	ValvulaCtx   * ctx     = connection->ctx;
+	const char   * message = _message ? _message : request->message_reply;
+	struct iovec   iov[5];
+
+	if (message == NULL) {
+		/* bare reply, already formatted */
+		iov[0].iov_base = (char *) reply->bare;
+		iov[0].iov_len  = reply->bare_len;
+		if (__valvula_reader_writev (connection, iov, 1))
+			valvula_log (VALVULA_LEVEL_DEBUG, "Sending reply 'action=%s' over session=%d (%p)",
+				     reply->action, connection->session, connection);
+		return;
+	} /* end if */
 
+	/* action=<status> <message>\n\n */
+	iov[0].iov_base = "action=";
+	iov[0].iov_len  = 7;
+	iov[1].iov_base = (char *) reply->action;
+	iov[1].iov_len  = reply->action_len;
+	iov[2].iov_base = " ";
+	iov[2].iov_len  = 1;
+	iov[3].iov_base = (char *) message;
+	iov[3].iov_len  = strlen (message);
+	iov[4].iov_base = "\n\n";
+	iov[4].iov_len  = 2;
+
+	if (__valvula_reader_writev (connection, iov, 5))
+		valvula_log (VALVULA_LEVEL_DEBUG, "Sending reply 'action=%s %s' over session=%d (%p)",
+			     reply->action, message, connection->session, connection);
 	return;
 }
 
@@ -237,97 +523,85 @@ void __valvula_reader_send_reply (ValvulaCtx        * ctx,
 	if (ctx->report_final_state)
 		ctx->report_final_state (ctx, connection, request, state, message, ctx->report_final_state_user_data);
 
-	switch (state) {
-	case VALVULA_STATE_OK:
-		__valvula_reader_send (connection, request, "ok", message);
-		break;
-	case VALVULA_STATE_DUNNO:
-		__valvula_reader_send (connection, request, "dunno", message);
-		break;
-	case VALVULA_STATE_REJECT:
-		__valvula_reader_send (connection, request, "reject", message);
-		break;
-	case VALVULA_STATE_DEFER_IF_PERMIT:
-		__valvula_reader_send (connection, request, "defer_if_permit", message);
-		break;
-	case VALVULA_STATE_DEFER_IF_REJECT:
-		__valvula_reader_send (connection, request, "defer_is_reject", message);
-		break;
-	case VALVULA_STATE_DEFER:
-		__valvula_reader_send (connection, request, "defer", message);
-		break;
-	case VALVULA_STATE_BCC:
-		break;
-	case VALVULA_STATE_DISCARD:
-		__valvula_reader_send (connection, request, "discard", message);
-		break;
-	case VALVULA_STATE_REDIRECT:
-		break;
-	case VALVULA_STATE_LOG:
-		break;
-	case VALVULA_STATE_HOLD:
-		break;
-	case VALVULA_STATE_PREPEND:
-		break;
-	case VALVULA_STATE_GENERIC_ERROR:
-		break;
-	case VALVULA_STATE_FILTER:
-		__valvula_reader_send (connection, request, "filter", message);
-		break;
-	/* do not place here a default; we want an error here when some case is not handled */
-	} /* end if */
+	/* states without reply (BCC, HOLD, PREPEND, REDIRECT, LOG
+	 * and GENERIC_ERROR) are not reported */
+	if (state < VALVULA_STATE_OK || state > VALVULA_STATE_FILTER || __valvula_reader_replies[state].action == NULL)
+		return;
 
-	/* flag the connection as process finished */
-	/* DO NOT UNCOMMENT THE FOLLOWING CODE: this is for handle
-	   procesing a request for each connection it is showed to
-	   work better */
-	/* connection->process_launched = axl_false; */
-	
+	__valvula_reader_send (connection, request, &__valvula_reader_replies[state], message);
+
+	/* NOTE: process_launched is cleared by
+	 * valvula_reader_process_request_proxy once all requests
+	 * queued on this connection are replied */
 
 	return;
 }
 
-axl_bool __valvula_reader_find_next_handler_in_list (axlPointer _element, axlPointer data)
-{
-        return _element == data;
-}
+/** 
+ * @internal protocol_state values sent by Postfix. Each one is
+ * identified by the bit of its position.
+ */
+static const char * __valvula_reader_protocol_states[] = {
+	"CONNECT", "EHLO", "HELO", "MAIL", "RCPT", "DATA", "END-OF-MESSAGE", "VRFY", "ETRN", NULL
+};
 
-ValvulaRequestRegistry * __valvula_reader_find_next_handler (ValvulaCtx * ctx, axlHashCursor * cursor, int listener_port, axlList * selected )
+/** 
+ * @internal Returns the bit that identifies the provided
+ * protocol_state value or 0 if it is not known.
+ */
+int __valvula_reader_protocol_state (const char * value)
 {
+	int iterator;
 
-	ValvulaRequestRegistry * next;
-	ValvulaRequestRegistry * registry = NULL;
+	if (value == NULL)
+		return 0;
 
-	/* reset cursor */
-	axl_hash_cursor_first (cursor);
-	while (axl_hash_cursor_has_item (cursor)) {
-		/* get value */
-		next = axl_hash_cursor_get_value (cursor);
-		if (next == NULL)
-			break;
+	for (iterator = 0; __valvula_reader_protocol_states[iterator]; iterator++) {
+		if (axl_casecmp (value, __valvula_reader_protocol_states[iterator]))
+			return 1 << iterator;
+	} /* end for */
 
-		/* ensure next is not already selected */
-		if (axl_list_lookup (selected, __valvula_reader_find_next_handler_in_list, next)) {
-		        /* go to the next position */
-		        axl_hash_cursor_next (cursor);
+	return 0;
+}
 
-		        continue;
-		} /* end if */
+/** 
+ * @internal Checks the filter declared by the handler found at the
+ * provided chain position (see \ref
+ * valvula_ctx_set_request_handler_filter, copied into the chain when
+ * it was compiled) against the request protocol_state and request
+ * values.
+ */
+axl_bool __valvula_reader_handler_applies (ValvulaHandlerChain * handlers, int position, int protocol_state, const char * request_name)
+{
+	int          protocol_states = handlers->protocol_states[position];
+	const char * request_filter  = handlers->request_filters[position];
 
-		/* check port to match current request */
-		if (next->port == listener_port) {
-			if (registry == NULL || next->priority < registry->priority)
-				registry = next;
-		} /* end if */
-		
-		/* go to the next position */
-		axl_hash_cursor_next (cursor);
-	} /* end while */
+	/* requests with an unknown protocol state are passed to all
+	 * handlers */
+	if (protocol_states && protocol_state && ! (protocol_states & protocol_state))
+		return axl_false;
+	if (request_filter && ! axl_cmp (request_filter, request_name))
+		return axl_false;
+	return axl_true;
+}
+
+/** 
+ * @internal Returns the next handler of the chain selected for the
+ * request (handlers are already sorted by priority), skipping
+ * handlers filtering the request, or NULL when the chain is
+ * finished.
+ */
+ValvulaRequestRegistry * __valvula_reader_chain_next (ValvulaReaderChain * chain)
+{
+	ValvulaRequestRegistry * registry;
 
-	if (registry)
-	        axl_list_append (selected, registry);
+	while (chain->next < chain->handlers->length) {
+		registry = chain->handlers->handlers[chain->next++];
+		if (__valvula_reader_handler_applies (chain->handlers, chain->next - 1, chain->protocol_state, chain->request_name))
+			return registry;
+	} /* end while */
 
-	return registry;
+	return NULL;
 }
 
 axlPointer __valvula_reader_record_handle_start (ValvulaCtx * ctx, const char * handler_name, ValvulaRequest * request)
@@ -375,163 +649,746 @@ void __valvula_reader_record_handle_stop (ValvulaCtx * ctx, axlPointer _process)
 }
 
 
-axlPointer valvula_reader_process_request (axlPointer _connection, ValvulaRequest * request)
+/** 
+ * @brief Allows to get the time left to reply the provided request
+ * according to the budget configured for its port (see \ref
+ * valvula_ctx_set_request_deadline). Handlers doing slow operations
+ * (database queries, network checks) can use it to limit them.
+ *
+ * @param request The request to check.
+ *
+ * @return Milliseconds left (0 if the budget is already spent) or -1
+ * if no budget applies to the request.
+ */
+long         valvula_request_get_remaining (ValvulaRequest * request)
 {
-	/* get variables */
-	ValvulaConnection       * connection    = _connection;
-	/* get port where this request was received */
-	int                       listener_port = valvula_support_strtod (connection->listener->port, NULL);
-	ValvulaCtx              * ctx = connection->ctx;
-	char                    * message = NULL;
-	ValvulaState              state;
+	struct timeval now;
+	long           remaining;
 
-	/* list of selected handlers this time */
-	axlList                 * selected;
+	if (request == NULL || request->deadline.tv_sec == 0)
+		return -1;
 
-	/* handler reference */
-	ValvulaProcessRequest     handler;
-	const char              * handler_name;
-	axlPointer                record_id;
+	gettimeofday (&now, NULL);
+	remaining = ((request->deadline.tv_sec - now.tv_sec) * 1000) + ((request->deadline.tv_usec - now.tv_usec) / 1000);
 
-	axlPointer                user_data;
-	ValvulaRequestRegistry  * registry = NULL;
-	axlHashCursor           * cursor;
+	return remaining > 0 ? remaining : 0;
+}
 
-	/* global operation */
-	struct timeval            start;
-	struct timeval            stop;
-	struct timeval            diff;
+/** 
+ * @internal Sets the request deadline according to the budget
+ * configured for the provided port (or for all ports).
+ *
+ * @return axl_true if a budget applies to the request, reporting the
+ * state to reply when it is spent.
+ */
+axl_bool __valvula_reader_request_deadline (ValvulaCtx * ctx, ValvulaRequest * request, int listener_port, ValvulaState * state)
+{
+	ValvulaRequestBudget * budget;
 
-	/* module operation */
-	struct timeval            start_m;
-	struct timeval            stop_m;
-	long                      total_microsecs;
+	if (ctx->deadlines == NULL)
+		return axl_false;
 
-	/* update port reported */
-	request->listener_port = listener_port;
+	budget = valvula_hash_lookup (ctx->deadlines, INT_TO_PTR (listener_port));
+	if (budget == NULL)
+		budget = valvula_hash_lookup (ctx->deadlines, INT_TO_PTR (-1));
+	if (budget == NULL)
+		return axl_false;
 
-	if (ctx->debug) {
-		/* drop debug starting, take starting time */
-		valvula_log (VALVULA_LEVEL_DEBUG, "valvula_reader_process_request: starting request handling");
-	}
+	/* requests not created by the reader */
+	if (request->arrival.tv_sec == 0)
+		gettimeofday (&request->arrival, NULL);
 
-	if (ctx->process_handler_registry && valvula_hash_size (ctx->process_handler_registry) > 0) {
-		/* get first element from the registry */
-	        selected = axl_list_new (axl_list_always_return_1, NULL);
-		cursor   = valvula_hash_get_cursor (ctx->process_handler_registry);
+	request->deadline.tv_sec  = request->arrival.tv_sec + (budget->budget / 1000);
+	request->deadline.tv_usec = request->arrival.tv_usec + ((budget->budget % 1000) * 1000);
+	if (request->deadline.tv_usec >= 1000000) {
+		request->deadline.tv_sec++;
+		request->deadline.tv_usec -= 1000000;
+	} /* end if */
 
-		/* iterate over all items to find the lowest on this port */
-		axl_hash_cursor_first (cursor);
-		registry = __valvula_reader_find_next_handler (ctx, cursor, listener_port, selected);
+	(*state) = budget->state;
+	return axl_true;
+}
 
-		if (registry == NULL) {
-			/* free cursor */
-			axl_hash_cursor_free (cursor);
-			axl_list_free (selected);
+/** 
+ * @internal Reply ownership of a chain with a deadline: the chain
+ * and the deadline watchdog race to reply the request (EXPIRED while
+ * the watchdog is sending the expired reply).
+ */
+#define VALVULA_READER_REPLY_OPEN      0
+#define VALVULA_READER_REPLY_EXPIRED   1
+#define VALVULA_READER_REPLY_DONE      2
 
-			/* no handlers defined so no policy can be delegated, replying default */
-			__valvula_reader_send_reply (ctx, connection, request, ctx->default_state, NULL);
-			return NULL;
-		} /* end if */
+/** 
+ * @internal Checks if the deadline a is before the deadline b.
+ */
+axl_bool __valvula_reader_deadline_before (struct timeval * a, struct timeval * b)
+{
+	if (a->tv_sec != b->tv_sec)
+		return a->tv_sec < b->tv_sec;
+	return a->tv_usec < b->tv_usec;
+}
 
-		/* start tracking */
-		gettimeofday (&start, NULL);
-		do {
-			/* get handler and user data */
-			handler      = registry->process_handler;
-			handler_name = registry->identifier;
-			user_data    = registry->user_data;
+axl_bool __valvula_reader_deadline_watchdog (ValvulaCtx * ctx, axlPointer user_data, axlPointer user_data2);
 
-			valvula_log (VALVULA_LEVEL_DEBUG, "Checking registry handler: %p (%s)", registry, handler_name);
+/** 
+ * @internal Arms the deadline watchdog to run once the provided
+ * deadline is reached. Called with deadline_mutex held.
+ */
+void __valvula_reader_deadline_arm (ValvulaCtx * ctx, struct timeval * deadline)
+{
+	struct timeval now;
+	long           wait;
+
+	gettimeofday (&now, NULL);
+	wait = ((deadline->tv_sec - now.tv_sec) * 1000000) + (deadline->tv_usec - now.tv_usec);
+	if (wait < 1)
+		wait = 1;
+
+	/* previous event (if any) runs but won't arm again */
+	ctx->deadline_timer++;
+	if (valvula_thread_pool_new_event (ctx, wait, __valvula_reader_deadline_watchdog, INT_TO_PTR (ctx->deadline_timer), NULL) == -1) {
+		/* budget is then only checked between handlers */
+		ctx->deadline_armed.tv_sec = 0;
+		return;
+	} /* end if */
 
-			/* start tracking */
-			gettimeofday (&start_m, NULL);
+	ctx->deadline_armed = *deadline;
+	return;
+}
 
-			/* record we are about to enter in a handler with a particular name */
-			record_id = __valvula_reader_record_handle_start (ctx, handler_name, request);
+/** 
+ * @internal Deadline watchdog: replies the expired state to requests
+ * whose budget is spent while a handler is still running (or left
+ * them pending). The chain continues until the handler returns but
+ * its result is discarded.
+ *
+ * Expired chains are taken under the mutex but replied outside it
+ * (writing may block on a client not reading), chains finishing
+ * meanwhile wait for their reply (see
+ * __valvula_reader_deadline_unwatch). Then the watchdog is armed
+ * again for the earliest deadline left.
+ */
+axl_bool __valvula_reader_deadline_watchdog (ValvulaCtx * ctx, axlPointer user_data, axlPointer user_data2)
+{
+	ValvulaReaderChain * chain;
+	ValvulaReaderChain * next;
+	ValvulaReaderChain * expired  = NULL;
+	ValvulaReaderChain * earliest = NULL;
+
+	valvula_mutex_lock (&ctx->deadline_mutex);
+	for (chain = ctx->deadline_chains; chain; chain = next) {
+		next = chain->deadline_next;
+		if (valvula_request_get_remaining (chain->request) != 0) {
+			if (earliest == NULL || __valvula_reader_deadline_before (&chain->request->deadline, &earliest->request->deadline))
+				earliest = chain;
+			continue;
+		} /* end if */
 
-			/* call to notify request and get a response */
-			message = NULL;
-			state   = handler (ctx, connection, request, user_data, &message);
+		/* take the reply and move the chain to the expired list */
+		__sync_bool_compare_and_swap (&chain->replied, VALVULA_READER_REPLY_OPEN, VALVULA_READER_REPLY_EXPIRED);
+		if (chain->deadline_prev)
+			chain->deadline_prev->deadline_next = chain->deadline_next;
+		else
+			ctx->deadline_chains = chain->deadline_next;
+		if (chain->deadline_next)
+			chain->deadline_next->deadline_prev = chain->deadline_prev;
+		chain->deadline_next = expired;
+		expired              = chain;
+	} /* end for */
 
-			/* call to record that we finished */
-			__valvula_reader_record_handle_stop (ctx, record_id);
+	/* only the event armed last arms the next one */
+	if (PTR_TO_INT (user_data) == ctx->deadline_timer) {
+		ctx->deadline_armed.tv_sec = 0;
+		if (earliest)
+			__valvula_reader_deadline_arm (ctx, &earliest->request->deadline);
+	} /* end if */
+	valvula_mutex_unlock (&ctx->deadline_mutex);
 
-			valvula_log (VALVULA_LEVEL_DEBUG, "Handler %p reported state (%d) %s", registry, state, valvula_support_state_str (state));
+	for (chain = expired; chain; chain = next) {
+		next = chain->deadline_next;
 
-			/* start tracking */
-			gettimeofday (&stop_m, NULL);
+		valvula_log (VALVULA_LEVEL_WARNING, "Request %p deadline reached while a handler was running (port %d), replying %s",
+			     chain->request, chain->listener_port, valvula_support_state_str (chain->expired_state));
+		__valvula_reader_send_reply (ctx, chain->connection, chain->request, chain->expired_state, NULL);
 
-			valvula_timeval_substract (&stop_m, &start_m, &diff);
-			total_microsecs = (diff.tv_sec * 1000000) + diff.tv_usec;
+		/* reply sent: the chain may be released after this */
+		valvula_mutex_lock (&ctx->deadline_mutex);
+		__sync_bool_compare_and_swap (&chain->replied, VALVULA_READER_REPLY_EXPIRED, VALVULA_READER_REPLY_DONE);
+		valvula_cond_broadcast (&ctx->deadline_cond);
+		valvula_mutex_unlock (&ctx->deadline_mutex);
+	} /* end for */
 
-			/* lock */
-			valvula_mutex_lock (&registry->stats_mutex);
+	/* one shot event */
+	return axl_true;
+}
 
-			/* update processing stats */
-			if (total_microsecs > registry->max_processing) 
-				registry->max_processing = total_microsecs;
-			if (total_microsecs < registry->min_processing || registry->min_processing == 0)
-				registry->min_processing = total_microsecs;
-			if (registry->avg_processing == 0)
-				registry->avg_processing = total_microsecs;
-			else 
-				registry->avg_processing = (registry->avg_processing + total_microsecs) / 2;
+/** 
+ * @internal Registers the chain on the deadline watchdog, arming it
+ * if the chain deadline is the earliest one.
+ */
+void __valvula_reader_deadline_watch (ValvulaCtx * ctx, ValvulaReaderChain * chain)
+{
+	valvula_mutex_lock (&ctx->deadline_mutex);
+	chain->deadline_prev = NULL;
+	chain->deadline_next = ctx->deadline_chains;
+	if (ctx->deadline_chains)
+		ctx->deadline_chains->deadline_prev = chain;
+	ctx->deadline_chains = chain;
 
-			/* unlock */
-			valvula_mutex_unlock (&registry->stats_mutex);
-			
+	if (ctx->deadline_armed.tv_sec == 0 || __valvula_reader_deadline_before (&chain->request->deadline, &ctx->deadline_armed))
+		__valvula_reader_deadline_arm (ctx, &chain->request->deadline);
+	valvula_mutex_unlock (&ctx->deadline_mutex);
 
-			/* check if the error code is disntict from DUNNO */
-			if (state != VALVULA_STATE_DUNNO)
-				break;
+	return;
+}
 
-			axl_free (message);
+/** 
+ * @internal Removes the chain from the deadline watchdog, waiting
+ * for the expired reply if the watchdog is sending it.
+ *
+ * @return axl_true if the chain must reply the request or axl_false
+ * if it was already replied by the watchdog.
+ */
+axl_bool __valvula_reader_deadline_unwatch (ValvulaCtx * ctx, ValvulaReaderChain * chain)
+{
+	axl_bool owned;
+
+	valvula_mutex_lock (&ctx->deadline_mutex);
+	owned = __sync_bool_compare_and_swap (&chain->replied, VALVULA_READER_REPLY_OPEN, VALVULA_READER_REPLY_DONE);
+	if (owned) {
+		/* still linked: the watchdog unlinks the chains it replies */
+		if (chain->deadline_prev)
+			chain->deadline_prev->deadline_next = chain->deadline_next;
+		else
+			ctx->deadline_chains = chain->deadline_next;
+		if (chain->deadline_next)
+			chain->deadline_next->deadline_prev = chain->deadline_prev;
+	} else {
+		while (__sync_fetch_and_add (&chain->replied, 0) == VALVULA_READER_REPLY_EXPIRED)
+			VALVULA_COND_WAIT (&ctx->deadline_cond, &ctx->deadline_mutex);
+	} /* end if */
+	valvula_mutex_unlock (&ctx->deadline_mutex);
 
-			/* get next registry */
-			registry = __valvula_reader_find_next_handler (ctx, cursor, listener_port, selected);
+	return owned;
+}
 
-		} while (registry);
+/** 
+ * @internal Checks if the chain deadline is reached (budget spent or
+ * request already replied by the deadline watchdog).
+ */
+axl_bool __valvula_reader_chain_expired (ValvulaReaderChain * chain)
+{
+	if (! chain->has_deadline)
+		return axl_false;
+	if (__sync_fetch_and_add (&chain->replied, 0) != VALVULA_READER_REPLY_OPEN)
+		return axl_true;
+	return valvula_request_get_remaining (chain->request) == 0;
+}
 
-		valvula_log (VALVULA_LEVEL_DEBUG, "Reply to request %p was state=%d (%s), message=%s",
-			     request, state, valvula_support_state_str (state), message ? message : "");
-		axl_list_free (selected);
+/** 
+ * @internal Handler call phases used to synchronize the thread
+ * calling a handler with \ref valvula_request_complete.
+ */
+#define VALVULA_READER_CHAIN_RUNNING   0
+#define VALVULA_READER_CHAIN_WAITING   1
+#define VALVULA_READER_CHAIN_COMPLETED 2
 
-		/* finish time tracking */
-		gettimeofday (&stop, NULL);
+/** 
+ * @internal Records the end of a handler call started at start_m
+ * that reported the provided state, updating its processing stats.
+ */
+void __valvula_reader_handler_done (ValvulaCtx * ctx, ValvulaRequestRegistry * registry, axlPointer record_id, struct timeval * start_m, ValvulaState state)
+{
+	struct timeval            stop_m;
+	struct timeval            diff;
+	long                      total_microsecs;
 
-		valvula_timeval_substract (&stop, &start, &diff);
-		total_microsecs = (diff.tv_sec * 1000000) + diff.tv_usec;
+	/* call to record that we finished */
+	__valvula_reader_record_handle_stop (ctx, record_id);
 
-		/* lock */
-		valvula_mutex_lock (&ctx->stats_mutex);
+	/* finish tracking */
+	gettimeofday (&stop_m, NULL);
 
-		/* update processing stats */
-		if (total_microsecs > ctx->max_processing) 
-			ctx->max_processing = total_microsecs;
-		if (total_microsecs < ctx->min_processing || ctx->min_processing == 0)
-			ctx->min_processing = total_microsecs;
-		if (ctx->avg_processing == 0)
-			ctx->avg_processing = total_microsecs;
-		else 
-			ctx->avg_processing = (ctx->avg_processing + total_microsecs) / 2;
+	valvula_timeval_substract (&stop_m, start_m, &diff);
+	total_microsecs = (diff.tv_sec * 1000000) + diff.tv_usec;
 
-		/* record requests handled */
-		ctx->requests_handled ++;
+	/* lock */
+	valvula_mutex_lock (&registry->stats_mutex);
+
+	/* update processing stats */
+	if (total_microsecs > registry->max_processing) 
+		registry->max_processing = total_microsecs;
+	if (total_microsecs < registry->min_processing || registry->min_processing == 0)
+		registry->min_processing = total_microsecs;
+	registry->requests_handled ++;
+	registry->processing_total += total_microsecs;
+	registry->avg_processing    = registry->processing_total / registry->requests_handled;
+
+	if (state != VALVULA_STATE_DUNNO)
+		registry->requests_decided ++;
+
+	/* cost and decisive verdicts since last reordering (only
+	 * handlers that can be reordered) */
+	if (registry->adaptive && ! registry->parallel) {
+		registry->window_handled ++;
+		registry->window_total += total_microsecs;
+		if (state != VALVULA_STATE_DUNNO)
+			registry->window_decided ++;
+	} /* end if */
 
-		/* unlock */
-		valvula_mutex_unlock (&ctx->stats_mutex);
+	/* unlock */
+	valvula_mutex_unlock (&registry->stats_mutex);
+
+	return;
+}
+
+/** 
+ * @internal Records the end of the handler being executed by the
+ * chain, updating its processing stats.
+ */
+void __valvula_reader_chain_handler_done (ValvulaCtx * ctx, ValvulaReaderChain * chain, ValvulaState state)
+{
+	__valvula_reader_handler_done (ctx, chain->registry, chain->record_id, &chain->start_m, state);
+	chain->record_id = NULL;
+
+	/* the verdict is cached the lowest time allowed by the
+	 * handlers called */
+	if (chain->cache_ttl < 0 || chain->registry->cache_ttl < chain->cache_ttl)
+		chain->cache_ttl = chain->registry->cache_ttl;
+
+	return;
+}
+
+/** 
+ * @internal Finishes the chain processing the request: updates
+ * context stats, sends the reply and releases chain state.
+ */
+void __valvula_reader_chain_finish (ValvulaCtx * ctx, ValvulaRequest * request, ValvulaState state, const char * message, axl_bool expired)
+{
+	ValvulaReaderChain * chain = request->chain;
+	struct timeval       stop;
+	struct timeval       diff;
+	long                 total_microsecs;
+	axl_bool             reply = axl_true;
+
+	/* check if the deadline watchdog already replied */
+	if (chain->has_deadline && ! __valvula_reader_deadline_unwatch (ctx, chain)) {
+		valvula_log (VALVULA_LEVEL_DEBUG, "Discarding state=%d (%s) for request %p, deadline state was already replied",
+			     state, valvula_support_state_str (state), request);
+		reply   = axl_false;
+		expired = axl_true;
+	} /* end if */
+
+	valvula_log (VALVULA_LEVEL_DEBUG, "Reply to request %p was state=%d (%s), message=%s",
+		     request, state, valvula_support_state_str (state), message ? message : "");
+
+	/* finish time tracking */
+	gettimeofday (&stop, NULL);
+
+	valvula_timeval_substract (&stop, &chain->start, &diff);
+	total_microsecs = (diff.tv_sec * 1000000) + diff.tv_usec;
+
+	/* lock */
+	valvula_mutex_lock (&ctx->stats_mutex);
+
+	/* update processing stats */
+	if (total_microsecs > ctx->max_processing) 
+		ctx->max_processing = total_microsecs;
+	if (total_microsecs < ctx->min_processing || ctx->min_processing == 0)
+		ctx->min_processing = total_microsecs;
+	ctx->processing_count ++;
+	ctx->processing_total += total_microsecs;
+	ctx->avg_processing    = ctx->processing_total / ctx->processing_count;
+
+	/* record requests handled */
+	ctx->requests_handled ++;
+	if (expired)
+		ctx->requests_expired ++;
+
+	/* unlock */
+	valvula_mutex_unlock (&ctx->stats_mutex);
+
+	/* store verdict if all handlers called allow it */
+	if (ctx->verdict_cache && ! expired && chain->cache_ttl > 0)
+		__valvula_cache_store (ctx, request, chain->listener_port, state, message, chain->cache_ttl);
 		
-		/* send reply */
-		__valvula_reader_send_reply (ctx, connection, request, state, message);
+	/* send reply */
+	if (reply)
+		__valvula_reader_send_reply (ctx, chain->connection, request, state, message);
+
+	/* release chain */
+	__valvula_ctx_release_handler_chain (chain->handlers);
+	axl_free (chain);
+	request->chain = NULL;
+
+	return;
+}
+
+axl_bool __valvula_reader_chain_run (ValvulaCtx * ctx, ValvulaRequest * request);
+void     __valvula_reader_process_queued (ValvulaConnection * connection);
+
+/** 
+ * @internal Records the state reported by a branch of a parallel
+ * group. The first state distinct from DUNNO (in chain order) is
+ * replied as soon as all branches before it reported DUNNO. The last
+ * branch finished releases the group and continues the chain (all
+ * branches reported DUNNO) or releases the request, processing
+ * requests queued on the connection.
+ *
+ * The branch replying the decisive state is only counted as finished
+ * once the reply is sent, so the request (and the group) can't be
+ * released, nor next requests processed, before that.
+ */
+void __valvula_reader_branch_done (ValvulaReaderBranch * branch, ValvulaState state, char * message)
+{
+	ValvulaReaderFanOut  * fan_out    = branch->fan_out;
+	ValvulaRequest       * request    = fan_out->request;
+	ValvulaConnection    * connection = fan_out->connection;
+	ValvulaCtx           * ctx        = connection->ctx;
+	ValvulaReaderBranch  * decisive   = NULL;
+	ValvulaReaderChain   * chain;
+	axl_bool               proceed    = axl_false;
+	axl_bool               last       = axl_false;
+	int                    iterator;
+
+	valvula_mutex_lock (&fan_out->mutex);
+
+	branch->state   = state;
+	branch->message = message;
+	branch->done    = axl_true;
+
+	if (! fan_out->decided) {
+		/* find first state in chain order */
+		for (iterator = 0; iterator < fan_out->length; iterator++) {
+			if (! fan_out->branches[iterator].done)
+				break;
+			if (fan_out->branches[iterator].state != VALVULA_STATE_DUNNO) {
+				decisive = &fan_out->branches[iterator];
+				break;
+			} /* end if */
+		} /* end for */
+
+		if (decisive)
+			fan_out->decided = axl_true;
+		else if (iterator == fan_out->length) {
+			/* all branches reported DUNNO */
+			fan_out->decided = axl_true;
+			proceed          = axl_true;
+		} /* end if */
+	} /* end if */
+
+	/* count this branch as finished now unless it has to reply
+	 * (counted once the reply is sent) */
+	if (decisive == NULL) {
+		fan_out->finished++;
+		last = (fan_out->finished == fan_out->length);
+	} /* end if */
+
+	valvula_mutex_unlock (&fan_out->mutex);
+
+	if (decisive || proceed) {
+		/* cache ttl of the handlers the outcome depends on */
+		chain = request->chain;
+		for (iterator = 0; iterator < fan_out->length; iterator++) {
+			if (chain->cache_ttl < 0 || fan_out->branches[iterator].registry->cache_ttl < chain->cache_ttl)
+				chain->cache_ttl = fan_out->branches[iterator].registry->cache_ttl;
+			if (&fan_out->branches[iterator] == decisive)
+				break;
+		} /* end for */
+	} /* end if */
+
+	if (decisive) {
+		valvula_log (VALVULA_LEVEL_DEBUG, "Handler %p (%s) decided request %p in parallel group with state (%d) %s",
+			     decisive->registry, decisive->registry->identifier, request, decisive->state, valvula_support_state_str (decisive->state));
+		__valvula_reader_chain_finish (ctx, request, decisive->state, decisive->message, axl_false);
+
+		/* reply sent: count this branch as finished */
+		valvula_mutex_lock (&fan_out->mutex);
+		fan_out->finished++;
+		last = (fan_out->finished == fan_out->length);
+		valvula_mutex_unlock (&fan_out->mutex);
+	} /* end if */
+
+	/* wait for the rest of branches, they are still using the
+	 * request */
+	if (! last)
+		return;
+
+	for (iterator = 0; iterator < fan_out->length; iterator++)
+		axl_free (fan_out->branches[iterator].message);
+	valvula_mutex_destroy (&fan_out->mutex);
+	axl_free (fan_out->branches);
+	axl_free (fan_out);
+
+	if (proceed) {
+		/* continue with the next priority */
+		chain           = request->chain;
+		chain->registry = __valvula_reader_chain_next (chain);
+		if (! __valvula_reader_chain_run (ctx, request))
+			return;
+	} /* end if */
+
+	/* request replied, continue with requests queued on this
+	 * connection */
+	valvula_connection_request_free (request);
+	__valvula_reader_process_queued (connection);
+
+	return;
+}
+
+/** 
+ * @internal Calls the handler of a parallel group branch (unless the
+ * group is already decided).
+ */
+axlPointer __valvula_reader_branch_run (axlPointer _branch)
+{
+	ValvulaReaderBranch     * branch   = _branch;
+	ValvulaReaderFanOut     * fan_out  = branch->fan_out;
+	ValvulaRequestRegistry  * registry = branch->registry;
+	ValvulaCtx              * ctx      = fan_out->connection->ctx;
+	ValvulaState              state    = VALVULA_STATE_DUNNO;
+	char                    * message  = NULL;
+	axlPointer                record_id;
+	struct timeval            start_m;
+
+	/* skip handlers not started once the group is decided or
+	 * the request budget is spent (the chain then replies the
+	 * expired state). The chain is not checked: it is released
+	 * by the decisive branch (the request lives until the last
+	 * branch finishes) */
+	if (! __sync_fetch_and_add (&fan_out->decided, 0) && 
+	    ! (fan_out->has_deadline && valvula_request_get_remaining (fan_out->request) == 0)) {
+		gettimeofday (&start_m, NULL);
+		record_id = __valvula_reader_record_handle_start (ctx, registry->identifier, fan_out->request);
+
+		state = registry->process_handler (ctx, fan_out->connection, fan_out->request, registry->user_data, &message);
+		if (state == VALVULA_STATE_PENDING) {
+			valvula_log (VALVULA_LEVEL_CRITICAL, "Handler %s left request %p pending inside a parallel group (not supported), using DUNNO",
+				     registry->identifier, fan_out->request);
+			axl_free (message);
+			message = NULL;
+			state   = VALVULA_STATE_DUNNO;
+		} /* end if */
+
+		__valvula_reader_handler_done (ctx, registry, record_id, &start_m, state);
+	} /* end if */
+
+	__valvula_reader_branch_done (branch, state, message);
+
+	return NULL;
+}
+
+/** 
+ * @internal Launches the parallel group starting at chain->registry:
+ * all branches but the first one are handed to the thread pool, the
+ * first one is called by the current thread.
+ */
+void __valvula_reader_fan_out (ValvulaCtx * ctx, ValvulaRequest * request, int length)
+{
+	ValvulaReaderChain      * chain = request->chain;
+	ValvulaReaderFanOut     * fan_out;
+	ValvulaReaderBranch     * branches;
+	ValvulaRequestRegistry  * registry;
+	int                       iterator;
+
+	fan_out             = axl_new (ValvulaReaderFanOut, 1);
+	branches            = axl_new (ValvulaReaderBranch, length);
+	fan_out->request      = request;
+	fan_out->connection   = chain->connection;
+	fan_out->has_deadline = chain->has_deadline;
+	fan_out->branches     = branches;
+	valvula_mutex_create (&fan_out->mutex);
+
+	/* branches for handlers of the group not filtering the
+	 * request (the first one is chain->registry) */
+	for (iterator = 0; iterator < length; iterator++) {
+		registry = chain->handlers->handlers[chain->next - 1 + iterator];
+		if (! __valvula_reader_handler_applies (chain->handlers, chain->next - 1 + iterator, chain->protocol_state, chain->request_name))
+			continue;
+
+		branches[fan_out->length].fan_out  = fan_out;
+		branches[fan_out->length].registry = registry;
+		fan_out->length++;
+	} /* end for */
+
+	valvula_log (VALVULA_LEVEL_DEBUG, "Evaluating %d handlers in parallel for request %p (priority %d)",
+		     fan_out->length, request, chain->registry->priority);
+
+	/* skip the group in the chain, no handler of the group can
+	 * use valvula_request_complete */
+	chain->next      += length - 1;
+	chain->completed  = axl_true;
+
+	for (iterator = 1; iterator < fan_out->length; iterator++) {
+		if (valvula_thread_pool_new_task (ctx, __valvula_reader_branch_run, &branches[iterator]))
+			continue;
+
+		/* unable to queue the branch: run it from this thread
+		 * (the group can't be released yet, the first branch
+		 * is still pending) */
+		valvula_log (VALVULA_LEVEL_WARNING, "Unable to queue handler %s for request %p, calling it from current thread",
+			     branches[iterator].registry->identifier, request);
+		__valvula_reader_branch_run (&branches[iterator]);
+	} /* end for */
+
+	/* the group may be released after this call */
+	__valvula_reader_branch_run (&branches[0]);
+
+	return;
+}
+
+/** 
+ * @internal Runs the handler chain from chain->registry until a
+ * handler reports a state distinct from DUNNO, the chain is
+ * exhausted or a handler leaves the request pending.
+ *
+ * @return axl_true if the request was replied or axl_false if a
+ * handler returned \ref VALVULA_STATE_PENDING (the chain continues
+ * once \ref valvula_request_complete is called) or a parallel group
+ * was launched (the chain continues once all its handlers finish).
+ */
+axl_bool __valvula_reader_chain_run (ValvulaCtx * ctx, ValvulaRequest * request)
+{
+	ValvulaReaderChain      * chain    = request->chain;
+	ValvulaRequestRegistry  * registry = chain->registry;
+	ValvulaState              state    = VALVULA_STATE_DUNNO;
+	char                    * message  = NULL;
+	axl_bool                  expired  = axl_false;
+
+	while (registry) {
+		valvula_log (VALVULA_LEVEL_DEBUG, "Checking registry handler: %p (%s)", registry, registry->identifier);
+
+		/* stop the chain if the request budget is spent */
+		if (__valvula_reader_chain_expired (chain)) {
+			valvula_log (VALVULA_LEVEL_WARNING, "Request %p deadline reached before calling handler %s (port %d), replying %s",
+				     request, registry->identifier, chain->listener_port, valvula_support_state_str (chain->expired_state));
+			state   = chain->expired_state;
+			expired = axl_true;
+			break;
+		} /* end if */
+
+		/* evaluate a group of parallel handlers concurrently,
+		 * the chain continues once all of them finish */
+		if (chain->handlers->groups[chain->next - 1] > 1) {
+			__valvula_reader_fan_out (ctx, request, chain->handlers->groups[chain->next - 1]);
+			return axl_false;
+		} /* end if */
+
+		/* start tracking */
+		gettimeofday (&chain->start_m, NULL);
+
+		/* record we are about to enter in a handler with a particular name */
+		chain->record_id = __valvula_reader_record_handle_start (ctx, registry->identifier, request);
+		chain->registry  = registry;
+		chain->completed = axl_false;
+		chain->phase     = VALVULA_READER_CHAIN_RUNNING;
+
+		/* call to notify request and get a response */
+		message = NULL;
+		state   = registry->process_handler (ctx, chain->connection, request, registry->user_data, &message);
+
+		if (state == VALVULA_STATE_PENDING) {
+			axl_free (message);
+			message = NULL;
+
+			/* release this thread until valvula_request_complete is called */
+			if (__sync_bool_compare_and_swap (&chain->phase, VALVULA_READER_CHAIN_RUNNING, VALVULA_READER_CHAIN_WAITING)) {
+				valvula_log (VALVULA_LEVEL_DEBUG, "Handler %p (%s) left request %p pending", registry, registry->identifier, request);
+				return axl_false;
+			} /* end if */
+
+			/* already completed from other thread */
+			state          = chain->state;
+			message        = chain->message;
+			chain->message = NULL;
+		} /* end if */
+
+		__valvula_reader_chain_handler_done (ctx, chain, state);
+
+		valvula_log (VALVULA_LEVEL_DEBUG, "Handler %p reported state (%d) %s", registry, state, valvula_support_state_str (state));
+
+		/* check if the error code is disntict from DUNNO */
+		if (state != VALVULA_STATE_DUNNO)
+			break;
+
 		axl_free (message);
+		message = NULL;
 
-		/* free cursor */
-		axl_hash_cursor_free (cursor);
+		/* get next registry */
+		registry = __valvula_reader_chain_next (chain);
+	} /* end while */
 
-		return NULL;
+	__valvula_reader_chain_finish (ctx, request, state, message, expired);
+	axl_free (message);
+
+	return axl_true;
+}
+
+/** 
+ * @internal Processes the provided request calling the handler chain
+ * selected for the port where it was received and replying.
+ *
+ * @return axl_true if the request was replied (caller must release
+ * it) or axl_false if a handler left it pending: the request is
+ * replied and released once \ref valvula_request_complete is called,
+ * after which requests queued on the connection are processed.
+ */
+axl_bool valvula_reader_process_request (axlPointer _connection, ValvulaRequest * request)
+{
+	/* get variables */
+	ValvulaConnection       * connection    = _connection;
+	/* get port where this request was received */
+	int                       listener_port = connection->listener->port_number;
+	ValvulaCtx              * ctx = connection->ctx;
+	ValvulaReaderChain      * chain;
+	ValvulaHandlerChain     * handlers;
+
+	/* request budget */
+	axl_bool                  has_deadline;
+	ValvulaState              expired_state = VALVULA_STATE_DUNNO;
+
+	/* update port reported */
+	request->listener_port = listener_port;
+
+	/* get deadline to reply this request */
+	has_deadline = __valvula_reader_request_deadline (ctx, request, listener_port, &expired_state);
+
+	if (ctx->debug) {
+		/* drop debug starting, take starting time */
+		valvula_log (VALVULA_LEVEL_DEBUG, "valvula_reader_process_request: starting request handling");
+	}
+
+	/* get handlers compiled for this port, sorted by priority
+	 * (referenced until the chain finishes) */
+	handlers = __valvula_ctx_acquire_handler_chain (ctx, listener_port);
+	if (handlers && handlers->length > 0) {
+		/* prepare chain state */
+		chain                = axl_new (ValvulaReaderChain, 1);
+		chain->connection    = connection;
+		chain->request       = request;
+		chain->listener_port = listener_port;
+		chain->has_deadline  = has_deadline;
+		chain->expired_state = expired_state;
+		chain->handlers       = handlers;
+		chain->cache_ttl      = -1;
+		chain->protocol_state = __valvula_reader_protocol_state (request->protocol_state);
+		chain->request_name   = request->request;
+		request->chain        = chain;
+
+		/* start tracking */
+		gettimeofday (&chain->start, NULL);
+		chain->registry = __valvula_reader_chain_next (chain);
+
+		/* reply the expired state if handlers don't finish on
+		 * time */
+		if (has_deadline)
+			__valvula_reader_deadline_watch (ctx, chain);
+
+		return __valvula_reader_chain_run (ctx, request);
 	} /* end if */
 
+	__valvula_ctx_release_handler_chain (handlers);
+
 	/* lock */
 	valvula_mutex_lock (&ctx->stats_mutex);
 
@@ -546,98 +1403,868 @@ axlPointer valvula_reader_process_request (axlPointer _connection, ValvulaReques
 	__valvula_reader_send_reply (ctx, connection, request, 
 				     ctx->default_state, NULL);
 
-	return NULL;
+	return axl_true;
 }
 
-axlPointer valvula_reader_process_request_proxy (axlPointer _connection)
+/** 
+ * @internal Processes all requests queued on the provided connection
+ * in the order they were received so replies are written in the
+ * same order (pipelining). Once the queue is empty, the connection
+ * is flagged so the reader launches a new task for next request and
+ * the reference owned by the task is released.
+ *
+ * If a request is left pending by a handler, the function returns
+ * keeping the connection flagged and referenced: \ref
+ * valvula_request_complete continues the work.
+ */
+void __valvula_reader_process_queued (ValvulaConnection * connection)
 {
-	/* get call from process request */
-	ValvulaConnection * connection = _connection;
 	ValvulaRequest    * request;
-	axlPointer          result;
-
-	/* get request reference */
-	request = connection->request;
-	/* clear it from connection */
-	connection->request = NULL;
-	/* flag connection as ready */
-	connection->process_launched = axl_false;
-	connection->lines_found = 0;
-	
-	/* pass reference as static to process request */
-	result  = valvula_reader_process_request (connection, request);	
+
+	while (axl_true) {
+		/* get next request */
+		valvula_mutex_lock (&connection->op_mutex);
+		request = axl_list_get_first (connection->pending_requests);
+		if (request == NULL) {
+			/* flag connection as ready so the reader launches
+			 * a new task for next request */
+			connection->process_launched = axl_false;
+			valvula_mutex_unlock (&connection->op_mutex);
+			break;
+		} /* end if */
+		axl_list_unlink_first (connection->pending_requests);
+		valvula_mutex_unlock (&connection->op_mutex);
+
+		/* process request if the connection is still
+		 * working */
+		if (valvula_connection_is_ok (connection)) {
+			if (! valvula_reader_process_request (connection, request))
+				return;
+		} /* end if */
+
+		/* release request */
+		valvula_connection_request_free (request);
+	} /* end while */
 
 	/* release connection reference */
-	valvula_connection_unref (_connection, "valvula reader (process request)");
-	/* release request */
-	valvula_connection_request_free (request);
+	valvula_connection_unref (connection, "valvula reader (process request)");
 
+	return;
+}
+
+axlPointer valvula_reader_process_request_proxy (axlPointer _connection)
+{
+	/* process all requests queued on this connection */
+	__valvula_reader_process_queued (_connection);
 
 	/* return value found from call */
-	return result;
+	return NULL;
 }
 
-axl_bool  valvula_reader_check_sql_injection_to_escape (ValvulaCtx * ctx, ValvulaConnection * connection, const char * key, const char * value)
+/** 
+ * @internal Pool task that continues the chain of a request once the
+ * handler that left it pending completed it.
+ */
+axlPointer __valvula_reader_chain_resume (axlPointer _request)
 {
-	/* check if this is an address or a domain */
-	char       * local_part;
-	axl_bool     result = axl_false;
-
-	local_part = valvula_get_local_part (value);
-	if (local_part) {
-		/* local part detected, check if we have something to escape */
-		if (strstr (local_part, "'") || 
-		    strstr (local_part, ";") || 
-		    strstr (local_part, "$") || 
-		    strstr (local_part, "%") ||
-		    strstr (local_part, "`")) {
-			/* notify we have to escape */
-			result = axl_true;
+	ValvulaRequest     * request    = _request;
+	ValvulaReaderChain * chain      = request->chain;
+	ValvulaConnection  * connection = chain->connection;
+	ValvulaCtx         * ctx        = connection->ctx;
+	ValvulaState         state      = chain->state;
+	char               * message    = chain->message;
+
+	chain->message = NULL;
+	__valvula_reader_chain_handler_done (ctx, chain, state);
+
+	valvula_log (VALVULA_LEVEL_DEBUG, "Handler %p completed request %p with state (%d) %s", 
+		     chain->registry, request, state, valvula_support_state_str (state));
+
+	if (state == VALVULA_STATE_DUNNO) {
+		axl_free (message);
+
+		/* resume at the next handler */
+		chain->registry = __valvula_reader_chain_next (chain);
+		if (! __valvula_reader_chain_run (ctx, request))
+			return NULL;
+	} else {
+		__valvula_reader_chain_finish (ctx, request, state, message, axl_false);
+		axl_free (message);
+	} /* end if */
+
+	/* request replied, continue with requests queued on this
+	 * connection */
+	valvula_connection_request_free (request);
+	__valvula_reader_process_queued (connection);
+
+	return NULL;
+}
+
+/** 
+ * @brief Completes a request left pending by a handler (the handler
+ * returned \ref VALVULA_STATE_PENDING).
+ *
+ * Handlers doing slow operations (database queries, network checks)
+ * can start them, return \ref VALVULA_STATE_PENDING to release the
+ * thread and call this function, from any thread, once the result is
+ * known. If the state is \ref VALVULA_STATE_DUNNO, the chain resumes
+ * at the next handler, otherwise the state is replied.
+ *
+ * The function must be called only once for each \ref
+ * VALVULA_STATE_PENDING returned. The request must not be used after
+ * this call.
+ *
+ * @param request The request left pending.
+ *
+ * @param state The state resolved for the request.
+ *
+ * @param message Optional message to be sent with the state (the
+ * function makes a copy).
+ */
+void         valvula_request_complete (ValvulaRequest * request, ValvulaState state, const char * message)
+{
+	ValvulaReaderChain * chain;
+	ValvulaCtx         * ctx;
+
+	if (request == NULL || request->chain == NULL)
+		return;
+	chain = request->chain;
+	ctx   = chain->connection->ctx;
+
+	/* only once for each pending state */
+	if (! __sync_bool_compare_and_swap (&chain->completed, axl_false, axl_true)) {
+		valvula_log (VALVULA_LEVEL_CRITICAL, "valvula_request_complete called twice for request %p, ignoring", request);
+		return;
+	} /* end if */
+
+	if (state == VALVULA_STATE_PENDING) {
+		valvula_log (VALVULA_LEVEL_CRITICAL, "valvula_request_complete called with pending state for request %p, using DUNNO", request);
+		state = VALVULA_STATE_DUNNO;
+	} /* end if */
+
+	chain->state   = state;
+	chain->message = message ? axl_strdup (message) : NULL;
+
+	/* the handler didn't return yet: the thread calling it
+	 * continues the chain */
+	if (__sync_bool_compare_and_swap (&chain->phase, VALVULA_READER_CHAIN_RUNNING, VALVULA_READER_CHAIN_COMPLETED))
+		return;
+
+	/* the handler returned pending: continue from the pool */
+	if (__sync_bool_compare_and_swap (&chain->phase, VALVULA_READER_CHAIN_WAITING, VALVULA_READER_CHAIN_COMPLETED)) {
+		valvula_thread_pool_new_task (ctx, __valvula_reader_chain_resume, request);
+		return;
+	} /* end if */
+
+	return;
+}
+
+/** 
+ * @internal Checks if all handlers selected for the provided port
+ * are flagged as non-blocking (see \ref
+ * valvula_ctx_set_request_handler_non_blocking), so requests received
+ * on that port can be resolved directly from the reader thread.
+ *
+ * @return axl_true when no handler may block (including the case
+ * where no handler is selected and the default reply is sent).
+ */
+axl_bool __valvula_reader_port_is_non_blocking (ValvulaCtx * ctx, int listener_port)
+{
+	ValvulaHandlerChain * handlers = __valvula_ctx_acquire_handler_chain (ctx, listener_port);
+	axl_bool              non_blocking;
+
+	/* flag computed when the chain was compiled */
+	non_blocking = (handlers == NULL || handlers->non_blocking);
+	__valvula_ctx_release_handler_chain (handlers);
+
+	return non_blocking;
+}
+
+/** 
+ * @internal Queues the request completely received on the provided
+ * connection and launches a task to process it (if no task is
+ * already processing requests for this connection).
+ *
+ * When no task is processing the connection and every handler
+ * selected for its port is non-blocking, the request is processed
+ * and replied directly from the reader thread, skipping the thread
+ * pool hand off.
+ *
+ * @return axl_false if the connection was closed.
+ */
+axl_bool __valvula_reader_queue_request (ValvulaCtx * ctx, ValvulaConnection * connection)
+{
+	ValvulaRequest * request = connection->request;
+	axl_bool         launch  = axl_false;
+	int              pending;
+	ValvulaState     state;
+	char           * message = NULL;
+
+	/* request completed, reset reader state for the next one */
+	connection->request     = NULL;
+	connection->lines_found = 0;
+
+	valvula_mutex_lock (&connection->op_mutex);
+
+	/* verdict cache: nothing pending on this connection (so reply
+	 * order is kept) and a verdict is stored for the request */
+	if (! connection->process_launched && ctx->verdict_cache &&
+	    __valvula_cache_lookup (ctx, request, connection->listener->port_number, &state, &message)) {
+		valvula_mutex_unlock (&connection->op_mutex);
+
+		valvula_log (VALVULA_LEVEL_DEBUG, "Replying request from verdict cache over connection session=%d (%p): %s", 
+			     connection->session, connection, valvula_support_state_str (state));
+
+		/* record requests handled */
+		valvula_mutex_lock (&ctx->stats_mutex);
+		ctx->requests_handled ++;
+		valvula_mutex_unlock (&ctx->stats_mutex);
+
+		request->listener_port = connection->listener->port_number;
+		__valvula_reader_send_reply (ctx, connection, request, state, message);
+		axl_free (message);
+		valvula_connection_request_free (request);
+
+		return valvula_connection_is_ok (connection);
+	} /* end if */
+
+	/* fast path: nothing pending on this connection (so reply
+	 * order is kept) and all handlers are non-blocking */
+	if (! connection->process_launched && 
+	    __valvula_reader_port_is_non_blocking (ctx, connection->listener->port_number)) {
+		/* flag the connection as being processed (a handler
+		 * may leave the request pending) */
+		connection->process_launched = axl_true;
+		valvula_mutex_unlock (&connection->op_mutex);
+
+		if (! valvula_connection_ref (connection, "valvula reader (process request)")) {
+			valvula_log (VALVULA_LEVEL_CRITICAL, "unable to increase connection reference count at process request, dropping connection");
+			valvula_connection_request_free (request);
+			valvula_connection_close (connection);
+			return axl_false;
+		} /* end if */
+
+		valvula_log (VALVULA_LEVEL_DEBUG, "Processing request inline over connection session=%d (%p)", 
+			     connection->session, connection);
+		if (valvula_reader_process_request (connection, request)) {
+			valvula_connection_request_free (request);
+
+			/* nothing else queued: clears the flag and
+			 * releases the reference */
+			__valvula_reader_process_queued (connection);
 		} /* end if */
-		axl_free (local_part);
-		return result;
+
+		return valvula_connection_is_ok (connection);
 	} /* end if */
-	
 
+	if (connection->pending_requests == NULL)
+		connection->pending_requests = axl_list_new (axl_list_always_return_1, (axlDestroyFunc) valvula_connection_request_free);
 
-	return axl_false; /* request clean, nothing to escape or replace */
+	pending = axl_list_length (connection->pending_requests);
+	if (pending >= VALVULA_READER_MAX_PIPELINED) {
+		valvula_mutex_unlock (&connection->op_mutex);
+		valvula_log (VALVULA_LEVEL_CRITICAL, "Too many pipelined requests (%d) pending on session=%d (%p), closing connection",
+			     pending, connection->session, connection);
+		valvula_connection_request_free (request);
+		valvula_connection_close (connection);
+		return axl_false;
+	} /* end if */
+
+	/* queue request */
+	axl_list_append (connection->pending_requests, request);
+
+	/* check if a task is already processing this connection */
+	if (! connection->process_launched) {
+		connection->process_launched = axl_true;
+		launch                       = axl_true;
+	} /* end if */
+	valvula_mutex_unlock (&connection->op_mutex);
+
+	if (! launch) {
+		valvula_log (VALVULA_LEVEL_DEBUG, "Queued pipelined request over connection session=%d (%p), pending=%d", 
+			     connection->session, connection, pending + 1);
+		return axl_true;
+	} /* end if */
+
+	/* drop a log */
+	valvula_log (VALVULA_LEVEL_DEBUG, "Launching process request over connection session=%d (%p)", 
+		     connection->session, connection);
+
+	/* increase reference counting */
+	if (! valvula_connection_ref (connection, "valvula reader (process request)")) {
+		valvula_log (VALVULA_LEVEL_CRITICAL, "unable to increase connection reference count at process request, dropping connection");
+		valvula_connection_close (connection);
+		return axl_false;
+	} /* end if */
+
+	/* process request */
+	valvula_thread_pool_new_task (ctx, valvula_reader_process_request_proxy, connection);
+	return axl_true;
 }
 
-#define valvula_reader_set_value(var,value_to_configure) do { \
-	if (var)                                             \
-		axl_free (var);                              \
-	var = axl_strdup(value_to_configure);		     \
-	} while (0)
+/** 
+ * @internal Characters that must be escaped when found in the local
+ * part of an address.
+ */
+#define VALVULA_READER_ESCAPE_QUOTE     (1 << 0)
+#define VALVULA_READER_ESCAPE_SEMICOLON (1 << 1)
+#define VALVULA_READER_ESCAPE_DOLLAR    (1 << 2)
+#define VALVULA_READER_ESCAPE_PERCENT   (1 << 3)
+#define VALVULA_READER_ESCAPE_BACKTICK  (1 << 4)
 
-char ** __valvula_reader_get_items (const char * buffer)
+/** 
+ * @internal Reports the escape class (VALVULA_READER_ESCAPE_*) for
+ * the provided character or 0 if it is a safe character.
+ */
+int __valvula_reader_escape_class (char value)
 {
-	char ** result;
-	int     iterator  = 0;
-	int     length    = strlen (buffer);
+	switch (value) {
+	case '\'':
+		return VALVULA_READER_ESCAPE_QUOTE;
+	case ';':
+		return VALVULA_READER_ESCAPE_SEMICOLON;
+	case '$':
+		return VALVULA_READER_ESCAPE_DOLLAR;
+	case '%':
+		return VALVULA_READER_ESCAPE_PERCENT;
+	case '`':
+		return VALVULA_READER_ESCAPE_BACKTICK;
+	default:
+		return 0;
+	} /* end switch */
+}
+
+#if defined(__AVX2__) || defined(__SSE2__)
+/** 
+ * @internal Classifies positions flagged in mask (relative to
+ * value), stopping at limit.
+ */
+int __valvula_reader_escape_mask (const char * value, unsigned int mask, int limit)
+{
+	int result = 0;
+	int position;
+
+	while (mask) {
+		position = __builtin_ctz (mask);
+		if (position >= limit)
+			break;
+		result |= __valvula_reader_escape_class (value[position]);
+		mask   &= mask - 1;
+	} /* end while */
+
+	return result;
+}
+#endif
 
-	/* printf ("Handling: %s\n", buffer); */
+/** 
+ * @internal Scans the provided value once, looking for the first @
+ * and for characters that must be escaped before it (the local
+ * part). The scan is done 32 bytes (AVX2) or 16 bytes (SSE2) at a time
+ * when available, with a scalar loop for the rest.
+ *
+ * @return Mask of VALVULA_READER_ESCAPE_* values found in the local
+ * part or 0 if nothing was found or the value is not an address.
+ */
+int __valvula_reader_scan_local_part (const char * value, int length)
+{
+	int          iterator = 0;
+	int          result   = 0;
+#if defined(__AVX2__)
+	unsigned int at;
+	unsigned int bad;
+	__m256i      block;
+	__m256i      c_at        = _mm256_set1_epi8 ('@');
+	__m256i      c_quote     = _mm256_set1_epi8 ('\'');
+	__m256i      c_semicolon = _mm256_set1_epi8 (';');
+	__m256i      c_dollar    = _mm256_set1_epi8 ('$');
+	__m256i      c_percent   = _mm256_set1_epi8 ('%');
+	__m256i      c_backtick  = _mm256_set1_epi8 ('`');
+
+	while ((iterator + 32) <= length) {
+		block = _mm256_loadu_si256 ((const __m256i *) (value + iterator));
+		at    = (unsigned int) _mm256_movemask_epi8 (_mm256_cmpeq_epi8 (block, c_at));
+		bad   = (unsigned int) _mm256_movemask_epi8 (
+			_mm256_or_si256 (_mm256_or_si256 (_mm256_cmpeq_epi8 (block, c_quote),
+							  _mm256_cmpeq_epi8 (block, c_semicolon)),
+					 _mm256_or_si256 (_mm256_or_si256 (_mm256_cmpeq_epi8 (block, c_dollar),
+									   _mm256_cmpeq_epi8 (block, c_percent)),
+							  _mm256_cmpeq_epi8 (block, c_backtick))));
+		if (at) {
+			/* end of local part found */
+			return result | __valvula_reader_escape_mask (value + iterator, bad, __builtin_ctz (at));
+		} /* end if */
+		if (bad)
+			result |= __valvula_reader_escape_mask (value + iterator, bad, 32);
+		iterator += 32;
+	} /* end while */
+#elif defined(__SSE2__)
+	unsigned int at;
+	unsigned int bad;
+	__m128i      block;
+	__m128i      c_at        = _mm_set1_epi8 ('@');
+	__m128i      c_quote     = _mm_set1_epi8 ('\'');
+	__m128i      c_semicolon = _mm_set1_epi8 (';');
+	__m128i      c_dollar    = _mm_set1_epi8 ('$');
+	__m128i      c_percent   = _mm_set1_epi8 ('%');
+	__m128i      c_backtick  = _mm_set1_epi8 ('`');
+
+	while ((iterator + 16) <= length) {
+		block = _mm_loadu_si128 ((const __m128i *) (value + iterator));
+		at    = (unsigned int) _mm_movemask_epi8 (_mm_cmpeq_epi8 (block, c_at));
+		bad   = (unsigned int) _mm_movemask_epi8 (
+			_mm_or_si128 (_mm_or_si128 (_mm_cmpeq_epi8 (block, c_quote),
+						    _mm_cmpeq_epi8 (block, c_semicolon)),
+				      _mm_or_si128 (_mm_or_si128 (_mm_cmpeq_epi8 (block, c_dollar),
+								  _mm_cmpeq_epi8 (block, c_percent)),
+						    _mm_cmpeq_epi8 (block, c_backtick))));
+		if (at) {
+			/* end of local part found */
+			return result | __valvula_reader_escape_mask (value + iterator, bad, __builtin_ctz (at));
+		} /* end if */
+		if (bad)
+			result |= __valvula_reader_escape_mask (value + iterator, bad, 16);
+		iterator += 16;
+	} /* end while */
+#endif
 
-	while (buffer[iterator] != '=' && buffer[iterator] != 0)
+	/* scalar scan for the rest of the value */
+	while (iterator < length) {
+		if (value[iterator] == '@')
+			return result;
+		result |= __valvula_reader_escape_class (value[iterator]);
 		iterator++;
+	} /* end while */
 
-	if (iterator > 0 && buffer[iterator] == '=') {
-		result    = axl_new (char *, 3);
+	/* no @ found: this is not an address */
+	return 0;
+}
 
-		/* key */
-		result[0] = axl_new (char, iterator + 1);
-		memcpy (result[0], buffer, iterator);
+/** 
+ * @brief Allows to check if the provided value is an address whose
+ * local part includes characters that must be escaped (' ; $ % `)
+ * before being used.
+ *
+ * @param ctx The context where the operation takes place.
+ *
+ * @param connection The connection where the value was received.
+ *
+ * @param key The attribute name.
+ *
+ * @param value The attribute value to check.
+ *
+ * @return axl_true if the value must be escaped, otherwise axl_false
+ * is returned.
+ */
+axl_bool  valvula_reader_check_sql_injection_to_escape (ValvulaCtx * ctx, ValvulaConnection * connection, const char * key, const char * value)
+{
+	if (value == NULL)
+		return axl_false;
 
-		/* value */
-		result[1] = axl_new (char, length - iterator + 1);
-		memcpy (result[1], buffer + iterator + 1, length - iterator -1);
+	return __valvula_reader_scan_local_part (value, strlen (value)) != 0;
+}
 
-		/* printf ("Reporting key: [%s], value: [%s]\n", result[0], result[1]); */
-		return result;
-	}
+/** 
+ * @internal Attributes mapped into \ref ValvulaRequest fields. The
+ * order must match __valvula_reader_attrs.
+ */
+typedef enum {
+	VALVULA_READER_ATTR_REQUEST,
+	VALVULA_READER_ATTR_PROTOCOL_STATE,
+	VALVULA_READER_ATTR_PROTOCOL_NAME,
+	VALVULA_READER_ATTR_QUEUE_ID,
+	VALVULA_READER_ATTR_SIZE,
+	VALVULA_READER_ATTR_MESSAGE_SIZE,
+	VALVULA_READER_ATTR_SENDER,
+	VALVULA_READER_ATTR_RECIPIENT,
+	VALVULA_READER_ATTR_RECIPIENT_COUNT,
+	VALVULA_READER_ATTR_HELO_NAME,
+	VALVULA_READER_ATTR_CLIENT_ADDRESS,
+	VALVULA_READER_ATTR_CLIENT_NAME,
+	VALVULA_READER_ATTR_REVERSE_CLIENT,
+	VALVULA_READER_ATTR_INSTANCE,
+	VALVULA_READER_ATTR_SASL_METHOD,
+	VALVULA_READER_ATTR_SASL_USERNAME,
+	VALVULA_READER_ATTR_SASL_SENDER,
+	VALVULA_READER_ATTR_CCERT_SUBJECT,
+	VALVULA_READER_ATTR_CCERT_ISSUER,
+	VALVULA_READER_ATTR_CCERT_FINGERPRINT,
+	VALVULA_READER_ATTR_CCERT_PUBKEY_FINGERPRINT,
+	VALVULA_READER_ATTR_ENCRYPTION_PROTOCOL,
+	VALVULA_READER_ATTR_ENCRYPTION_CIPHER,
+	VALVULA_READER_ATTR_ENCRYPTION_KEYSIZE,
+	VALVULA_READER_ATTR_ETRN_DOMAIN,
+	VALVULA_READER_ATTR_STRESS,
+	VALVULA_READER_ATTR_NUM
+} ValvulaReaderAttrId;
+
+typedef struct _ValvulaReaderAttr {
+	const char * name;
+	/* offset of the char * field holding the value or -1 */
+	int          field;
+	/* offset of the int field holding the value or -1 */
+	int          number;
+} ValvulaReaderAttr;
+
+static const ValvulaReaderAttr __valvula_reader_attrs[VALVULA_READER_ATTR_NUM] = {
+	{"request", offsetof (ValvulaRequest, request), -1},
+	{"protocol_state", offsetof (ValvulaRequest, protocol_state), -1},
+	{"protocol_name", offsetof (ValvulaRequest, protocol_name), -1},
+	{"queue_id", offsetof (ValvulaRequest, queue_id), -1},
+	{"size", -1, offsetof (ValvulaRequest, size)},
+	{"message_size", -1, offsetof (ValvulaRequest, size)},
+	{"sender", offsetof (ValvulaRequest, sender), -1},
+	{"recipient", offsetof (ValvulaRequest, recipient), -1},
+	{"recipient_count", -1, offsetof (ValvulaRequest, recipient_count)},
+	{"helo_name", offsetof (ValvulaRequest, helo_name), -1},
+	{"client_address", offsetof (ValvulaRequest, client_address), -1},
+	{"client_name", offsetof (ValvulaRequest, client_name), -1},
+	{"reverse_client", offsetof (ValvulaRequest, reverse_client), -1},
+	{"instance", offsetof (ValvulaRequest, instance), -1},
+	{"sasl_method", offsetof (ValvulaRequest, sasl_method), -1},
+	{"sasl_username", offsetof (ValvulaRequest, sasl_username), -1},
+	{"sasl_sender", offsetof (ValvulaRequest, sasl_sender), -1},
+	{"ccert_subject", offsetof (ValvulaRequest, ccert_subject), -1},
+	{"ccert_issuer", offsetof (ValvulaRequest, ccert_issuer), -1},
+	{"ccert_fingerprint", offsetof (ValvulaRequest, ccert_fingerprint), -1},
+	{"ccert_pubkey_fingerprint", offsetof (ValvulaRequest, ccert_pubkey_fingerprint), -1},
+	{"encryption_protocol", offsetof (ValvulaRequest, encryption_protocol), -1},
+	{"encryption_cipher", offsetof (ValvulaRequest, encryption_cipher), -1},
+	{"encryption_keysize", offsetof (ValvulaRequest, encryption_keysize), -1},
+	{"etrn_domain", offsetof (ValvulaRequest, etrn_domain), -1},
+	{"stress", offsetof (ValvulaRequest, stress), -1},
+};
+
+#define VALVULA_REQUEST_FIELD(request,offset) (*((char **) (((char *) (request)) + (offset))))
+#define VALVULA_REQUEST_NUMBER(request,offset) (*((int *) (((char *) (request)) + (offset))))
+
+#define VALVULA_READER_ATTR_CHECK(id) do {                                       \
+	if (memcmp (key, __valvula_reader_attrs[VALVULA_READER_ATTR_##id].name, length) == 0) \
+		return &__valvula_reader_attrs[VALVULA_READER_ATTR_##id];         \
+	} while (0)
 
+/** 
+ * @internal Finds the attribute definition for the provided key,
+ * dispatching by key length so at most a few comparisons are done.
+ *
+ * @return A reference to the attribute or NULL if it is not known.
+ */
+const ValvulaReaderAttr * __valvula_reader_attr_lookup (const char * key, int length)
+{
+	switch (length) {
+	case 4:
+		VALVULA_READER_ATTR_CHECK (SIZE);
+		break;
+	case 6:
+		VALVULA_READER_ATTR_CHECK (SENDER);
+		VALVULA_READER_ATTR_CHECK (STRESS);
+		break;
+	case 7:
+		VALVULA_READER_ATTR_CHECK (REQUEST);
+		break;
+	case 8:
+		VALVULA_READER_ATTR_CHECK (QUEUE_ID);
+		VALVULA_READER_ATTR_CHECK (INSTANCE);
+		break;
+	case 9:
+		VALVULA_READER_ATTR_CHECK (RECIPIENT);
+		VALVULA_READER_ATTR_CHECK (HELO_NAME);
+		break;
+	case 11:
+		VALVULA_READER_ATTR_CHECK (CLIENT_NAME);
+		VALVULA_READER_ATTR_CHECK (SASL_METHOD);
+		VALVULA_READER_ATTR_CHECK (SASL_SENDER);
+		VALVULA_READER_ATTR_CHECK (ETRN_DOMAIN);
+		break;
+	case 12:
+		VALVULA_READER_ATTR_CHECK (MESSAGE_SIZE);
+		VALVULA_READER_ATTR_CHECK (CCERT_ISSUER);
+		break;
+	case 13:
+		VALVULA_READER_ATTR_CHECK (PROTOCOL_NAME);
+		VALVULA_READER_ATTR_CHECK (SASL_USERNAME);
+		VALVULA_READER_ATTR_CHECK (CCERT_SUBJECT);
+		break;
+	case 14:
+		VALVULA_READER_ATTR_CHECK (PROTOCOL_STATE);
+		VALVULA_READER_ATTR_CHECK (CLIENT_ADDRESS);
+		VALVULA_READER_ATTR_CHECK (REVERSE_CLIENT);
+		break;
+	case 15:
+		VALVULA_READER_ATTR_CHECK (RECIPIENT_COUNT);
+		break;
+	case 17:
+		VALVULA_READER_ATTR_CHECK (CCERT_FINGERPRINT);
+		VALVULA_READER_ATTR_CHECK (ENCRYPTION_CIPHER);
+		break;
+	case 18:
+		VALVULA_READER_ATTR_CHECK (ENCRYPTION_KEYSIZE);
+		break;
+	case 19:
+		VALVULA_READER_ATTR_CHECK (ENCRYPTION_PROTOCOL);
+		break;
+	case 24:
+		VALVULA_READER_ATTR_CHECK (CCERT_PUBKEY_FINGERPRINT);
+		break;
+	default:
+		break;
+	} /* end switch */
+
+	/* attribute not known */
 	return NULL;
 }
 
+
+/** 
+ * @internal Ensures the request raw block has room for bytes more
+ * bytes, moving it into a bigger heap block (and updating all
+ * attributes already stored) if required.
+ */
+axl_bool __valvula_reader_request_reserve (ValvulaRequest * request, int bytes)
+{
+	char * raw;
+	int    size;
+	int    iterator;
+	int    field;
+
+	if (request->raw == NULL) {
+		request->raw      = request->raw_inline;
+		request->raw_size = VALVULA_REQUEST_INLINE_SIZE;
+	} /* end if */
+
+	if ((request->raw_length + bytes) <= request->raw_size)
+		return axl_true;
+
+	size = request->raw_size;
+	while ((request->raw_length + bytes) > size)
+		size = size * 2;
+
+	raw = axl_new (char, size);
+	if (raw == NULL)
+		return axl_false;
+	memcpy (raw, request->raw, request->raw_length);
+
+	/* point attributes to the new block */
+	for (iterator = 0; iterator < VALVULA_READER_ATTR_NUM; iterator++) {
+		field = __valvula_reader_attrs[iterator].field;
+		if (field != -1 && VALVULA_REQUEST_FIELD (request, field))
+			VALVULA_REQUEST_FIELD (request, field) = raw + (VALVULA_REQUEST_FIELD (request, field) - request->raw);
+	} /* end for */
+
+	if (request->raw != request->raw_inline)
+		axl_free (request->raw);
+	request->raw      = raw;
+	request->raw_size = size;
+
+	return axl_true;
+}
+
+/** 
+ * @internal Stores the provided value into the request raw block,
+ * escaping $ ' ; % ` characters if requested.
+ *
+ * @return A reference to the value stored (NUL terminated) or NULL if
+ * it fails.
+ */
+char * __valvula_reader_request_store (ValvulaRequest * request, const char * value, int length, axl_bool escape)
+{
+	char * result;
+	int    iterator;
+	int    written = 0;
+
+	if (! __valvula_reader_request_reserve (request, (escape ? length * 2 : length) + 1))
+		return NULL;
+
+	result = request->raw + request->raw_length;
+	if (escape) {
+		/* write escaped form in a single pass */
+		for (iterator = 0; iterator < length; iterator++) {
+			if (__valvula_reader_escape_class (value[iterator]))
+				result[written++] = '\\';
+			result[written++] = value[iterator];
+		} /* end for */
+	} else {
+		memcpy (result, value, length);
+		written = length;
+	} /* end if */
+
+	result[written]      = 0;
+	request->raw_length += written + 1;
+
+	return result;
+}
+
+/** 
+ * @internal Stores a key/value pair into the request generic
+ * attribute table (attributes not mapped into \ref ValvulaRequest
+ * fields).
+ */
+void __valvula_reader_request_store_attr (ValvulaCtx     * ctx,
+					  ValvulaRequest * request, 
+					  const char     * key, 
+					  int              key_length, 
+					  const char     * value, 
+					  int              value_length,
+					  axl_bool         escape)
+{
+	char * stored_key;
+	char * stored_value;
+
+	if (request->attrs_num >= VALVULA_REQUEST_MAX_ATTRS) {
+		valvula_log (VALVULA_LEVEL_DEBUG, "Skipping attribute %s, request attribute table is full (%d)", key, VALVULA_REQUEST_MAX_ATTRS);
+		return;
+	} /* end if */
+
+	stored_key   = __valvula_reader_request_store (request, key, key_length, axl_false);
+	if (stored_key == NULL)
+		return;
+	/* offset must be taken before storing the value because the
+	 * raw block may be moved */
+	request->attrs[request->attrs_num * 2] = stored_key - request->raw;
+
+	stored_value = __valvula_reader_request_store (request, value, value_length, escape);
+	if (stored_value == NULL)
+		return;
+	request->attrs[(request->attrs_num * 2) + 1] = stored_value - request->raw;
+	request->attrs_num++;
+
+	return;
+}
+
+/** 
+ * @brief Allows to get the value of any attribute received in the
+ * provided request, including those that are not mapped into a
+ * \ref ValvulaRequest field (for example "policy_context",
+ * "client_port" or "server_address").
+ *
+ * @param request The request to query.
+ *
+ * @param name The attribute name as sent by Postfix.
+ *
+ * @return A reference to the value (owned by the request) or NULL if
+ * it wasn't received or parameters are wrong.
+ */
+const char * valvula_request_get_attr (ValvulaRequest * request, const char * name)
+{
+	const ValvulaReaderAttr * attr;
+	int                       iterator;
+
+	if (request == NULL || name == NULL)
+		return NULL;
+
+	/* check attributes mapped into fields */
+	attr = __valvula_reader_attr_lookup (name, strlen (name));
+	if (attr && attr->field != -1)
+		return VALVULA_REQUEST_FIELD (request, attr->field);
+
+	/* check generic table */
+	for (iterator = 0; iterator < request->attrs_num; iterator++) {
+		if (axl_cmp (request->raw + request->attrs[iterator * 2], name))
+			return request->raw + request->attrs[(iterator * 2) + 1];
+	} /* end for */
+
+	return NULL;
+}
+
+/** 
+ * @internal Process a single line received on the provided
+ * connection, updating the request being built or launching its
+ * processing once the empty line is found.
+ *
+ * @return axl_true if the caller can continue processing lines or
+ * axl_false if the connection was closed.
+ */
+axl_bool __valvula_reader_process_line (ValvulaCtx        * ctx, 
+					ValvulaConnection * connection,
+					char              * buffer)
+{
+	char                    * key;
+	char                    * value;
+	int                       key_length;
+	int                       value_length;
+	axl_bool                  escape;
+	const ValvulaReaderAttr * attr;
+
+	axl_stream_trim (buffer);
+	valvula_log (VALVULA_LEVEL_DEBUG, "Found content line: %s (lines: %d)", buffer, connection->lines_found + 1);
+	if (axl_memcmp (buffer, "checkserver", 11)) {
+		valvula_log (VALVULA_LEVEL_DEBUG, "Received request to check server, reporting ok and closing connection: socket=%d",
+			     connection->session);
+		send (connection->session, "I'm running right", 17, 0);
+		connection->process_launched = axl_true;
+		valvula_connection_close (connection); 
+		return axl_false;
+	} /* end if */
+
+	/* increase number of lines found until now to limit them */
+	connection->lines_found += 1;
+	if (connection->lines_found > ctx->request_line_limit) {
+		valvula_log (VALVULA_LEVEL_CRITICAL, "Exceeded  line limit (%d) with %d while reading request, closing..",
+			     ctx->request_line_limit, connection->lines_found);
+		valvula_connection_close (connection);
+		return axl_false;
+	} /* ned if */
+
+	/* prepare request type to hold all info */
+	if (! connection->request) {
+		/* only clear header fields: raw_inline is always
+		 * written before being read */
+		connection->request = valvula_pool_alloc_header (VALVULA_POOL_REQUEST, sizeof (ValvulaRequest),
+								 offsetof (ValvulaRequest, raw_inline));
+		if (connection->request == NULL) {
+			valvula_log (VALVULA_LEVEL_CRITICAL, "unable to allocate memory to hold request, closing connection");
+			valvula_connection_close (connection);
+			return axl_false;
+		} /* end if */
+
+		/* stamp arrival: request deadline is counted from here */
+		gettimeofday (&connection->request->arrival, NULL);
+	} /* end if */
+
+	/* check for empty line so we can process the request */
+	axl_stream_trim (buffer);
+
+	if (strlen (buffer) == 0) {
+		/* request completed: queue it to be processed */
+		return __valvula_reader_queue_request (ctx, connection);
+	} /* end if */
+
+	/* parse line (key=value) and attach to the connection
+	 * request */
+	value = strchr (buffer, '=');
+	if (value == NULL || value == buffer) {
+		/* report error found */
+		valvula_log (VALVULA_LEVEL_CRITICAL, "Failed to process line received, empty content found or malformed, closing connection");
+		/* close connection */
+		valvula_connection_close (connection);
+		return axl_false;
+	} /* end if */
+	key          = buffer;
+	key_length   = value - buffer;
+	value[0]     = 0;
+	value++;
+	value_length = strlen (value);
+
+	/* check value is not a local part that can include escapable values */
+	escape = __valvula_reader_scan_local_part (value, value_length) != 0;
+
+	/* find attribute and store its value */
+	attr = __valvula_reader_attr_lookup (key, key_length);
+	if (attr && attr->field != -1) {
+		VALVULA_REQUEST_FIELD (connection->request, attr->field) = 
+			__valvula_reader_request_store (connection->request, value, value_length, escape);
+	} else {
+		if (attr)
+			VALVULA_REQUEST_NUMBER (connection->request, attr->number) = (int) valvula_support_strtod (value, NULL);
+
+		/* keep it into the generic attribute table so it can
+		 * be queried with valvula_request_get_attr */
+		__valvula_reader_request_store_attr (ctx, connection->request, key, key_length, value, value_length, escape);
+	} /* end if */
+
+	/* that's all I can do */
+	return axl_true;
+}
+
 /** 
  * @internal
  * 
@@ -674,157 +2301,110 @@ char ** __valvula_reader_get_items (const char * buffer)
 void __valvula_reader_process_socket (ValvulaCtx        * ctx, 
 				      ValvulaConnection * connection)
 {
+	int       bytes_read;
+	char    * line;
+	axl_bool  drain = valvula_io_waiting_is_edge_triggered (ctx);
 
-	char    buffer[2048];
-	int     bytes_read;
-	char ** items;
-
-	/* limit buffer */
-	memset (buffer, 0, 2048);
-	bytes_read = valvula_readline (connection, buffer, 2048);
-	if (bytes_read == -1) 
-		return;
-	if (bytes_read == -2) 
-		return; /* not ready yet */
-
-	axl_stream_trim (buffer);
-	valvula_log (VALVULA_LEVEL_DEBUG, "Found content line: %s (%d bytes, lines: %d)", buffer, bytes_read, connection->lines_found + 1);
-	if (axl_memcmp (buffer, "checkserver", 11)) {
-		valvula_log (VALVULA_LEVEL_DEBUG, "Received request to check server, reporting ok and closing connection: socket=%d",
-			     connection->session);
-		send (connection->session, "I'm running right", 17, 0);
-		connection->process_launched = axl_true;
-		valvula_connection_close (connection); 
-		return;
-	} /* end if */
+	do {
+		/* read all content available with a single call */
+		bytes_read = valvula_reader_fill_buffer (connection);
+		if (bytes_read == -1) {
+			/* failed to read, close connection */
+			valvula_connection_close (connection);
+			return;
+		} /* end if */
+		if (bytes_read == -2) 
+			return; /* not ready yet (or drained) */
+		if (bytes_read == 0) {
+			/* remote peer closed the connection */
+			valvula_connection_close (connection);
+			return;
+		} /* end if */
 
-	/* increase number of lines found until now to limit them */
-	connection->lines_found += 1;
-	if (connection->lines_found > ctx->request_line_limit) {
-		valvula_log (VALVULA_LEVEL_CRITICAL, "Exceeded  line limit (%d) with %d while reading request, closing..",
-			     ctx->request_line_limit, connection->lines_found);
-		valvula_connection_close (connection);
-		return;
-	} /* ned if */
+		/* now process all complete lines found */
+		while (valvula_connection_is_ok (connection)) {
+			line = valvula_reader_next_line (connection, VALVULA_READER_LINE_SIZE);
+			if (line == NULL)
+				break;
 
-	/* prepare request type to hold all info */
-	if (! connection->request)
-		connection->request = axl_new (ValvulaRequest, 1);
+			if (! __valvula_reader_process_line (ctx, connection, line))
+				break;
+		} /* end while */
 
-	/* check for empty line so we can process the request */
-	axl_stream_trim (buffer);
+		/* with edge-triggered notifications, keep reading
+		 * until EAGAIN because no more notifications will be
+		 * received for content already available */
+	} while (drain && valvula_connection_is_ok (connection));
 
-	if (strlen (buffer) == 0) {
-		/* check if the process was launched */
-	        if (connection->process_launched) {
-			valvula_log (VALVULA_LEVEL_DEBUG, "Connection close while processing on session=%d (%p), closing connection");
-			valvula_connection_close (connection);
-			return;
-		} /* end if */
+	return;
+}
 
-		/* flag we are about to launch the process */
-		connection->process_launched = axl_true; 
+/** 
+ * @internal Registers the provided connection into the reader fd
+ * group when the current I/O mechanism works in persistent
+ * registration mode (otherwise the fd group is built on every loop
+ * and nothing is done).
+ *
+ * @return axl_true if the connection was registered (or nothing was
+ * required), otherwise axl_false is returned and the connection is
+ * closed.
+ */
+axl_bool __valvula_reader_watch_socket (ValvulaReader * reader, ValvulaConnection * connection)
+{
+	ValvulaCtx * ctx = reader->ctx;
 
-		/* drop a log */
-		valvula_log (VALVULA_LEVEL_DEBUG, "Launching process request over connection session=%d (%p)", 
-			     connection->session, connection);
+	/* record the reader loop that watches this connection */
+	connection->reader = reader;
 
-		/* increase reference counting */
-		if (! valvula_connection_ref (connection, "valvula reader (process request)")) {
-			valvula_log (VALVULA_LEVEL_CRITICAL, "unable to increase connection reference count at process request, dropping connection");
-			valvula_connection_close (connection);
-			return;
-		} /* end if */
+	/* nothing to do if not persistent mode */
+	if (! valvula_io_waiting_is_persistent (ctx) || reader->on_reading == NULL)
+		return axl_true;
 
-		/* process request */
-		valvula_thread_pool_new_task (ctx, valvula_reader_process_request_proxy, connection);
-		return;
-	} /* end if */
+	/* already registered */
+	if (connection->watched)
+		return axl_true;
 
-	/* parse line and attach to the connection request */	
-	items = __valvula_reader_get_items (buffer);
-	if (items == NULL || items[0] == NULL || items[1] == NULL) {
-		/* report error found */
-		axl_freev (items);
-		valvula_log (VALVULA_LEVEL_CRITICAL, "Failed to process line received, empty content found or malformed, closing connection");
-		/* close connection */
+	if (! valvula_io_waiting_invoke_add_to_fd_group (ctx, valvula_connection_get_socket (connection), connection, reader->on_reading)) {
+		valvula_log (VALVULA_LEVEL_WARNING, 
+			     "unable to add the connection to the valvula reader watching set. This could mean you did reach the I/O waiting mechanism limit.");
 		valvula_connection_close (connection);
-		return;
+		return axl_false;
 	} /* end if */
 
-	/* check value is not a local part that can include escapable values */
-	if (valvula_reader_check_sql_injection_to_escape (ctx, connection, items[0], items[1])) {
-		/* escape/replace items */
-		axl_replace (items[1], "$", "\\$");
-		axl_replace (items[1], "'", "\\'");
-		axl_replace (items[1], ";", "\\;");
-		axl_replace (items[1], "%", "\\%");
-		axl_replace (items[1], "`", "\\`");
-	} /* end if */
+	/* flag the connection as registered */
+	connection->watched = axl_true;
+	return axl_true;
+}
+
+/** 
+ * @internal Removes from the provided list all connections that are
+ * no longer working. Used in persistent registration mode, where the
+ * fd group is not built again on every loop.
+ */
+void __valvula_reader_cleanup_closed (ValvulaCtx * ctx, axlListCursor * cursor)
+{
+	ValvulaConnection * connection;
 
-	if (axl_cmp (items[0], "request"))
-		valvula_reader_set_value (connection->request->request, items[1]);
-	else if (axl_cmp (items[0], "protocol_state"))
-		valvula_reader_set_value (connection->request->protocol_state, items[1]);
-	else if (axl_cmp (items[0], "protocol_name"))
-		valvula_reader_set_value (connection->request->protocol_name, items[1]);
-
-	else if (axl_cmp (items[0], "queue_id"))
-		valvula_reader_set_value (connection->request->queue_id, items[1]);
-	else if (axl_cmp (items[0], "size") || axl_cmp (items[0], "message_size")) 
-		connection->request->size = (int) valvula_support_strtod (items[1], NULL);
-
-	else if (axl_cmp (items[0], "sender")) 
-		valvula_reader_set_value (connection->request->sender, items[1]);
-	else if (axl_cmp (items[0], "recipient"))
-		valvula_reader_set_value (connection->request->recipient, items[1]);
-	else if (axl_cmp (items[0], "recipient_count"))
-		connection->request->recipient_count = valvula_support_strtod (items[1], NULL);
-
-	else if (axl_cmp (items[0], "helo_name"))
-		valvula_reader_set_value (connection->request->helo_name, items[1]);
-
-	else if (axl_cmp (items[0], "client_address"))
-		valvula_reader_set_value (connection->request->client_address, items[1]);
-	else if (axl_cmp (items[0], "client_name"))
-		valvula_reader_set_value (connection->request->client_name, items[1]);
-	else if (axl_cmp (items[0], "reverse_client"))
-		valvula_reader_set_value (connection->request->reverse_client, items[1]);
-	else if (axl_cmp (items[0], "instance"))
-		valvula_reader_set_value (connection->request->instance, items[1]);
-
-	else if (axl_cmp (items[0], "sasl_method"))
-		valvula_reader_set_value (connection->request->sasl_method, items[1]);
-	else if (axl_cmp (items[0], "sasl_username"))
-		valvula_reader_set_value (connection->request->sasl_username, items[1]);
-	else if (axl_cmp (items[0], "sasl_sender"))
-		valvula_reader_set_value (connection->request->sasl_sender, items[1]);
-
-	else if (axl_cmp (items[0], "ccert_subject"))
-		valvula_reader_set_value (connection->request->ccert_subject, items[1]);
-	else if (axl_cmp (items[0], "ccert_issuer"))
-		valvula_reader_set_value (connection->request->ccert_issuer, items[1]);
-	else if (axl_cmp (items[0], "ccert_fingerprint"))
-		valvula_reader_set_value (connection->request->ccert_fingerprint, items[1]);
-	else if (axl_cmp (items[0], "ccert_pubkey_fingerprint"))
-		valvula_reader_set_value (connection->request->ccert_pubkey_fingerprint, items[1]);
-
-	else if (axl_cmp (items[0], "encryption_protocol"))
-		valvula_reader_set_value (connection->request->encryption_protocol, items[1]);
-	else if (axl_cmp (items[0], "encryption_cipher"))
-		valvula_reader_set_value (connection->request->encryption_cipher, items[1]);
-	else if (axl_cmp (items[0], "encryption_keysize"))
-		valvula_reader_set_value (connection->request->encryption_keysize, items[1]);
-
-	else if (axl_cmp (items[0], "etrn_domain"))
-		valvula_reader_set_value (connection->request->etrn_domain, items[1]);
-	else if (axl_cmp (items[0], "stress"))
-		valvula_reader_set_value (connection->request->stress, items[1]);
-
-	/* release memory not needed */
-	axl_freev (items);
+	axl_list_cursor_first (cursor);
+	while (axl_list_cursor_has_item (cursor)) {
+
+		/* get current connection */
+		connection = axl_list_cursor_get (cursor);
+		if (! valvula_connection_is_ok (connection)) {
+			/* FIRST: remove current cursor to ensure the
+			 * connection is out of our handling before
+			 * finishing the reference the reader owns */
+			axl_list_cursor_unlink (cursor);
+
+			/* connection isn't ok, unref it */
+			valvula_connection_unref (connection, "valvula reader (cleanup)");
+			continue;
+		} /* end if */
+
+		/* get the next */
+		axl_list_cursor_next (cursor);
+	} /* end while */
 
-	/* that's all I can do */
 	return;
 }
 
@@ -839,7 +2419,7 @@ void __valvula_reader_process_socket (ValvulaCtx        * ctx,
  * @return axl_true if the item to be managed was clearly read or axl_false if
  * an error on registering the item was produced.
  */
-axl_bool   valvula_reader_register_watch (ValvulaReaderData * data, axlList * con_list, axlList * srv_list)
+axl_bool   valvula_reader_register_watch (ValvulaReader * reader, ValvulaReaderData * data)
 {
 	ValvulaConnection * connection;
 
@@ -860,11 +2440,19 @@ axl_bool   valvula_reader_register_watch (ValvulaReaderData * data, axlList * co
 		}
 			
 		/* now we have a first connection, we can start to wait */
-		axl_list_append (con_list, connection);
+		axl_list_append (reader->conn_list, connection);
 
+		/* register it (if persistent mode) */
+		__valvula_reader_watch_socket (reader, connection);
 		break;
 	case LISTENER:
-		axl_list_append (srv_list, connection);
+		/* listeners are accepted in batches until EAGAIN so
+		 * they must not block */
+		valvula_connection_set_sock_block (valvula_connection_get_socket (connection), axl_false);
+		axl_list_append (reader->srv_list, connection);
+
+		/* register it (if persistent mode) */
+		__valvula_reader_watch_socket (reader, connection);
 		break;
 	case TERMINATE:
 	case IO_WAIT_CHANGED:
@@ -880,36 +2468,39 @@ axl_bool   valvula_reader_register_watch (ValvulaReaderData * data, axlList * co
 /** 
  * @internal Valvula function to implement valvula reader I/O change.
  */
-ValvulaReaderData * __valvula_reader_change_io_mech (ValvulaCtx        * ctx,
-						   axlPointer       * on_reading, 
-						   axlList          * con_list, 
-						   axlList          * srv_list, 
+ValvulaReaderData * __valvula_reader_change_io_mech (ValvulaReader     * reader,
 						   ValvulaReaderData * data)
 {
 	/* get current context */
+	ValvulaCtx        * ctx = reader->ctx;
 	ValvulaReaderData * result;
 
 	valvula_log (VALVULA_LEVEL_DEBUG, "found I/O notification change");
 	
 	/* unref IO waiting object */
-	valvula_io_waiting_invoke_destroy_fd_group (ctx, *on_reading); 
-	*on_reading = NULL;
+	valvula_io_waiting_invoke_destroy_fd_group (ctx, reader->on_reading); 
+	reader->on_reading = NULL;
 	
 	/* notify preparation done and lock until new
 	 * I/O is installed */
 	valvula_log (VALVULA_LEVEL_DEBUG, "notify valvula reader preparation done");
-	valvula_async_queue_push (ctx->reader_stopped, INT_TO_PTR(1));
+	valvula_async_queue_push (reader->reader_stopped, INT_TO_PTR(1));
 	
 	/* free data use the function that includes that knoledge */
-	valvula_reader_register_watch (data, con_list, srv_list);
+	valvula_reader_register_watch (reader, data);
 	
 	/* lock */
 	valvula_log (VALVULA_LEVEL_DEBUG, "lock until new API is installed");
-	result = valvula_async_queue_pop (ctx->reader_queue);
+	result = valvula_async_queue_pop (reader->reader_queue);
 
 	/* initialize the read set */
 	valvula_log (VALVULA_LEVEL_DEBUG, "unlocked, creating new I/O mechanism used current API");
-	*on_reading = valvula_io_waiting_invoke_create_fd_group (ctx, READ_OPERATIONS);
+	reader->on_reading = valvula_io_waiting_invoke_create_fd_group (ctx, READ_OPERATIONS);
+
+	/* in persistent mode, register again all sockets on the new
+	 * fd group because they are not added on every loop */
+	if (valvula_io_waiting_is_persistent (ctx))
+		__valvula_reader_build_set_to_watch (ctx, reader->on_reading, reader->conn_cursor, reader->srv_cursor);
 
 	return result;
 }
@@ -930,17 +2521,14 @@ ValvulaReaderData * __valvula_reader_change_io_mech (ValvulaCtx        * ctx,
  * @return axl_true to keep valvula reader working, axl_false if valvula reader
  * should stop.
  */
-axl_bool      valvula_reader_read_queue (ValvulaCtx  * ctx,
-					axlList    * con_list, 
-					axlList    * srv_list, 
-					axlPointer * on_reading)
+axl_bool      valvula_reader_read_queue (ValvulaReader * reader)
 {
 	/* get current context */
 	ValvulaReaderData * data;
 	int                should_continue;
 
 	do {
-		data            = valvula_async_queue_pop (ctx->reader_queue);
+		data            = valvula_async_queue_pop (reader->reader_queue);
 
 		/* check if we have to continue working */
 		should_continue = (data->type != TERMINATE);
@@ -948,14 +2536,10 @@ axl_bool      valvula_reader_read_queue (ValvulaCtx  * ctx,
 		/* check if the io/wait mech have changed */
 		if (data->type == IO_WAIT_CHANGED) {
 			/* change io mechanism */
-			data = __valvula_reader_change_io_mech (ctx,
-							       on_reading, 
-							       con_list, 
-							       srv_list, 
-							       data);
+			data = __valvula_reader_change_io_mech (reader, data);
 		} /* end if */
 
-	}while (!valvula_reader_register_watch (data, con_list, srv_list));
+	}while (!valvula_reader_register_watch (reader, data));
 
 	return should_continue;
 }
@@ -965,29 +2549,22 @@ axl_bool      valvula_reader_read_queue (ValvulaCtx  * ctx,
  * more connections to watch, to check if it has to terminate or to
  * check at run time the I/O waiting mechanism used.
  * 
- * @param con_list The set of connections already watched.
- *
- * @param srv_list The set of listener connections already watched.
- *
- * @param on_reading A reference to the I/O waiting object, in the
- * case the I/O waiting mechanism is changed.
+ * @param reader The reader loop where the pending items are read.
  * 
  * @return axl_true to flag the process to continue working to to stop.
  */
-axl_bool      valvula_reader_read_pending (ValvulaCtx  * ctx,
-					  axlList    * con_list, 
-					  axlList    * srv_list, 
-					  axlPointer * on_reading)
+axl_bool      valvula_reader_read_pending (ValvulaReader * reader)
 {
 	/* get current context */
+	ValvulaCtx        * ctx = reader->ctx;
 	ValvulaReaderData * data;
 	int                length;
 	axl_bool           should_continue = axl_true;
 
-	length = valvula_async_queue_length (ctx->reader_queue);
+	length = valvula_async_queue_length (reader->reader_queue);
 	while (length > 0) {
 		length--;
-		data            = valvula_async_queue_pop (ctx->reader_queue);
+		data            = valvula_async_queue_pop (reader->reader_queue);
 
 		valvula_log (VALVULA_LEVEL_DEBUG, "read pending type=%d",
 			    data->type);
@@ -998,13 +2575,13 @@ axl_bool      valvula_reader_read_pending (ValvulaCtx  * ctx,
 		/* check if the io/wait mech have changed */
 		if (data->type == IO_WAIT_CHANGED) {
 			/* change io mechanism */
-			data = __valvula_reader_change_io_mech (ctx, on_reading, con_list, srv_list, data);
+			data = __valvula_reader_change_io_mech (reader, data);
 
 		} /* end if */
 
 		/* watch the request received, maybe a connection or a
 		 * valvula reader command to process  */
-		valvula_reader_register_watch (data, con_list, srv_list);
+		valvula_reader_register_watch (reader, data);
 		
 	} /* end while */
 
@@ -1013,27 +2590,58 @@ axl_bool      valvula_reader_read_pending (ValvulaCtx  * ctx,
 
 void valvula_reader_accept_connections (ValvulaCtx * ctx, int fds, ValvulaConnection * listener)
 {
-	VALVULA_SOCKET      new_socket = valvula_listener_accept (fds);
+	VALVULA_SOCKET      new_socket;
 	ValvulaConnection * conn;
+	ValvulaReader     * reader     = listener->reader;
+	ValvulaConnection * master     = listener->listener ? listener->listener : listener;
+	int                 accepted   = 0;
+
+	/* accept all pending connections (up to a limit to not starve
+	 * the rest of connections watched by this reader). Listeners
+	 * are always watched level-triggered (even when the epoll
+	 * backend is edge-triggered) so connections left pending
+	 * (because the limit was reached or accept failed, i.e.
+	 * EMFILE) are notified again on next wait */
+	while (accepted < VALVULA_READER_ACCEPT_BATCH) {
+		new_socket = valvula_listener_accept_nonblocking (fds);
+		if (new_socket < 0) {
+			if (errno == VALVULA_EINTR)
+				continue;
+			if (errno == VALVULA_EWOULDBLOCK || errno == VALVULA_EAGAIN)
+				break;
+			valvula_log (VALVULA_LEVEL_CRITICAL, "Failed to accept incoming socket from %d (errno=%d)",
+				     fds, errno);
+			break;
+		} /* end if */
 
-	if (new_socket < 0) {
-		valvula_log (VALVULA_LEVEL_CRITICAL, "Failed to accept incoming socket from %d (errno=%d)",
-			     fds, errno);
-		return;
-	} /* end if */
+		/* configure accepted socket as the listener states */
+		if (master->tcp_nodelay)
+			valvula_connection_set_sock_tcp_nodelay (new_socket, axl_true);
 
-	/* create connection */
-	conn = valvula_connection_new_empty (ctx, new_socket, ValvulaRoleListener);
-	if (conn == NULL) {
-		valvula_log (VALVULA_LEVEL_CRITICAL, "Failed to create connection reference (ValvulaConnection)");
-		return;
-	}
+		/* create connection */
+		conn = valvula_connection_new_empty (ctx, new_socket, ValvulaRoleListener);
+		if (conn == NULL) {
+			valvula_log (VALVULA_LEVEL_CRITICAL, "Failed to create connection reference (ValvulaConnection)");
+			valvula_close_socket (new_socket);
+			break;
+		}
+
+		/* configure listener (for listener shards running on other
+		 * reader loops, report the master listener) */
+		conn->listener = master;
 
-	/* configure listener */
-	conn->listener = listener;
+		/* watch connection on the same reader loop that accepted it */
+		axl_list_append (reader->conn_list, conn);
 
-	/* watch listener */
-	axl_list_append (ctx->conn_list, conn);
+		/* register it (if persistent mode) */
+		__valvula_reader_watch_socket (reader, conn);
+
+		/* next connection */
+		accepted++;
+	} /* end while */
+
+	if (accepted > 1)
+		valvula_log (VALVULA_LEVEL_DEBUG, "accepted %d connections from listener socket %d in one pass", accepted, fds);
 	
 	return;
 }
@@ -1096,6 +2704,9 @@ VALVULA_SOCKET __valvula_reader_build_set_to_watch_aux (ValvulaCtx     * ctx,
 			continue;
 		} /* end if */
 
+		/* flag it as registered if the mechanism keeps it */
+		connection->watched = valvula_io_waiting_is_persistent (ctx);
+
 		/* get the next */
 		axl_list_cursor_next (cursor);
 
@@ -1246,34 +2857,36 @@ int  __valvula_reader_check_listener_list (ValvulaCtx     * ctx,
  * memory used.
  * 
  */
-void __valvula_reader_stop_process (ValvulaCtx     * ctx,
-				   axlPointer      on_reading, 
-				   axlListCursor * conn_cursor, 
-				   axlListCursor * srv_cursor)
+void __valvula_reader_stop_process (ValvulaReader * reader)
 
 {
+	ValvulaCtx * ctx = reader->ctx;
+
 	/* stop valvula reader process unreferring already managed
 	 * connections */
 
-	valvula_async_queue_unref (ctx->reader_queue);
+	valvula_async_queue_unref (reader->reader_queue);
 
 	/* unref listener connections */
-	valvula_log (VALVULA_LEVEL_DEBUG, "cleaning pending %d listener connections..", axl_list_length (ctx->srv_list));
-	ctx->srv_list = NULL;
-	axl_list_free (axl_list_cursor_list (srv_cursor));
-	axl_list_cursor_free (srv_cursor);
+	valvula_log (VALVULA_LEVEL_DEBUG, "cleaning pending %d listener connections..", axl_list_length (reader->srv_list));
+	reader->srv_list = NULL;
+	axl_list_free (axl_list_cursor_list (reader->srv_cursor));
+	axl_list_cursor_free (reader->srv_cursor);
+	reader->srv_cursor = NULL;
 
 	/* unref initiators connections */
-	valvula_log (VALVULA_LEVEL_DEBUG, "cleaning pending %d peer connections..", axl_list_length (ctx->conn_list));
-	ctx->conn_list = NULL;
-	axl_list_free (axl_list_cursor_list (conn_cursor));
-	axl_list_cursor_free (conn_cursor);
+	valvula_log (VALVULA_LEVEL_DEBUG, "cleaning pending %d peer connections..", axl_list_length (reader->conn_list));
+	reader->conn_list = NULL;
+	axl_list_free (axl_list_cursor_list (reader->conn_cursor));
+	axl_list_cursor_free (reader->conn_cursor);
+	reader->conn_cursor = NULL;
 
 	/* unref IO waiting object */
-	valvula_io_waiting_invoke_destroy_fd_group (ctx, on_reading); 
+	valvula_io_waiting_invoke_destroy_fd_group (ctx, reader->on_reading); 
+	reader->on_reading = NULL;
 
 	/* signal that the valvula reader process is stopped */
-	valvula_async_queue_push (ctx->reader_stopped, INT_TO_PTR (1));
+	valvula_async_queue_push (reader->reader_stopped, INT_TO_PTR (1));
 
 	return;
 }
@@ -1361,30 +2974,30 @@ axl_bool __valvula_reader_detect_and_cleanup_connection (axlListCursor * cursor)
 	return axl_true;
 }
 
-void __valvula_reader_detect_and_cleanup_connections (ValvulaCtx * ctx)
+void __valvula_reader_detect_and_cleanup_connections (ValvulaReader * reader)
 {
 	/* check all listeners */
-	axl_list_cursor_first (ctx->conn_cursor);
-	while (axl_list_cursor_has_item (ctx->conn_cursor)) {
+	axl_list_cursor_first (reader->conn_cursor);
+	while (axl_list_cursor_has_item (reader->conn_cursor)) {
 
 		/* get the connection */
-		if (! __valvula_reader_detect_and_cleanup_connection (ctx->conn_cursor))
+		if (! __valvula_reader_detect_and_cleanup_connection (reader->conn_cursor))
 			continue;
 
 		/* get the next */
-		axl_list_cursor_next (ctx->conn_cursor);
+		axl_list_cursor_next (reader->conn_cursor);
 	} /* end while */
 
 	/* check all listeners */
-	axl_list_cursor_first (ctx->srv_cursor);
-	while (axl_list_cursor_has_item (ctx->srv_cursor)) {
+	axl_list_cursor_first (reader->srv_cursor);
+	while (axl_list_cursor_has_item (reader->srv_cursor)) {
 
 	  /* get the connection */
-	  if (! __valvula_reader_detect_and_cleanup_connection (ctx->srv_cursor))
+	  if (! __valvula_reader_detect_and_cleanup_connection (reader->srv_cursor))
 		   continue; 
 
 	    /* get the next */
-	    axl_list_cursor_next (ctx->srv_cursor); 
+	    axl_list_cursor_next (reader->srv_cursor); 
 	} /* end while */
 
 	/* clear errno after cleaning descriptors */
@@ -1395,59 +3008,85 @@ void __valvula_reader_detect_and_cleanup_connections (ValvulaCtx * ctx)
 	return; 
 }
 
-axlPointer __valvula_reader_run (ValvulaCtx * ctx)
+axlPointer __valvula_reader_run (ValvulaReader * reader)
 {
+	ValvulaCtx        * ctx         = reader->ctx;
 	VALVULA_SOCKET      max_fds     = 0;
 	VALVULA_SOCKET      result;
 	int                error_tries = 0;
+	long               last_cleanup = 0;
 
 	/* initialize the read set */
-	ctx->on_reading  = valvula_io_waiting_invoke_create_fd_group (ctx, READ_OPERATIONS);
+	reader->on_reading  = valvula_io_waiting_invoke_create_fd_group (ctx, READ_OPERATIONS);
 
 	/* create lists */
-	ctx->conn_list = axl_list_new (axl_list_always_return_1, __valvula_reader_close_connection);
-	ctx->srv_list = axl_list_new (axl_list_always_return_1, __valvula_reader_close_connection);
+	reader->conn_list = axl_list_new (axl_list_always_return_1, __valvula_reader_close_connection);
+	reader->srv_list = axl_list_new (axl_list_always_return_1, __valvula_reader_close_connection);
 
 	/* create cursors */
-	ctx->conn_cursor = axl_list_cursor_new (ctx->conn_list);
-	ctx->srv_cursor = axl_list_cursor_new (ctx->srv_list);
-
+	reader->conn_cursor = axl_list_cursor_new (reader->conn_list);
+	reader->srv_cursor = axl_list_cursor_new (reader->srv_list);
+
+	/* pin reader loop if configured */
+	valvula_mutex_lock (&ctx->readers_mutex);
+	if (ctx->readers_cpus && valvula_thread_set_affinity (NULL, ctx->readers_cpus, reader->id)) 
+		valvula_log (VALVULA_LEVEL_DEBUG, "reader loop %d running on cpu %d (numa node %d)", 
+			     reader->id, valvula_thread_get_cpu (), valvula_thread_get_numa_node (valvula_thread_get_cpu ()));
+	valvula_mutex_unlock (&ctx->readers_mutex);
 	
 
 	/* first step. Waiting blocked for our first connection to
 	 * listen */
  __valvula_reader_run_first_connection:
-	if (!valvula_reader_read_queue (ctx, ctx->conn_list, ctx->srv_list, &(ctx->on_reading))) {
+	if (!valvula_reader_read_queue (reader)) {
 		/* seems that the valvula reader main loop should
 		 * stop */
-		__valvula_reader_stop_process (ctx, ctx->on_reading, ctx->conn_cursor, ctx->srv_cursor);
+		__valvula_reader_stop_process (reader);
 		return NULL;
 	}
 
 	while (axl_true) {
 
-		/* reset descriptor set */
-		valvula_io_waiting_invoke_clear_fd_group (ctx, ctx->on_reading);
+		if (valvula_io_waiting_is_persistent (ctx)) {
+			/* persistent mode: sockets are already
+			 * registered, just release closed connections
+			 * (at most once per second) */
+			if (last_cleanup != valvula_now ()) {
+				last_cleanup = valvula_now ();
+				__valvula_reader_cleanup_closed (ctx, reader->srv_cursor);
+				__valvula_reader_cleanup_closed (ctx, reader->conn_cursor);
+			} /* end if */
 
-		if ((axl_list_length (ctx->conn_list) == 0) && (axl_list_length (ctx->srv_list) == 0)) {
-			valvula_log (VALVULA_LEVEL_DEBUG, "no more connection to watch for, putting thread to sleep");
-			goto __valvula_reader_run_first_connection;
-		}
+			if ((axl_list_length (reader->conn_list) == 0) && (axl_list_length (reader->srv_list) == 0)) {
+				valvula_log (VALVULA_LEVEL_DEBUG, "no more connection to watch for, putting thread to sleep");
+				goto __valvula_reader_run_first_connection;
+			}
+		} else {
+			/* reset descriptor set */
+			valvula_io_waiting_invoke_clear_fd_group (ctx, reader->on_reading);
 
-		/* build socket descriptor to be read */
-		max_fds = __valvula_reader_build_set_to_watch (ctx, ctx->on_reading, ctx->conn_cursor, ctx->srv_cursor);
-		if (errno == EBADF) {
-			valvula_log (VALVULA_LEVEL_CRITICAL, "Found wrong file descriptor error...(max_fds=%d, errno=%d), cleaning", max_fds, errno);
-			/* detect and cleanup wrong connections */
-			__valvula_reader_detect_and_cleanup_connections (ctx);
-			continue;
+			if ((axl_list_length (reader->conn_list) == 0) && (axl_list_length (reader->srv_list) == 0)) {
+				valvula_log (VALVULA_LEVEL_DEBUG, "no more connection to watch for, putting thread to sleep");
+				goto __valvula_reader_run_first_connection;
+			}
+
+			/* build socket descriptor to be read */
+			max_fds = __valvula_reader_build_set_to_watch (ctx, reader->on_reading, reader->conn_cursor, reader->srv_cursor);
+			if (errno == EBADF) {
+				valvula_log (VALVULA_LEVEL_CRITICAL, "Found wrong file descriptor error...(max_fds=%d, errno=%d), cleaning", max_fds, errno);
+				/* detect and cleanup wrong connections */
+				__valvula_reader_detect_and_cleanup_connections (reader);
+				continue;
+			} /* end if */
 		} /* end if */
 		
 		/* perform IO blocking wait for read operation */
-		result = valvula_io_waiting_invoke_wait (ctx, ctx->on_reading, max_fds, READ_OPERATIONS);
+		result = valvula_io_waiting_invoke_wait (ctx, reader->on_reading, max_fds, READ_OPERATIONS);
 
-		/* do automatic thread pool resize here */
-		__valvula_thread_pool_automatic_resize (ctx);  
+		/* do automatic thread pool resize here (only from the
+		 * first reader loop) */
+		if (reader->id == 0)
+			__valvula_thread_pool_automatic_resize (ctx);  
 
 		/* check for timeout error */
 		if (result == -1 || result == -2)
@@ -1469,7 +3108,7 @@ axlPointer __valvula_reader_run (ValvulaCtx * ctx)
 		/* check for fatal error */
 		if (result == -3) {
 			valvula_log (VALVULA_LEVEL_CRITICAL, "fatal error received from io-wait function, exiting from valvula reader process..");
-			__valvula_reader_stop_process (ctx, ctx->on_reading, ctx->conn_cursor, ctx->srv_cursor);
+			__valvula_reader_stop_process (reader);
 			return NULL;
 		}
 
@@ -1477,18 +3116,18 @@ axlPointer __valvula_reader_run (ValvulaCtx * ctx)
 		if (result > 0) {
 			/* check if the mechanism have automatic
 			 * dispatch */
-			if (valvula_io_waiting_invoke_have_dispatch (ctx, ctx->on_reading)) {
+			if (valvula_io_waiting_invoke_have_dispatch (ctx, reader->on_reading)) {
 				/* perform automatic dispatch,
 				 * providing the dispatch function and
 				 * the number of sockets changed */
-				valvula_io_waiting_invoke_dispatch (ctx, ctx->on_reading, __valvula_reader_dispatch_connection, result, ctx);
+				valvula_io_waiting_invoke_dispatch (ctx, reader->on_reading, __valvula_reader_dispatch_connection, result, ctx);
 
 			} else {
 				/* call to check listener connections */
-				result = __valvula_reader_check_listener_list (ctx, ctx->on_reading, ctx->srv_cursor, result);
+				result = __valvula_reader_check_listener_list (ctx, reader->on_reading, reader->srv_cursor, result);
 			
 				/* check for each connection to be watch is it have check */
-				__valvula_reader_check_connection_list (ctx, ctx->on_reading, ctx->conn_cursor, result);
+				__valvula_reader_check_connection_list (ctx, reader->on_reading, reader->conn_cursor, result);
 			} /* end if */
 		}
 
@@ -1500,8 +3139,8 @@ axlPointer __valvula_reader_run (ValvulaCtx * ctx)
 		error_tries = 0;
 
 		/* read new connections to be managed */
-		if (!valvula_reader_read_pending (ctx, ctx->conn_list, ctx->srv_list, &(ctx->on_reading))) {
-			__valvula_reader_stop_process (ctx, ctx->on_reading, ctx->conn_cursor, ctx->srv_cursor);
+		if (!valvula_reader_read_pending (reader)) {
+			__valvula_reader_stop_process (reader);
 			return NULL;
 		}
 	}
@@ -1510,33 +3149,104 @@ axlPointer __valvula_reader_run (ValvulaCtx * ctx)
 
 /** 
  * @brief Function that returns the number of connections that are
- * currently watched by the reader.
+ * currently watched by the reader (all reader loops).
  * @param ctx The context where the reader loop is located.
  * @return Number of connections watched. 
  */
 int  valvula_reader_connections_watched         (ValvulaCtx        * ctx)
 {
-	if (ctx == NULL || ctx->conn_list == NULL || ctx->srv_list == NULL)
+	int             iterator;
+	int             result = 0;
+	ValvulaReader * reader;
+
+	if (ctx == NULL)
 		return 0;
+
+	iterator = 0;
+	while (iterator < ctx->readers_num) {
+		reader = ctx->readers[iterator];
+		if (reader->conn_list && reader->srv_list)
+			result += axl_list_length (reader->conn_list) + axl_list_length (reader->srv_list);
+
+		/* next reader */
+		iterator++;
+	} /* end while */
 	
 	/* return list */
-	return axl_list_length (ctx->conn_list) + axl_list_length (ctx->srv_list);
+	return result;
+}
+
+/** 
+ * @brief Function that returns the number of listeners that are
+ * currently watched by the reader (all reader loops, including
+ * listener shards).
+ * @param ctx The context where the reader loop is located.
+ * @return Number of listeners watched. 
+ */
+int  valvula_reader_listeners_watched           (ValvulaCtx        * ctx)
+{
+	int             iterator;
+	int             result = 0;
+	ValvulaReader * reader;
+
+	if (ctx == NULL)
+		return 0;
+
+	iterator = 0;
+	while (iterator < ctx->readers_num) {
+		reader = ctx->readers[iterator];
+		if (reader->srv_list)
+			result += axl_list_length (reader->srv_list);
+
+		/* next reader */
+		iterator++;
+	} /* end while */
+	
+	return result;
+}
+
+/** 
+ * @brief Function that returns the number of items pending to be
+ * handled by the reader loops (new connections, listeners or
+ * commands).
+ * @param ctx The context where the reader loop is located.
+ * @return Number of items pending. 
+ */
+int  valvula_reader_pending_items               (ValvulaCtx        * ctx)
+{
+	int             iterator;
+	int             result = 0;
+
+	if (ctx == NULL)
+		return 0;
+
+	iterator = 0;
+	while (iterator < ctx->readers_num) {
+		result += valvula_async_queue_items (ctx->readers[iterator]->reader_queue);
+
+		/* next reader */
+		iterator++;
+	} /* end while */
+	
+	return result;
 }
 
 /** 
  * @internal
  * 
  * Adds a new connection to be watched on valvula reader process. This
- * function is for internal valvula library use.
+ * function is for internal valvula library use. Connections are
+ * spread across the available reader loops.
  **/
 void valvula_reader_watch_connection (ValvulaCtx        * ctx,
 				     ValvulaConnection * connection)
 {
 	/* get current context */
 	ValvulaReaderData * data;
+	ValvulaReader     * reader;
 
 	v_return_if_fail (valvula_connection_is_ok (connection));
-	v_return_if_fail (ctx->reader_queue);
+	v_return_if_fail (ctx->readers_num > 0);
 
 	if (!valvula_connection_set_nonblocking_socket (connection)) {
 		valvula_log (VALVULA_LEVEL_CRITICAL, "unable to set non-blocking I/O operation, at connection registration, closing session");
@@ -1549,13 +3259,19 @@ void valvula_reader_watch_connection (ValvulaCtx        * ctx,
 		return;
 	}
 
+	/* select next reader loop */
+	valvula_mutex_lock (&ctx->readers_mutex);
+	reader = ctx->readers[ctx->readers_next % ctx->readers_num];
+	ctx->readers_next++;
+	valvula_mutex_unlock (&ctx->readers_mutex);
+
 	/* prepare data to be queued */
 	data             = axl_new (ValvulaReaderData, 1);
 	data->type       = CONNECTION;
 	data->connection = connection;
 
 	/* push data */
-	valvula_async_queue_push (ctx->reader_queue, data);
+	valvula_async_queue_push (reader->reader_queue, data);
 
 	return;
 }
@@ -1563,14 +3279,17 @@ void valvula_reader_watch_connection (ValvulaCtx        * ctx,
 /** 
  * @internal
  *
- * Install a new listener to watch for new incoming connections.
+ * Install a new listener to watch for new incoming connections on
+ * the provided reader loop.
  **/
-void valvula_reader_watch_listener   (ValvulaCtx        * ctx,
-				     ValvulaConnection * listener)
+void __valvula_reader_watch_listener_on (ValvulaCtx        * ctx,
+					 ValvulaConnection * listener,
+					 int                 reader_id)
 {
 	/* get current context */
 	ValvulaReaderData * data;
 	v_return_if_fail (listener > 0);
+	v_return_if_fail (reader_id >= 0 && reader_id < ctx->readers_num);
 	
 	/* prepare data to be queued */
 	data             = axl_new (ValvulaReaderData, 1);
@@ -1578,11 +3297,87 @@ void valvula_reader_watch_listener   (ValvulaCtx        * ctx,
 	data->connection = listener;
 
 	/* push data */
-	valvula_async_queue_push (ctx->reader_queue, data);
+	valvula_async_queue_push (ctx->readers[reader_id]->reader_queue, data);
+
+	return;
+}
+
+/** 
+ * @internal
+ *
+ * Install a new listener to watch for new incoming connections. The
+ * listener is watched by the first reader loop and its shards (if
+ * any) are watched by the rest of reader loops.
+ **/
+void valvula_reader_watch_listener   (ValvulaCtx        * ctx,
+				     ValvulaConnection * listener)
+{
+	int                 iterator;
+	ValvulaConnection * shard;
+
+	v_return_if_fail (listener > 0);
+
+	/* watch master listener on the first reader */
+	__valvula_reader_watch_listener_on (ctx, listener, 0);
+
+	/* now watch shards */
+	iterator = 0;
+	while (listener->shards && iterator < axl_list_length (listener->shards)) {
+		shard = axl_list_get_nth (listener->shards, iterator);
+
+		/* shard n is watched by reader n + 1 */
+		__valvula_reader_watch_listener_on (ctx, shard, (iterator + 1) % ctx->readers_num);
+
+		/* next shard */
+		iterator++;
+	} /* end while */
 
 	return;
 }
 
+/** 
+ * @internal Creates and starts a new reader loop.
+ */
+axl_bool  __valvula_reader_start (ValvulaCtx * ctx)
+{
+	ValvulaReader * reader;
+
+	if (ctx->readers_num >= VALVULA_READER_MAX_NUM) {
+		valvula_log (VALVULA_LEVEL_CRITICAL, "unable to start more reader loops, max limit reached (%d)", VALVULA_READER_MAX_NUM);
+		return axl_false;
+	} /* end if */
+
+	reader                 = axl_new (ValvulaReader, 1);
+	reader->ctx            = ctx;
+	reader->id             = ctx->readers_num;
+
+	/* reader_queue */
+	reader->reader_queue   = valvula_async_queue_new ();
+
+	/* reader stopped */
+	reader->reader_stopped = valvula_async_queue_new ();
+
+	/* create the valvula reader main thread */
+	if (! valvula_thread_create (&reader->thread, 
+				    (ValvulaThreadFunc) __valvula_reader_run,
+				    reader,
+				    VALVULA_THREAD_CONF_END)) {
+		valvula_log (VALVULA_LEVEL_CRITICAL, "unable to start valvula reader loop");
+		valvula_async_queue_unref (reader->reader_queue);
+		valvula_async_queue_unref (reader->reader_stopped);
+		axl_free (reader);
+		return axl_false;
+	} /* end if */
+
+	/* register reader */
+	valvula_mutex_lock (&ctx->readers_mutex);
+	ctx->readers[ctx->readers_num] = reader;
+	ctx->readers_num++;
+	valvula_mutex_unlock (&ctx->readers_mutex);
+	
+	return axl_true;
+}
+
 /** 
  * @internal
  * 
@@ -1597,24 +3392,115 @@ axl_bool  valvula_reader_run (ValvulaCtx * ctx)
 {
 	v_return_val_if_fail (ctx, axl_false);
 
-	/* reader_queue */
-	ctx->reader_queue   = valvula_async_queue_new ();
+	valvula_mutex_create (&ctx->readers_mutex);
 
-	/* reader stopped */
-	ctx->reader_stopped = valvula_async_queue_new ();
+	/* start first reader loop: more can be added with
+	 * valvula_reader_set_num */
+	return __valvula_reader_start (ctx);
+}
 
-	/* create the valvula reader main thread */
-	if (! valvula_thread_create (&ctx->reader_thread, 
-				    (ValvulaThreadFunc) __valvula_reader_run,
-				    ctx,
-				    VALVULA_THREAD_CONF_END)) {
-		valvula_log (VALVULA_LEVEL_CRITICAL, "unable to start valvula reader loop");
+/** 
+ * @brief Allows to configure the number of reader loops (threads
+ * doing protocol I/O: accepting connections, reading and parsing
+ * requests) used by the provided context. 
+ *
+ * Each reader loop has its own listener sockets (bound with
+ * SO_REUSEPORT so the kernel spreads new connections among them)
+ * and its own set of connections. The thread pool and the handler
+ * registry are shared by all reader loops.
+ *
+ * This function must be called after \ref valvula_init_ctx but
+ * before creating listeners because only listeners created after
+ * this call are sharded across reader loops. Currently the number of
+ * reader loops can only be increased.
+ *
+ * @param ctx The context to configure.
+ *
+ * @param num Number of reader loops to use (1 by default).
+ *
+ * @return axl_true if the number of reader loops was configured,
+ * otherwise axl_false is returned.
+ */
+axl_bool  valvula_reader_set_num (ValvulaCtx * ctx, int num)
+{
+	v_return_val_if_fail (ctx && ctx->readers_num > 0, axl_false);
+	v_return_val_if_fail (num > 0 && num <= VALVULA_READER_MAX_NUM, axl_false);
+
+	if (num < ctx->readers_num) {
+		valvula_log (VALVULA_LEVEL_WARNING, "unable to reduce reader loops from %d to %d, keeping current configuration", 
+			     ctx->readers_num, num);
 		return axl_false;
 	} /* end if */
-	
+
+	/* start missing reader loops */
+	while (ctx->readers_num < num) {
+		if (! __valvula_reader_start (ctx))
+			return axl_false;
+	} /* end while */
+
+	valvula_log (VALVULA_LEVEL_DEBUG, "running %d reader loops", ctx->readers_num);
 	return axl_true;
 }
 
+/** 
+ * @brief Allows to pin reader loops to a set of CPUs. Each reader
+ * loop is pinned to a single CPU taken from the list in order
+ * (wrapping around when there are more reader loops than CPUs) so
+ * memory allocated by it is placed on that CPU NUMA node.
+ *
+ * The configuration is applied to running reader loops and to those
+ * started later with \ref valvula_reader_set_num.
+ *
+ * @param ctx The context to configure.
+ *
+ * @param cpus CPU list in the format used by the kernel ("0-3,8").
+ *
+ * @return axl_true if all reader loops were pinned, otherwise
+ * axl_false is returned (wrong CPU list or thread affinity not
+ * supported by the platform).
+ */
+axl_bool  valvula_reader_set_cpus (ValvulaCtx * ctx, const char * cpus)
+{
+	ValvulaReader * reader;
+	int             iterator;
+	axl_bool        result = axl_true;
+
+	v_return_val_if_fail (ctx && cpus, axl_false);
+
+	valvula_mutex_lock (&ctx->readers_mutex);
+	for (iterator = 0; iterator < ctx->readers_num; iterator++) {
+		reader = ctx->readers[iterator];
+		if (! valvula_thread_set_affinity (&reader->thread, cpus, reader->id)) {
+			result = axl_false;
+			break;
+		} /* end if */
+	} /* end for */
+
+	/* record for reader loops started later */
+	if (result) {
+		axl_free (ctx->readers_cpus);
+		ctx->readers_cpus = axl_strdup (cpus);
+	} /* end if */
+	valvula_mutex_unlock (&ctx->readers_mutex);
+
+	return result;
+}
+
+/** 
+ * @brief Allows to get the number of reader loops running on the
+ * provided context.
+ *
+ * @param ctx The context where the operation takes place.
+ *
+ * @return Number of reader loops or -1 if it fails.
+ */
+int       valvula_reader_get_num (ValvulaCtx * ctx)
+{
+	if (ctx == NULL)
+		return -1;
+	return ctx->readers_num;
+}
+
 /** 
  * @internal
  * @brief Cleanup valvula reader process.
@@ -1623,6 +3509,8 @@ void valvula_reader_stop (ValvulaCtx * ctx)
 {
 	/* get current context */
 	ValvulaReaderData * data;
+	ValvulaReader     * reader;
+	int                 iterator;
 
 	/* skip reader stop as indicated */
 	if (ctx->skip_reader_stop)
@@ -1630,28 +3518,45 @@ void valvula_reader_stop (ValvulaCtx * ctx)
 
 	valvula_log (VALVULA_LEVEL_DEBUG, "stopping valvula reader ..");
 
-	/* create a bacon to signal valvula reader that it should stop
-	 * and unref resources */
-	data       = axl_new (ValvulaReaderData, 1);
-	data->type = TERMINATE;
+	iterator = 0;
+	while (iterator < ctx->readers_num) {
+		reader = ctx->readers[iterator];
+
+		/* create a bacon to signal valvula reader that it should stop
+		 * and unref resources */
+		data       = axl_new (ValvulaReaderData, 1);
+		data->type = TERMINATE;
+
+		/* push data */
+		valvula_log (VALVULA_LEVEL_DEBUG, "pushing data stop signal (reader %d)..", reader->id);
+		valvula_async_queue_push (reader->reader_queue, data);
+		valvula_log (VALVULA_LEVEL_DEBUG, "signal sent reader ..");
+
+		/* waiting until the reader is stoped */
+		valvula_log (VALVULA_LEVEL_DEBUG, "waiting valvula reader 10 seconds to stop");
+		if (PTR_TO_INT (valvula_async_queue_timedpop (reader->reader_stopped, 10000000))) {
+			valvula_log (VALVULA_LEVEL_DEBUG, "valvula reader properly stopped, cleaning thread..");
+			/* terminate thread */
+			valvula_thread_destroy (&reader->thread, axl_false);
+
+			/* clear queue */
+			valvula_async_queue_unref (reader->reader_stopped);
+			reader->reader_stopped = NULL;
+
+			/* release reader */
+			axl_free (reader);
+		} else {
+			valvula_log (VALVULA_LEVEL_WARNING, "timeout while waiting valvula reader thread to stop..");
+		}
+		ctx->readers[iterator] = NULL;
 
-	/* push data */
-	valvula_log (VALVULA_LEVEL_DEBUG, "pushing data stop signal..");
-	valvula_async_queue_push (ctx->reader_queue, data);
-	valvula_log (VALVULA_LEVEL_DEBUG, "signal sent reader ..");
-
-	/* waiting until the reader is stoped */
-	valvula_log (VALVULA_LEVEL_DEBUG, "waiting valvula reader 10 seconds to stop");
-	if (PTR_TO_INT (valvula_async_queue_timedpop (ctx->reader_stopped, 10000000))) {
-		valvula_log (VALVULA_LEVEL_DEBUG, "valvula reader properly stopped, cleaning thread..");
-		/* terminate thread */
-		valvula_thread_destroy (&ctx->reader_thread, axl_false);
-
-		/* clear queue */
-		valvula_async_queue_unref (ctx->reader_stopped);
-	} else {
-		valvula_log (VALVULA_LEVEL_WARNING, "timeout while waiting valvula reader thread to stop..");
-	}
+		/* next reader */
+		iterator++;
+	} /* end while */
+
+	/* no reader loop running */
+	ctx->readers_num = 0;
+	valvula_mutex_destroy (&ctx->readers_mutex);
 
 	return;
 }
@@ -1667,24 +3572,31 @@ void valvula_reader_stop (ValvulaCtx * ctx)
 axl_bool  valvula_reader_notify_change_io_api               (ValvulaCtx * ctx)
 {
 	ValvulaReaderData * data;
+	int                 iterator;
 
 	/* check if the valvula reader is running */
-	if (ctx == NULL || ctx->reader_queue == NULL)
+	if (ctx == NULL || ctx->readers_num == 0)
 		return axl_false;
 
 	valvula_log (VALVULA_LEVEL_DEBUG, "stopping valvula reader due to a request for a I/O notify change...");
 
-	/* create a bacon to signal valvula reader that it should stop
-	 * and unref resources */
-	data       = axl_new (ValvulaReaderData, 1);
-	data->type = IO_WAIT_CHANGED;
+	iterator = 0;
+	while (iterator < ctx->readers_num) {
+		/* create a bacon to signal valvula reader that it should stop
+		 * and unref resources */
+		data       = axl_new (ValvulaReaderData, 1);
+		data->type = IO_WAIT_CHANGED;
 
-	/* push data */
-	valvula_log (VALVULA_LEVEL_DEBUG, "pushing signal to notify I/O change..");
-	valvula_async_queue_push (ctx->reader_queue, data);
+		/* push data */
+		valvula_log (VALVULA_LEVEL_DEBUG, "pushing signal to notify I/O change..");
+		valvula_async_queue_push (ctx->readers[iterator]->reader_queue, data);
+
+		/* waiting until the reader is stoped */
+		valvula_async_queue_pop (ctx->readers[iterator]->reader_stopped);
 
-	/* waiting until the reader is stoped */
-	valvula_async_queue_pop (ctx->reader_stopped);
+		/* next reader */
+		iterator++;
+	} /* end while */
 
 	valvula_log (VALVULA_LEVEL_DEBUG, "done, now valvula reader will wait until the new API is installed..");
 
@@ -1698,15 +3610,22 @@ axl_bool  valvula_reader_notify_change_io_api               (ValvulaCtx * ctx)
 void valvula_reader_notify_change_done_io_api   (ValvulaCtx * ctx)
 {
 	ValvulaReaderData * data;
+	int                 iterator;
 
-	/* create a bacon to signal valvula reader that it should stop
-	 * and unref resources */
-	data       = axl_new (ValvulaReaderData, 1);
-	data->type = IO_WAIT_READY;
+	iterator = 0;
+	while (iterator < ctx->readers_num) {
+		/* create a bacon to signal valvula reader that it should stop
+		 * and unref resources */
+		data       = axl_new (ValvulaReaderData, 1);
+		data->type = IO_WAIT_READY;
 
-	/* push data */
-	valvula_log (VALVULA_LEVEL_DEBUG, "pushing signal to notify I/O is ready..");
-	valvula_async_queue_push (ctx->reader_queue, data);
+		/* push data */
+		valvula_log (VALVULA_LEVEL_DEBUG, "pushing signal to notify I/O is ready..");
+		valvula_async_queue_push (ctx->readers[iterator]->reader_queue, data);
+
+		/* next reader */
+		iterator++;
+	} /* end while */
 
 	valvula_log (VALVULA_LEVEL_DEBUG, "notification done..");
 
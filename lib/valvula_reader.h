@@ -46,8 +46,29 @@ void valvula_reader_watch_connection            (ValvulaCtx         * ctx,
 
 int  valvula_reader_connections_watched         (ValvulaCtx        * ctx);
 
+int  valvula_reader_listeners_watched           (ValvulaCtx        * ctx);
+
+int  valvula_reader_pending_items               (ValvulaCtx        * ctx);
+
+int  valvula_readline                          (ValvulaConnection * connection,
+						 char              * buffer,
+						 int                 maxlen);
+
+int  valvula_reader_fill_buffer                 (ValvulaConnection * connection);
+
+char * valvula_reader_next_line                 (ValvulaConnection * connection,
+						 int                 maxlen);
+
 int  valvula_reader_run                         (ValvulaCtx * ctx);
 
+axl_bool valvula_reader_set_num                 (ValvulaCtx * ctx,
+						 int          num);
+
+int  valvula_reader_get_num                     (ValvulaCtx * ctx);
+
+axl_bool valvula_reader_set_cpus                (ValvulaCtx * ctx,
+						 const char * cpus);
+
 void valvula_reader_stop                        (ValvulaCtx * ctx);
 
 int  valvula_reader_notify_change_io_api        (ValvulaCtx * ctx);
@@ -643,6 +643,8 @@ const char * valvula_support_state_str              (ValvulaState state)
 		return "FILTER";
 	case VALVULA_STATE_LOG:
 		return "LOG";
+	case VALVULA_STATE_PENDING:
+		return "PENDING";
 		/* do not place here a default; we want an error here when some case is not handled */
 	}
 
@@ -33,6 +33,11 @@
  *      Email address:
  *         info@aspl.es - http://www.aspl.es/valvula
  */
+/* cpu_set_t, pthread_setaffinity_np and sched_getcpu are GNU
+ * extensions (detected by configure with _GNU_SOURCE) */
+#if defined(VALVULA_HAVE_AFFINITY) && ! defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
 #include <valvula.h>
 
 #define LOG_DOMAIN "valvula-thread"
@@ -406,6 +411,201 @@ void valvula_thread_set_destroy (ValvulaThreadDestroyFunc destroy_fn)
 		__valvula_thread_destroy = valvula_thread_destroy_internal;
 }
 
+/** 
+ * @internal Max number of CPUs supported by thread placement
+ * functions.
+ */
+#define VALVULA_THREAD_MAX_CPUS  1024
+
+/** 
+ * @internal Max number of NUMA nodes checked by thread placement
+ * functions.
+ */
+#define VALVULA_THREAD_MAX_NODES 64
+
+/** 
+ * @internal Parses a CPU list in the format used by the kernel
+ * ("0-3,8,10-11") into the provided array.
+ *
+ * @return Number of CPUs found or -1 if the list is not valid.
+ */
+int __valvula_thread_parse_cpus (const char * cpus, int * list, int max)
+{
+	const char * pos = cpus;
+	char       * end;
+	long         first;
+	long         last;
+	int          count = 0;
+
+	if (cpus == NULL)
+		return -1;
+
+	while (*pos) {
+		/* skip separators */
+		while (*pos == ',' || *pos == ' ' || *pos == '\n')
+			pos++;
+		if (*pos == 0)
+			break;
+
+		/* get first cpu and, if defined, last cpu of the range */
+		first = strtol (pos, &end, 10);
+		if (end == pos || first < 0)
+			return -1;
+		last  = first;
+		pos   = end;
+		if (*pos == '-') {
+			pos++;
+			last = strtol (pos, &end, 10);
+			if (end == pos || last < first)
+				return -1;
+			pos  = end;
+		} /* end if */
+
+		if ((*pos && *pos != ',' && *pos != ' ' && *pos != '\n') || last >= VALVULA_THREAD_MAX_CPUS)
+			return -1;
+
+		while (first <= last && count < max) {
+			list[count] = first;
+			count++;
+			first++;
+		} /* end while */
+	} /* end while */
+
+	return count;
+}
+
+/** 
+ * @brief Allows to pin a thread to a set of CPUs.
+ *
+ * @param thread_def The thread to configure or NULL to configure the
+ * calling thread.
+ *
+ * @param cpus CPU list in the format used by the kernel, for example
+ * "0-3,8,10-11".
+ *
+ * @param index If -1, the thread is allowed to run on all CPUs in the
+ * list. Otherwise, the thread is pinned to the CPU found at that
+ * position in the list (wrapping around), which allows to spread
+ * several threads one per CPU.
+ *
+ * @return axl_true if the placement was applied, otherwise axl_false
+ * is returned (wrong CPU list or thread affinity not supported by the
+ * platform).
+ */
+axl_bool           valvula_thread_set_affinity (ValvulaThread * thread_def,
+						const char    * cpus,
+						int             index)
+{
+#if defined(VALVULA_HAVE_AFFINITY)
+	int       list[VALVULA_THREAD_MAX_CPUS];
+	int       count;
+	int       iterator;
+	cpu_set_t set;
+
+	count = __valvula_thread_parse_cpus (cpus, list, VALVULA_THREAD_MAX_CPUS);
+	if (count <= 0)
+		return axl_false;
+
+	CPU_ZERO (&set);
+	if (index >= 0) 
+		CPU_SET (list[index % count], &set);
+	else {
+		for (iterator = 0; iterator < count; iterator++)
+			CPU_SET (list[iterator], &set);
+	} /* end if */
+
+	return pthread_setaffinity_np (thread_def ? *thread_def : pthread_self (), sizeof (cpu_set_t), &set) == 0;
+#else
+	return axl_false;
+#endif
+}
+
+/** 
+ * @brief Returns the CPU where the calling thread is running.
+ *
+ * @return CPU number or -1 if it is not supported by the platform.
+ */
+int                valvula_thread_get_cpu (void)
+{
+#if defined(VALVULA_HAVE_AFFINITY)
+	return sched_getcpu ();
+#else
+	return -1;
+#endif
+}
+
+#if defined(VALVULA_HAVE_AFFINITY)
+/* cpu -> numa node map, loaded from sysfs on first use */
+static int            __valvula_thread_numa_nodes = 1;
+static unsigned char  __valvula_thread_numa_map[VALVULA_THREAD_MAX_CPUS];
+static pthread_once_t __valvula_thread_numa_once  = PTHREAD_ONCE_INIT;
+
+void __valvula_thread_numa_load (void)
+{
+	char   path[64];
+	char   buffer[1024];
+	int    list[VALVULA_THREAD_MAX_CPUS];
+	int    node;
+	int    count;
+	int    iterator;
+	FILE * file;
+
+	for (node = 0; node < VALVULA_THREAD_MAX_NODES; node++) {
+		sprintf (path, "/sys/devices/system/node/node%d/cpulist", node);
+		file = fopen (path, "r");
+		if (file == NULL)
+			break;
+
+		if (fgets (buffer, sizeof (buffer), file)) {
+			count = __valvula_thread_parse_cpus (buffer, list, VALVULA_THREAD_MAX_CPUS);
+			for (iterator = 0; iterator < count; iterator++)
+				__valvula_thread_numa_map[list[iterator]] = node;
+		} /* end if */
+		fclose (file);
+
+		__valvula_thread_numa_nodes = node + 1;
+	} /* end for */
+
+	return;
+}
+#endif
+
+/** 
+ * @brief Returns the NUMA node the provided CPU belongs to.
+ *
+ * @param cpu The CPU to check (see \ref valvula_thread_get_cpu).
+ *
+ * @return The NUMA node (0 if the platform has no NUMA support or the
+ * CPU is not valid).
+ */
+int                valvula_thread_get_numa_node (int cpu)
+{
+#if defined(VALVULA_HAVE_AFFINITY)
+	pthread_once (&__valvula_thread_numa_once, __valvula_thread_numa_load);
+	if (cpu < 0 || cpu >= VALVULA_THREAD_MAX_CPUS)
+		return 0;
+	return __valvula_thread_numa_map[cpu];
+#else
+	return 0;
+#endif
+}
+
+/** 
+ * @brief Returns the number of NUMA nodes found on the system.
+ *
+ * @return Number of NUMA nodes (1 if the platform has no NUMA
+ * support).
+ */
+int                valvula_thread_get_numa_nodes (void)
+{
+#if defined(VALVULA_HAVE_AFFINITY)
+	pthread_once (&__valvula_thread_numa_once, __valvula_thread_numa_load);
+	return __valvula_thread_numa_nodes;
+#else
+	return 1;
+#endif
+}
+
 /** 
  * @brief Allows to create a new mutex to protect critical sections to
  * be executed by several threads at the same time.
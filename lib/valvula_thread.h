@@ -57,6 +57,16 @@ void               valvula_thread_set_create (ValvulaThreadCreateFunc  create_fn
 
 void               valvula_thread_set_destroy(ValvulaThreadDestroyFunc destroy_fn);
 
+axl_bool           valvula_thread_set_affinity (ValvulaThread * thread_def,
+						const char    * cpus,
+						int             index);
+
+int                valvula_thread_get_cpu  (void);
+
+int                valvula_thread_get_numa_node (int cpu);
+
+int                valvula_thread_get_numa_nodes (void);
+
 axl_bool           valvula_mutex_create    (ValvulaMutex       * mutex_def);
 
 axl_bool           valvula_mutex_destroy   (ValvulaMutex       * mutex_def);
@@ -41,9 +41,93 @@
 
 #define LOG_DOMAIN "valvula-thread-pool"
 
+/** 
+ * @internal Number of tasks each worker deque can hold. Tasks
+ * submitted when the selected deque is full are placed into the pool
+ * overflow list.
+ */
+#define VALVULA_THREAD_POOL_DEQUE_SIZE  256
+
+/** 
+ * @internal Max number of worker slots a thread pool can have.
+ */
+#define VALVULA_THREAD_POOL_MAX_WORKERS 1024
+
+/** 
+ * @internal Number of buckets used to record queue wait times: bucket
+ * N holds waits below 2^N microseconds (the last one everything
+ * above).
+ */
+#define VALVULA_THREAD_POOL_WAIT_BUCKETS 25
+
+/** 
+ * @internal Length (microseconds) of the window used to sample queue
+ * wait and service times before resizing the pool.
+ */
+#define VALVULA_THREAD_POOL_SAMPLE_WINDOW 250000
+
+/** 
+ * @internal Queue wait p99 (microseconds) above which the pool is
+ * grown without waiting for thread_add_period.
+ */
+#define VALVULA_THREAD_POOL_WAIT_TARGET 10000
+
+/** 
+ * @internal Utilization (percent) the pool is sized for when
+ * estimating threads needed from the measured load.
+ */
+#define VALVULA_THREAD_POOL_UTILIZATION 75
+
+/* valvula thread pool struct used by valvula library to notify to tasks
+ * to be performed to valvula thread pool */
+typedef struct _ValvulaThreadPoolTask {
+	ValvulaThreadFunc                func;
+	axlPointer                       data;
+	/* when the task was submitted (queue wait tracking) */
+	struct timeval                   queued;
+	/* next task when placed into the overflow list */
+	struct _ValvulaThreadPoolTask  * next;
+} ValvulaThreadPoolTask;
+
+/* a worker: a thread from the pool and its bounded task deque */
+typedef struct _ValvulaThreadPoolWorker {
+	ValvulaMutex             mutex;
+	ValvulaThreadPoolTask  * tasks[VALVULA_THREAD_POOL_DEQUE_SIZE];
+	int                      head;
+	int                      count;
+
+	/* slot is being used by a running thread */
+	axl_bool                 active;
+	int                      index;
+	ValvulaThreadPool      * pool;
+} ValvulaThreadPoolWorker;
+
 struct _ValvulaThreadPool {
-	/* new tasks to be procesed */
-	ValvulaAsyncQueue * queue;
+	/* per thread task deques (work stealing) */
+	ValvulaThreadPoolWorker * workers[VALVULA_THREAD_POOL_MAX_WORKERS];
+	int                       workers_num;
+	int                       next_worker;
+
+	/* tasks that didn't fit into worker deques */
+	ValvulaMutex              overflow_mutex;
+	ValvulaThreadPoolTask   * overflow_first;
+	ValvulaThreadPoolTask   * overflow_last;
+	int                       overflow_count;
+
+	/* tasks pending to be processed (deques + overflow) */
+	int                       pending;
+
+	/* idle threads waiting for work */
+	ValvulaMutex              park_mutex;
+	ValvulaCond               park_cond;
+	int                       parked;
+	axl_bool                  timer_keeper;
+
+	/* threads requested to finish (pool reduced) and finished
+	 * threads pending to be collected */
+	int                       to_remove;
+	int                       to_collect;
+
 	ValvulaMutex        mutex;
 	
 	/* list of threads */
@@ -54,7 +138,15 @@ struct _ValvulaThreadPool {
 	/* list of events */
 	axlList          * events;
 	axlListCursor    * events_cursor;
-	axl_bool           processing_events;
+
+	/* timer service: events ordered by deadline (min-heap) and
+	 * the thread that sleeps until the next one expires */
+	struct _ValvulaThreadPoolEvent ** heap;
+	int                               heap_num;
+	int                               heap_size;
+	ValvulaThread                   * timer;
+	ValvulaCond                       timer_cond;
+	axl_bool                          timer_stop;
 
 	/* context */
 	ValvulaCtx        * ctx;
@@ -71,14 +163,26 @@ struct _ValvulaThreadPool {
 	axl_bool           preemtive;
 	struct timeval     last;
 
-};
+	/* queue wait and service time samples of the current window */
+	int                wait_hist[VALVULA_THREAD_POOL_WAIT_BUCKETS];
+	long               service_total;
+	int                service_count;
+	struct timeval     window_start;
 
-/* valvula thread pool struct used by valvula library to notify to tasks
- * to be performed to valvula thread pool */
-typedef struct _ValvulaThreadPoolTask {
-	ValvulaThreadFunc   func;
-	axlPointer         data;
-} ValvulaThreadPoolTask;
+	/* figures computed from the last closed window */
+	long               wait_p50;
+	long               wait_p99;
+	long               service_avg;
+	int                busy_threads;
+
+	/* CPUs where pool threads are pinned */
+	char             * cpus;
+
+	/* shrink hysteresis: since when the pool is oversized */
+	axl_bool           oversized;
+	struct timeval     oversized_since;
+
+};
 
 /* struct used to represent async events */
 typedef struct _ValvulaThreadPoolEvent {
@@ -88,19 +192,32 @@ typedef struct _ValvulaThreadPoolEvent {
 	long                     delay;
 	struct timeval           next_step;
 	int                      ref_count;
+
+	/* position inside the timer heap (-1 if not scheduled) */
+	int                      heap_index;
+	/* the event handler is being executed by the pool */
+	axl_bool                 running;
+	/* the event was removed */
+	axl_bool                 removed;
+	ValvulaThreadPool      * pool;
 } ValvulaThreadPoolEvent;
 
 typedef struct _ValvulaThreadPoolStarter {
-	ValvulaThreadPool * pool;
-	ValvulaThread     * thread;
-	ValvulaAsyncQueue * queue;
+	ValvulaThreadPool       * pool;
+	ValvulaThread           * thread;
+	ValvulaThreadPoolWorker * worker;
 } ValvulaThreadPoolStarter;
 
+#if defined(AXL_OS_UNIX)
+/* worker running on the current thread (if any) */
+static __thread ValvulaThreadPoolWorker * __valvula_thread_pool_current = NULL;
+#endif
+
 /* update next step to the appropiate value */
 void __valvula_thread_pool_increase_stamp (ValvulaThreadPoolEvent * event)
 {
 	/* increase seconds part */
-	if ((event->next_step.tv_usec + event->delay) > 1000000) {
+	if ((event->next_step.tv_usec + event->delay) >= 1000000) {
 		/* update seconds part */
 		event->next_step.tv_sec += ((event->next_step.tv_usec + event->delay) / 1000000);
 	} /* end if */
@@ -120,192 +237,699 @@ void __valvula_thread_pool_unref_event (axlPointer _event)
 	return;
 }
 
-void __valvula_thread_pool_process_events (ValvulaCtx * ctx, ValvulaThreadPool * pool)
+/** 
+ * @internal Returns axl_true if event a expires before event b.
+ */
+axl_bool __valvula_thread_pool_event_before (ValvulaThreadPoolEvent * a, ValvulaThreadPoolEvent * b)
 {
-	int                     length;
-	int                     iterator;
-	struct timeval          now;
-	ValvulaThreadPoolEvent * event;
+	if (a->next_step.tv_sec != b->next_step.tv_sec)
+		return a->next_step.tv_sec < b->next_step.tv_sec;
+	return a->next_step.tv_usec < b->next_step.tv_usec;
+}
 
-	/* reference to implement the call */
-	ValvulaThreadAsyncEvent   func;
-	axlPointer               data;
-	axlPointer               data2;
+/** 
+ * @internal Places the event at the provided heap position.
+ */
+void __valvula_thread_pool_heap_set (ValvulaThreadPool * pool, int position, ValvulaThreadPoolEvent * event)
+{
+	pool->heap[position] = event;
+	event->heap_index    = position;
+	return;
+}
+
+/** 
+ * @internal Moves the event at the provided position to its place
+ * in the heap.
+ */
+void __valvula_thread_pool_heap_fix (ValvulaThreadPool * pool, int position)
+{
+	ValvulaThreadPoolEvent * event = pool->heap[position];
+	int                      parent;
+	int                      child;
+
+	/* move up */
+	while (position > 0) {
+		parent = (position - 1) / 2;
+		if (! __valvula_thread_pool_event_before (event, pool->heap[parent]))
+			break;
+		__valvula_thread_pool_heap_set (pool, position, pool->heap[parent]);
+		position = parent;
+	} /* end while */
+
+	/* move down */
+	while (axl_true) {
+		child = (position * 2) + 1;
+		if (child >= pool->heap_num)
+			break;
+		if ((child + 1) < pool->heap_num && __valvula_thread_pool_event_before (pool->heap[child + 1], pool->heap[child]))
+			child++;
+		if (! __valvula_thread_pool_event_before (pool->heap[child], event))
+			break;
+		__valvula_thread_pool_heap_set (pool, position, pool->heap[child]);
+		position = child;
+	} /* end while */
+
+	__valvula_thread_pool_heap_set (pool, position, event);
+	return;
+}
+
+/** 
+ * @internal Schedules the event into the timer heap (pool->mutex
+ * must be held), waking up the timer thread if it is now the first
+ * event to expire.
+ */
+axl_bool __valvula_thread_pool_heap_push (ValvulaThreadPool * pool, ValvulaThreadPoolEvent * event)
+{
+	ValvulaThreadPoolEvent ** heap;
+
+	if (pool->heap_num == pool->heap_size) {
+		heap = axl_realloc (pool->heap, sizeof (ValvulaThreadPoolEvent *) * (pool->heap_size + 32));
+		if (heap == NULL)
+			return axl_false;
+		pool->heap       = heap;
+		pool->heap_size += 32;
+	} /* end if */
+
+	__valvula_thread_pool_heap_set (pool, pool->heap_num, event);
+	pool->heap_num++;
+	__valvula_thread_pool_heap_fix (pool, event->heap_index);
+
+	if (event->heap_index == 0)
+		valvula_cond_signal (&pool->timer_cond);
+	return axl_true;
+}
+
+/** 
+ * @internal Removes the event from the timer heap (pool->mutex must
+ * be held).
+ */
+void __valvula_thread_pool_heap_remove (ValvulaThreadPool * pool, ValvulaThreadPoolEvent * event)
+{
+	int position = event->heap_index;
 
-	/* ensure only one thread is processing */
-	if (valvula_is_exiting (ctx))
+	if (position < 0)
 		return;
 
-	/* acquire lock */
+	pool->heap_num--;
+	if (position != pool->heap_num) {
+		__valvula_thread_pool_heap_set (pool, position, pool->heap[pool->heap_num]);
+		__valvula_thread_pool_heap_fix (pool, position);
+	} /* end if */
+	event->heap_index = -1;
+
+	return;
+}
+
+/** 
+ * @internal Runs an expired event inside the pool and schedules it
+ * again or removes it according to the handler result.
+ */
+axlPointer __valvula_thread_pool_run_event (axlPointer _event)
+{
+	ValvulaThreadPoolEvent * event = _event;
+	ValvulaThreadPool      * pool  = event->pool;
+	ValvulaCtx             * ctx   = pool->ctx;
+	axl_bool                 remove;
+	struct timeval           now;
+
+	/* call to notify event */
+	remove = event->func (ctx, event->data, event->data2);
+
 	valvula_mutex_lock (&pool->mutex);
-	/* ensure again we can continue */
-	if (pool->processing_events || axl_list_length (pool->events) == 0 || valvula_is_exiting (ctx)) {
-		valvula_mutex_unlock (&pool->mutex);
-		return;
+	event->running = axl_false;
+	if (! event->removed) {
+		if (remove) {
+			/* the user asked to remove the event */
+			event->removed = axl_true;
+			axl_list_remove_ptr (pool->events, event);
+		} else {
+			/* schedule it again, from its previous
+			 * deadline so the period is kept, unless
+			 * we are late */
+			__valvula_thread_pool_increase_stamp (event);
+			gettimeofday (&now, NULL);
+			if (now.tv_sec > event->next_step.tv_sec || 
+			    (now.tv_sec == event->next_step.tv_sec && now.tv_usec > event->next_step.tv_usec)) {
+				event->next_step = now;
+				__valvula_thread_pool_increase_stamp (event);
+			} /* end if */
+			__valvula_thread_pool_heap_push (pool, event);
+		} /* end if */
 	} /* end if */
 
-	/* flag we are processing */
-	pool->processing_events = axl_true;
-	length = axl_list_length (pool->events);
+	/* release reference acquired by the timer */
+	__valvula_thread_pool_unref_event (event);
 	valvula_mutex_unlock (&pool->mutex);
-	
-	/* get current stamp */
-	gettimeofday (&now, NULL);
-	iterator = 0;
-	/* valvula_log2 (VALVULA_LEVEL_DEBUG, "Found (%d) events to process: now (%d, %d)..", length, (int) now.tv_sec, (int) now.tv_usec); */
-	while (iterator < length) {
 
-		/* get event reference */
-		valvula_mutex_lock (&pool->mutex);
-		event = axl_list_get_nth (pool->events, iterator);
-		if (event == NULL) {
-			valvula_mutex_unlock (&pool->mutex);
+	return NULL;
+}
+
+/** 
+ * @internal Timer thread: sleeps until the first event expires and
+ * hands it to the pool to be executed.
+ */
+axlPointer __valvula_thread_pool_timer (axlPointer _pool)
+{
+	ValvulaThreadPool      * pool = _pool;
+	ValvulaThreadPoolEvent * event;
+	struct timeval           now;
+	long                     wait;
+
+	valvula_mutex_lock (&pool->mutex);
+	while (! pool->timer_stop) {
+		/* nothing scheduled */
+		if (pool->heap_num == 0) {
+			VALVULA_COND_WAIT (&pool->timer_cond, &pool->mutex);
+			continue;
+		} /* end if */
+
+		/* wait until the first event expires (or a new one is
+		 * scheduled before it) */
+		event = pool->heap[0];
+		gettimeofday (&now, NULL);
+		wait  = ((event->next_step.tv_sec - now.tv_sec) * 1000000) + (event->next_step.tv_usec - now.tv_usec);
+		if (wait > 0) {
+			valvula_cond_timedwait (&pool->timer_cond, &pool->mutex, wait);
+			continue;
+		} /* end if */
+
+		/* pool is being stopped, do not notify more events */
+		if (pool->ctx->thread_pool_being_stopped)
 			break;
-		}
 
-		/* increase ref count now we have the look */
+		/* expired: unschedule and run it in the pool */
+		__valvula_thread_pool_heap_remove (pool, event);
+		event->running = axl_true;
 		event->ref_count++;
 
-		/* get stamp */
-		if ((now.tv_sec > event->next_step.tv_sec) ||
-		    ((now.tv_sec == event->next_step.tv_sec) &&
-		     (now.tv_usec >= event->next_step.tv_usec))) {
+		valvula_mutex_unlock (&pool->mutex);
+		if (valvula_thread_pool_new_task (pool->ctx, __valvula_thread_pool_run_event, event)) {
+			valvula_mutex_lock (&pool->mutex);
+			continue;
+		} /* end if */
 
-			func  = event->func;
-			data  = event->data;
-			data2 = event->data2;
+		/* task not queued: schedule the event again (after its
+		 * period, to not spin) and release the reference
+		 * acquired for the task */
+		valvula_mutex_lock (&pool->mutex);
+		event->running = axl_false;
+		if (! event->removed) {
+			gettimeofday (&event->next_step, NULL);
+			__valvula_thread_pool_increase_stamp (event);
+			__valvula_thread_pool_heap_push (pool, event);
+		} /* end if */
+		__valvula_thread_pool_unref_event (event);
+	} /* end while */
+	valvula_mutex_unlock (&pool->mutex);
 
-			/* unlock before calling */
-			valvula_mutex_unlock (&pool->mutex);
+	return NULL;
+}
 
-			/* call to notify event */
-			if (func (ctx, data, data2)) {
-				valvula_mutex_lock (&pool->mutex);
+/** 
+ * @internal Pushes the task at the end of the worker deque.
+ *
+ * @return axl_false if the deque is full.
+ */
+axl_bool __valvula_thread_pool_worker_push (ValvulaThreadPoolWorker * worker, ValvulaThreadPoolTask * task)
+{
+	valvula_mutex_lock (&worker->mutex);
+	if (! worker->active || worker->count == VALVULA_THREAD_POOL_DEQUE_SIZE) {
+		valvula_mutex_unlock (&worker->mutex);
+		return axl_false;
+	} /* end if */
+	worker->tasks[(worker->head + worker->count) % VALVULA_THREAD_POOL_DEQUE_SIZE] = task;
+	worker->count++;
+	valvula_mutex_unlock (&worker->mutex);
 
-				/* remove event using the pointer not
-				 * the position because it may be
-				 * pointing to a different location
-				 * (i.e: someone removed or added an
-				 * event durint the last func()
-				 * call) */
-				axl_list_remove_ptr (pool->events, event);
+	return axl_true;
+}
 
-				/* decrease local reference */
-				__valvula_thread_pool_unref_event (event);
+/** 
+ * @internal Places the task at the end of the pool overflow list.
+ */
+void __valvula_thread_pool_overflow_push (ValvulaThreadPool * pool, ValvulaThreadPoolTask * task)
+{
+	task->next = NULL;
+	valvula_mutex_lock (&pool->overflow_mutex);
+	if (pool->overflow_last)
+		pool->overflow_last->next = task;
+	else
+		pool->overflow_first = task;
+	pool->overflow_last = task;
+	pool->overflow_count++;
+	valvula_mutex_unlock (&pool->overflow_mutex);
+	return;
+}
 
-				valvula_mutex_unlock (&pool->mutex);
+/** 
+ * @internal Takes the first task from the worker deque (or NULL if
+ * it is empty). When steal is provided, half of the remaining tasks
+ * are moved into that worker deque too.
+ */
+ValvulaThreadPoolTask * __valvula_thread_pool_worker_pop (ValvulaThreadPoolWorker * worker, ValvulaThreadPoolWorker * steal)
+{
+	ValvulaThreadPoolTask * task;
+	ValvulaThreadPoolTask * moved[VALVULA_THREAD_POOL_DEQUE_SIZE / 2];
+	int                     moved_num = 0;
+	int                     iterator;
 
-				/* don't update iterator to manage next position */
-				continue;
-			}
+	/* avoid locking empty deques */
+	if (worker->count == 0)
+		return NULL;
 
-			/* now recalculate event to be executed in the
-			 * future (because the user did selected to
-			 * keep it) */
-			valvula_mutex_lock (&pool->mutex);
-			__valvula_thread_pool_increase_stamp (event);
-			
+	valvula_mutex_lock (&worker->mutex);
+	if (worker->count == 0) {
+		valvula_mutex_unlock (&worker->mutex);
+		return NULL;
+	} /* end if */
+
+	task         = worker->tasks[worker->head];
+	worker->head = (worker->head + 1) % VALVULA_THREAD_POOL_DEQUE_SIZE;
+	worker->count--;
+
+	if (steal) {
+		/* take half of the remaining tasks */
+		while (moved_num < (worker->count / 2)) {
+			moved[moved_num++] = worker->tasks[worker->head];
+			worker->head       = (worker->head + 1) % VALVULA_THREAD_POOL_DEQUE_SIZE;
+		} /* end while */
+		worker->count -= moved_num;
+	} /* end if */
+	valvula_mutex_unlock (&worker->mutex);
+
+	/* place stolen tasks into our deque */
+	for (iterator = 0; iterator < moved_num; iterator++) {
+		if (! __valvula_thread_pool_worker_push (steal, moved[iterator])) {
+			/* our deque may be filled concurrently (by
+			 * threads pushing new tasks) so it can be full:
+			 * place the task at the overflow tail to not get
+			 * ahead of older tasks waiting there */
+			__valvula_thread_pool_overflow_push (worker->pool, moved[iterator]);
 		} /* end if */
+	} /* end for */
 
-		/* decrease local reference */
-		__valvula_thread_pool_unref_event (event);
+	return task;
+}
 
-		/* unlock for the next lock */
-		valvula_mutex_unlock (&pool->mutex);
+/** 
+ * @internal Takes the first task from the pool overflow list.
+ */
+ValvulaThreadPoolTask * __valvula_thread_pool_overflow_pop (ValvulaThreadPool * pool)
+{
+	ValvulaThreadPoolTask * task;
 
-		/* next position */
-		iterator++;
-	}
+	if (pool->overflow_count == 0)
+		return NULL;
+
+	valvula_mutex_lock (&pool->overflow_mutex);
+	task = pool->overflow_first;
+	if (task) {
+		pool->overflow_first = task->next;
+		if (pool->overflow_first == NULL)
+			pool->overflow_last = NULL;
+		pool->overflow_count--;
+	} /* end if */
+	valvula_mutex_unlock (&pool->overflow_mutex);
+
+	return task;
+}
+
+/** 
+ * @internal Finds next task to be processed by the provided worker:
+ * first from its own deque, then from the overflow list and finally
+ * stealing from other workers.
+ */
+ValvulaThreadPoolTask * __valvula_thread_pool_next_task (ValvulaThreadPool * pool, ValvulaThreadPoolWorker * worker)
+{
+	ValvulaThreadPoolTask   * task;
+	ValvulaThreadPoolWorker * victim;
+	int                       workers_num;
+	int                       start;
+	int                       iterator;
+
+	task = __valvula_thread_pool_worker_pop (worker, NULL);
+	if (task == NULL)
+		task = __valvula_thread_pool_overflow_pop (pool);
+
+	if (task == NULL) {
+		/* steal from other workers */
+		workers_num = pool->workers_num;
+		start       = worker->index + 1;
+		for (iterator = 0; iterator < workers_num && task == NULL; iterator++) {
+			victim = pool->workers[(start + iterator) % workers_num];
+			if (victim == NULL || victim == worker)
+				continue;
+			task = __valvula_thread_pool_worker_pop (victim, worker);
+		} /* end for */
+	} /* end if */
+
+	if (task)
+		__sync_fetch_and_sub (&pool->pending, 1);
+	return task;
+}
+
+/** 
+ * @internal Wakes up one parked worker (if any).
+ */
+void __valvula_thread_pool_unpark (ValvulaThreadPool * pool)
+{
+	if (__sync_fetch_and_add (&pool->parked, 0) == 0)
+		return;
 
-	/* flag that no more processing events */
+	valvula_mutex_lock (&pool->park_mutex);
+	valvula_cond_signal (&pool->park_cond);
+	valvula_mutex_unlock (&pool->park_mutex);
+	return;
+}
+
+/** 
+ * @internal Wakes up all parked workers.
+ */
+void __valvula_thread_pool_unpark_all (ValvulaThreadPool * pool)
+{
+	valvula_mutex_lock (&pool->park_mutex);
+	valvula_cond_broadcast (&pool->park_cond);
+	valvula_mutex_unlock (&pool->park_mutex);
+	return;
+}
+
+/** 
+ * @internal Returns how long (microseconds) the worker keeping track
+ * of automatic resize can stay parked, or 0 if it can wait until new
+ * work is submitted.
+ */
+long __valvula_thread_pool_park_timeout (ValvulaThreadPool * pool)
+{
+	long timeout = 0;
+
+	/* check automatic resize periodically */
 	valvula_mutex_lock (&pool->mutex);
-	pool->processing_events = axl_false;
+	if (pool->automatic_resize_status)
+		timeout = 1000000;
 	valvula_mutex_unlock (&pool->mutex);
+
+	return timeout;
+}
+
+/** 
+ * @internal Parks the calling worker until new work is submitted.
+ * One of the parked workers (the timer keeper) uses a timed wait to
+ * check automatic resize on time.
+ */
+void __valvula_thread_pool_park (ValvulaCtx * ctx, ValvulaThreadPool * pool)
+{
+	long     timeout;
+	axl_bool keeper = axl_false;
+
+	/* get timeout before locking park mutex */
+	timeout = __valvula_thread_pool_park_timeout (pool);
+
+	valvula_mutex_lock (&pool->park_mutex);
+	__sync_fetch_and_add (&pool->parked, 1);
+
+	/* check again, after flagging we are parked, that nothing
+	 * was submitted in the meantime */
+	if (__sync_fetch_and_add (&pool->pending, 0) == 0 && 
+	    __sync_fetch_and_add (&pool->to_remove, 0) == 0 && 
+	    __sync_fetch_and_add (&pool->to_collect, 0) == 0 && 
+	    ! ctx->thread_pool_being_stopped) {
+		if (timeout > 0 && ! pool->timer_keeper) {
+			/* this worker tracks timed work */
+			pool->timer_keeper = axl_true;
+			keeper             = axl_true;
+			valvula_cond_timedwait (&pool->park_cond, &pool->park_mutex, timeout);
+			pool->timer_keeper = axl_false;
+		} else
+			VALVULA_COND_WAIT (&pool->park_cond, &pool->park_mutex);
+	} /* end if */
+
+	__sync_fetch_and_sub (&pool->parked, 1);
+
+	/* if we were keeping track of timed work, hand it over to
+	 * other parked worker */
+	if (keeper && pool->parked > 0)
+		valvula_cond_signal (&pool->park_cond);
+	valvula_mutex_unlock (&pool->park_mutex);
+
+	return;
+}
+
+/** 
+ * @internal Atomically takes one unit from the provided counter if
+ * it is greater than 0.
+ */
+axl_bool __valvula_thread_pool_claim (int * counter)
+{
+	int value;
+
+	while ((value = __sync_fetch_and_add (counter, 0)) > 0) {
+		if (__sync_bool_compare_and_swap (counter, value, value - 1))
+			return axl_true;
+	} /* end while */
+
+	return axl_false;
+}
+
+/** 
+ * @internal Returns microseconds elapsed from since to now.
+ */
+long __valvula_thread_pool_elapsed (struct timeval * since, struct timeval * now)
+{
+	long elapsed = ((now->tv_sec - since->tv_sec) * 1000000L) + (now->tv_usec - since->tv_usec);
+
+	return elapsed > 0 ? elapsed : 0;
+}
+
+/** 
+ * @internal Records how long a task waited in the queue.
+ */
+void __valvula_thread_pool_record_wait (ValvulaThreadPool * pool, long wait)
+{
+	int bucket = 0;
+
+	while (bucket < (VALVULA_THREAD_POOL_WAIT_BUCKETS - 1) && wait >= (1L << bucket))
+		bucket++;
+	__sync_fetch_and_add (&pool->wait_hist[bucket], 1);
 	return;
 }
 
+/** 
+ * @internal Returns the upper bound (microseconds) of the bucket
+ * holding the provided percentile.
+ */
+long __valvula_thread_pool_percentile (int * hist, int total, int percent)
+{
+	int  bucket;
+	long seen = 0;
+	long rank = (((long) total * percent) + 99) / 100;
+
+	for (bucket = 0; bucket < VALVULA_THREAD_POOL_WAIT_BUCKETS; bucket++) {
+		seen += hist[bucket];
+		if (seen >= rank)
+			break;
+	} /* end for */
+
+	if (bucket == VALVULA_THREAD_POOL_WAIT_BUCKETS)
+		bucket--;
+	return 1L << bucket;
+}
+
+/** 
+ * @internal Closes current sampling window (if it is long enough)
+ * computing queue wait percentiles, average service time and the
+ * number of threads busy on average (Little's law: arrival rate x
+ * service time, that is, service time accumulated / window length).
+ *
+ * Must be called with the pool mutex locked.
+ *
+ * @return axl_true if a new sample was computed.
+ */
+axl_bool __valvula_thread_pool_sample (ValvulaThreadPool * pool, struct timeval * now)
+{
+	int  hist[VALVULA_THREAD_POOL_WAIT_BUCKETS];
+	int  total = 0;
+	int  iterator;
+	long elapsed;
+	long service_total;
+	int  service_count;
+
+	elapsed = __valvula_thread_pool_elapsed (&pool->window_start, now);
+	if (elapsed < VALVULA_THREAD_POOL_SAMPLE_WINDOW)
+		return axl_false;
+
+	/* take and reset window samples */
+	for (iterator = 0; iterator < VALVULA_THREAD_POOL_WAIT_BUCKETS; iterator++) {
+		hist[iterator] = __sync_fetch_and_and (&pool->wait_hist[iterator], 0);
+		total         += hist[iterator];
+	} /* end for */
+	service_total      = __sync_fetch_and_and (&pool->service_total, 0);
+	service_count      = __sync_fetch_and_and (&pool->service_count, 0);
+	pool->window_start = *now;
+
+	if (total > 0) {
+		pool->wait_p50 = __valvula_thread_pool_percentile (hist, total, 50);
+		pool->wait_p99 = __valvula_thread_pool_percentile (hist, total, 99);
+	} else if (__sync_fetch_and_add (&pool->pending, 0) > 0) {
+		/* nothing was taken from the queue during the whole
+		 * window while tasks are pending: all threads are
+		 * stuck, queued tasks waited at least this long */
+		pool->wait_p50 = elapsed;
+		pool->wait_p99 = elapsed;
+	} else {
+		pool->wait_p50 = 0;
+		pool->wait_p99 = 0;
+	} /* end if */
+
+	if (service_count > 0)
+		pool->service_avg = service_total / service_count;
+	pool->busy_threads = (service_total + elapsed - 1) / elapsed;
+
+	return axl_true;
+}
+
 /** 
  * @internal Code that resizes the thread pool adding or removing
- * threads according to current status and user configuration.
+ * threads according to measured queue wait, service time and user
+ * configuration.
+ *
+ * The pool is grown when queue wait p99 goes above \ref
+ * VALVULA_THREAD_POOL_WAIT_TARGET (in steps proportional to the
+ * excess, and at least to the threads needed according to Little's
+ * law) or, as before, when there are pending tasks and no idle
+ * threads for thread_add_period seconds. Threads are only removed
+ * once the pool has been oversized for thread_remove_period seconds.
  */
 void __valvula_thread_pool_automatic_resize (ValvulaCtx * ctx)
 {
-	struct timeval   now;
-	struct timeval   diff;
-	int              waiting_threads;
-	int              pending_tasks;
-	int              running_threads;
+	ValvulaThreadPool * pool;
+	struct timeval      now;
+	struct timeval      diff;
+	int                 waiting_threads;
+	int                 pending_tasks;
+	int                 running_threads;
+	int                 needed;
+	int                 step;
 
 	/* check before acquiring the look if the user changed during
 	 * our lock */
 	if (! ctx->thread_pool || valvula_is_exiting (ctx))  
 		return;
 
+	pool = ctx->thread_pool;
+	gettimeofday (&now, NULL);
+
 	/* lock thread pool */
-	valvula_mutex_lock (&ctx->thread_pool->mutex);
+	valvula_mutex_lock (&pool->mutex);
 
-	/* check if the user changed during our lock */
-	if (! ctx->thread_pool || ! ctx->thread_pool->automatic_resize_status || 
+	/* check if the user changed during our lock and if a new
+	 * sample is available */
+	if (! ctx->thread_pool || ! __valvula_thread_pool_sample (pool, &now) || 
+	    ! pool->automatic_resize_status || 
 	    ctx->thread_pool_being_stopped || valvula_is_exiting (ctx)) {
-		valvula_mutex_unlock (&ctx->thread_pool->mutex);
+		valvula_mutex_unlock (&pool->mutex);
 		return;
 	}
 
-	running_threads = axl_list_length (ctx->thread_pool->threads);
-	waiting_threads = valvula_async_queue_waiters (ctx->thread_pool->queue);
-	pending_tasks   = valvula_async_queue_items (ctx->thread_pool->queue);
-
-	/* now get difference in diff */
-	gettimeofday (&now, NULL);
-	valvula_timeval_substract (&now, &(ctx->thread_pool->last), &diff);
-
-/*	valvula_log2 (VALVULA_LEVEL_DEBUG, 
-		     "Checking thread pool resize: running_threads=%d, base threads=%d, waiting_threads=%d, pending_tasks=%d, thread_max_limit=%d diff=%ld, add_period=%d, auto_remove=%d\n",
-		    running_threads, ctx->thread_pool->base_thread_num, waiting_threads, pending_tasks, ctx->thread_pool->thread_max_limit, diff.tv_sec, 
-		    ctx->thread_pool->thread_add_period, ctx->thread_pool->auto_remove); */
-	/* if we have waiting threads equal to 0 and our last update
-	 * was thread_pool->last seconds ago and there is at least 1
-	 * pending_tasks do */
-	if (running_threads < ctx->thread_pool->thread_max_limit &&
-	    waiting_threads == 0 && 
-	    pending_tasks > 0 && 
-	    diff.tv_sec >= ctx->thread_pool->thread_add_period){
+	running_threads = axl_list_length (pool->threads);
+	waiting_threads = __sync_fetch_and_add (&pool->parked, 0);
+	pending_tasks   = __sync_fetch_and_add (&pool->pending, 0);
 
-		valvula_log (VALVULA_LEVEL_DEBUG, "Adding %d threads because there are pending tasks %d and limit was not reached %d (waiting_threads=%d, running_threads=%d)\n",
-			ctx->thread_pool->thread_add_step, pending_tasks, ctx->thread_pool->thread_max_limit, waiting_threads, running_threads);
-		fflush (stdout);
+	/* threads needed for the measured load: all of them if the
+	 * pool is saturated (tasks still running are not accounted
+	 * in service time yet) */
+	needed = pool->busy_threads;
+	if (waiting_threads == 0 && pending_tasks > 0 && needed < running_threads)
+		needed = running_threads;
+	needed = ((needed * 100) + VALVULA_THREAD_POOL_UTILIZATION - 1) / VALVULA_THREAD_POOL_UTILIZATION;
 
-		/* add a thread to the pool (call internal unlocked) */
-		valvula_thread_pool_add_internal (ctx, ctx->thread_pool->thread_add_step);
-		gettimeofday (&(ctx->thread_pool->last), NULL);
+	/* now get difference in diff */
+	valvula_timeval_substract (&now, &(pool->last), &diff);
 
-	} else if (ctx->thread_pool->auto_remove && 
+	if (running_threads < pool->thread_max_limit && 
+	    pending_tasks > 0 && 
+	    (pool->wait_p99 > VALVULA_THREAD_POOL_WAIT_TARGET || 
+	     (waiting_threads == 0 && diff.tv_sec >= pool->thread_add_period))) {
+
+		/* grow proportionally to queue wait excess (at most
+		 * doubling the pool) and at least to the threads
+		 * needed */
+		step = 0;
+		if (pool->wait_p99 > VALVULA_THREAD_POOL_WAIT_TARGET)
+			step = (running_threads * (pool->wait_p99 - VALVULA_THREAD_POOL_WAIT_TARGET)) / VALVULA_THREAD_POOL_WAIT_TARGET;
+		if (step > running_threads)
+			step = running_threads;
+		if (step < (needed - running_threads))
+			step = needed - running_threads;
+		if (step < pool->thread_add_step)
+			step = pool->thread_add_step;
+		if (step > (pool->thread_max_limit - running_threads))
+			step = pool->thread_max_limit - running_threads;
+
+		valvula_log (VALVULA_LEVEL_DEBUG, "Adding %d threads: queue wait p99=%ldus, service avg=%ldus, busy=%d, pending tasks=%d (waiting_threads=%d, running_threads=%d, limit=%d)",
+			     step, pool->wait_p99, pool->service_avg, pool->busy_threads, pending_tasks, waiting_threads, running_threads, pool->thread_max_limit);
+
+		/* add threads to the pool (call internal unlocked) */
+		valvula_thread_pool_add_internal (ctx, step);
+		pool->last      = now;
+		pool->oversized = axl_false;
+
+	} else if (pool->auto_remove && 
 		   pending_tasks == 0 && 
-		   running_threads > ctx->thread_pool->base_thread_num &&
-		   (waiting_threads + 2) > ctx->thread_pool->base_thread_num && 
-		   diff.tv_sec > (ctx->thread_pool->thread_remove_period)) {
-
-		/* remove threads if no pending task is found, and
-		   there are more waiting_threads than base thread
-		   number and that no reduce operation had happend
-		   during last thread_add_period * 2. */
-
-		valvula_log (VALVULA_LEVEL_DEBUG, "Removing %d threads because there are no pending tasks, and there are more waiting threads %d than base number %d\n",
-			ctx->thread_pool->thread_remove_step, waiting_threads, ctx->thread_pool->base_thread_num);
-		fflush (stdout);
-		   
-		/* remove a thread from the pool */
-		valvula_thread_pool_remove_internal (ctx, ctx->thread_pool->thread_remove_step);
-		gettimeofday (&(ctx->thread_pool->last), NULL);
-
-	} /* end if */
+		   running_threads > pool->base_thread_num &&
+		   needed <= (running_threads - pool->thread_remove_step) && 
+		   pool->wait_p99 <= (VALVULA_THREAD_POOL_WAIT_TARGET / 2)) {
+
+		/* the pool is oversized: only reduce it once it has
+		 * been this way for thread_remove_period (and no resize
+		 * happened during that time) */
+		if (! pool->oversized) {
+			pool->oversized       = axl_true;
+			pool->oversized_since = now;
+		} else if (__valvula_thread_pool_elapsed (&pool->oversized_since, &now) > (pool->thread_remove_period * 1000000L) && 
+			   diff.tv_sec > pool->thread_remove_period) {
+			step = pool->thread_remove_step;
+			if (step > (running_threads - pool->base_thread_num))
+				step = running_threads - pool->base_thread_num;
+
+			valvula_log (VALVULA_LEVEL_DEBUG, "Removing %d threads: no pending tasks and %d threads needed for current load (running_threads=%d, base=%d)",
+				     step, needed, running_threads, pool->base_thread_num);
+
+			/* remove threads from the pool */
+			valvula_thread_pool_remove_internal (ctx, step);
+			pool->last            = now;
+			pool->oversized_since = now;
+		} /* end if */
+	} else
+		pool->oversized = axl_false;
 
 	/* unlock the mutex */
-	valvula_mutex_unlock (&ctx->thread_pool->mutex);
+	valvula_mutex_unlock (&pool->mutex);
 	
 	return;
 }
 
+/** 
+ * @internal Moves all tasks from the worker deque into the overflow
+ * list (used when the worker finishes).
+ */
+void __valvula_thread_pool_worker_flush (ValvulaThreadPool * pool, ValvulaThreadPoolWorker * worker)
+{
+	ValvulaThreadPoolTask * task;
+
+	valvula_mutex_lock (&worker->mutex);
+	worker->active = axl_false;
+	while (worker->count > 0) {
+		task         = worker->tasks[worker->head];
+		worker->head = (worker->head + 1) % VALVULA_THREAD_POOL_DEQUE_SIZE;
+		worker->count--;
+		__valvula_thread_pool_overflow_push (pool, task);
+	} /* end while */
+	worker->head = 0;
+	valvula_mutex_unlock (&worker->mutex);
+
+	return;
+}
+
 /** 
  * @internal
  * 
@@ -314,47 +938,62 @@ void __valvula_thread_pool_automatic_resize (ValvulaCtx * ctx)
 axlPointer __valvula_thread_pool_dispatcher (ValvulaThreadPoolStarter * _data)
 {
 	/* get current context */
-	ValvulaThreadPoolTask * task;
-	ValvulaThread         * thread = _data->thread;
-	ValvulaThreadPool     * pool   = _data->pool;
-	ValvulaCtx            * ctx    = pool->ctx;
-	ValvulaAsyncQueue     * queue  = _data->queue;
+	ValvulaThreadPoolTask   * task;
+	ValvulaThread           * thread = _data->thread;
+	ValvulaThreadPool       * pool   = _data->pool;
+	ValvulaThreadPoolWorker * worker = _data->worker;
+	ValvulaCtx              * ctx    = pool->ctx;
 
 	/* local pointers to release soon data object */
 	ValvulaThreadFunc       func;
 	axlPointer             data;
 
+	/* queue wait and service time tracking */
+	struct timeval          start;
+	struct timeval          stop;
+
 	axl_free (_data);
 
 	valvula_log (VALVULA_LEVEL_DEBUG, "thread from pool started");
 
-	/* get a reference to the queue, waiting for the next work */
+#if defined(AXL_OS_UNIX)
+	/* tasks created from this thread go to its own deque */
+	__valvula_thread_pool_current = worker;
+#endif
+
+	/* pin thread if configured (before it allocates memory) */
+	valvula_mutex_lock (&pool->mutex);
+	if (pool->cpus && valvula_thread_set_affinity (NULL, pool->cpus, -1))
+		valvula_log (VALVULA_LEVEL_DEBUG, "thread from pool running on cpu %d (numa node %d)", 
+			     valvula_thread_get_cpu (), valvula_thread_get_numa_node (valvula_thread_get_cpu ()));
+	valvula_mutex_unlock (&pool->mutex);
+
 	while (axl_true) {
 
-		/* get next task to process: precision=100ms */
-		task = valvula_async_queue_timedpop (queue, 100000);
-		
-		if (task == NULL) {
-			/* call to process events */
-			__valvula_thread_pool_process_events (ctx, pool);
+		/* check stop in progress signal */
+		if (ctx->thread_pool_being_stopped) {
+			valvula_log (VALVULA_LEVEL_DEBUG, "--> thread from pool stoping, found finish signal");
 
-			/* do automatic reasize */
-			__valvula_thread_pool_automatic_resize (ctx);
+			/* call to cleanup thread if defined */
+			if (ctx->thread_pool_cleanup) 
+				ctx->thread_pool_cleanup (ctx);
+			
+			valvula_ctx_unref2 (&ctx, "end pool dispatcher");
 
-			continue;
-		}
+			return NULL;
+		} /* end if */
 
-		if (PTR_TO_INT (task) == 3) {
-			/* collect thread data terminated */
+		/* collect thread data terminated */
+		if (__valvula_thread_pool_claim (&pool->to_collect)) {
 			valvula_mutex_lock (&(ctx->thread_pool->stopped_mutex));
 			axl_list_remove_first (pool->stopped);
 			valvula_mutex_unlock (&(ctx->thread_pool->stopped_mutex));
 			continue;
-		}
+		} /* end if */
 
 		/* check to stop current thread because pool was reduced */
-		if (PTR_TO_INT (task) == 2) {
-			valvula_log (VALVULA_LEVEL_DEBUG, "--> thread from pool stoping, found thread stop beacon");
+		if (__valvula_thread_pool_claim (&pool->to_remove)) {
+			valvula_log (VALVULA_LEVEL_DEBUG, "--> thread from pool stoping, pool was reduced");
 
 			/* do not lock because this is already done by
 			 * valvula_thread_pool_remove .. */
@@ -365,13 +1004,15 @@ axlPointer __valvula_thread_pool_dispatcher (ValvulaThreadPoolStarter * _data)
 			axl_list_unlink_ptr (pool->threads, thread);
 			valvula_mutex_unlock (&pool->mutex);
 
+			/* pass pending tasks to other workers */
+			__valvula_thread_pool_worker_flush (pool, worker);
+
 			axl_list_append (pool->stopped, thread);
 			valvula_mutex_unlock (&(ctx->thread_pool->stopped_mutex));
 
-			valvula_async_queue_push (queue, INT_TO_PTR (3));
-
-			/* unref the queue and return */
-			valvula_async_queue_unref (queue);
+			/* ask other thread to collect us */
+			__sync_fetch_and_add (&pool->to_collect, 1);
+			__valvula_thread_pool_unpark (pool);
 
 			/* call to cleanup thread if defined */
 			if (ctx->thread_pool_cleanup) 
@@ -382,28 +1023,27 @@ axlPointer __valvula_thread_pool_dispatcher (ValvulaThreadPoolStarter * _data)
 			return NULL;
 		} /* end if */
 
-		/* check stop in progress signal */
-		if ((PTR_TO_INT (task) == 1) && ctx->thread_pool_being_stopped) {
-			valvula_log (VALVULA_LEVEL_DEBUG, "--> thread from pool stoping, found finish beacon");
-
-			/* unref the queue and return */
-			valvula_async_queue_unref (queue);
-
-			/* call to cleanup thread if defined */
-			if (ctx->thread_pool_cleanup) 
-				ctx->thread_pool_cleanup (ctx);
-			
-			valvula_ctx_unref2 (&ctx, "end pool dispatcher");
+		/* get next task to process */
+		task = __valvula_thread_pool_next_task (pool, worker);
+		if (task == NULL) {
+			/* do automatic reasize */
+			__valvula_thread_pool_automatic_resize (ctx);
 
-			return NULL;
+			/* wait for more work */
+			__valvula_thread_pool_park (ctx, pool);
+			continue;
 		} /* end if */
 
 		valvula_log (VALVULA_LEVEL_DEBUG, "--> thread from pool processing new job");
 
+		/* record how long the task was queued */
+		gettimeofday (&start, NULL);
+		__valvula_thread_pool_record_wait (pool, __valvula_thread_pool_elapsed (&task->queued, &start));
+
 		/* grab references to release before call */
 		func = task->func;
 		data = task->data;
-		axl_free (task);
+		valvula_pool_release (VALVULA_POOL_TASK, task);
 
 		/* do automatic reasize (preemtive) */
 		if (ctx && ctx->thread_pool && ctx->thread_pool->preemtive)
@@ -413,8 +1053,10 @@ axlPointer __valvula_thread_pool_dispatcher (ValvulaThreadPoolStarter * _data)
 		if (! ctx->thread_pool_being_stopped && ! ctx->valvula_exit) 
 			func (data);
 
-		/* call to process events after finishing tasks */
-		__valvula_thread_pool_process_events (ctx, pool);
+		/* record service time */
+		gettimeofday (&stop, NULL);
+		__sync_fetch_and_add (&pool->service_total, __valvula_thread_pool_elapsed (&start, &stop));
+		__sync_fetch_and_add (&pool->service_count, 1);
 
 		/* do automatic reasize */
 		if (ctx && ctx->thread_pool && ! ctx->thread_pool->preemtive)
@@ -525,15 +1167,15 @@ void valvula_thread_pool_init     (ValvulaCtx * ctx,
 	ctx->thread_pool->events        = axl_list_new (__valvula_thread_pool_soon_events_first, __valvula_thread_pool_unref_event);
 	ctx->thread_pool->events_cursor = axl_list_cursor_new (ctx->thread_pool->events);
 	ctx->thread_pool->ctx           = ctx;
-
-	/* init the queue */
-	if (ctx->thread_pool->queue != NULL)
-		valvula_async_queue_release (ctx->thread_pool->queue);
-	ctx->thread_pool->queue       = valvula_async_queue_new ();
+	gettimeofday (&(ctx->thread_pool->window_start), NULL);
 
 	/* init mutex */
 	valvula_mutex_create (&(ctx->thread_pool->mutex));
 	valvula_mutex_create (&(ctx->thread_pool->stopped_mutex));
+	valvula_mutex_create (&(ctx->thread_pool->overflow_mutex));
+	valvula_mutex_create (&(ctx->thread_pool->park_mutex));
+	valvula_cond_create  (&(ctx->thread_pool->park_cond));
+	valvula_cond_create  (&(ctx->thread_pool->timer_cond));
 	
 	/* init all threads required */
 	valvula_thread_pool_add (ctx, max_threads);
@@ -653,8 +1295,10 @@ void valvula_thread_pool_add_internal                 (ValvulaCtx        * ctx,
 						      int                threads)
 {
 	int                       iterator;
+	int                       slot;
 	ValvulaThread            * thread;
 	ValvulaThreadPoolStarter * starter;
+	ValvulaThreadPoolWorker  * worker;
 	ValvulaCtx               * local_ctx;
 
 	v_return_if_fail (ctx);
@@ -677,13 +1321,40 @@ void valvula_thread_pool_add_internal                 (ValvulaCtx        * ctx,
 		starter->thread = thread;
 		starter->pool   = ctx->thread_pool;
 
-		/* update the reference counting for this thread to
-		 * the queue */
-		if (! valvula_async_queue_ref (ctx->thread_pool->queue)) {
-			axl_free (thread);
-			break;
-		}
-		starter->queue = ctx->thread_pool->queue;
+		/* find a free worker slot (reusing slots from threads
+		 * removed) */
+		worker = NULL;
+		for (slot = 0; slot < ctx->thread_pool->workers_num; slot++) {
+			if (! ctx->thread_pool->workers[slot]->active) {
+				worker = ctx->thread_pool->workers[slot];
+				break;
+			} /* end if */
+		} /* end for */
+		if (worker == NULL) {
+			if (ctx->thread_pool->workers_num == VALVULA_THREAD_POOL_MAX_WORKERS) {
+				valvula_log (VALVULA_LEVEL_CRITICAL, "unable to add more threads to the pool, reached max workers=%d",
+					     VALVULA_THREAD_POOL_MAX_WORKERS);
+				axl_free (thread);
+				axl_free (starter);
+				break;
+			} /* end if */
+			worker = axl_new (ValvulaThreadPoolWorker, 1);
+			if (worker == NULL) {
+				axl_free (thread);
+				axl_free (starter);
+				break;
+			} /* end if */
+			valvula_mutex_create (&worker->mutex);
+			worker->pool  = ctx->thread_pool;
+			worker->index = ctx->thread_pool->workers_num;
+
+			/* publish the worker once initialized */
+			ctx->thread_pool->workers[ctx->thread_pool->workers_num] = worker;
+			__sync_synchronize ();
+			ctx->thread_pool->workers_num++;
+		} /* end if */
+		worker->active  = axl_true;
+		starter->worker = worker;
 
 		/* acquire a reference to the context */
 		valvula_ctx_ref2 (ctx, "begin pool dispatcher");
@@ -696,8 +1367,8 @@ void valvula_thread_pool_add_internal                 (ValvulaCtx        * ctx,
 					    /* finish thread configuration */
 					    VALVULA_THREAD_CONF_END)) {
 
-			/* unref the queue */
-			valvula_async_queue_unref (ctx->thread_pool->queue);
+			/* release the worker slot */
+			worker->active = axl_false;
 
 			/* failed, release ctx */
 			local_ctx = ctx;
@@ -766,14 +1437,17 @@ void valvula_thread_pool_remove_internal        (ValvulaCtx        * ctx,
 	if (ctx == NULL || threads <= 0)
 		return;
 
-	threads_running = axl_list_length (ctx->thread_pool->threads);
+	threads_running = axl_list_length (ctx->thread_pool->threads) - __sync_fetch_and_add (&ctx->thread_pool->to_remove, 0);
 	while (threads > 0 && threads_running > 1) {
-		/* push a task to stop one thread */
-		valvula_async_queue_push (ctx->thread_pool->queue, INT_TO_PTR (2));
+		/* flag one thread to stop */
+		__sync_fetch_and_add (&ctx->thread_pool->to_remove, 1);
 		threads--;
 		threads_running--;
 	} /* end if */
 
+	/* wake up idle threads so they can finish */
+	__valvula_thread_pool_unpark_all (ctx->thread_pool);
+
 	return;
 }
 
@@ -814,8 +1488,10 @@ void valvula_thread_pool_remove        (ValvulaCtx        * ctx,
 void valvula_thread_pool_exit (ValvulaCtx * ctx) 
 {
 	/* get current context */
-	int             iterator;
-	ValvulaThread  * thread;
+	int                       iterator;
+	ValvulaThread           * thread;
+	ValvulaThreadPoolWorker * worker;
+	ValvulaThreadPoolTask   * task;
 
 	if (ctx->skip_thread_pool_wait)
 		return;
@@ -827,15 +1503,19 @@ void valvula_thread_pool_exit (ValvulaCtx * ctx)
 	ctx->thread_pool_being_stopped = axl_true;
 	valvula_mutex_unlock (&ctx->thread_pool->mutex);
 
-	/* push beacons to notify eacy thread created to stop */
-	iterator = 0;
-	while (iterator < axl_list_length (ctx->thread_pool->threads)) {
-		valvula_log (VALVULA_LEVEL_DEBUG, "pushing beacon to stop thread from the pool..");
-		/* push a notifier */
-		valvula_async_queue_push (ctx->thread_pool->queue, INT_TO_PTR (1));
+	/* wake up all threads so they notice the pool is stopping */
+	valvula_log (VALVULA_LEVEL_DEBUG, "waking up threads from the pool to stop them..");
+	__valvula_thread_pool_unpark_all (ctx->thread_pool);
 
-		/* update the iterator */
-		iterator++;
+	/* stop timer thread */
+	if (ctx->thread_pool->timer) {
+		valvula_mutex_lock (&ctx->thread_pool->mutex);
+		ctx->thread_pool->timer_stop = axl_true;
+		valvula_cond_signal (&ctx->thread_pool->timer_cond);
+		valvula_mutex_unlock (&ctx->thread_pool->mutex);
+
+		valvula_thread_destroy (ctx->thread_pool->timer, axl_true);
+		ctx->thread_pool->timer = NULL;
 	} /* end if */
 
 	/* stop all threads */
@@ -864,12 +1544,29 @@ void valvula_thread_pool_exit (ValvulaCtx * ctx)
 	axl_list_cursor_free (ctx->thread_pool->events_cursor);
 	axl_list_free (ctx->thread_pool->stopped);
 
-	/* unref the queue */
-	valvula_async_queue_unref (ctx->thread_pool->queue);
+	/* release workers and tasks not processed */
+	for (iterator = 0; iterator < ctx->thread_pool->workers_num; iterator++) {
+		worker = ctx->thread_pool->workers[iterator];
+		while (worker->count > 0) {
+			valvula_pool_release (VALVULA_POOL_TASK, worker->tasks[worker->head]);
+			worker->head = (worker->head + 1) % VALVULA_THREAD_POOL_DEQUE_SIZE;
+			worker->count--;
+		} /* end while */
+		valvula_mutex_destroy (&worker->mutex);
+		axl_free (worker);
+	} /* end for */
+	while ((task = __valvula_thread_pool_overflow_pop (ctx->thread_pool)))
+		valvula_pool_release (VALVULA_POOL_TASK, task);
 
 	/* terminate mutex */
 	valvula_mutex_destroy (&ctx->thread_pool->mutex);
 	valvula_mutex_destroy (&(ctx->thread_pool->stopped_mutex));
+	valvula_mutex_destroy (&(ctx->thread_pool->overflow_mutex));
+	valvula_mutex_destroy (&(ctx->thread_pool->park_mutex));
+	valvula_cond_destroy  (&(ctx->thread_pool->park_cond));
+	valvula_cond_destroy  (&(ctx->thread_pool->timer_cond));
+	axl_free (ctx->thread_pool->heap);
+	axl_free (ctx->thread_pool->cpus);
 
 	/* free the node itself */
 	axl_free (ctx->thread_pool);
@@ -895,6 +1592,9 @@ void valvula_thread_pool_being_closed        (ValvulaCtx * ctx)
 
 	/* unlock thread pool */
 	valvula_mutex_unlock (&ctx->thread_pool->mutex);
+
+	/* wake up idle threads */
+	__valvula_thread_pool_unpark_all (ctx->thread_pool);
 	
 	return;
 }
@@ -911,30 +1611,58 @@ void valvula_thread_pool_being_closed        (ValvulaCtx * ctx)
  * @param func the function to execute.
  * @param data the data to be passed in to the function.
  *
- * 
+ * @return axl_true if the task was queued, otherwise axl_false is
+ * returned (wrong parameters, pool being stopped or memory
+ * allocation failure). In such case the task will not be executed
+ * so the caller must handle it.
  **/
-void valvula_thread_pool_new_task (ValvulaCtx * ctx, ValvulaThreadFunc func, axlPointer data)
+axl_bool valvula_thread_pool_new_task (ValvulaCtx * ctx, ValvulaThreadFunc func, axlPointer data)
 {
 	/* get current context */
-	ValvulaThreadPoolTask * task;
+	ValvulaThreadPoolTask   * task;
+	ValvulaThreadPool       * pool;
+	ValvulaThreadPoolWorker * worker = NULL;
+	int                       workers_num;
+	int                       iterator;
+	axl_bool                  queued = axl_false;
 
 	/* check parameters */
 	if (func == NULL || ctx == NULL || ctx->thread_pool == NULL || ctx->thread_pool_being_stopped)
-		return;
+		return axl_false;
+	pool = ctx->thread_pool;
 
 	/* create the task data */
-	task       = malloc (sizeof (ValvulaThreadPoolTask));
+	task       = valvula_pool_alloc (VALVULA_POOL_TASK, sizeof (ValvulaThreadPoolTask));
 
 	/* check allocated result */
 	if (task == NULL)
-		return;
+		return axl_false;
 	task->func = func;
 	task->data = data;
+	gettimeofday (&task->queued, NULL);
+
+#if defined(AXL_OS_UNIX)
+	/* tasks created from a pool thread go to its own deque */
+	if (__valvula_thread_pool_current && __valvula_thread_pool_current->pool == pool)
+		queued = __valvula_thread_pool_worker_push (__valvula_thread_pool_current, task);
+#endif
 
-	/* queue the task for the next available thread */
-	valvula_async_queue_push (ctx->thread_pool->queue, task);
+	/* otherwise, spread tasks among workers */
+	workers_num = pool->workers_num;
+	for (iterator = 0; ! queued && iterator < 2 && iterator < workers_num; iterator++) {
+		worker = pool->workers[((unsigned int) __sync_fetch_and_add (&pool->next_worker, 1)) % workers_num];
+		queued = __valvula_thread_pool_worker_push (worker, task);
+	} /* end for */
 
-	return;
+	/* checked deques are full (or not active) */
+	if (! queued)
+		__valvula_thread_pool_overflow_push (pool, task);
+
+	/* notify pending task and wake up an idle thread if needed */
+	__sync_fetch_and_add (&pool->pending, 1);
+	__valvula_thread_pool_unpark (pool);
+
+	return axl_true;
 }
 
 /** 
@@ -947,12 +1675,13 @@ void valvula_thread_pool_new_task (ValvulaCtx * ctx, ValvulaThreadFunc func, axl
  * expired. And if the handler returns axl_true (remove) the event
  * will be cleared and called no more.
  *
- * Note that events installed on this function must be tasks that
- * aren't loops or takes too long to complete. This is because the
- * thread pool asigns one thread to check and execute pending events,
- * so, if one of those events delays, the rest won't be executed until
- * the former finishes. In the case you want to install a loop handler
- * or some handler that executes a long running code, then use \ref
+ * Events are kept by a timer thread that sleeps until the next one
+ * expires and then hands it to the thread pool, so each handler runs
+ * on a pool thread (and never concurrently with itself). Note that
+ * events installed on this function must be tasks that aren't loops
+ * or takes too long to complete because they use a pool thread while
+ * running. In the case you want to install a loop handler or some
+ * handler that executes a long running code, then use \ref
  * valvula_thread_pool_new_task.
  *
  * @param ctx The ValvulaCtx context where the event will be
@@ -1003,11 +1732,26 @@ int  valvula_thread_pool_new_event           (ValvulaCtx              * ctx,
 		event->delay     = microseconds;
 		gettimeofday (&event->next_step, NULL);
 
+		event->heap_index = -1;
+		event->pool       = ctx->thread_pool;
+
 		/* update next step to the appropiate value */
 		__valvula_thread_pool_increase_stamp (event);
 
 		/* add into the event event */
 		axl_list_add (ctx->thread_pool->events, event);
+
+		/* schedule it, starting timer thread on first use */
+		__valvula_thread_pool_heap_push (ctx->thread_pool, event);
+		if (ctx->thread_pool->timer == NULL) {
+			ctx->thread_pool->timer = axl_new (ValvulaThread, 1);
+			if (ctx->thread_pool->timer && 
+			    ! valvula_thread_create (ctx->thread_pool->timer, __valvula_thread_pool_timer, ctx->thread_pool, VALVULA_THREAD_CONF_END)) {
+				valvula_log (VALVULA_LEVEL_CRITICAL, "unable to create timer thread, events will not be notified");
+				axl_free (ctx->thread_pool->timer);
+				ctx->thread_pool->timer = NULL;
+			} /* end if */
+		} /* end if */
 	} /* end if */
 
 	/* (un)lock the thread pool */
@@ -1047,7 +1791,10 @@ axl_bool valvula_thread_pool_remove_event        (ValvulaCtx              * ctx,
 		event = axl_list_cursor_get (ctx->thread_pool->events_cursor);
 
 		if (PTR_TO_INT (event) == event_id) {
-			/* found event to remove */
+			/* found event to remove: unschedule it (if it is
+			 * running, flag it so it is not scheduled again) */
+			__valvula_thread_pool_heap_remove (ctx->thread_pool, event);
+			event->removed = axl_true;
 			axl_list_cursor_remove (ctx->thread_pool->events_cursor);
 
 			valvula_log (VALVULA_LEVEL_DEBUG, "Removing event id %d, total events registered after removal: %d",
@@ -1111,11 +1858,63 @@ void valvula_thread_pool_stats               (ValvulaCtx        * ctx,
 	if (running_threads)
 		*running_threads = axl_list_length (ctx->thread_pool->threads);
 	if (waiting_threads)
-		*waiting_threads = valvula_async_queue_waiters (ctx->thread_pool->queue);
+		*waiting_threads = __sync_fetch_and_add (&ctx->thread_pool->parked, 0);
 	if (pending_tasks)
-		*pending_tasks = valvula_async_queue_items (ctx->thread_pool->queue);
+		*pending_tasks = __sync_fetch_and_add (&ctx->thread_pool->pending, 0);
+
+	/* lock the thread pool */
+	valvula_mutex_unlock (&(ctx->thread_pool->mutex));
+
+	return;
+}
+
+/** 
+ * @brief Allows to get queue wait and service time figures measured
+ * on the valvula thread pool during the last sampling window (these
+ * are the figures used to resize the pool automatically).
+ *
+ * @param ctx The valvula context. If NULL is received, the function do not return any stat.
+ *
+ * @param wait_p50 Median time (microseconds) tasks waited in the queue before being processed. Optional argument.
+ *
+ * @param wait_p99 99th percentile time (microseconds) tasks waited in the queue. Optional argument.
+ *
+ * @param service_avg Average time (microseconds) spent processing a task. Optional argument.
+ */
+void valvula_thread_pool_wait_stats          (ValvulaCtx        * ctx,
+					     long             * wait_p50,
+					     long             * wait_p99,
+					     long             * service_avg)
+{
+	struct timeval now;
+
+	/* clear variables received */
+	if (wait_p50)
+		*wait_p50 = 0;
+	if (wait_p99)
+		*wait_p99 = 0;
+	if (service_avg)
+		*service_avg = 0;
+	/* check ctx reference */
+	if (ctx == NULL || ctx->thread_pool == NULL)
+		return;
 
 	/* lock the thread pool */
+	valvula_mutex_lock (&(ctx->thread_pool->mutex));
+
+	/* close current window if it is due */
+	gettimeofday (&now, NULL);
+	__valvula_thread_pool_sample (ctx->thread_pool, &now);
+
+	/* update values */
+	if (wait_p50)
+		*wait_p50 = ctx->thread_pool->wait_p50;
+	if (wait_p99)
+		*wait_p99 = ctx->thread_pool->wait_p99;
+	if (service_avg)
+		*service_avg = ctx->thread_pool->service_avg;
+
+	/* unlock the thread pool */
 	valvula_mutex_unlock (&(ctx->thread_pool->mutex));
 
 	return;
@@ -1264,6 +2063,50 @@ void valvula_thread_pool_set_exclusive_pool  (ValvulaCtx * ctx,
 }
 
 
+/** 
+ * @brief Allows to pin all threads of the valvula thread pool to a
+ * set of CPUs (for example, the CPUs of a single NUMA node). Threads
+ * are allowed to run on any CPU of the list.
+ *
+ * The configuration is applied to running threads and to those added
+ * later (see \ref valvula_thread_pool_setup).
+ *
+ * @param ctx The context to configure.
+ *
+ * @param cpus CPU list in the format used by the kernel ("0-3,8").
+ *
+ * @return axl_true if all threads were pinned, otherwise axl_false is
+ * returned (wrong CPU list or thread affinity not supported by the
+ * platform).
+ */
+axl_bool valvula_thread_pool_set_cpus        (ValvulaCtx        * ctx,
+					     const char        * cpus)
+{
+	ValvulaThread * thread;
+	axl_bool        result = axl_true;
+	int             iterator;
+
+	v_return_val_if_fail (ctx && ctx->thread_pool && cpus, axl_false);
+
+	valvula_mutex_lock (&ctx->thread_pool->mutex);
+	for (iterator = 0; iterator < axl_list_length (ctx->thread_pool->threads); iterator++) {
+		thread = axl_list_get_nth (ctx->thread_pool->threads, iterator);
+		if (! valvula_thread_set_affinity (thread, cpus, -1)) {
+			result = axl_false;
+			break;
+		} /* end if */
+	} /* end for */
+
+	/* record for threads added later */
+	if (result) {
+		axl_free (ctx->thread_pool->cpus);
+		ctx->thread_pool->cpus = axl_strdup (cpus);
+	} /* end if */
+	valvula_mutex_unlock (&ctx->thread_pool->mutex);
+
+	return result;
+}
+
 /**
  * @brief Allows to configure a cleanup function that is called just
  * after a thread from the thread pool is finished.
@@ -67,7 +67,7 @@ void valvula_thread_pool_exit                (ValvulaCtx * ctx);
 
 void valvula_thread_pool_being_closed        (ValvulaCtx * ctx);
 
-void valvula_thread_pool_new_task            (ValvulaCtx        * ctx,
+axl_bool valvula_thread_pool_new_task        (ValvulaCtx        * ctx,
 					      ValvulaThreadFunc   func, 
 					      axlPointer         data);
 
@@ -85,6 +85,11 @@ void valvula_thread_pool_stats               (ValvulaCtx        * ctx,
 					      int              * waiting_threads,
 					      int              * pending_tasks);
 
+void valvula_thread_pool_wait_stats          (ValvulaCtx        * ctx,
+					     long             * wait_p50,
+					     long             * wait_p99,
+					     long             * service_avg);
+
 void valvula_thread_pool_event_stats         (ValvulaCtx        * ctx,
 					     int              * events_installed);
 
@@ -97,6 +102,9 @@ int  valvula_thread_pool_get_num             (void);
 void valvula_thread_pool_set_exclusive_pool  (ValvulaCtx        * ctx,
 					     axl_bool           value);
 
+axl_bool valvula_thread_pool_set_cpus        (ValvulaCtx        * ctx,
+					     const char        * cpus);
+
 void valvula_thread_pool_set_cleanup_func    (ValvulaCtx        * ctx,
 					      ValvulaThreadCleanup     func);
 
@@ -362,6 +362,19 @@ typedef enum {
 	 * socket number to be handled at the compilation process.
 	 */
 	VALVULA_IO_WAIT_EPOLL  = 3,
+	/**
+	 * @internal Allows to configure the linux io_uring based
+	 * mechanism (only available when compiled with
+	 * --enable-io-uring and supported by the running kernel).
+	 *
+	 * Sockets are kept registered with multishot poll requests
+	 * and completions are reaped in batches, reducing the number
+	 * of system calls done by the reader under load. When the
+	 * kernel doesn't support it, \ref valvula_io_waiting_use
+	 * fails and the current mechanism (usually \ref
+	 * VALVULA_IO_WAIT_EPOLL) is kept.
+	 */
+	VALVULA_IO_WAIT_URING  = 4,
 } ValvulaIoWaitingType;
 
 /** 
@@ -392,6 +405,25 @@ typedef enum {
 	
 } ValvulaPeerRole;
 
+/** 
+ * @brief Amount of bytes reserved inside each \ref ValvulaRequest to
+ * hold attribute values without additional allocations. Requests
+ * bigger than this are moved into a heap block.
+ */
+#define VALVULA_REQUEST_INLINE_SIZE 1024
+
+/** 
+ * @brief Max number of attributes not mapped into \ref
+ * ValvulaRequest fields that are kept for each request (see \ref
+ * valvula_request_get_attr).
+ */
+#define VALVULA_REQUEST_MAX_ATTRS 32
+
+/** 
+ * @brief Policy request received. All text attributes point into a
+ * single block (raw) where values are stored one after another, NUL
+ * terminated, so the request is released at once.
+ */
 typedef struct _ValvulaRequest {
 	/* protocol declaration and state of the request */
 	char * request;
@@ -437,6 +469,28 @@ typedef struct _ValvulaRequest {
 
 	/* listener port */
 	int    listener_port;
+
+	/* when the request was received and when it must be replied
+	 * according to the budget configured for its port (tv_sec == 0
+	 * if no budget applies) */
+	struct timeval arrival;
+	struct timeval deadline;
+
+	/* handler chain progress (internal) */
+	axlPointer     chain;
+
+	/* attributes not mapped into fields above: key and value
+	 * offsets inside raw for each one */
+	int    attrs_num;
+	int    attrs[VALVULA_REQUEST_MAX_ATTRS * 2];
+
+	/* raw request content: block holding all values (either
+	 * raw_inline or a heap block if it didn't fit), bytes used and
+	 * its size */
+	char * raw;
+	int    raw_length;
+	int    raw_size;
+	char   raw_inline[VALVULA_REQUEST_INLINE_SIZE];
 } ValvulaRequest;
 
 /** 
@@ -512,7 +566,15 @@ typedef enum {
 	/** 
 	 * @brief Allows to configure postfix filter option (see access(5))
 	 */
-	VALVULA_STATE_FILTER = 13
+	VALVULA_STATE_FILTER = 13,
+
+	/** 
+	 * @brief The handler didn't resolve the request yet: it will
+	 * call \ref valvula_request_complete (from any thread) once
+	 * done, releasing the current thread meanwhile. This state is
+	 * never replied.
+	 */
+	VALVULA_STATE_PENDING = 14
 } ValvulaState;
 
 /** 
@@ -521,6 +583,29 @@ typedef enum {
  */
 typedef struct _ValvulaRequestRegistry ValvulaRequestRegistry;
 
+/** 
+ * @brief Object pools handled by the \ref valvula_pool module. Each
+ * value identifies a set of recycled objects of the same size.
+ */
+typedef enum {
+	/** 
+	 * @brief Pool used for \ref ValvulaConnection objects.
+	 */
+	VALVULA_POOL_CONNECTION = 0,
+	/** 
+	 * @brief Pool used for \ref ValvulaRequest objects.
+	 */
+	VALVULA_POOL_REQUEST    = 1,
+	/** 
+	 * @brief Pool used for thread pool tasks.
+	 */
+	VALVULA_POOL_TASK       = 2,
+	/** 
+	 * @internal Number of pools available.
+	 */
+	VALVULA_POOL_MAX        = 3
+} ValvulaPoolType;
+
 
 #endif
 
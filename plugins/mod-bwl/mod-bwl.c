@@ -809,6 +809,12 @@ void bwl_reconf (ValvuladCtx * ctx) {
 	return;
 }
 
+/** 
+ * @brief Module API version this module was built against (it fills
+ * ValvuladModDef fields added on version 1).
+ */
+VLD_MOD_API_VERSION_DECLARE;
+
 /** 
  * @brief Public entry point for the module to be loaded. This is the
  * symbol the valvulad will lookup to load the rest of items.
@@ -820,6 +826,14 @@ ValvuladModDef module_def = {
 	bwl_close,
 	bwl_process_request,
 	NULL,
+	NULL,
+	/* blocking: lists are queried from the database */
+	axl_false,
+	/* verdicts only depend on the request and on lists: cache
+	 * them for one minute */
+	60,
+	/* lists are checked when sender and recipient are known */
+	"MAIL,RCPT",
 	NULL
 };
 
@@ -135,6 +135,12 @@ void lmm_reconf (ValvuladCtx * ctx) {
 	return;
 }
 
+/** 
+ * @brief Module API version this module was built against (it fills
+ * ValvuladModDef fields added on version 1).
+ */
+VLD_MOD_API_VERSION_DECLARE;
+
 /** 
  * @brief Public entry point for the module to be loaded. This is the
  * symbol the valvulad will lookup to load the rest of items.
@@ -146,6 +152,13 @@ ValvuladModDef module_def = {
 	lmm_close,
 	lmm_process_request,
 	NULL,
+	NULL,
+	/* blocking */
+	axl_false,
+	/* not cacheable */
+	0,
+	/* mail from is checked */
+	"MAIL,RCPT",
 	NULL
 };
 
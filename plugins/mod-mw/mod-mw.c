@@ -98,6 +98,12 @@ void mw_reconf (ValvuladCtx * ctx) {
 }
 
 
+/** 
+ * @internal Module API version this module was built against (it
+ * fills ValvuladModDef fields added on version 1).
+ */
+VLD_MOD_API_VERSION_DECLARE;
+
 /** 
  * @internal Public entry point for the module to be loaded. This is the
  * symbol the valvulad will lookup to load the rest of items.
@@ -109,7 +115,9 @@ ValvuladModDef module_def = {
 	mw_close,
 	mw_process_request,
 	mw_reconf,
-	NULL
+	NULL,
+	/* non blocking: process_request only replies DUNNO */
+	axl_true
 };
 
 END_C_DECLS
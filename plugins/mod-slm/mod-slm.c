@@ -230,6 +230,12 @@ void slm_reconf (ValvuladCtx * ctx) {
 	return;
 }
 
+/** 
+ * @internal Module API version this module was built against (it
+ * fills ValvuladModDef fields added on version 1).
+ */
+VLD_MOD_API_VERSION_DECLARE;
+
 /** 
  * @internal Public entry point for the module to be loaded. This is the
  * symbol the valvulad will lookup to load the rest of items.
@@ -241,6 +247,14 @@ ValvuladModDef module_def = {
 	slm_close,
 	slm_process_request,
 	NULL,
+	NULL,
+	/* blocking: exceptions are queried from the database */
+	axl_false,
+	/* verdicts only depend on the request and on configured
+	 * exceptions: cache them for one minute */
+	60,
+	/* sasl user is checked against mail from */
+	"MAIL,RCPT",
 	NULL
 };
 
@@ -107,6 +107,12 @@ void test_reconf (ValvuladCtx * ctx) {
 }
 
 
+/** 
+ * @brief Module API version this module was built against (it fills
+ * ValvuladModDef fields added on version 1).
+ */
+VLD_MOD_API_VERSION_DECLARE;
+
 /** 
  * @brief Public entry point for the module to be loaded. This is the
  * symbol the valvulad will lookup to load the rest of items.
@@ -118,7 +124,9 @@ ValvuladModDef module_def = {
 	test_close,
 	test_process_request,
 	test_reconf,
-	NULL
+	NULL,
+	/* non blocking: process_request only replies DUNNO */
+	axl_true
 };
 
 END_C_DECLS
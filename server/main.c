@@ -68,16 +68,74 @@ axl_bool valvulad_report_status_foreach (axlPointer key, axlPointer data, axlPoi
 	fprintf (fstatus, "  <attr name='avg request processing time' value='%ld' />\n", registry->avg_processing / 1000);
 	fprintf (fstatus, "  <attr name='min request processing time' value='%ld' />\n", registry->min_processing / 1000);
 	fprintf (fstatus, "  <attr name='max request processing time' value='%ld' />\n", registry->max_processing / 1000);
+	fprintf (fstatus, "  <attr name='requests handled' value='%d' />\n", registry->requests_handled);
+	fprintf (fstatus, "  <attr name='decisive verdicts' value='%d' />\n", registry->requests_decided);
 
 
 	return axl_false; /* iterate over all nodes */
 }
 
+void valvulad_report_status_order (FILE * fstatus)
+{
+	ValvulaHandlerChains * chains = __valvula_ctx_acquire_handler_chains (ctx->ctx);
+	char                 * order;
+	int                    iterator;
+
+	if (chains == NULL)
+		return;
+
+	/* order modules are currently called on each port */
+	fprintf (fstatus, "  <section title='Handler order' />\n");
+	for (iterator = 0; iterator < chains->length; iterator++) {
+		order = valvula_ctx_get_request_handler_order (ctx->ctx, chains->chains[iterator].port);
+		fprintf (fstatus, "  <attr name='port %d' value='%s' />\n", chains->chains[iterator].port, order ? order : "");
+		axl_free (order);
+	} /* end for */
+	__valvula_ctx_release_handler_chains (chains);
+
+	return;
+}
+
+void valvulad_report_status_pool (FILE * fstatus, const char * label, ValvulaPoolType type)
+{
+	long allocs = 0;
+	long hits   = 0;
+	int  cached = 0;
+
+	if (! valvula_pool_stats (type, &allocs, &hits, &cached))
+		return;
+
+	fprintf (fstatus, "  <attr name='%s pool allocs' value='%ld' />\n", label, allocs);
+	fprintf (fstatus, "  <attr name='%s pool hit rate' value='%ld%%' />\n", label, allocs > 0 ? (hits * 100) / allocs : 0);
+	fprintf (fstatus, "  <attr name='%s pool cached' value='%d' />\n", label, cached);
+	return;
+}
+
+void valvulad_report_status_cache (FILE * fstatus)
+{
+	long hits    = 0;
+	long misses  = 0;
+	int  entries = 0;
+
+	if (! valvula_cache_stats (ctx->ctx, &hits, &misses, &entries))
+		return;
+
+	fprintf (fstatus, "  <section title='Verdict cache' />\n");
+	fprintf (fstatus, "  <attr name='verdict cache hits' value='%ld' />\n", hits);
+	fprintf (fstatus, "  <attr name='verdict cache misses' value='%ld' />\n", misses);
+	fprintf (fstatus, "  <attr name='verdict cache hit rate' value='%ld%%' />\n", (hits + misses) > 0 ? (hits * 100) / (hits + misses) : 0);
+	fprintf (fstatus, "  <attr name='verdict cache entries' value='%d' />\n", entries);
+	return;
+}
+
 void valvulad_report_status (void) {
 	FILE * fstatus;
 	int                 running_threads = 0;
 	int                 waiting_threads = 0;
 	int                 pending_tasks = 0;
+	long                wait_p50 = 0;
+	long                wait_p99 = 0;
+	long                service_avg = 0;
 	struct timeval  now;
 
 	/* open valvula status */
@@ -92,7 +150,7 @@ void valvulad_report_status (void) {
 	fprintf (fstatus, "  <section title='General stats' />\n");
 	fprintf (fstatus, "  <attr name='valvula pid' value='%d' />\n", getpid ());
 	fprintf (fstatus, "  <attr name='operation stamp' value='%ld' />\n", (long) time (NULL));
-	fprintf (fstatus, "  <attr name='pending in reader queue' value='%d' />\n", valvula_async_queue_items (ctx->ctx->reader_queue));
+	fprintf (fstatus, "  <attr name='pending in reader queue' value='%d' />\n", valvula_reader_pending_items (ctx->ctx));
 	fprintf (fstatus, "  <attr name='handlers registered' value='%d' />\n", valvula_hash_size (ctx->ctx->process_handler_registry));
 	fprintf (fstatus, "  <attr name='requests handled' value='%d' />\n", ctx->ctx->requests_handled);
 
@@ -100,8 +158,10 @@ void valvulad_report_status (void) {
 	fprintf (fstatus, "  <attr name='seconds_running' value='%ld' />\n", now.tv_sec - ctx->started_at );
 
 	fprintf (fstatus, "  <section title='TCP stats' />\n");
-	fprintf (fstatus, "  <attr name='current listeners' value='%d' />\n", axl_list_length (ctx->ctx->srv_list));
-	fprintf (fstatus, "  <attr name='current connections' value='%d' />\n", axl_list_length (ctx->ctx->conn_list));
+	fprintf (fstatus, "  <attr name='reader threads' value='%d' />\n", valvula_reader_get_num (ctx->ctx));
+	fprintf (fstatus, "  <attr name='current listeners' value='%d' />\n", valvula_reader_listeners_watched (ctx->ctx));
+	fprintf (fstatus, "  <attr name='current connections' value='%d' />\n", 
+		 valvula_reader_connections_watched (ctx->ctx) - valvula_reader_listeners_watched (ctx->ctx));
 
 	/* thread status and pending tasks */
 
@@ -110,14 +170,29 @@ void valvulad_report_status (void) {
 	fprintf (fstatus, "  <attr name='running threads' value='%d' />\n", running_threads);
 	fprintf (fstatus, "  <attr name='waiting threads' value='%d' />\n", waiting_threads);
 	fprintf (fstatus, "  <attr name='pending tasks' value='%d' />\n", pending_tasks);
+	valvula_thread_pool_wait_stats (ctx->ctx, &wait_p50, &wait_p99, &service_avg);
+	fprintf (fstatus, "  <attr name='queue wait p50 (us)' value='%ld' />\n", wait_p50);
+	fprintf (fstatus, "  <attr name='queue wait p99 (us)' value='%ld' />\n", wait_p99);
+	fprintf (fstatus, "  <attr name='task service time avg (us)' value='%ld' />\n", service_avg);
+
+	/* memory pools */
+	fprintf (fstatus, "  <section title='Memory pools' />\n");
+	valvulad_report_status_pool (fstatus, "connection", VALVULA_POOL_CONNECTION);
+	valvulad_report_status_pool (fstatus, "request", VALVULA_POOL_REQUEST);
+	valvulad_report_status_pool (fstatus, "task", VALVULA_POOL_TASK);
+
+	/* verdict cache */
+	valvulad_report_status_cache (fstatus);
 
 	/* processing stats */
 	fprintf (fstatus, "  <section title='Processing stats (in ms)' />\n");
 	fprintf (fstatus, "  <attr name='avg request processing time' value='%ld' />\n", ctx->ctx->avg_processing / 1000);
 	fprintf (fstatus, "  <attr name='min request processing time' value='%ld' />\n", ctx->ctx->min_processing / 1000);
 	fprintf (fstatus, "  <attr name='max request processing time' value='%ld' />\n", ctx->ctx->max_processing / 1000);
+	fprintf (fstatus, "  <attr name='requests replied by deadline' value='%ld' />\n", ctx->ctx->requests_expired);
 
-	/* now show processing stats for each module */
+	/* order of modules and processing stats for each module */
+	valvulad_report_status_order (fstatus);
 
 	valvula_hash_foreach (ctx->ctx->process_handler_registry, valvulad_report_status_foreach, fstatus);
 
@@ -146,6 +146,45 @@ typedef struct _ValvuladModDef {
 	 */
 	ModUnloadFunc  unload;
 
+	/* NOTE: fields below were added after the initial module
+	 * API. They are only read when the module declares its API
+	 * version (see \ref VLD_MOD_API_VERSION_DECLARE), so modules
+	 * built against previous headers keep working. */
+
+	/** 
+	 * @brief Optional flag to declare that process_request never
+	 * blocks (it only uses in-memory state: no database queries,
+	 * no network access). When all modules running on a port are
+	 * non-blocking, requests are resolved directly from the
+	 * reader thread without going through the thread pool.
+	 */
+	axl_bool       non_blocking;
+
+	/** 
+	 * @brief Optional seconds verdicts resolved by
+	 * process_request can be reused by the verdict cache (see
+	 * <verdict-cache>). Leave it 0 (not cacheable) unless the
+	 * verdict only depends on request fields and on state that
+	 * rarely changes: modules counting requests (quotas) must not
+	 * declare it.
+	 */
+	int            cache_ttl;
+
+	/** 
+	 * @brief Optional comma separated list of protocol_state
+	 * values process_request must be called for (for example
+	 * "MAIL,RCPT"). NULL to be called at all SMTP stages. It can
+	 * be changed with protocol-state attribute on <run>.
+	 */
+	const char   * protocol_states;
+
+	/** 
+	 * @brief Optional request attribute value process_request
+	 * must be called for (NULL for all requests). It can be
+	 * changed with request attribute on <run>.
+	 */
+	const char   * request_filter;
+
 } ValvuladModDef;
 
 /** 
@@ -159,6 +198,22 @@ typedef struct _ValvuladModDef {
  */
 #define VLD_MOD_PREPARE(_ctx) do{ctx = _ctx;}while(0)
 
+/** 
+ * @brief Current valvulad module API version. Version 1 added
+ * non_blocking, cache_ttl, protocol_states and request_filter to
+ * \ref ValvuladModDef.
+ */
+#define VLD_MOD_API_VERSION 1
+
+/** 
+ * @brief Declares the module API version the module was built
+ * against (exporting the module_api_version symbol, next to
+ * module_def). Modules filling any \ref ValvuladModDef field added
+ * after unload must use it: valvulad doesn't read those fields from
+ * modules without it (they were built with a smaller structure).
+ */
+#define VLD_MOD_API_VERSION_DECLARE int module_api_version = VLD_MOD_API_VERSION
+
 #endif
 
 /* @} */
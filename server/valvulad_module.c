@@ -85,6 +85,7 @@ const char       * valvulad_module_name        (ValvuladModule * module)
 ValvuladModule * valvulad_module_open (ValvuladCtx * ctx, const char * module)
 {
 	ValvuladModule * result;
+	int            * api_version;
 
 	axl_return_val_if_fail (module, NULL);
 
@@ -133,7 +134,17 @@ ValvuladModule * valvulad_module_open (ValvuladCtx * ctx, const char * module)
 		return NULL;
 	} /* end if */
 	
-	msg ("module found: [%s]", result->def->mod_name);
+	/* get module API version: modules not declaring it were
+	 * built before ValvuladModDef was extended so fields added
+	 * after unload must not be read */
+#if defined(AXL_OS_UNIX)
+	api_version = (int *) dlsym (result->handle, "module_api_version");
+#elif defined(AXL_OS_WIN32)
+	api_version = (int *) GetProcAddress (result->handle, "module_api_version");
+#endif
+	result->api_version = api_version ? (*api_version) : 0;
+
+	msg ("module found: [%s] (api version %d)", result->def->mod_name, result->api_version);
 	
 	return result;
 }
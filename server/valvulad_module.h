@@ -46,6 +46,9 @@ typedef struct _ValvuladModule {
 	char             * path;
 	void             * handle;
 	ValvuladModDef   * def;
+	/* module API version declared by the module (0 if it
+	 * doesn't declare it) */
+	int                api_version;
 	axl_bool           skip_unmap;
 
 	/* context that loaded the module */
@@ -170,36 +170,109 @@ void valvulad_run_load_modules (ValvuladCtx * ctx, axlDoc * doc)
 	return;
 }
 
+/** 
+ * @internal Microseconds between handler reorderings (modules
+ * flagged adaptive).
+ */
+#define VALVULAD_RUN_REORDER_PERIOD 60000000
+
+/** 
+ * @internal Event that reorders modules sharing priority according to
+ * their measured cost.
+ */
+axl_bool __valvulad_run_reorder_handlers (ValvulaCtx  * _ctx, 
+					  axlPointer    user_data,
+					  axlPointer    user_data2)
+{
+	valvula_ctx_reorder_request_handlers (_ctx);
+
+	/* keep the event */
+	return axl_false;
+}
+
 void valvulad_run_register_handlers (ValvuladCtx * ctx)
 {
-	axlNode        * node;
-	axlNode        * node2;
-	ValvuladModule * module;
-	int              port;
-	int              prio;
+	axlNode                * node;
+	axlNode                * node2;
+	ValvuladModule         * module;
+	ValvulaRequestRegistry * registry;
+	int                      port;
+	int                      prio;
+	axl_bool                 parallel;
+	int                      group;
+	int                      last_group;
+	axl_bool                 adaptive = axl_false;
+	const char             * protocol_states;
+	const char             * request_filter;
+	axl_bool                 def_ext;
 
 	/* get first node */
 	node = axl_doc_get (ctx->config, "/valvula/general/listen");
 	while (node) {
 		msg ("  - processing node: %p", node);
 		/* get default port to be used on this listener */
-		prio     = 1;
-		port     = -1;
+		prio          = 1;
+		port          = -1;
+		last_group    = 0;
 		if (HAS_ATTR (node, "port")) 
 			port = atoi (ATTR_VALUE (node, "port"));
 
 		/* get first module */
 		node2 = axl_node_get_child_called (node, "run");
 		while (node2) {
+			/* consecutive modules flagged parallel share the
+			 * priority so they are evaluated concurrently,
+			 * consecutive modules flagged adaptive share the
+			 * priority so they are reordered by measured
+			 * cost */
+			parallel = HAS_ATTR_VALUE (node2, "parallel", "yes");
+			group    = parallel ? 1 : (HAS_ATTR_VALUE (node2, "adaptive", "yes") ? 2 : 0);
+			if (group && group == last_group)
+				prio --;
+			if (group == 2)
+				adaptive = axl_true;
+
 			/* module */
 			module = valvulad_module_find_by_name (ctx, ATTR_VALUE (node2, "module"));
 			if (module && module->def->process_request) {
+				/* fields after unload are only available on
+				 * modules declaring the module API version */
+				def_ext = (module->api_version >= 1);
+
 				/* call to register the function on the provided port */
 				msg ("Registering module: %s, on port %d (prio: %d)", ATTR_VALUE (node2, "module"), port, prio);
-				valvula_ctx_register_request_handler (ctx->ctx, ATTR_VALUE (node2, "module"), module->def->process_request, prio, port, NULL);
+				registry = valvula_ctx_register_request_handler (ctx->ctx, ATTR_VALUE (node2, "module"), module->def->process_request, prio, port, NULL);
+
+				/* flag handler so requests can be resolved on the reader thread */
+				if (registry && def_ext && module->def->non_blocking)
+					valvula_ctx_set_request_handler_non_blocking (registry, axl_true);
+				if (registry && parallel)
+					valvula_ctx_set_request_handler_parallel (registry, axl_true);
+				/* allow reordering the module by measured cost */
+				if (registry && group == 2)
+					valvula_ctx_set_request_handler_adaptive (registry, axl_true);
+				/* allow caching verdicts resolved by the module */
+				if (registry && def_ext && module->def->cache_ttl > 0)
+					valvula_ctx_set_request_handler_cacheable (registry, module->def->cache_ttl);
+
+				/* skip the module for requests it doesn't handle */
+				protocol_states = def_ext ? module->def->protocol_states : NULL;
+				request_filter  = def_ext ? module->def->request_filter : NULL;
+				if (HAS_ATTR (node2, "protocol-state"))
+					protocol_states = ATTR_VALUE (node2, "protocol-state");
+				if (HAS_ATTR (node2, "request"))
+					request_filter = ATTR_VALUE (node2, "request");
+				if (registry && (protocol_states || request_filter)) {
+					msg ("  filtering module %s: protocol_state=%s, request=%s", ATTR_VALUE (node2, "module"), 
+					     protocol_states ? protocol_states : "(all)", request_filter ? request_filter : "(all)");
+					if (! valvula_ctx_set_request_handler_filter (registry, protocol_states, request_filter))
+						error ("Unable to configure filter for module %s (protocol-state='%s'), it will be called for all requests", 
+						       ATTR_VALUE (node2, "module"), protocol_states ? protocol_states : "");
+				} /* end if */
 			} /* end if */
 
 			/* next node */
+			last_group = group;
 			prio ++;
 			node2 = axl_node_get_next_called (node2, "run");
 		} /* end while */
@@ -208,6 +281,12 @@ void valvulad_run_register_handlers (ValvuladCtx * ctx)
 		node = axl_node_get_next_called (node, "listen");
 	} /* end while */
 
+	/* reorder adaptive modules periodically */
+	if (adaptive) {
+		msg ("Installing handler reordering every %d seconds", VALVULAD_RUN_REORDER_PERIOD / 1000000);
+		valvula_thread_pool_new_event (ctx->ctx, VALVULAD_RUN_REORDER_PERIOD, __valvulad_run_reorder_handlers, ctx, NULL);
+	} /* end if */
+
 	return;
 }
 
@@ -849,6 +928,137 @@ axl_bool valvulad_run_check_local_domains_config (ValvuladCtx * ctx) {
 	return axl_true;
 }
 
+/** 
+ * @internal Translates a state name (dunno, defer, reject..) into its
+ * value, reporting VALVULA_STATE_DUNNO if it is not recognized.
+ */
+ValvulaState valvulad_run_get_state (ValvuladCtx * ctx, const char * name)
+{
+	ValvulaState state;
+
+	for (state = VALVULA_STATE_OK; state <= VALVULA_STATE_LOG; state++) {
+		if (axl_casecmp (valvula_support_state_str (state), name))
+			return state;
+	} /* end for */
+
+	wrn ("Unknown state %s, using dunno", name);
+	return VALVULA_STATE_DUNNO;
+}
+
+/** 
+ * @internal Applies socket options defined on the <listen> node to
+ * the listener created:
+ *
+ * - backlog="N" : listen(2) queue size.
+ * - defer-accept="N" : TCP_DEFER_ACCEPT seconds.
+ * - tcp-nodelay="yes|no" : disable Nagle on accepted connections.
+ * - deadline="N" : milliseconds requests received on this port have
+ *   to be replied, and deadline-state="dunno|defer|..." : state
+ *   replied once it is spent (dunno by default, that is, fail open).
+ */
+void valvulad_run_config_listener (ValvuladCtx * ctx, axlNode * node, ValvulaConnection * listener)
+{
+	int          value;
+	ValvulaState state;
+
+	if (HAS_ATTR (node, "backlog")) {
+		value = valvula_support_strtod (ATTR_VALUE (node, "backlog"), NULL);
+		if (valvula_listener_set_backlog (listener, value))
+			msg ("Configured listener backlog to %d", value);
+		else
+			error ("Unable to configure listener backlog to %d", value);
+	} /* end if */
+
+	if (HAS_ATTR (node, "defer-accept")) {
+		value = valvula_support_strtod (ATTR_VALUE (node, "defer-accept"), NULL);
+		if (valvula_listener_set_defer_accept (listener, value))
+			msg ("Configured listener defer accept to %d seconds", value);
+		else
+			error ("Unable to configure listener defer accept to %d seconds", value);
+	} /* end if */
+
+	if (HAS_ATTR (node, "tcp-nodelay"))
+		valvula_listener_set_tcp_nodelay (listener, HAS_ATTR_VALUE (node, "tcp-nodelay", "yes"));
+
+	if (HAS_ATTR (node, "deadline")) {
+		value = valvula_support_strtod (ATTR_VALUE (node, "deadline"), NULL);
+		state = VALVULA_STATE_DUNNO;
+		if (HAS_ATTR (node, "deadline-state"))
+			state = valvulad_run_get_state (ctx, ATTR_VALUE (node, "deadline-state"));
+		valvula_ctx_set_request_deadline (ctx->ctx, valvula_support_strtod (valvula_connection_get_port (listener), NULL), value, state);
+		msg ("Configured request deadline for port %s to %d ms (replying %s once spent)", 
+		     valvula_connection_get_port (listener), value, valvula_support_state_str (state));
+	} /* end if */
+
+	return;
+}
+
+/** 
+ * @internal Reports CPU topology (CPUs found on each NUMA node) and
+ * applies CPU placement defined on the <cpu-affinity> node:
+ *
+ * - readers="0-1" : CPUs where reader loops are pinned (one per loop).
+ * - workers="2-7" : CPUs where thread pool workers are pinned.
+ */
+void valvulad_run_config_affinity (ValvuladCtx * ctx, axlNode * node)
+{
+	int    cpus  = sysconf (_SC_NPROCESSORS_CONF);
+	int    nodes = valvula_thread_get_numa_nodes ();
+	int    numa;
+	int    cpu;
+	int    first;
+	int    last  = -1;
+	char * list;
+	char * aux;
+
+	msg ("CPU topology: %d cpus, %d numa node(s)", cpus, nodes);
+	for (numa = 0; numa < nodes; numa++) {
+		/* build cpu ranges found on this node */
+		list  = NULL;
+		first = -1;
+		for (cpu = 0; cpu <= cpus; cpu++) {
+			if (cpu < cpus && valvula_thread_get_numa_node (cpu) == numa) {
+				if (first == -1)
+					first = cpu;
+				last = cpu;
+				continue;
+			} /* end if */
+
+			if (first == -1)
+				continue;
+			if (first == last)
+				aux = axl_strdup_printf ("%s%s%d", list ? list : "", list ? "," : "", first);
+			else
+				aux = axl_strdup_printf ("%s%s%d-%d", list ? list : "", list ? "," : "", first, last);
+			axl_free (list);
+			list  = aux;
+			first = -1;
+		} /* end for */
+
+		msg ("  numa node %d: cpus %s", numa, list ? list : "none");
+		axl_free (list);
+	} /* end for */
+
+	if (node == NULL)
+		return;
+
+	if (HAS_ATTR (node, "readers")) {
+		if (valvula_reader_set_cpus (ctx->ctx, ATTR_VALUE (node, "readers")))
+			msg ("Reader loops (%d) pinned to cpus %s, one cpu per loop", valvula_reader_get_num (ctx->ctx), ATTR_VALUE (node, "readers"));
+		else
+			error ("Unable to pin reader loops to cpus %s (wrong cpu list or thread affinity not supported)", ATTR_VALUE (node, "readers"));
+	} /* end if */
+
+	if (HAS_ATTR (node, "workers")) {
+		if (valvula_thread_pool_set_cpus (ctx->ctx, ATTR_VALUE (node, "workers")))
+			msg ("Thread pool workers (%d) pinned to cpus %s", valvula_thread_pool_get_running_threads (ctx->ctx), ATTR_VALUE (node, "workers"));
+		else
+			error ("Unable to pin thread pool workers to cpus %s (wrong cpu list or thread affinity not supported)", ATTR_VALUE (node, "workers"));
+	} /* end if */
+
+	return;
+}
+
 /** 
  * @brief Starts valvulad engine using the current configuration.
  */
@@ -858,6 +1068,9 @@ axl_bool valvulad_run_config (ValvuladCtx * ctx)
 	ValvulaConnection * listener;
 	int                 gid, pid;
 	int                 request_line_limit;
+	int                 reader_threads;
+	int                 cache_size;
+	ValvulaIoWaitingType io_mech;
 
 	if (ctx == NULL || ctx->ctx == NULL)
 		return axl_false;
@@ -865,6 +1078,64 @@ axl_bool valvulad_run_config (ValvuladCtx * ctx)
 	/* init log reporting */
 	valvulad_log_init (ctx);
 
+	/* configure I/O waiting mechanism used by reader loops */
+	node = axl_doc_get (ctx->config, "/valvula/global-settings/io-waiting");
+	if (node && HAS_ATTR (node, "mech")) {
+		if (HAS_ATTR_VALUE (node, "mech", "uring"))
+			io_mech = VALVULA_IO_WAIT_URING;
+		else if (HAS_ATTR_VALUE (node, "mech", "epoll"))
+			io_mech = VALVULA_IO_WAIT_EPOLL;
+		else if (HAS_ATTR_VALUE (node, "mech", "poll"))
+			io_mech = VALVULA_IO_WAIT_POLL;
+		else if (HAS_ATTR_VALUE (node, "mech", "select"))
+			io_mech = VALVULA_IO_WAIT_SELECT;
+		else {
+			error ("Unknown I/O waiting mechanism %s, expected uring, epoll, poll or select", ATTR_VALUE (node, "mech"));
+			io_mech = valvula_io_waiting_get_current (ctx->ctx);
+		} /* end if */
+
+		if (io_mech != valvula_io_waiting_get_current (ctx->ctx)) {
+			if (valvula_io_waiting_use (ctx->ctx, io_mech))
+				msg ("Using I/O waiting mechanism: %s", ATTR_VALUE (node, "mech"));
+			else
+				wrn ("I/O waiting mechanism %s not available, keeping default", ATTR_VALUE (node, "mech"));
+		} /* end if */
+	} /* end if */
+
+	/* edge-triggered notifications (epoll) */
+	if (node && HAS_ATTR_VALUE (node, "edge-triggered", "yes")) {
+		msg ("Enabling edge-triggered I/O notifications");
+		valvula_io_waiting_set_edge_triggered (ctx->ctx, axl_true);
+	} /* end if */
+
+	/* configure reader threads (must be done before starting
+	 * listeners so they are sharded across all reader loops) */
+	node = axl_doc_get (ctx->config, "/valvula/global-settings/reader-threads");
+	if (node && HAS_ATTR (node, "num")) {
+		reader_threads = valvula_support_strtod (ATTR_VALUE (node, "num"), NULL);
+		if (reader_threads > 1) {
+			msg ("Configuring reader threads to %d", reader_threads);
+			if (! valvula_reader_set_num (ctx->ctx, reader_threads)) 
+				error ("Unable to configure %d reader threads, using %d", reader_threads, valvula_reader_get_num (ctx->ctx));
+		} /* end if */
+	} /* end if */
+
+	/* verdict cache in front of the module chain (configured
+	 * before listeners are started) */
+	node = axl_doc_get (ctx->config, "/valvula/global-settings/verdict-cache");
+	if (node && HAS_ATTR (node, "size") && HAS_ATTR (node, "key")) {
+		cache_size = valvula_support_strtod (ATTR_VALUE (node, "size"), NULL);
+		if (cache_size > 0) {
+			msg ("Enabling verdict cache (size %d, key %s)", cache_size, ATTR_VALUE (node, "key"));
+			if (! valvula_cache_setup (ctx->ctx, cache_size, ATTR_VALUE (node, "key")))
+				error ("Unable to configure verdict cache, requests will be resolved by modules");
+		} /* end if */
+	} /* end if */
+
+	/* report topology and pin reader loops and pool workers (once
+	 * all reader loops are started) */
+	valvulad_run_config_affinity (ctx, axl_doc_get (ctx->config, "/valvula/global-settings/cpu-affinity"));
+
 	/* get listen nodes and startup server */
 	node = axl_doc_get (ctx->config, "/valvula/general/listen");
 	if (node == NULL) {
@@ -873,8 +1144,29 @@ axl_bool valvulad_run_config (ValvuladCtx * ctx)
 	} /* end if */
 
 	while (node) {
+		if (HAS_ATTR (node, "path")) {
+			/* unix socket listener: port (if defined) is only
+			 * used to select handlers */
+			listener = valvula_listener_new_unix (ctx->ctx, ATTR_VALUE (node, "path"), 
+							      HAS_ATTR (node, "mode") ? (int) strtol (ATTR_VALUE (node, "mode"), NULL, 8) : -1,
+							      ATTR_VALUE (node, "port"));
+			if (! valvula_connection_is_ok (listener)) {
+				error ("Failed to start listener at unix:%s, found error", ATTR_VALUE (node, "path"));
+				return axl_false;
+			}
+			msg ("Started listener at unix:%s (port %s)", ATTR_VALUE (node, "path"), valvula_connection_get_port (listener));
+			axl_list_append (ctx->listeners, listener);
+
+			/* configure listener socket options */
+			valvulad_run_config_listener (ctx, node, listener);
+
+			/* get listen node */
+			node = axl_node_get_next_called (node, "listen");
+			continue;
+		} /* end if */
+
 		if (! HAS_ATTR (node, "host") || ! HAS_ATTR (node, "port")) {
-			error ("Failed to start Valvula, found <listen> node without host or port attribute");
+			error ("Failed to start Valvula, found <listen> node without host or port attribute (or path for unix sockets)");
 			return axl_false;
 		}
 		
@@ -887,6 +1179,9 @@ axl_bool valvulad_run_config (ValvuladCtx * ctx)
 		msg ("Started listener at %s:%s", ATTR_VALUE (node, "host"), ATTR_VALUE (node, "port"));
 		axl_list_append (ctx->listeners, listener);
 
+		/* configure listener socket options */
+		valvulad_run_config_listener (ctx, node, listener);
+
 		/* get listen node */
 		node = axl_node_get_next_called (node, "listen");
 	} /* end while */
@@ -96,6 +96,21 @@ int          test_readline (ValvulaCtx * ctx, VALVULA_SOCKET session, char  * bu
 
 }
 
+/** 
+ * @brief Waits the provided amount of microseconds (usleep is not
+ * available under -ansi).
+ */
+void test_wait (long microseconds)
+{
+	struct timeval tv;
+
+	tv.tv_sec  = microseconds / 1000000;
+	tv.tv_usec = microseconds % 1000000;
+	select (0, NULL, NULL, NULL, &tv);
+
+	return;
+}
+
 ValvuladCtx *  test_valvula_load_config_aux (const char * label, const char * path, axl_bool run_config, 
 					     ValvuladCtx * result, const char * postfix_file) {
 
@@ -364,6 +379,379 @@ axl_bool  test_00 (void) {
 	return axl_true;
 }
 
+ValvulaState test_00a_handler (ValvulaCtx        * ctx, 
+			       ValvulaConnection * connection, 
+			       ValvulaRequest    * request,
+			       axlPointer          request_data,
+			       char             ** message)
+{
+	return VALVULA_STATE_DUNNO;
+}
+
+ValvulaRequest * test_00a_request (const char * sender, const char * recipient, const char * protocol_state)
+{
+	ValvulaRequest * request = axl_new (ValvulaRequest, 1);
+
+	request->request        = "smtpd_access_policy";
+	request->protocol_state = (char *) protocol_state;
+	request->sender         = (char *) sender;
+	request->recipient      = (char *) recipient;
+
+	return request;
+}
+
+ValvulaState test_valvula_request (const char * policy_server, const char * port,
+				   const char * request, const char * protocol_state, const char * protocol_name,
+				   const char * sender, const char * recipient, const char * recipient_count,
+				   const char * queue_id, const char * message_size,
+				   const char * sasl_method, const char * sasl_username, const char * sasl_sender);
+ValvulaCtx * test_valvula_listener (const char * port);
+
+ValvulaState test_00a_state (ValvulaCtx        * ctx, 
+			     ValvulaConnection * connection, 
+			     ValvulaRequest    * request,
+			     axlPointer          request_data,
+			     char             ** message)
+{
+	/* state configured for each handler */
+	return (ValvulaState) PTR_TO_INT (request_data);
+}
+
+ValvulaState test_00a_chain_request (const char * port)
+{
+	return test_valvula_request (/* policy server location */
+				     "127.0.0.1", port, 
+				     /* state */
+				     "smtpd_access_policy", "RCPT", "SMTP",
+				     /* sender, recipient, recipient count */
+				     "francis@aspl.es", "info@aspl.es", "1",
+				     /* queue-id, size */
+				     "935jfe534", "235",
+				     /* sasl method, sasl username, sasl sender */
+				     NULL, NULL, NULL);
+}
+
+long test_00a_cached_ttl (ValvulaCtx * ctx, int port)
+{
+	ValvulaRequest    * request = test_00a_request ("francis@aspl.es", "info@aspl.es", "RCPT");
+	ValvulaCacheEntry * entry;
+	char              * key;
+	long                ttl     = -1;
+
+	/* seconds left for the verdict stored for the request (-1
+	 * when not stored) */
+	key = __valvula_cache_key (ctx, ctx->verdict_cache, request, port);
+	valvula_mutex_lock (&ctx->verdict_cache->mutex);
+	entry = axl_hash_get (ctx->verdict_cache->index, key);
+	if (entry)
+		ttl = entry->expires - valvula_now ();
+	valvula_mutex_unlock (&ctx->verdict_cache->mutex);
+
+	axl_free (key);
+	axl_free (request);
+	return ttl;
+}
+
+axl_bool  test_00a (void) {
+
+	ValvulaCtx             * ctx = valvula_ctx_new ();
+	ValvulaRequest         * request1;
+	ValvulaRequest         * request2;
+	ValvulaRequest         * request3;
+	ValvulaRequestRegistry * registry;
+	ValvulaCacheEntry      * entry;
+	ValvulaState             state;
+	char                   * message;
+	char                   * key;
+	long                     hits;
+	long                     misses;
+	int                      entries;
+	long                     ttl;
+
+	request1 = test_00a_request ("francis@aspl.es", "info@aspl.es", "RCPT");
+	request2 = test_00a_request ("francis@aspl.es", "support@aspl.es", "RCPT");
+	request3 = test_00a_request ("francis@aspl.es", "info@example.com", "DATA");
+
+	printf ("Test 00-a: checking verdict cache setup..\n");
+	if (! valvula_cache_setup (ctx, 2, "sender, recipient_domain")) {
+		printf ("ERROR 0a.1: expected to setup verdict cache..\n");
+		return axl_false;
+	} /* end if */
+
+	/*** key building ***/
+	printf ("Test 00-a: checking verdict cache key..\n");
+	key = __valvula_cache_key (ctx, ctx->verdict_cache, request1, 3579);
+	if (! axl_cmp (key, "3579\nfrancis@aspl.es\naspl.es")) {
+		printf ("ERROR 0a.2: expected different key: %s..\n", key);
+		return axl_false;
+	} /* end if */
+	axl_free (key);
+
+	/* requests with the same key fields must share the key */
+	key = __valvula_cache_key (ctx, ctx->verdict_cache, request2, 3579);
+	if (! axl_cmp (key, "3579\nfrancis@aspl.es\naspl.es")) {
+		printf ("ERROR 0a.3: expected different key: %s..\n", key);
+		return axl_false;
+	} /* end if */
+	axl_free (key);
+
+	/* but not across listener ports */
+	key = __valvula_cache_key (ctx, ctx->verdict_cache, request1, 3580);
+	if (! axl_cmp (key, "3580\nfrancis@aspl.es\naspl.es")) {
+		printf ("ERROR 0a.4: expected different key: %s..\n", key);
+		return axl_false;
+	} /* end if */
+	axl_free (key);
+
+	/* once handlers filter requests, the SMTP stage is part of the key */
+	registry = valvula_ctx_register_request_handler (ctx, "test-00a-filtered", test_00a_handler, 1, -1, NULL);
+	if (! valvula_ctx_set_request_handler_filter (registry, "RCPT", NULL)) {
+		printf ("ERROR 0a.5: expected to configure handler filter..\n");
+		return axl_false;
+	} /* end if */
+	key = __valvula_cache_key (ctx, ctx->verdict_cache, request1, 3579);
+	if (! axl_cmp (key, "3579\nRCPT\nsmtpd_access_policy\nfrancis@aspl.es\naspl.es")) {
+		printf ("ERROR 0a.6: expected different key: %s..\n", key);
+		return axl_false;
+	} /* end if */
+	axl_free (key);
+
+	/*** CLOCK eviction ***/
+	printf ("Test 00-a: checking verdict cache CLOCK eviction..\n");
+	__valvula_cache_store (ctx, request1, 3579, VALVULA_STATE_REJECT, "rejected", 60);
+	__valvula_cache_store (ctx, request3, 3579, VALVULA_STATE_OK, NULL, 60);
+
+	/* use request1 so it gets a second chance */
+	message = NULL;
+	if (! __valvula_cache_lookup (ctx, request1, 3579, &state, &message) || state != VALVULA_STATE_REJECT || ! axl_cmp (message, "rejected")) {
+		printf ("ERROR 0a.7: expected to find verdict stored..\n");
+		return axl_false;
+	} /* end if */
+	axl_free (message);
+
+	/* cache is full: storing a new verdict must evict request3 (not used) */
+	__valvula_cache_store (ctx, request1, 3580, VALVULA_STATE_DUNNO, NULL, 60);
+	message = NULL;
+	if (__valvula_cache_lookup (ctx, request3, 3579, &state, &message)) {
+		printf ("ERROR 0a.8: expected verdict to be evicted..\n");
+		return axl_false;
+	} /* end if */
+	if (! __valvula_cache_lookup (ctx, request1, 3579, &state, &message) || state != VALVULA_STATE_REJECT) {
+		printf ("ERROR 0a.9: expected verdict used to survive eviction..\n");
+		return axl_false;
+	} /* end if */
+	axl_free (message);
+	message = NULL;
+	if (! __valvula_cache_lookup (ctx, request1, 3580, &state, &message) || state != VALVULA_STATE_DUNNO) {
+		printf ("ERROR 0a.10: expected to find verdict stored..\n");
+		return axl_false;
+	} /* end if */
+
+	if (! valvula_cache_stats (ctx, &hits, &misses, &entries) || hits != 3 || misses != 1 || entries != 2) {
+		printf ("ERROR 0a.11: expected different stats: hits=%ld, misses=%ld, entries=%d..\n", hits, misses, entries);
+		return axl_false;
+	} /* end if */
+
+	/*** TTL expiry ***/
+	printf ("Test 00-a: checking verdict cache TTL expiry..\n");
+	key   = __valvula_cache_key (ctx, ctx->verdict_cache, request1, 3579);
+	entry = axl_hash_get (ctx->verdict_cache->index, key);
+	axl_free (key);
+	if (entry == NULL) {
+		printf ("ERROR 0a.12: expected to find cache entry..\n");
+		return axl_false;
+	} /* end if */
+
+	/* expire the verdict */
+	entry->expires = valvula_now ();
+	if (__valvula_cache_lookup (ctx, request1, 3579, &state, &message)) {
+		printf ("ERROR 0a.13: expected verdict expired to be ignored..\n");
+		return axl_false;
+	} /* end if */
+
+	/* expired entries are evicted first, even if used */
+	entry->referenced = axl_true;
+	__valvula_cache_store (ctx, request3, 3579, VALVULA_STATE_OK, NULL, 60);
+	message = NULL;
+	if (! __valvula_cache_lookup (ctx, request1, 3580, &state, &message) || state != VALVULA_STATE_DUNNO) {
+		printf ("ERROR 0a.14: expected verdict not expired to survive eviction..\n");
+		return axl_false;
+	} /* end if */
+
+	/* disable cache */
+	valvula_cache_setup (ctx, 0, NULL);
+	if (valvula_cache_stats (ctx, NULL, NULL, NULL)) {
+		printf ("ERROR 0a.15: expected cache to be disabled..\n");
+		return axl_false;
+	} /* end if */
+
+	axl_free (request1);
+	axl_free (request2);
+	axl_free (request3);
+	valvula_ctx_unref (&ctx);
+
+	/*** ttl of verdicts stored by handler chains ***/
+	printf ("Test 00-a: checking verdicts are stored with the lowest ttl of the handlers called..\n");
+	ctx = test_valvula_listener ("3595");
+	if (ctx == NULL)
+		return axl_false;
+	if (! valvula_connection_is_ok (valvula_listener_new (ctx, "127.0.0.1", "3596")) ||
+	    ! valvula_connection_is_ok (valvula_listener_new (ctx, "127.0.0.1", "3597"))) {
+		printf ("ERROR 0a.16: failed to start listeners..\n");
+		return axl_false;
+	} /* end if */
+	valvula_cache_setup (ctx, 16, "sender");
+
+	/* handlers are not cacheable unless declared */
+	registry = valvula_ctx_register_request_handler (ctx, "test-00a-long", test_00a_state, 1, 3595, INT_TO_PTR (VALVULA_STATE_DUNNO));
+	if (registry->cache_ttl != 0) {
+		printf ("ERROR 0a.17: expected handler not cacheable by default..\n");
+		return axl_false;
+	} /* end if */
+
+	/* sequential chain: ttl of the decisive handler is the
+	 * lowest, the handler not reached doesn't count */
+	valvula_ctx_set_request_handler_cacheable (registry, 60);
+	registry = valvula_ctx_register_request_handler (ctx, "test-00a-short", test_00a_state, 2, 3595, INT_TO_PTR (VALVULA_STATE_REJECT));
+	valvula_ctx_set_request_handler_cacheable (registry, 5);
+	registry = valvula_ctx_register_request_handler (ctx, "test-00a-unreached", test_00a_state, 3, 3595, INT_TO_PTR (VALVULA_STATE_OK));
+	valvula_ctx_set_request_handler_cacheable (registry, 1);
+
+	if (test_00a_chain_request ("3595") != VALVULA_STATE_REJECT) {
+		printf ("ERROR 0a.18: expected reject from handler chain..\n");
+		return axl_false;
+	} /* end if */
+	ttl = test_00a_cached_ttl (ctx, 3595);
+	if (ttl < 4 || ttl > 5) {
+		printf ("ERROR 0a.19: expected verdict stored with ttl 5 but found %ld..\n", ttl);
+		return axl_false;
+	} /* end if */
+
+	/* a non cacheable handler called: nothing stored */
+	registry = valvula_ctx_register_request_handler (ctx, "test-00a-long", test_00a_state, 1, 3596, INT_TO_PTR (VALVULA_STATE_DUNNO));
+	valvula_ctx_set_request_handler_cacheable (registry, 60);
+	valvula_ctx_register_request_handler (ctx, "test-00a-uncached", test_00a_state, 2, 3596, INT_TO_PTR (VALVULA_STATE_REJECT));
+
+	if (test_00a_chain_request ("3596") != VALVULA_STATE_REJECT) {
+		printf ("ERROR 0a.20: expected reject from handler chain..\n");
+		return axl_false;
+	} /* end if */
+	ttl = test_00a_cached_ttl (ctx, 3596);
+	if (ttl != -1) {
+		printf ("ERROR 0a.21: expected verdict not to be stored but found ttl %ld..\n", ttl);
+		return axl_false;
+	} /* end if */
+
+	/* parallel group: branches up to the decisive one count,
+	 * later siblings don't */
+	registry = valvula_ctx_register_request_handler (ctx, "test-00a-par-long", test_00a_state, 1, 3597, INT_TO_PTR (VALVULA_STATE_DUNNO));
+	valvula_ctx_set_request_handler_parallel (registry, axl_true);
+	valvula_ctx_set_request_handler_cacheable (registry, 60);
+	registry = valvula_ctx_register_request_handler (ctx, "test-00a-par-short", test_00a_state, 1, 3597, INT_TO_PTR (VALVULA_STATE_REJECT));
+	valvula_ctx_set_request_handler_parallel (registry, axl_true);
+	valvula_ctx_set_request_handler_cacheable (registry, 5);
+	registry = valvula_ctx_register_request_handler (ctx, "test-00a-par-late", test_00a_state, 1, 3597, INT_TO_PTR (VALVULA_STATE_DUNNO));
+	valvula_ctx_set_request_handler_parallel (registry, axl_true);
+	valvula_ctx_set_request_handler_cacheable (registry, 1);
+
+	if (test_00a_chain_request ("3597") != VALVULA_STATE_REJECT) {
+		printf ("ERROR 0a.22: expected reject from parallel group..\n");
+		return axl_false;
+	} /* end if */
+	ttl = test_00a_cached_ttl (ctx, 3597);
+	if (ttl < 4 || ttl > 5) {
+		printf ("ERROR 0a.23: expected verdict stored with ttl 5 but found %ld..\n", ttl);
+		return axl_false;
+	} /* end if */
+
+	valvula_exit_ctx (ctx, axl_true);
+
+	return axl_true;
+}
+
+axl_bool  test_00b (void) {
+
+	ValvulaCtx             * ctx = valvula_ctx_new ();
+	ValvulaRequestRegistry * registry;
+	ValvulaHandlerChain    * chain;
+	char                   * order;
+
+	/* register handlers out of order and mixing ports */
+	printf ("Test 00-b: registering handlers for several ports..\n");
+	valvula_ctx_register_request_handler (ctx, "c", test_00a_handler, 3, 3579, NULL);
+	valvula_ctx_register_request_handler (ctx, "x", test_00a_handler, 2, 3580, NULL);
+	valvula_ctx_register_request_handler (ctx, "a", test_00a_handler, 1, 3579, NULL);
+	valvula_ctx_register_request_handler (ctx, "b", test_00a_handler, 2, 3579, NULL);
+	valvula_ctx_register_request_handler (ctx, "y", test_00a_handler, 1, 3580, NULL);
+	valvula_ctx_register_request_handler (ctx, "b2", test_00a_handler, 2, 3579, NULL);
+
+	/* chains are sorted by priority and then by registration order */
+	printf ("Test 00-b: checking handler chain order for each port..\n");
+	order = valvula_ctx_get_request_handler_order (ctx, 3579);
+	if (! axl_cmp (order, "a, b, b2, c")) {
+		printf ("ERROR 0b.1: expected different order for port 3579: %s..\n", order);
+		return axl_false;
+	} /* end if */
+	axl_free (order);
+
+	order = valvula_ctx_get_request_handler_order (ctx, 3580);
+	if (! axl_cmp (order, "y, x")) {
+		printf ("ERROR 0b.2: expected different order for port 3580: %s..\n", order);
+		return axl_false;
+	} /* end if */
+	axl_free (order);
+
+	order = valvula_ctx_get_request_handler_order (ctx, 3581);
+	if (order != NULL) {
+		printf ("ERROR 0b.3: expected no chain for port 3581: %s..\n", order);
+		return axl_false;
+	} /* end if */
+
+	/* registering a new handler recompiles the chain of its port */
+	printf ("Test 00-b: checking chain is recompiled after registering..\n");
+	registry = valvula_ctx_register_request_handler (ctx, "z", test_00a_handler, 1, 3580, NULL);
+	order    = valvula_ctx_get_request_handler_order (ctx, 3580);
+	if (registry == NULL || ! axl_cmp (order, "y, z, x")) {
+		printf ("ERROR 0b.4: expected different order for port 3580: %s..\n", order);
+		return axl_false;
+	} /* end if */
+	axl_free (order);
+
+	/* reordering never moves handlers that are not adaptive */
+	printf ("Test 00-b: checking reordering keeps chains without adaptive handlers..\n");
+	valvula_ctx_reorder_request_handlers (ctx);
+	order = valvula_ctx_get_request_handler_order (ctx, 3579);
+	if (! axl_cmp (order, "a, b, b2, c")) {
+		printf ("ERROR 0b.5: expected different order for port 3579: %s..\n", order);
+		return axl_false;
+	} /* end if */
+	axl_free (order);
+
+	/* replaced tables are released once unreferenced, but not
+	 * while a thread still walks them */
+	printf ("Test 00-b: checking replaced chains are released once unreferenced..\n");
+	if (ctx->handler_chains->retired != NULL) {
+		printf ("ERROR 0b.6: expected replaced tables to be released..\n");
+		return axl_false;
+	} /* end if */
+	chain = __valvula_ctx_acquire_handler_chain (ctx, 3579);
+	valvula_ctx_register_request_handler (ctx, "d", test_00a_handler, 4, 3579, NULL);
+	if (chain == NULL || ctx->handler_chains->retired != chain->table || chain->length != 4) {
+		printf ("ERROR 0b.7: expected table referenced to be kept..\n");
+		return axl_false;
+	} /* end if */
+	__valvula_ctx_release_handler_chain (chain);
+	valvula_ctx_register_request_handler (ctx, "e", test_00a_handler, 5, 3579, NULL);
+	if (ctx->handler_chains->retired != NULL) {
+		printf ("ERROR 0b.8: expected replaced tables to be released..\n");
+		return axl_false;
+	} /* end if */
+
+	valvula_ctx_unref (&ctx);
+
+	return axl_true;
+}
+
 
 axl_bool  test_01 (void)
 {
@@ -540,6 +928,593 @@ ValvulaState test_valvula_request (const char * policy_server, const char * port
 }
 
 
+/** 
+ * @brief Starts a valvula context listening at 127.0.0.1 on the
+ * provided port (without valvulad), so tests can register handlers
+ * directly.
+ */
+ValvulaCtx * test_valvula_listener (const char * port)
+{
+	ValvulaCtx        * ctx = valvula_ctx_new ();
+	ValvulaConnection * listener;
+
+	if (! valvula_init_ctx (ctx)) {
+		printf ("ERROR: failed to initialize valvula context..\n");
+		return NULL;
+	} /* end if */
+
+	listener = valvula_listener_new (ctx, "127.0.0.1", port);
+	if (! valvula_connection_is_ok (listener)) {
+		printf ("ERROR: failed to start listener at 127.0.0.1:%s..\n", port);
+		return NULL;
+	} /* end if */
+
+	return ctx;
+}
+
+/** 
+ * @brief Reads the next action line replied over the provided
+ * session (skipping the empty lines that terminate replies).
+ */
+ValvulaState test_valvula_read_action (ValvulaCtx * ctx, VALVULA_SOCKET session, char * buffer, int buffer_size)
+{
+	int bytes;
+	int tries = 0;
+
+	while (tries < 50) {
+		memset (buffer, 0, buffer_size);
+		bytes = test_readline (ctx, session, buffer, buffer_size);
+		if (bytes == -1 || bytes == 0) {
+			printf ("ERROR: received error code = %d from test_readline\n", bytes);
+			return VALVULA_STATE_GENERIC_ERROR;
+		} /* end if */
+		if (bytes == -2) {
+			tries++;
+			test_wait (100000);
+			continue;
+		} /* end if */
+
+		/* skip reply terminator */
+		if (buffer[0] == '\n')
+			continue;
+
+		printf ("Test --: content received as reply (bytes=%d): %s", bytes, buffer); 
+		return test_translate_action (buffer, buffer_size);
+	} /* end while */
+
+	printf ("ERROR: no reply received..\n");
+	return VALVULA_STATE_GENERIC_ERROR;
+}
+
+ValvulaState test_00c_handler (ValvulaCtx        * ctx, 
+			       ValvulaConnection * connection, 
+			       ValvulaRequest    * request,
+			       axlPointer          request_data,
+			       char             ** message)
+{
+	/* first request takes a while to be resolved */
+	if (axl_cmp (request->sender, "slow@aspl.es")) {
+		test_wait (300000);
+		return VALVULA_STATE_REJECT;
+	} /* end if */
+
+	return VALVULA_STATE_OK;
+}
+
+axl_bool  test_00c (void)
+{
+	ValvulaCtx      * ctx;
+	ValvulaCtx      * client = valvula_ctx_new ();
+	axlError        * error  = NULL;
+	VALVULA_SOCKET    session;
+	char              buffer[1024];
+	const char      * requests = 
+		"request=smtpd_access_policy\nprotocol_state=RCPT\nsender=slow@aspl.es\nrecipient=info@aspl.es\n\n"
+		"request=smtpd_access_policy\nprotocol_state=RCPT\nsender=fast@aspl.es\nrecipient=info@aspl.es\n\n";
+
+	printf ("Test 00-c: starting listener..\n");
+	ctx = test_valvula_listener ("3589");
+	if (ctx == NULL)
+		return axl_false;
+	valvula_ctx_register_request_handler (ctx, "test-00c", test_00c_handler, 1, 3589, NULL);
+
+	session = valvula_connection_sock_connect (client, "127.0.0.1", "3589", NULL, &error);
+	if (session < 1) {
+		printf ("ERROR: failed to connect to 127.0.0.1:3589, error was: %s, errno=%d\n", axl_error_get (error), errno);
+		axl_error_free (error);
+		return axl_false;
+	} /* end if */
+
+	/* send both requests at once, without waiting for the first reply */
+	printf ("Test 00-c: sending pipelined requests..\n");
+	if (send (session, requests, strlen (requests), 0) != (int) strlen (requests)) {
+		printf ("ERROR 0c.1: failed to send requests..\n");
+		return axl_false;
+	} /* end if */
+
+	/* replies must follow requests order (and the connection must remain open) */
+	if (test_valvula_read_action (client, session, buffer, 1024) != VALVULA_STATE_REJECT) {
+		printf ("ERROR 0c.2: expected first reply to be reject (slow request)..\n");
+		return axl_false;
+	} /* end if */
+	if (test_valvula_read_action (client, session, buffer, 1024) != VALVULA_STATE_OK) {
+		printf ("ERROR 0c.3: expected second reply to be ok (fast request)..\n");
+		return axl_false;
+	} /* end if */
+
+	valvula_close_socket (session);
+	valvula_ctx_unref (&client);
+
+	valvula_exit_ctx (ctx, axl_true);
+
+	return axl_true;
+}
+
+ValvulaState test_00d_slow (ValvulaCtx        * ctx, 
+			    ValvulaConnection * connection, 
+			    ValvulaRequest    * request,
+			    axlPointer          request_data,
+			    char             ** message)
+{
+	/* decisive (but slow) for first sender, undecided for the rest */
+	test_wait (300000);
+	if (axl_cmp (request->sender, "reject@aspl.es"))
+		return VALVULA_STATE_REJECT;
+	return VALVULA_STATE_DUNNO;
+}
+
+ValvulaState test_00d_fast (ValvulaCtx        * ctx, 
+			    ValvulaConnection * connection, 
+			    ValvulaRequest    * request,
+			    axlPointer          request_data,
+			    char             ** message)
+{
+	return VALVULA_STATE_OK;
+}
+
+ValvulaState test_00d_reject (ValvulaCtx        * ctx, 
+			      ValvulaConnection * connection, 
+			      ValvulaRequest    * request,
+			      axlPointer          request_data,
+			      char             ** message)
+{
+	return VALVULA_STATE_REJECT;
+}
+
+axl_bool  test_00d (void)
+{
+	ValvulaCtx             * ctx;
+	ValvulaCtx             * client = valvula_ctx_new ();
+	axlError               * error  = NULL;
+	ValvulaRequestRegistry * registry;
+	ValvulaState             state;
+	VALVULA_SOCKET           session;
+	char                     buffer[1024];
+	const char             * identifiers[] = { "test-00d-late-1", "test-00d-late-2", "test-00d-late-3", NULL };
+	int                      iterator;
+	const char             * requests = 
+		"request=smtpd_access_policy\nprotocol_state=RCPT\nsender=dunno@aspl.es\nrecipient=info@aspl.es\n\n"
+		"request=smtpd_access_policy\nprotocol_state=RCPT\nsender=dunno@aspl.es\nrecipient=info@aspl.es\n\n";
+
+	printf ("Test 00-d: starting listener..\n");
+	ctx = test_valvula_listener ("3590");
+	if (ctx == NULL)
+		return axl_false;
+
+	/* same priority, evaluated concurrently: the slow handler is
+	 * registered first so its verdict wins when decisive */
+	registry = valvula_ctx_register_request_handler (ctx, "test-00d-slow", test_00d_slow, 1, 3590, NULL);
+	valvula_ctx_set_request_handler_parallel (registry, axl_true);
+	registry = valvula_ctx_register_request_handler (ctx, "test-00d-fast", test_00d_fast, 1, 3590, NULL);
+	valvula_ctx_set_request_handler_parallel (registry, axl_true);
+
+	printf ("Test 00-d: checking first decisive verdict in registration order wins..\n");
+	state = test_valvula_request (/* policy server location */
+				      "127.0.0.1", "3590", 
+				      /* state */
+				      "smtpd_access_policy", "RCPT", "SMTP",
+				      /* sender, recipient, recipient count */
+				      "reject@aspl.es", "info@aspl.es", "1",
+				      /* queue-id, size */
+				      "935jfe534", "235",
+				      /* sasl method, sasl username, sasl sender */
+				      NULL, NULL, NULL);
+	if (state != VALVULA_STATE_REJECT) {
+		printf ("ERROR 0d.1: expected valvula state %d but found %d\n", VALVULA_STATE_REJECT, state);
+		return axl_false;
+	} /* end if */
+
+	printf ("Test 00-d: checking undecided handlers are skipped..\n");
+	state = test_valvula_request (/* policy server location */
+				      "127.0.0.1", "3590", 
+				      /* state */
+				      "smtpd_access_policy", "RCPT", "SMTP",
+				      /* sender, recipient, recipient count */
+				      "dunno@aspl.es", "info@aspl.es", "1",
+				      /* queue-id, size */
+				      "935jfe534", "235",
+				      /* sasl method, sasl username, sasl sender */
+				      NULL, NULL, NULL);
+	if (state != VALVULA_STATE_OK) {
+		printf ("ERROR 0d.2: expected valvula state %d but found %d\n", VALVULA_STATE_OK, state);
+		return axl_false;
+	} /* end if */
+
+	/* first handler registered decides at once while its slow
+	 * siblings are still queued or running (the request has a
+	 * budget, checked by siblings once the chain is released) */
+	printf ("Test 00-d: checking group decided while siblings are queued..\n");
+	if (! valvula_connection_is_ok (valvula_listener_new (ctx, "127.0.0.1", "3591"))) {
+		printf ("ERROR 0d.3: failed to start listener at 127.0.0.1:3591..\n");
+		return axl_false;
+	} /* end if */
+	valvula_ctx_set_request_deadline (ctx, 3591, 5000, VALVULA_STATE_DUNNO);
+
+	registry = valvula_ctx_register_request_handler (ctx, "test-00d-reject", test_00d_reject, 1, 3591, NULL);
+	valvula_ctx_set_request_handler_parallel (registry, axl_true);
+	for (iterator = 0; identifiers[iterator]; iterator++) {
+		registry = valvula_ctx_register_request_handler (ctx, identifiers[iterator], test_00d_slow, 1, 3591, NULL);
+		valvula_ctx_set_request_handler_parallel (registry, axl_true);
+	} /* end for */
+
+	session = valvula_connection_sock_connect (client, "127.0.0.1", "3591", NULL, &error);
+	if (session < 1) {
+		printf ("ERROR: failed to connect to 127.0.0.1:3591, error was: %s, errno=%d\n", axl_error_get (error), errno);
+		axl_error_free (error);
+		return axl_false;
+	} /* end if */
+
+	/* second request is processed once all siblings of the
+	 * first one finish */
+	if (send (session, requests, strlen (requests), 0) != (int) strlen (requests)) {
+		printf ("ERROR 0d.4: failed to send requests..\n");
+		return axl_false;
+	} /* end if */
+	for (iterator = 0; iterator < 2; iterator++) {
+		if (test_valvula_read_action (client, session, buffer, 1024) != VALVULA_STATE_REJECT) {
+			printf ("ERROR 0d.5: expected reply %d to be reject..\n", iterator);
+			return axl_false;
+		} /* end if */
+	} /* end for */
+
+	valvula_close_socket (session);
+	valvula_ctx_unref (&client);
+
+	valvula_exit_ctx (ctx, axl_true);
+
+	return axl_true;
+}
+
+ValvulaState test_00e_handler (ValvulaCtx        * ctx, 
+			       ValvulaConnection * connection, 
+			       ValvulaRequest    * request,
+			       axlPointer          request_data,
+			       char             ** message)
+{
+	/* resolved after the request budget is spent */
+	if (axl_cmp (request->sender, "slow@aspl.es")) {
+		test_wait (600000);
+		return VALVULA_STATE_REJECT;
+	} /* end if */
+
+	return VALVULA_STATE_OK;
+}
+
+axl_bool  test_00e (void)
+{
+	ValvulaCtx      * ctx;
+	ValvulaCtx      * client = valvula_ctx_new ();
+	axlError        * error  = NULL;
+	VALVULA_SOCKET    session;
+	char              buffer[1024];
+	struct timeval    start;
+	struct timeval    stop;
+	struct timeval    diff;
+	const char      * requests = 
+		"request=smtpd_access_policy\nprotocol_state=RCPT\nsender=slow@aspl.es\nrecipient=info@aspl.es\n\n"
+		"request=smtpd_access_policy\nprotocol_state=RCPT\nsender=fast@aspl.es\nrecipient=info@aspl.es\n\n";
+
+	printf ("Test 00-e: starting listener..\n");
+	ctx = test_valvula_listener ("3592");
+	if (ctx == NULL)
+		return axl_false;
+	valvula_ctx_register_request_handler (ctx, "test-00e", test_00e_handler, 1, 3592, NULL);
+
+	/* 200ms to reply, discard once spent */
+	valvula_ctx_set_request_deadline (ctx, 3592, 200, VALVULA_STATE_DISCARD);
+
+	session = valvula_connection_sock_connect (client, "127.0.0.1", "3592", NULL, &error);
+	if (session < 1) {
+		printf ("ERROR: failed to connect to 127.0.0.1:3592, error was: %s, errno=%d\n", axl_error_get (error), errno);
+		axl_error_free (error);
+		return axl_false;
+	} /* end if */
+
+	printf ("Test 00-e: checking expired state is replied while the handler runs..\n");
+	gettimeofday (&start, NULL);
+	if (send (session, requests, strlen (requests), 0) != (int) strlen (requests)) {
+		printf ("ERROR 0e.1: failed to send requests..\n");
+		return axl_false;
+	} /* end if */
+	if (test_valvula_read_action (client, session, buffer, 1024) != VALVULA_STATE_DISCARD) {
+		printf ("ERROR 0e.2: expected first reply to be discard (deadline reached)..\n");
+		return axl_false;
+	} /* end if */
+
+	/* the watchdog replies once the budget is spent, not when
+	 * the handler finishes */
+	gettimeofday (&stop, NULL);
+	valvula_timeval_substract (&stop, &start, &diff);
+	if (diff.tv_sec > 0 || diff.tv_usec >= 550000) {
+		printf ("ERROR 0e.3: expired reply took too long: %ld.%06ld secs..\n", (long) diff.tv_sec, (long) diff.tv_usec);
+		return axl_false;
+	} /* end if */
+
+	/* the verdict reported later by the handler is discarded: next
+	 * reply belongs to the second request */
+	printf ("Test 00-e: checking the late verdict is discarded..\n");
+	if (test_valvula_read_action (client, session, buffer, 1024) != VALVULA_STATE_OK) {
+		printf ("ERROR 0e.4: expected second reply to be ok..\n");
+		return axl_false;
+	} /* end if */
+
+	/* both requests handled, only the first one expired */
+	valvula_mutex_lock (&ctx->stats_mutex);
+	if (ctx->requests_expired != 1 || ctx->requests_handled != 2) {
+		printf ("ERROR 0e.5: expected 1 expired request out of 2 but found %ld out of %d..\n", ctx->requests_expired, ctx->requests_handled);
+		valvula_mutex_unlock (&ctx->stats_mutex);
+		return axl_false;
+	} /* end if */
+	valvula_mutex_unlock (&ctx->stats_mutex);
+
+	valvula_close_socket (session);
+	valvula_ctx_unref (&client);
+
+	valvula_exit_ctx (ctx, axl_true);
+
+	return axl_true;
+}
+
+ValvulaState test_00f_handler (ValvulaCtx        * ctx, 
+			       ValvulaConnection * connection, 
+			       ValvulaRequest    * request,
+			       axlPointer          request_data,
+			       char             ** message)
+{
+	/* state configured for each handler */
+	return (ValvulaState) PTR_TO_INT (request_data);
+}
+
+ValvulaState test_00f_request (const char * protocol_state)
+{
+	return test_valvula_request (/* policy server location */
+				     "127.0.0.1", "3593", 
+				     /* state */
+				     "smtpd_access_policy", protocol_state, "SMTP",
+				     /* sender, recipient, recipient count */
+				     "francis@aspl.es", "info@aspl.es", "1",
+				     /* queue-id, size */
+				     "935jfe534", "235",
+				     /* sasl method, sasl username, sasl sender */
+				     NULL, NULL, NULL);
+}
+
+axl_bool  test_00f (void)
+{
+	ValvulaCtx             * ctx;
+	ValvulaRequestRegistry * rcpt;
+	ValvulaRequestRegistry * registry;
+	ValvulaState             state;
+
+	printf ("Test 00-f: starting listener..\n");
+	ctx = test_valvula_listener ("3593");
+	if (ctx == NULL)
+		return axl_false;
+
+	/* handlers only called at some SMTP stages or for other
+	 * requests */
+	rcpt     = valvula_ctx_register_request_handler (ctx, "test-00f-rcpt", test_00f_handler, 1, 3593, INT_TO_PTR (VALVULA_STATE_REJECT));
+	registry = valvula_ctx_register_request_handler (ctx, "test-00f-data", test_00f_handler, 2, 3593, INT_TO_PTR (VALVULA_STATE_DISCARD));
+	if (! valvula_ctx_set_request_handler_filter (rcpt, "RCPT", NULL) ||
+	    ! valvula_ctx_set_request_handler_filter (registry, "DATA", "smtpd_access_policy")) {
+		printf ("ERROR 0f.1: expected to configure handler filters..\n");
+		return axl_false;
+	} /* end if */
+	registry = valvula_ctx_register_request_handler (ctx, "test-00f-other", test_00f_handler, 3, 3593, INT_TO_PTR (VALVULA_STATE_OK));
+	if (! valvula_ctx_set_request_handler_filter (registry, NULL, "other_policy")) {
+		printf ("ERROR 0f.2: expected to configure handler filters..\n");
+		return axl_false;
+	} /* end if */
+
+	/* unknown protocol states are rejected */
+	if (valvula_ctx_set_request_handler_filter (registry, "RCPT,UNKNOWN", NULL)) {
+		printf ("ERROR 0f.3: expected unknown protocol state to be rejected..\n");
+		return axl_false;
+	} /* end if */
+
+	printf ("Test 00-f: checking handlers are skipped by protocol_state and request..\n");
+	state = test_00f_request ("RCPT");
+	if (state != VALVULA_STATE_REJECT) {
+		printf ("ERROR 0f.4: expected valvula state %d but found %d\n", VALVULA_STATE_REJECT, state);
+		return axl_false;
+	} /* end if */
+
+	state = test_00f_request ("DATA");
+	if (state != VALVULA_STATE_DISCARD) {
+		printf ("ERROR 0f.5: expected valvula state %d but found %d\n", VALVULA_STATE_DISCARD, state);
+		return axl_false;
+	} /* end if */
+
+	/* no handler applies: default state */
+	state = test_00f_request ("END-OF-MESSAGE");
+	if (state != VALVULA_STATE_DUNNO) {
+		printf ("ERROR 0f.6: expected valvula state %d but found %d\n", VALVULA_STATE_DUNNO, state);
+		return axl_false;
+	} /* end if */
+
+	/* filters can be changed while serving */
+	printf ("Test 00-f: checking filters changed while serving..\n");
+	if (! valvula_ctx_set_request_handler_filter (rcpt, "DATA", NULL)) {
+		printf ("ERROR 0f.7: expected to configure handler filter..\n");
+		return axl_false;
+	} /* end if */
+
+	state = test_00f_request ("RCPT");
+	if (state != VALVULA_STATE_DUNNO) {
+		printf ("ERROR 0f.8: expected valvula state %d but found %d\n", VALVULA_STATE_DUNNO, state);
+		return axl_false;
+	} /* end if */
+
+	state = test_00f_request ("DATA");
+	if (state != VALVULA_STATE_REJECT) {
+		printf ("ERROR 0f.9: expected valvula state %d but found %d\n", VALVULA_STATE_REJECT, state);
+		return axl_false;
+	} /* end if */
+
+	valvula_exit_ctx (ctx, axl_true);
+
+	return axl_true;
+}
+
+typedef struct _Test00gTask {
+	ValvulaRequest * request;
+	ValvulaState     state;
+	long             wait;
+	int              done;
+	int              refs;
+} Test00gTask;
+
+void test_00g_release (Test00gTask * task)
+{
+	/* released by the last of the handler and the task */
+	if (__sync_sub_and_fetch (&task->refs, 1) == 0)
+		axl_free (task);
+	return;
+}
+
+axlPointer test_00g_complete (axlPointer _data)
+{
+	Test00gTask * task = _data;
+
+	/* resolve the request later, from a pool thread */
+	if (task->wait > 0)
+		test_wait (task->wait);
+	valvula_request_complete (task->request, task->state, NULL);
+	__sync_fetch_and_add (&task->done, 1);
+
+	test_00g_release (task);
+	return NULL;
+}
+
+ValvulaState test_00g_handler (ValvulaCtx        * ctx, 
+			       ValvulaConnection * connection, 
+			       ValvulaRequest    * request,
+			       axlPointer          request_data,
+			       char             ** message)
+{
+	Test00gTask * task = axl_new (Test00gTask, 1);
+	int           tries;
+
+	task->request = request;
+	task->refs    = 1;
+	if (axl_cmp (request->sender, "before@aspl.es")) {
+		/* completed before the handler returns */
+		task->state = VALVULA_STATE_REJECT;
+		task->refs  = 2;
+		if (! valvula_thread_pool_new_task (ctx, test_00g_complete, task)) {
+			axl_free (task);
+			return VALVULA_STATE_GENERIC_ERROR;
+		} /* end if */
+
+		tries = 0;
+		while (! __sync_fetch_and_add (&task->done, 0) && tries < 50) {
+			test_wait (10000);
+			tries++;
+		} /* end while */
+		test_00g_release (task);
+		return VALVULA_STATE_PENDING;
+	} /* end if */
+
+	/* completed after the handler returns: the slow one with a
+	 * verdict, the other one resuming the chain */
+	task->wait  = axl_cmp (request->sender, "after@aspl.es") ? 300000 : 100000;
+	task->state = axl_cmp (request->sender, "after@aspl.es") ? VALVULA_STATE_DISCARD : VALVULA_STATE_DUNNO;
+	if (! valvula_thread_pool_new_task (ctx, test_00g_complete, task)) {
+		axl_free (task);
+		return VALVULA_STATE_GENERIC_ERROR;
+	} /* end if */
+
+	return VALVULA_STATE_PENDING;
+}
+
+ValvulaState test_00g_next (ValvulaCtx        * ctx, 
+			    ValvulaConnection * connection, 
+			    ValvulaRequest    * request,
+			    axlPointer          request_data,
+			    char             ** message)
+{
+	/* only reached once the chain is resumed */
+	return VALVULA_STATE_OK;
+}
+
+axl_bool  test_00g (void)
+{
+	ValvulaCtx      * ctx;
+	ValvulaCtx      * client = valvula_ctx_new ();
+	axlError        * error  = NULL;
+	VALVULA_SOCKET    session;
+	char              buffer[1024];
+	const char      * requests = 
+		"request=smtpd_access_policy\nprotocol_state=RCPT\nsender=after@aspl.es\nrecipient=info@aspl.es\n\n"
+		"request=smtpd_access_policy\nprotocol_state=RCPT\nsender=before@aspl.es\nrecipient=info@aspl.es\n\n"
+		"request=smtpd_access_policy\nprotocol_state=RCPT\nsender=resume@aspl.es\nrecipient=info@aspl.es\n\n";
+
+	printf ("Test 00-g: starting listener..\n");
+	ctx = test_valvula_listener ("3594");
+	if (ctx == NULL)
+		return axl_false;
+	valvula_ctx_register_request_handler (ctx, "test-00g", test_00g_handler, 1, 3594, NULL);
+	valvula_ctx_register_request_handler (ctx, "test-00g-next", test_00g_next, 2, 3594, NULL);
+
+	session = valvula_connection_sock_connect (client, "127.0.0.1", "3594", NULL, &error);
+	if (session < 1) {
+		printf ("ERROR: failed to connect to 127.0.0.1:3594, error was: %s, errno=%d\n", axl_error_get (error), errno);
+		axl_error_free (error);
+		return axl_false;
+	} /* end if */
+
+	printf ("Test 00-g: sending pipelined requests completed from other threads..\n");
+	if (send (session, requests, strlen (requests), 0) != (int) strlen (requests)) {
+		printf ("ERROR 0g.1: failed to send requests..\n");
+		return axl_false;
+	} /* end if */
+
+	/* completed after the handler returned pending */
+	if (test_valvula_read_action (client, session, buffer, 1024) != VALVULA_STATE_DISCARD) {
+		printf ("ERROR 0g.2: expected first reply to be discard (completed after handler returned)..\n");
+		return axl_false;
+	} /* end if */
+
+	/* completed while the handler was still running */
+	if (test_valvula_read_action (client, session, buffer, 1024) != VALVULA_STATE_REJECT) {
+		printf ("ERROR 0g.3: expected second reply to be reject (completed before handler returned)..\n");
+		return axl_false;
+	} /* end if */
+
+	/* completed with dunno: chain resumed at next handler */
+	if (test_valvula_read_action (client, session, buffer, 1024) != VALVULA_STATE_OK) {
+		printf ("ERROR 0g.4: expected third reply to be ok (chain resumed)..\n");
+		return axl_false;
+	} /* end if */
+
+	valvula_close_socket (session);
+	valvula_ctx_unref (&client);
+
+	valvula_exit_ctx (ctx, axl_true);
+
+	return axl_true;
+}
+
 axl_bool  test_01a (void)
 {
 	ValvuladCtx   * ctx;
@@ -3531,9 +4506,11 @@ int main (int argc, char ** argv)
 	printf ("** To gather information about memory consumed (and leaks) use:\n**\n");
 	printf ("**     >> libtool --mode=execute valgrind --leak-check=yes --show-reachable=yes --error-limit=no ./test_01 [--debug]\n**\n");
 	printf ("** Providing --run-test=NAME will run only the provided regression test.\n");
-	printf ("** Available tests: test_00, test_01, test_02, test_02a, test_02b, test_02c, test_02d, test_02e,\n");
-	printf ("**                  test_02f, test_02g, test_02h, test_03, test_03a, test_04, test_05,\n");
-	printf ("**                  test_06, test_07, test_07a, test_08\n");
+	printf ("** Available tests: test_00, test_00a, test_00b, test_00c, test_00d, test_00e, test_00f,\n");
+	printf ("**                  test_00g,\n");
+	printf ("**                  test_01, test_02, test_02a, test_02b, test_02c, test_02d, test_02e, test_02f,\n");
+	printf ("**                  test_02g, test_02h, test_03, test_03a, test_04, test_05, test_06, test_07,\n");
+	printf ("**                  test_07a, test_08\n");
 	printf ("**\n");
 	printf ("** Report bugs to:\n**\n");
 	printf ("**     <valvula@lists.aspl.es> Valvula Mailing list\n**\n");
@@ -3558,6 +4535,27 @@ int main (int argc, char ** argv)
 	CHECK_TEST("test_00")
 	run_test (test_00, "Test 00: generic API function checks");
 
+	CHECK_TEST("test_00a")
+	run_test (test_00a, "Test 00-a: verdict cache (keys, eviction, expiry)");
+
+	CHECK_TEST("test_00b")
+	run_test (test_00b, "Test 00-b: handler chains compiled per port");
+
+	CHECK_TEST("test_00c")
+	run_test (test_00c, "Test 00-c: pipelined requests replied in order");
+
+	CHECK_TEST("test_00d")
+	run_test (test_00d, "Test 00-d: parallel handlers, first decisive verdict wins");
+
+	CHECK_TEST("test_00e")
+	run_test (test_00e, "Test 00-e: request deadline replied by the watchdog");
+
+	CHECK_TEST("test_00f")
+	run_test (test_00f, "Test 00-f: handlers filtered by protocol_state and request");
+
+	CHECK_TEST("test_00g")
+	run_test (test_00g, "Test 00-g: requests completed from other threads replied in order");
+
 	/* run tests */
 	CHECK_TEST("test_01")
 	run_test (test_01, "Test 01: basic server startup (using default configuration)");